@@ -0,0 +1,119 @@
+// ------------------------------------------------------------
+// ais_columns.c
+// Prints columnar files of rtl_ais (-U columnar:dir, ais_query -x)
+// as CSV, one row per message, for tools that cannot read the
+// columnar layout directly. Positions are in degrees, speeds in
+// knots, unavailable values are empty.
+// ------------------------------------------------------------
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "lib/columnar.h"
+
+// A CSV field, quoted when needed.
+static void print_string(const char *s)
+{
+	if (!strpbrk(s, ",\"\r\n"))
+	{
+		fputs(s, stdout);
+		return;
+	}
+	putchar('"');
+	for (; *s; s++)
+	{
+		if (*s == '"')
+			putchar('"');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void print_row(const struct columnar_row *r)
+{
+	const struct ais_msg *m = &r->msg;
+
+	printf("%lld.%03d,%lu,%u,", (long long)(r->time_ms / 1000), (int)(r->time_ms % 1000), m->mmsi, m->type);
+	if (m->chanid)
+		putchar(m->chanid);
+	putchar(',');
+	if (m->has_pos)
+		printf("%.6f,%.6f", m->lat / 600000.0, m->lon / 600000.0);
+	else
+		putchar(',');
+	putchar(',');
+	if (m->sog < AIS_SOG_NA)
+		printf("%.1f", m->sog / 10.0);
+	putchar(',');
+	if (m->cog < AIS_COG_NA)
+		printf("%.1f", m->cog / 10.0);
+	putchar(',');
+	if (m->heading < 360)
+		printf("%u", m->heading);
+	putchar(',');
+	if (m->navstatus != AIS_NAVSTATUS_NA)
+		printf("%u", m->navstatus);
+	putchar(',');
+	if (m->shiptype)
+		printf("%u", m->shiptype);
+	putchar(',');
+	print_string(m->name);
+	putchar(',');
+	print_string(m->callsign);
+	putchar(',');
+	print_string(m->destination);
+	putchar('\n');
+}
+
+int main(int argc, char **argv)
+{
+	struct columnar_row *rows = NULL;
+	unsigned int nrows, i;
+	int opt, header = 1, rc, status = 0;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "n")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			header = 0;
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf(stderr, "Usage: ais_columns [-n] file...\n"
+						"\t-n: no header line\n");
+		return 1;
+	}
+	if (header)
+		printf("time,mmsi,type,channel,lat,lon,sog,cog,heading,navstatus,shiptype,name,callsign,destination\n");
+	for (; optind < argc; optind++)
+	{
+		f = fopen(argv[optind], "r");
+		if (!f || !columnar_read_header(f))
+		{
+			fprintf(stderr, "%s: not a columnar file\n", argv[optind]);
+			if (f)
+				fclose(f);
+			status = 1;
+			continue;
+		}
+		while ((rc = columnar_read_group(f, &rows, &nrows)) > 0)
+			for (i = 0; i < nrows; i++)
+				print_row(&rows[i]);
+		if (rc < 0)
+		{
+			fprintf(stderr, "%s: damaged row group\n", argv[optind]);
+			status = 1;
+		}
+		fclose(f);
+	}
+	free(rows);
+	return status;
+}
@@ -0,0 +1,268 @@
+// ------------------------------------------------------------
+// ais_query.c
+// Query tool for the message archive of rtl_ais (-U archive:dir).
+// Prints the messages of a time range, optionally of one MMSI,
+// as NMEA sentences. Finished segments are searched through their
+// index, the segment still being written is read from start to end.
+// With -x the messages are decoded and written to a columnar file
+// instead, see ais_columns.
+// ------------------------------------------------------------
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+#include <getopt.h>
+
+#include "lib/archive.h"
+#include "lib/columnar.h"
+
+#define QUERY_MAX_SEGMENTS 100000
+
+static int64_t begin_ms = 0, end_ms = INT64_MAX;
+static unsigned long mmsi = 0;
+static int nmea_only = 0, count_only = 0;
+static unsigned long long found = 0;
+static struct columnar export;
+static char *export_path = NULL;
+
+// Unix seconds, or YYYY-MM-DD[THH[:MM[:SS]]] in UTC. Returns ms, -1 if invalid.
+static int64_t parse_time(const char *s)
+{
+	struct tm tm;
+	char *end;
+	long long v;
+	int n;
+
+	v = strtoll(s, &end, 10);
+	if (*s && *end == 0)
+		return v * 1000;
+	memset(&tm, 0, sizeof(tm));
+	n = sscanf(s, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if (n < 3)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	return (int64_t)timegm(&tm) * 1000;
+}
+
+// Decode the message and add it to the columnar export.
+static void export_record(const struct archive_record *r)
+{
+	unsigned char bits[ARCHIVE_MAX_BYTES * 8];
+	struct ais_msg msg;
+	unsigned int i;
+
+	for (i = 0; i < r->nbits; i++)
+		bits[i] = (r->data[i >> 3] >> (7 - (i & 7))) & 1;
+	ais_msg_decode(&msg, bits, r->nbits, r->channel);
+	columnar_add(&export, r->time_ms, &msg, 0);
+}
+
+static void print_record(const struct archive_record *r)
+{
+	char nmea[1024], *line, *save = NULL;
+	char stamp[32];
+	time_t t = r->time_ms / 1000;
+	struct tm tm;
+	int n;
+
+	found++;
+	if (count_only)
+		return;
+	if (export_path)
+	{
+		export_record(r);
+		return;
+	}
+	n = archive_nmea(r, nmea, sizeof(nmea) - 1, found % 10);
+	if (n < 0)
+		return;
+	nmea[n] = 0;
+	if (nmea_only)
+	{
+		fputs(nmea, stdout);
+		return;
+	}
+	gmtime_r(&t, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	for (line = strtok_r(nmea, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save))
+		printf("%s.%03dZ %c %3u%% %s\n", stamp, (int)(r->time_ms % 1000), r->channel ? r->channel : '-', r->level, line);
+}
+
+// Print the matching records between the offsets lo and hi.
+static void scan(const struct archive_segment *seg, size_t lo, size_t hi)
+{
+	struct archive_record r;
+	size_t next;
+
+	while (lo < hi && (next = archive_segment_record(seg, lo, &r)) != 0)
+	{
+		if (r.time_ms >= end_ms)
+			break;
+		if (r.time_ms >= begin_ms && (!mmsi || archive_mmsi(&r) == mmsi))
+			print_record(&r);
+		lo = next;
+	}
+}
+
+// The offset of the first record at or after second s of the segment.
+static size_t second_offset(const struct archive_segment *seg, int64_t s)
+{
+	if (s < 0)
+		s = 0;
+	if (s > ARCHIVE_SEGMENT_SEC)
+		s = ARCHIVE_SEGMENT_SEC;
+	return seg->second_offset[s];
+}
+
+static void query_segment(const char *path)
+{
+	struct archive_segment seg;
+	struct archive_record r;
+	const struct archive_index_vessel *v;
+	size_t lo, hi;
+	unsigned int a, b, m, i;
+
+	if (!archive_segment_map(&seg, path))
+	{
+		fprintf(stderr, "%s: not an archive segment\n", path);
+		return;
+	}
+	if (!seg.index)
+	{
+		scan(&seg, sizeof(struct archive_header), seg.size);
+		archive_segment_unmap(&seg);
+		return;
+	}
+	lo = second_offset(&seg, (begin_ms - seg.start_ms) / 1000);
+	hi = end_ms == INT64_MAX ? seg.index->data_size : second_offset(&seg, (end_ms - seg.start_ms + 999) / 1000);
+	if (!mmsi)
+	{
+		scan(&seg, lo, hi);
+		archive_segment_unmap(&seg);
+		return;
+	}
+
+	// Find the vessel, then read only its records.
+	for (a = 0, b = seg.index->nvessels; a < b;)
+	{
+		m = (a + b) / 2;
+		if (seg.vessel[m].mmsi < mmsi)
+			a = m + 1;
+		else
+			b = m;
+	}
+	v = &seg.vessel[a];
+	if (a < seg.index->nvessels && v->mmsi == mmsi && v->first + v->count <= seg.index->nrecords)
+	{
+		for (i = v->first; i < v->first + v->count && seg.record_offset[i] < hi; i++)
+		{
+			if (seg.record_offset[i] >= lo && archive_segment_record(&seg, seg.record_offset[i], &r))
+				print_record(&r);
+		}
+	}
+	archive_segment_unmap(&seg);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int main(int argc, char **argv)
+{
+	char **names, path[1024];
+	struct dirent *e;
+	struct tm tm;
+	int64_t start;
+	int opt, n = 0, i, len;
+	DIR *d;
+
+	while ((opt = getopt(argc, argv, "m:s:e:ncx:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			mmsi = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			begin_ms = parse_time(optarg);
+			break;
+		case 'e':
+			end_ms = parse_time(optarg);
+			break;
+		case 'n':
+			nmea_only = 1;
+			break;
+		case 'c':
+			count_only = 1;
+			break;
+		case 'x':
+			export_path = optarg;
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind != argc - 1 || begin_ms < 0 || end_ms < 0)
+	{
+		fprintf(stderr, "Usage: ais_query [-m mmsi] [-s start] [-e end] [-n] [-c] [-x file] dir\n"
+						"\tdir as given to rtl_ais -U archive:dir\n"
+						"\t-s, -e: the time range, unix time or YYYY-MM-DD[THH[:MM[:SS]]] in UTC\n"
+						"\t-n: NMEA sentences only, without time, channel and level\n"
+						"\t-c: only count the messages\n"
+						"\t-x: write the decoded messages to a columnar file, see ais_columns\n");
+		return 1;
+	}
+
+	d = opendir(argv[optind]);
+	if (!d)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if (export_path && !columnar_create(&export, export_path, COLUMNAR_DEFAULT_ROWS))
+	{
+		closedir(d);
+		return 1;
+	}
+	names = malloc(QUERY_MAX_SEGMENTS * sizeof(char *));
+	while ((e = readdir(d)) != NULL && n < QUERY_MAX_SEGMENTS)
+	{
+		// YYYYMMDD-HH.aisa, only the hours overlapping the range
+		memset(&tm, 0, sizeof(tm));
+		len = 0;
+		if (sscanf(e->d_name, "%4d%2d%2d-%2d.aisa%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &len) != 4 ||
+			len == 0 || e->d_name[len] != 0)
+			continue;
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		start = (int64_t)timegm(&tm) * 1000;
+		if (start >= end_ms || start + ARCHIVE_SEGMENT_SEC * 1000LL <= begin_ms)
+			continue;
+		names[n++] = strdup(e->d_name);
+	}
+	closedir(d);
+	qsort(names, n, sizeof(char *), compare_names);
+	for (i = 0; i < n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", argv[optind], names[i]);
+		query_segment(path);
+		free(names[i]);
+	}
+	free(names);
+	if (export_path)
+	{
+		columnar_close(&export);
+		if (export.errors)
+		{
+			fprintf(stderr, "%s: %lu row groups could not be written\n", export_path, export.errors);
+			return 1;
+		}
+	}
+	if (count_only)
+		printf("%llu\n", found);
+	return 0;
+}
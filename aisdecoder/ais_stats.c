@@ -0,0 +1,112 @@
+// ------------------------------------------------------------
+// ais_stats.c
+// Reader for the shared statistics page of rtl_ais (-m). Prints
+// the statistics once, or with -w every few seconds together with
+// the rates since the previous print.
+// ------------------------------------------------------------
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "lib/stats_shm.h"
+
+static const char *stage_names[STATS_SHM_STAGES] = {"downsample", "demodulate", "upsample", "decode"};
+
+static double rate(uint64_t now, uint64_t before, double seconds)
+{
+	return seconds > 0 ? (now - before) / seconds : 0.0;
+}
+
+static void print_stats(const struct stats_shm *s, const struct stats_shm *prev)
+{
+	double seconds = prev ? (s->updated - prev->updated) / 1000.0 : 0.0;
+	time_t now = time(NULL);
+	unsigned int i;
+	int c;
+
+	printf("rtl_ais pid %u, up %lds, updated %.1fs ago%s\n", s->pid, (long)(now - s->started),
+		   now - s->updated / 1000.0, kill(s->pid, 0) < 0 && errno == ESRCH ? " (not running)" : "");
+	for (c = 0; c < 2; c++)
+	{
+		printf("%c: %llu frames ok, %llu wrong CRC, %llu wrong size, level %u%%",
+			   'A' + c, (unsigned long long)s->frames_ok[c], (unsigned long long)s->frames_crc[c],
+			   (unsigned long long)s->frames_size[c], s->level[c]);
+		if (prev)
+			printf(", %.1f frames/s", rate(s->frames_ok[c], prev->frames_ok[c], seconds));
+		printf("\n");
+	}
+	printf("Messages by type:");
+	for (i = 1; i < STATS_SHM_TYPES; i++)
+		if (s->types[i])
+			printf(" %u:%llu", i, (unsigned long long)s->types[i]);
+	printf("\n");
+	printf("USB: %llu buffers, %llu bytes, %llu overruns\n", (unsigned long long)s->usb_buffers,
+		   (unsigned long long)s->usb_bytes, (unsigned long long)s->usb_overruns);
+	printf("DSP: %llu blocks", (unsigned long long)s->dsp_blocks);
+	for (i = 0; i < STATS_SHM_STAGES; i++)
+		printf(", %s %.3f ms", stage_names[i], s->dsp_blocks ? s->dsp_ns[i] / 1e6 / s->dsp_blocks : 0.0);
+	printf(" per block\n");
+	if (s->thinned)
+		printf("Thinning: %llu reports, %llu bytes dropped\n", (unsigned long long)s->thinned,
+			   (unsigned long long)s->thinned_bytes);
+	for (i = 0; i < s->nsinks && i < STATS_SHM_SINKS; i++)
+	{
+		printf("%.*s: %llu sentences, queued %u, dropped %llu, errors %llu", STATS_SHM_NAME, s->sink[i].name,
+			   (unsigned long long)s->sink[i].sentences, s->sink[i].queued,
+			   (unsigned long long)s->sink[i].dropped, (unsigned long long)s->sink[i].errors);
+		if (prev)
+			printf(", %.1f sentences/s", rate(s->sink[i].sentences, prev->sink[i].sentences, seconds));
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct stats_shm *shm, cur, prev;
+	int opt, interval = 0, have_prev = 0;
+
+	while ((opt = getopt(argc, argv, "w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			interval = atoi(optarg);
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "Usage: ais_stats [-w seconds] name\n"
+						"\tname as given to rtl_ais -m, e.g. /rtl_ais\n");
+		return 1;
+	}
+	shm = stats_shm_attach(argv[optind]);
+	if (!shm)
+		return 1;
+	while (1)
+	{
+		if (!stats_shm_read(shm, &cur))
+		{
+			fprintf(stderr, "Statistics page busy\n");
+			return 1;
+		}
+		print_stats(&cur, have_prev ? &prev : NULL);
+		if (interval <= 0)
+			break;
+		prev = cur;
+		have_prev = 1;
+		printf("\n");
+		fflush(stdout);
+		sleep(interval);
+	}
+	stats_shm_close(shm);
+	return 0;
+}
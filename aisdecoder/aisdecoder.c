@@ -24,11 +24,26 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include <pthread.h>
 // #include "config.h"
 #include "sounddecoder.h"
+#include "aisdecoder.h"
 #include "lib/callbacks.h"
+#include "lib/aismsg.h"
+#include "lib/thinning.h"
+#include "lib/coverage.h"
+#include "lib/metrics.h"
+#include "lib/stats_shm.h"
+#include "lib/spool.h"
+#include "lib/archive.h"
+#include "lib/columnar.h"
 #include "../tcp_listener/tcp_listener.h"
+#include "../tcp_listener/ais_ring.h"
+#include "../rtl_ais.h"
 
 #define MAX_BUFFER_LENGTH 2048
 // #define MAX_BUFFER_LENGTH 8190
@@ -37,10 +52,126 @@ static char buffer[MAX_BUFFER_LENGTH];
 static unsigned int buffer_count = 0;
 static int _debug_nmea;
 static int _debug;
-static int sock;
 static int _use_tcp;
 
-static struct addrinfo *addr = NULL;
+// Prefix every sentence with an NMEA 4.10 TAG block holding the capture
+// time of the frame (-J), as c: UNIX time in seconds or milliseconds.
+// Text that does not fit in TAGGED_MAX goes out untagged.
+#define TAG_BLOCK_MAX 32
+#define TAGGED_MAX (MAX_BUFFER_LENGTH + 5 * TAG_BLOCK_MAX)
+#define AIS_TAG_BLOCK_OFF 0
+#define AIS_TAG_BLOCK_S 1
+#define AIS_TAG_BLOCK_MS 2
+static int _tag_block = AIS_TAG_BLOCK_OFF;
+
+// Output sinks. Every sink has its own filter and a bounded queue. The
+// decoder thread only copies matching messages into the queues, the
+// sender thread does all the network work.
+//
+// UDP sinks send one sentence (or multipart group) per datagram, or with
+// an mtu set, pack sentences into datagrams of up to mtu bytes that are
+// sent at the latest max_latency ms after the oldest sentence was queued.
+// Either way up to SINK_BATCH datagrams go out per sendmmsg() call.
+//
+// TCP sinks connect to a remote server, and retry with a backoff
+// from SINK_RECONNECT_MIN to SINK_RECONNECT_MAX seconds while it is
+// unreachable. With a spool they keep messages on disk meanwhile and
+// replay them, at most replay kB/s, once the link is back. Until the
+// spool is empty new messages go through it too, so order is kept.
+//
+// Archive sinks queue binary records instead of sentences, encoded in
+// the decoder thread while the signal level is known, and the sender
+// thread appends them to the archive. Columnar sinks queue the decoded
+// message, the sender thread collects them into row groups.
+//
+// Priority messages (safety and SAR traffic, see ais_msg_is_priority)
+// of UDP and TCP sinks go to a small queue of their own, which is sent
+// before anything else: UDP without waiting for a batch, TCP ahead of
+// the queue and of a spool being replayed at the replay rate.
+#define SINK_UDP 0
+#define SINK_TCP 1
+#define SINK_ARCHIVE 2
+#define SINK_COLUMNAR 3
+#define SINK_BATCH 16
+#define SINK_MAX_MTU 65507
+#define SINK_DEFAULT_QUEUE_KB 256
+#define SINK_DEFAULT_LATENCY 100
+#define SINK_RECONNECT_MIN 1
+#define SINK_RECONNECT_MAX 60
+#define SINK_DEFAULT_REPLAY_KB 64
+#define SINK_REPLAY_MIN 1024      // bytes, smallest replay read
+#define SINK_TCP_OUT 16384
+// UDP datagram buffers, a longer message is dropped
+#define SINK_DGRAM_SIZE(s) ((s)->mtu > TAGGED_MAX ? (unsigned int)(s)->mtu : TAGGED_MAX)
+#define SINK_URGENT_KB 16
+
+struct sink
+{
+    int type;
+    char *name;               // the -U spec without options, for logging
+    char *host, *port;
+    struct addrinfo *addr;
+    int fd;
+    int connecting;           // TCP: non-blocking connect in progress
+    time_t next_connect;      // TCP: earliest time for the next attempt
+    int backoff;              // TCP: seconds to wait after the next failure
+    struct spool *spool;      // TCP: store and forward (spool=dir)
+    char *spool_dir;
+    int spool_mb;
+    int replay_rate;          // bytes per second, 0: unlimited
+    double replay_tokens, replay_last;
+    int out_spooled;          // out holds data read from the spool
+    struct archive *archive;  // archive: the open archive
+    struct columnar *columnar; // columnar: the open files
+    int columnar_rows;        // columnar: rows per row group
+    struct ais_filter filter;
+    AIS_RING queue;           // protected by sink_lock
+    AIS_RING urgent;          // UDP, TCP: priority messages, protected by sink_lock
+    int mtu, max_latency, ttl;
+    char *dgram[SINK_BATCH];  // UDP: datagrams being sent
+    unsigned int dgram_len[SINK_BATCH];
+    char out[SINK_TCP_OUT];   // TCP: data taken from the queue, not yet sent
+    unsigned int out_len, out_off;
+    // statistics
+    unsigned long sentences, datagrams, syscalls, bytes;
+    unsigned long dropped, filtered, errors;
+    double latency_sum, latency_max;
+    struct sink *next;
+};
+
+static struct sink *sinks = NULL;
+static int nsinks = 0;
+static pthread_mutex_t sink_lock;
+static pthread_t sender_thread;
+static int sender_pipe[2];
+static volatile int sender_active = 0;
+static int sender_wakeup = 0; // a wakeup byte is in sender_pipe
+
+// A reload (SIGHUP) hands the new list of outputs to the sender thread,
+// which owns the sinks, and waits until it was applied. Sinks whose
+// destination and options did not change are kept with their queue,
+// connection, spool or open files, only their filter is replaced.
+struct sink_reload
+{
+    char **outputs;
+    int noutputs, udp_mtu, udp_max_latency;
+    int done, ok;
+};
+static struct sink_reload *sink_reload_pending = NULL; // protected by sink_lock
+static pthread_cond_t sink_reload_cond = PTHREAD_COND_INITIALIZER;
+
+// Report thinning (-X), applied before all outputs.
+static struct ais_thinning thinning;
+static int _thinning = 0;
+
+// Reception coverage (-N), aggregated from every decoded position.
+static int _coverage = 0;
+
+// Shared statistics page (-m), updated by its own thread.
+static struct stats_shm *stats_page = NULL;
+static pthread_t stats_thread;
+static volatile int stats_active = 0;
+
 // messages can be retrived from a different thread
 static pthread_mutex_t message_mutex;
 
@@ -95,8 +226,8 @@ const char *aisdecoder_next_message()
     return last_message->buffer;
 }
 
-static int initSocket(const char *host, const char *portname);
-int send_nmea(const char *sentence, unsigned int length);
+int send_nmea(const char *sentence, unsigned int length, const struct ais_msg *msg);
+static double now_ms(void);
 
 void sound_level_changed(float level, int channel, unsigned char high)
 {
@@ -106,15 +237,56 @@ void sound_level_changed(float level, int channel, unsigned char high)
         fprintf(stderr, "Level on ch %d: %.0f %%\n", channel, level);
 }
 
+// Write text to out with the TAG block before each of its sentences.
+// Returns the new length, 0 if out is too small.
+static unsigned int tag_sentences(char *out, unsigned int size, const char *text, unsigned int length, const struct ais_msg *msg)
+{
+    char tag[TAG_BLOCK_MAX];
+    const char *p = text, *end = text + length, *eol;
+    struct timespec ts;
+    long long wall_ms;
+    unsigned char sum = 0;
+    unsigned int len = 0, line;
+    int n, i;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    if (msg->capture_ms > 0)
+        wall_ms -= (long long)(now_ms() - msg->capture_ms);
+    n = sprintf(tag, "\\c:%lld", _tag_block == AIS_TAG_BLOCK_MS ? wall_ms : wall_ms / 1000);
+    for (i = 1; i < n; i++)
+        sum ^= tag[i];
+    n += sprintf(tag + n, "*%02X\\", sum);
+    while (p < end)
+    {
+        eol = memchr(p, '\n', end - p);
+        line = eol ? eol + 1 - p : end - p;
+        if (len + n + line >= size)
+            return 0;
+        memcpy(out + len, tag, n);
+        memcpy(out + len + n, p, line);
+        len += n + line;
+        p += line;
+    }
+    out[len] = 0;
+    return len;
+}
+
 void nmea_sentence_received(const char *sentence,
                             unsigned int length,
                             unsigned char sentences,
-                            unsigned char sentencenum)
+                            unsigned char sentencenum,
+                            const struct ais_msg *msg)
 {
-    append_message(sentence);
+    char tagged[TAG_BLOCK_MAX + 256];
+
+    if (_tag_block && msg && tag_sentences(tagged, sizeof(tagged), sentence, length, msg))
+        append_message(tagged);
+    else
+        append_message(sentence);
     if (sentences == 1)
     {
-        if (send_nmea(sentence, length) == -1)
+        if (send_nmea(sentence, length, msg) == -1)
         {
             if (_debug)
                 fprintf(stderr, "-----Send_nmea Abort....");
@@ -137,7 +309,7 @@ void nmea_sentence_received(const char *sentence,
 
         if (sentences == sentencenum && buffer_count > 0)
         {
-            if (send_nmea(buffer, buffer_count) == -1)
+            if (send_nmea(buffer, buffer_count, msg) == -1)
             {
                 if (_debug)
                     fprintf(stderr, "*****Send_nmea Abort....");
@@ -150,64 +322,1421 @@ void nmea_sentence_received(const char *sentence,
     }
 }
 
-int send_nmea(const char *sentence, unsigned int length)
+static double now_ms(void)
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double timeval_ms(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+static unsigned int count_sentences(const char *buf, unsigned int length)
+{
+    unsigned int n = 0;
+    const char *p = buf, *end = buf + length;
+    while ((p = memchr(p, '\n', end - p)) != NULL)
+    {
+        n++;
+        p++;
+    }
+    return n ? n : 1;
+}
+
+// Queue a message on every sink whose filter matches it. Text sinks get
+// text, the archive the sentence as received.
+static void sinks_queue(const char *sentence, unsigned int length, const char *text, unsigned int text_len, const struct ais_msg *msg)
+{
+    struct archive_record record;
+    struct columnar_row row;
+    unsigned int record_len = 0;
+    struct timespec ts;
+    struct timeval now;
+    struct sink *s;
+    int64_t wall_ms;
+    int wake;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now.tv_sec = ts.tv_sec;
+    now.tv_usec = ts.tv_nsec / 1000;
+    record.nbits = 0;
+
+    pthread_mutex_lock(&sink_lock);
+    for (s = sinks; s != NULL; s = s->next)
+    {
+        if (!ais_filter_match(&s->filter, msg))
+        {
+            s->filtered++;
+            continue;
+        }
+        if (s->type == SINK_ARCHIVE)
+        {
+            if (record.nbits == 0)
+                record_len = archive_encode(&record, sentence, length, wall_ms,
+                                            METRIC_GET(metrics_demod.level[msg->chanid == 'B']));
+            if (record_len == 0 || !ais_ring_push(&s->queue, &now, (const char *)&record, record_len))
+                s->dropped++;
+            continue;
+        }
+        if (s->type == SINK_COLUMNAR)
+        {
+            row.time_ms = wall_ms;
+            row.msg = *msg;
+            if (!ais_ring_push(&s->queue, &now, (const char *)&row, sizeof(row)))
+                s->dropped++;
+            continue;
+        }
+        if (!ais_ring_push(msg && msg->priority ? &s->urgent : &s->queue, &now, text, text_len))
+            s->dropped++;
+    }
+    wake = !sender_wakeup;
+    sender_wakeup = 1;
+    pthread_mutex_unlock(&sink_lock);
+    if (wake && write(sender_pipe[1], "", 1) < 0 && _debug)
+        perror("sender pipe");
+}
+
+int send_nmea(const char *sentence, unsigned int length, const struct ais_msg *msg)
+{
+    char tagged[TAGGED_MAX];
+    const char *text = sentence;
+    unsigned int text_len = length;
+
+    if (msg && msg->capture_ms > 0)
+        metrics_latency_add(&metrics_capture, now_ms() - msg->capture_ms);
+    // Coverage (-N) counts what was heard, before thinning.
+    if (_coverage && msg)
+        coverage_add(msg);
+    // Safety messages are never thinned.
+    if (_thinning && msg && !msg->priority && !thinning_check(&thinning, msg, length, now_ms()))
+        return 0;
+    // The TAG block (-J) goes to the text outputs only.
+    if (_tag_block && msg && (text_len = tag_sentences(tagged, sizeof(tagged), sentence, length, msg)) > 0)
+        text = tagged;
+    else
+        text_len = length;
+    if (nsinks > 0)
+        sinks_queue(sentence, length, text, text_len, msg);
     if (_use_tcp)
     {
-        return add_nmea_ais_message(sentence, length);
+        return add_nmea_ais_message(text, text_len, msg);
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Sender thread
+// ------------------------------------------------------------
+
+// Take one datagram worth of messages out of q, the queue or the urgent
+// queue of a UDP sink. Expects sink_lock to be held. Returns the
+// datagram length.
+static unsigned int sink_take_datagram(struct sink *s, P_AIS_RING q, char *dgram, double now)
+{
+    struct timeval ts;
+    unsigned int length, len = 0;
+    const char *data;
+
+    while ((data = ais_ring_peek(q, &ts, &length)) != NULL)
+    {
+        // A message longer than the mtu (or any message without one)
+        // goes out alone, sentences and multipart groups are never split.
+        if (len > 0 && (s->mtu == 0 || len + length > (unsigned int)s->mtu))
+            break;
+        if (length > SINK_DGRAM_SIZE(s))
+        {
+            s->dropped += count_sentences(data, length);
+            ais_ring_pop(q);
+            continue;
+        }
+        memcpy(dgram + len, data, length);
+        len += length;
+        s->sentences += count_sentences(data, length);
+        s->latency_sum += now - timeval_ms(&ts);
+        if (now - timeval_ms(&ts) > s->latency_max)
+            s->latency_max = now - timeval_ms(&ts);
+        metrics_latency_add(&metrics_send, now - timeval_ms(&ts));
+        if (q == &s->urgent)
+            metrics_latency_add(&metrics_priority, now - timeval_ms(&ts));
+        ais_ring_pop(q);
+    }
+    return len;
+}
+
+static void sink_service_udp(struct sink *s)
+{
+    struct mmsghdr msgs[SINK_BATCH];
+    struct iovec iov[SINK_BATCH];
+    struct timeval ts;
+    unsigned int length;
+    int i, n, sent, rc;
+    double now;
+
+    while (1)
+    {
+        now = now_ms();
+        pthread_mutex_lock(&sink_lock);
+        // Priority messages go out at once, ahead of the queue.
+        for (n = 0; n < SINK_BATCH; n++)
+        {
+            s->dgram_len[n] = sink_take_datagram(s, &s->urgent, s->dgram[n], now);
+            if (s->dgram_len[n] == 0)
+                break;
+        }
+        // Unless nothing is queued, or still collecting a batch.
+        if (ais_ring_peek(&s->queue, &ts, &length) != NULL &&
+            (s->mtu == 0 || now - timeval_ms(&ts) >= s->max_latency ||
+             s->queue.head - s->queue.tail >= (unsigned long long)SINK_BATCH * s->mtu))
+        {
+            for (; n < SINK_BATCH; n++)
+            {
+                s->dgram_len[n] = sink_take_datagram(s, &s->queue, s->dgram[n], now);
+                if (s->dgram_len[n] == 0)
+                    break;
+            }
+        }
+        pthread_mutex_unlock(&sink_lock);
+        if (n == 0)
+            return;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < n; i++)
+        {
+            iov[i].iov_base = s->dgram[i];
+            iov[i].iov_len = s->dgram_len[i];
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = s->addr->ai_addr;
+            msgs[i].msg_hdr.msg_namelen = s->addr->ai_addrlen;
+        }
+        for (sent = 0; sent < n; sent += rc)
+        {
+            rc = sendmmsg(s->fd, msgs + sent, n - sent, 0);
+            s->syscalls++;
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                {
+                    rc = 0;
+                    continue;
+                }
+                if (_debug)
+                    fprintf(stderr, "%s: %s\n", s->name, strerror(errno));
+                s->errors++;
+                break;
+            }
+            for (i = sent; i < sent + rc; i++)
+                s->bytes += s->dgram_len[i];
+        }
+        s->datagrams += sent;
+    }
+}
+
+// Append everything queued to the archive.
+static void sink_service_archive(struct sink *s)
+{
+    struct archive_record record;
+    struct timeval ts;
+    unsigned int length;
+    const char *data;
+    double now = now_ms();
+
+    pthread_mutex_lock(&sink_lock);
+    while ((data = ais_ring_peek(&s->queue, &ts, &length)) != NULL)
+    {
+        memcpy(&record, data, length);
+        ais_ring_pop(&s->queue);
+        if (archive_write(s->archive, &record, now))
+            s->sentences++;
+        else
+            s->errors++;
+        s->latency_sum += now - timeval_ms(&ts);
+        if (now - timeval_ms(&ts) > s->latency_max)
+            s->latency_max = now - timeval_ms(&ts);
+    }
+    s->bytes = s->archive->bytes;
+    pthread_mutex_unlock(&sink_lock);
+    archive_flush(s->archive, now, 0);
+}
+
+// Add everything queued to the current row group of a columnar sink.
+// A full row group is compressed and written by columnar_add, so the
+// lock is not held during it.
+static void sink_service_columnar(struct sink *s)
+{
+    struct columnar_row row;
+    struct timeval ts;
+    unsigned int length;
+    const char *data;
+    double now = now_ms();
+    int ok;
+
+    pthread_mutex_lock(&sink_lock);
+    while ((data = ais_ring_peek(&s->queue, &ts, &length)) != NULL)
+    {
+        memcpy(&row, data, sizeof(row));
+        ais_ring_pop(&s->queue);
+        s->latency_sum += now - timeval_ms(&ts);
+        if (now - timeval_ms(&ts) > s->latency_max)
+            s->latency_max = now - timeval_ms(&ts);
+        pthread_mutex_unlock(&sink_lock);
+        ok = columnar_add(s->columnar, row.time_ms, &row.msg, now);
+        pthread_mutex_lock(&sink_lock);
+        if (ok)
+            s->sentences++;
+        else
+            s->errors++;
+    }
+    s->bytes = s->columnar->bytes;
+    pthread_mutex_unlock(&sink_lock);
+    if (columnar_flush_timeout(s->columnar, now) == 0)
+        columnar_flush(s->columnar);
+}
+
+// Keep what was not sent yet in the spool, from the start of its line.
+static void sink_spool_unsent(struct sink *s)
+{
+    unsigned int off = s->out_off;
+
+    if (off >= s->out_len)
+        return;
+    while (off > 0 && s->out[off - 1] != '\n')
+        off--;
+    if (s->out_spooled)
+        spool_unread(s->spool, s->out_len - off);
+    else
+        spool_append(s->spool, s->out + off, s->out_len - off, now_ms());
+}
+
+// Move everything in q, the queue or the urgent queue, to the spool.
+static void sink_spool_queue(struct sink *s, P_AIS_RING q)
+{
+    struct timeval ts;
+    unsigned int length;
+    const char *data;
+    double now = now_ms();
+
+    pthread_mutex_lock(&sink_lock);
+    while ((data = ais_ring_peek(q, &ts, &length)) != NULL)
+    {
+        spool_append(s->spool, data, length, now);
+        ais_ring_pop(q);
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+// Fill the empty output buffer of a TCP sink with whole messages from
+// q, the queue or the urgent queue. Expects sink_lock to be held.
+static void sink_fill_out(struct sink *s, P_AIS_RING q, double now)
+{
+    struct timeval ts;
+    unsigned int length;
+    const char *data;
+
+    while ((data = ais_ring_peek(q, &ts, &length)) != NULL &&
+           s->out_len + length <= SINK_TCP_OUT)
+    {
+        memcpy(s->out + s->out_len, data, length);
+        s->out_len += length;
+        s->sentences += count_sentences(data, length);
+        s->latency_sum += now - timeval_ms(&ts);
+        if (now - timeval_ms(&ts) > s->latency_max)
+            s->latency_max = now - timeval_ms(&ts);
+        metrics_latency_add(&metrics_send, now - timeval_ms(&ts));
+        if (q == &s->urgent)
+            metrics_latency_add(&metrics_priority, now - timeval_ms(&ts));
+        ais_ring_pop(q);
+    }
+}
+
+static void sink_disconnect(struct sink *s)
+{
+    if (s->spool)
+        sink_spool_unsent(s);
+    close(s->fd);
+    s->fd = -1;
+    s->connecting = 0;
+    s->out_len = s->out_off = 0;
+    s->next_connect = time(NULL) + s->backoff;
+    s->backoff = s->backoff * 2 > SINK_RECONNECT_MAX ? SINK_RECONNECT_MAX : s->backoff * 2;
+}
+
+// Bytes the spool may replay now.
+static unsigned int sink_replay_budget(struct sink *s, double now)
+{
+    double burst = s->replay_rate > SINK_REPLAY_MIN ? s->replay_rate : SINK_REPLAY_MIN;
+
+    if (s->replay_rate == 0)
+        return SINK_TCP_OUT;
+    s->replay_tokens += (now - s->replay_last) * s->replay_rate / 1000.0;
+    s->replay_last = now;
+    if (s->replay_tokens > burst)
+        s->replay_tokens = burst;
+    return s->replay_tokens > SINK_TCP_OUT ? SINK_TCP_OUT : (unsigned int)s->replay_tokens;
+}
+
+static void sink_connect(struct sink *s)
+{
+    s->fd = socket(s->addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0)
+    {
+        s->next_connect = time(NULL) + s->backoff;
+        return;
+    }
+    if (connect(s->fd, s->addr->ai_addr, s->addr->ai_addrlen) == 0)
+        return;
+    if (errno == EINPROGRESS)
+    {
+        s->connecting = 1;
+        return;
+    }
+    if (_debug)
+        fprintf(stderr, "%s: connect failed: %s\n", s->name, strerror(errno));
+    s->errors++;
+    sink_disconnect(s);
+}
+
+// revents are the poll() results for the sink's socket, if it had one.
+static void sink_service_tcp(struct sink *s, short revents)
+{
+    double now;
+    ssize_t rc;
+    char discard[256];
+    unsigned int budget;
+
+    if (s->spool)
+    {
+        // While the link is down, and until the spool has been
+        // replayed, everything goes through the spool. Priority
+        // messages only while it is down, they skip the replay.
+        if (s->fd < 0 || s->connecting)
+            sink_spool_queue(s, &s->urgent);
+        if (s->fd < 0 || s->connecting || !spool_empty(s->spool))
+            sink_spool_queue(s, &s->queue);
+        spool_flush(s->spool, now_ms(), 0);
+    }
+    if (s->fd < 0)
+    {
+        if (time(NULL) < s->next_connect)
+            return;
+        sink_connect(s);
+        if (s->fd < 0 || s->connecting)
+            return;
+    }
+    if (s->connecting)
+    {
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+            return;
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+        if (err != 0)
+        {
+            if (_debug)
+                fprintf(stderr, "%s: connect failed: %s\n", s->name, strerror(err));
+            s->errors++;
+            sink_disconnect(s);
+            return;
+        }
+        s->connecting = 0;
+        if (_debug)
+            fprintf(stderr, "%s: connected\n", s->name);
+    }
+    s->backoff = SINK_RECONNECT_MIN;
+    if (revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        // The server has nothing to say, anything but data means it is gone.
+        rc = recv(s->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            if (_debug)
+                fprintf(stderr, "%s: connection closed\n", s->name);
+            sink_disconnect(s);
+            return;
+        }
+    }
+
+    while (1)
+    {
+        if (s->out_off == s->out_len)
+        {
+            // Priority messages first, they skip the spool.
+            s->out_len = s->out_off = 0;
+            s->out_spooled = 0;
+            pthread_mutex_lock(&sink_lock);
+            sink_fill_out(s, &s->urgent, now_ms());
+            pthread_mutex_unlock(&sink_lock);
+        }
+        if (s->out_off == s->out_len && s->spool && !spool_empty(s->spool))
+        {
+            // Replay the spool, as fast as the replay rate allows.
+            now = now_ms();
+            s->out_len = s->out_off = 0;
+            budget = sink_replay_budget(s, now);
+            if (budget < SINK_REPLAY_MIN && budget < SINK_TCP_OUT)
+                return;
+            s->out_len = spool_read(s->spool, s->out, budget);
+            s->out_spooled = 1;
+            if (s->out_len == 0)
+                return;
+            if (s->replay_rate)
+                s->replay_tokens -= s->out_len;
+            s->sentences += count_sentences(s->out, s->out_len);
+        }
+        else if (s->out_off == s->out_len)
+        {
+            // Refill the output buffer with whole messages.
+            now = now_ms();
+            s->out_len = s->out_off = 0;
+            s->out_spooled = 0;
+            pthread_mutex_lock(&sink_lock);
+            sink_fill_out(s, &s->queue, now);
+            pthread_mutex_unlock(&sink_lock);
+            if (s->out_len == 0)
+                return;
+        }
+        rc = send(s->fd, s->out + s->out_off, s->out_len - s->out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+        s->syscalls++;
+        if (rc < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            if (_debug)
+                fprintf(stderr, "%s: %s\n", s->name, strerror(errno));
+            s->errors++;
+            if (!s->spool)
+                s->dropped += count_sentences(s->out + s->out_off, s->out_len - s->out_off);
+            sink_disconnect(s);
+            return;
+        }
+        s->out_off += rc;
+        s->bytes += rc;
+        s->datagrams++;
+    }
+}
+
+// Milliseconds until the sink needs servicing without new messages
+// arriving, or -1 if never.
+static int sink_timeout(struct sink *s)
+{
+    struct timeval ts;
+    unsigned int length;
+    int t = -1, u;
+
+    if (s->spool)
+    {
+        t = spool_flush_timeout(s->spool, now_ms());
+        if (s->fd >= 0 && !s->connecting && s->out_off == s->out_len && s->replay_rate && !spool_empty(s->spool))
+        {
+            // Waiting for the replay rate.
+            u = (SINK_REPLAY_MIN - s->replay_tokens) * 1000 / s->replay_rate + 1;
+            if (u < 0)
+                u = 0;
+            if (t < 0 || u < t)
+                t = u;
+        }
+    }
+    if (s->type == SINK_ARCHIVE)
+        return archive_flush_timeout(s->archive, now_ms());
+    if (s->type == SINK_COLUMNAR)
+        return columnar_flush_timeout(s->columnar, now_ms());
+    if (s->type == SINK_TCP && s->fd < 0)
+    {
+        u = (s->next_connect - time(NULL)) * 1000;
+        if (u < 0)
+            u = 0;
+        return t >= 0 && t < u ? t : u;
+    }
+    pthread_mutex_lock(&sink_lock);
+    if (s->type == SINK_UDP && ais_ring_peek(&s->queue, &ts, &length) != NULL)
+    {
+        t = timeval_ms(&ts) + s->max_latency - now_ms() + 1;
+        if (t < 0)
+            t = 0;
+    }
+    pthread_mutex_unlock(&sink_lock);
+    return t;
+}
+
+// Hand over what is still queued before a sink is closed. Datagrams
+// go out now, archives are written, TCP sinks with a spool keep it
+// there for the next run.
+static void sink_drain(struct sink *s)
+{
+    if (s->type == SINK_UDP)
+    {
+        s->max_latency = 0;
+        sink_service_udp(s);
+    }
+    else if (s->type == SINK_ARCHIVE)
+        sink_service_archive(s);
+    else if (s->type == SINK_COLUMNAR)
+        sink_service_columnar(s);
+    else if (s->spool)
+    {
+        sink_spool_unsent(s);
+        s->out_len = s->out_off = 0;
+        sink_spool_queue(s, &s->urgent);
+        sink_spool_queue(s, &s->queue);
+    }
+}
+
+static struct sink *sink_create(const char *spec, int default_mtu, int default_latency);
+static int sink_open(struct sink *s);
+static void sink_free(struct sink *s);
+
+static int str_equal(const char *a, const char *b)
+{
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// Everything but the filter is the same, the old sink can stay.
+static int sink_same(const struct sink *a, const struct sink *b)
+{
+    return strcmp(a->name, b->name) == 0 && a->mtu == b->mtu && a->max_latency == b->max_latency &&
+           a->ttl == b->ttl && a->queue.size == b->queue.size && str_equal(a->spool_dir, b->spool_dir) &&
+           a->spool_mb == b->spool_mb && a->replay_rate == b->replay_rate && a->columnar_rows == b->columnar_rows;
+}
+
+// Apply a reload, in the sender thread. New destinations are opened
+// first, if one fails nothing changes. Then the new list is published
+// under sink_lock, the decoder thread sees either all old or all new
+// sinks. Sinks that were removed are drained and closed after that,
+// and sinks whose options changed for the same destination are closed
+// before their replacement is opened, so a directory is never open
+// twice.
+static int sinks_reload(struct sink_reload *r)
+{
+    struct sink **parsed = calloc(r->noutputs + 1, sizeof(struct sink *));
+    struct sink **keep = calloc(r->noutputs + 1, sizeof(struct sink *));
+    struct sink **replace = calloc(r->noutputs + 1, sizeof(struct sink *));
+    struct sink *s, *old, **tail, **old_list;
+    int i, n, kept = 0, opened = 0, closed = 0, ok = 0;
+
+    for (i = 0; i < r->noutputs; i++)
+    {
+        parsed[i] = sink_create(r->outputs[i], r->udp_mtu, r->udp_max_latency);
+        if (!parsed[i])
+            goto out;
+        for (old = sinks; old != NULL; old = old->next)
+        {
+            for (n = 0; n < i && keep[n] != old && replace[n] != old; n++)
+                ;
+            if (n == i && strcmp(old->name, parsed[i]->name) == 0)
+                break;
+        }
+        if (old && sink_same(old, parsed[i]))
+            keep[i] = old;
+        else if (old)
+            replace[i] = old;
+        else if (!sink_open(parsed[i]))
+        {
+            fprintf(stderr, "Reload: cannot open %s, outputs not changed\n", r->outputs[i]);
+            goto out;
+        }
+        else
+            opened++;
+    }
+
+    // Publish the new list, replacements queue until they are opened.
+    // The decoder walks the list under sink_lock, so it is relinked
+    // there; the sender thread is the only one that changes it.
+    for (n = 0, s = sinks; s != NULL; s = s->next)
+        n++;
+    old_list = calloc(n + 1, sizeof(struct sink *));
+    for (n = 0, s = sinks; s != NULL; s = s->next)
+        old_list[n++] = s;
+    pthread_mutex_lock(&sink_lock);
+    tail = &sinks;
+    for (i = 0; i < r->noutputs; i++)
+    {
+        if (keep[i])
+        {
+            keep[i]->filter = parsed[i]->filter;
+            kept++;
+        }
+        *tail = keep[i] ? keep[i] : parsed[i];
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+    nsinks = r->noutputs;
+    pthread_mutex_unlock(&sink_lock);
+
+    // The old sinks that were not kept are no longer seen by the decoder.
+    while (n-- > 0)
+    {
+        for (i = 0; i < r->noutputs && keep[i] != old_list[n]; i++)
+            ;
+        if (i < r->noutputs)
+            continue;
+        sink_drain(old_list[n]);
+        sink_free(old_list[n]);
+        closed++;
+    }
+    free(old_list);
+    for (i = 0; i < r->noutputs; i++)
+    {
+        if (keep[i])
+        {
+            sink_free(parsed[i]);
+            parsed[i] = NULL;
+        }
+        else if (replace[i] && !sink_open(parsed[i]))
+        {
+            fprintf(stderr, "Reload: cannot open %s, output removed\n", r->outputs[i]);
+            pthread_mutex_lock(&sink_lock);
+            for (tail = &sinks; *tail != parsed[i]; tail = &(*tail)->next)
+                ;
+            *tail = parsed[i]->next;
+            nsinks--;
+            pthread_mutex_unlock(&sink_lock);
+            sink_free(parsed[i]);
+        }
+        else if (replace[i])
+            opened++;
+        parsed[i] = NULL;
+    }
+    fprintf(stderr, "Reload: %d outputs, %d kept, %d opened, %d closed\n", nsinks, kept, opened, closed);
+    ok = 1;
+
+out:
+    for (i = 0; i < r->noutputs; i++)
+        if (parsed[i])
+            sink_free(parsed[i]);
+    free(parsed);
+    free(keep);
+    free(replace);
+    return ok;
+}
+
+static void *sender_thread_fn(void *arg)
+{
+    struct pollfd *pfd = malloc((nsinks + 1) * sizeof(struct pollfd));
+    struct sink_reload *r;
+    struct sink *s;
+    char buff[64];
+    int i, timeout, t, ok;
+    (void)(arg); // not used
+
+    while (sender_active)
+    {
+        pthread_mutex_lock(&sink_lock);
+        r = sink_reload_pending;
+        sink_reload_pending = NULL;
+        pthread_mutex_unlock(&sink_lock);
+        if (r)
+        {
+            ok = sinks_reload(r);
+            pfd = realloc(pfd, (nsinks + 1) * sizeof(struct pollfd));
+            pthread_mutex_lock(&sink_lock);
+            r->ok = ok;
+            r->done = 1;
+            pthread_cond_broadcast(&sink_reload_cond);
+            pthread_mutex_unlock(&sink_lock);
+        }
+        timeout = -1;
+        pfd[0].fd = sender_pipe[0];
+        pfd[0].events = POLLIN;
+        for (s = sinks, i = 1; s != NULL; s = s->next, i++)
+        {
+            pfd[i].fd = -1;
+            pfd[i].events = 0;
+            if (s->type == SINK_TCP && s->fd >= 0)
+            {
+                pfd[i].fd = s->fd;
+                pfd[i].events = POLLIN;
+                if (s->connecting || s->out_off < s->out_len)
+                    pfd[i].events |= POLLOUT;
+            }
+            t = sink_timeout(s);
+            if (t >= 0 && (timeout < 0 || t < timeout))
+                timeout = t;
+        }
+        if (poll(pfd, nsinks + 1, timeout) < 0 && errno != EINTR)
+        {
+            perror("sender poll");
+            break;
+        }
+        if (pfd[0].revents & POLLIN)
+        {
+            pthread_mutex_lock(&sink_lock);
+            sender_wakeup = 0;
+            pthread_mutex_unlock(&sink_lock);
+            while (read(sender_pipe[0], buff, sizeof(buff)) > 0)
+                ;
+        }
+        for (s = sinks, i = 1; s != NULL; s = s->next, i++)
+        {
+            if (s->type == SINK_UDP)
+                sink_service_udp(s);
+            else if (s->type == SINK_ARCHIVE)
+                sink_service_archive(s);
+            else if (s->type == SINK_COLUMNAR)
+                sink_service_columnar(s);
+            else
+                sink_service_tcp(s, pfd[i].fd >= 0 ? pfd[i].revents : 0);
+        }
     }
-    else if (sock)
+    // A reload that came too late is not applied.
+    pthread_mutex_lock(&sink_lock);
+    if (sink_reload_pending)
     {
-        return sendto(sock, sentence, length, 0, addr->ai_addr, addr->ai_addrlen);
+        sink_reload_pending->done = 1;
+        sink_reload_pending = NULL;
+        pthread_cond_broadcast(&sink_reload_cond);
     }
+    pthread_mutex_unlock(&sink_lock);
+    free(pfd);
     return 0;
 }
 
-int init_ais_decoder(char *host, char *port, int show_levels, int debug_nmea, int buf_len, int time_print_stats, int use_tcp_listener, int tcp_keep_ais_time, int tcp_stream_forever, int add_sample_num, unsigned long mmsi,int debug)
+// ------------------------------------------------------------
+// Sink setup
+// ------------------------------------------------------------
+
+// Parse "udp:host:port[;key=value...]", "tcp:host:port[;...]",
+// "archive:dir[;...]" or "columnar:dir[;...]". IPv6 addresses are
+// written in brackets, "udp:[ff02::1]:10110".
+static struct sink *sink_create(const char *spec, int default_mtu, int default_latency)
+{
+    struct sink *s = calloc(1, sizeof(struct sink));
+    char *copy = strdup(spec), *opts, *p, *item, *save = NULL, *host, *port = NULL;
+    int queue_kb = SINK_DEFAULT_QUEUE_KB;
+    int i;
+
+    s->fd = -1;
+    s->mtu = default_mtu;
+    s->max_latency = default_latency;
+    s->ttl = -1;
+    s->backoff = SINK_RECONNECT_MIN;
+    s->spool_mb = SPOOL_DEFAULT_MB;
+    s->replay_rate = SINK_DEFAULT_REPLAY_KB * 1024;
+    ais_filter_clear(&s->filter);
+
+    opts = strchr(copy, ';');
+    if (opts)
+        *opts++ = 0;
+    s->name = strdup(copy);
+    if (strncmp(copy, "udp:", 4) == 0)
+        s->type = SINK_UDP;
+    else if (strncmp(copy, "tcp:", 4) == 0)
+        s->type = SINK_TCP;
+    else if (strncmp(copy, "archive:", 8) == 0 && copy[8])
+        s->type = SINK_ARCHIVE;
+    else if (strncmp(copy, "columnar:", 9) == 0 && copy[9])
+        s->type = SINK_COLUMNAR;
+    else
+        goto fail;
+    p = copy + 4;
+    if (s->type == SINK_ARCHIVE || s->type == SINK_COLUMNAR)
+        host = strchr(copy, ':') + 1;    // the directory
+    else if (*p == '[')
+    {
+        host = p + 1;
+        p = strchr(p, ']');
+        if (!p || p[1] != ':')
+            goto fail;
+        *p = 0;
+        port = p + 2;
+    }
+    else
+    {
+        host = p;
+        p = strrchr(p, ':');
+        if (!p)
+            goto fail;
+        *p = 0;
+        port = p + 1;
+    }
+    s->host = strdup(host);
+    s->port = port ? strdup(port) : NULL;
+
+    for (item = opts ? strtok_r(opts, ";", &save) : NULL; item; item = strtok_r(NULL, ";", &save))
+    {
+        char *value = strchr(item, '=');
+        if (!value)
+            goto fail;
+        *value++ = 0;
+        i = ais_filter_set(&s->filter, item, value);
+        if (i < 0)
+            goto fail;
+        if (i > 0)
+            continue;
+        if (strcmp(item, "mtu") == 0)
+            s->mtu = atoi(value);
+        else if (strcmp(item, "latency") == 0)
+            s->max_latency = atoi(value);
+        else if (strcmp(item, "queue") == 0)
+            queue_kb = atoi(value);
+        else if (strcmp(item, "ttl") == 0)
+            s->ttl = atoi(value);
+        else if (strcmp(item, "spool") == 0 && s->type == SINK_TCP && !s->spool_dir)
+            s->spool_dir = strdup(value);
+        else if (strcmp(item, "spool_mb") == 0)
+            s->spool_mb = atoi(value);
+        else if (strcmp(item, "replay") == 0)
+            s->replay_rate = atoi(value) * 1024;
+        else if (strcmp(item, "rows") == 0 && s->type == SINK_COLUMNAR)
+            s->columnar_rows = atoi(value);
+        else
+            goto fail;
+    }
+    if (s->mtu < 0 || s->mtu > SINK_MAX_MTU || s->max_latency < 0 || queue_kb <= 0 ||
+        s->spool_mb <= 0 || s->replay_rate < 0 || s->columnar_rows < 0 || s->columnar_rows > COLUMNAR_MAX_ROWS)
+        goto fail;
+    if (!ais_ring_init(&s->queue, queue_kb * 1024) || !ais_ring_init(&s->urgent, SINK_URGENT_KB * 1024))
+        goto fail;
+    free(copy);
+    return s;
+
+fail:
+    fprintf(stderr, "Invalid output destination '%s'\n", spec);
+    ais_ring_free(&s->queue);
+    ais_ring_free(&s->urgent);
+    free(copy);
+    free(s->spool_dir);
+    free(s->host);
+    free(s->port);
+    free(s->name);
+    free(s);
+    return NULL;
+}
+
+static int sink_open(struct sink *s)
+{
+    struct addrinfo hints;
+    int i, err;
+
+    if (s->type == SINK_ARCHIVE)
+    {
+        s->archive = malloc(sizeof(struct archive));
+        if (!s->archive || !archive_open(s->archive, s->host))
+        {
+            free(s->archive);
+            s->archive = NULL;
+            return 0;
+        }
+        fprintf(stderr, "AIS messages will be archived in %s\n", s->host);
+        return 1;
+    }
+    if (s->type == SINK_COLUMNAR)
+    {
+        s->columnar = malloc(sizeof(struct columnar));
+        if (!s->columnar || !columnar_open_dir(s->columnar, s->host, s->columnar_rows))
+        {
+            free(s->columnar);
+            s->columnar = NULL;
+            return 0;
+        }
+        fprintf(stderr, "Decoded AIS messages will be written to daily columnar files in %s, %u rows per group\n",
+                s->host, s->columnar->max_rows);
+        return 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    if (s->type == SINK_UDP)
+    {
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_protocol = IPPROTO_UDP;
+    }
+    else
+    {
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+    }
+    err = getaddrinfo(s->host, s->port, &hints, &s->addr);
+    if (err != 0)
+    {
+        fprintf(stderr, "Failed to resolve remote socket address %s!\n", s->name);
+        return 0;
+    }
+    if (s->type == SINK_TCP)
+    {
+        // Connected from the sender thread, which retries until it works.
+        fprintf(stderr, "AIS data will be sent to TCP server %s port %s\n", s->host, s->port);
+        if (s->spool_dir)
+        {
+            s->spool = malloc(sizeof(struct spool));
+            if (!s->spool || !spool_open(s->spool, s->spool_dir, (unsigned long long)s->spool_mb << 20, now_ms()))
+            {
+                free(s->spool);
+                s->spool = NULL;
+                return 0;
+            }
+            s->replay_last = now_ms();
+            fprintf(stderr, "%s: spooling to %s while disconnected, up to %d MB, replay at %d kB/s%s\n",
+                    s->name, s->spool_dir, s->spool_mb, s->replay_rate / 1024,
+                    spool_empty(s->spool) ? "" : ", replaying the earlier spool first");
+        }
+        return 1;
+    }
+
+    s->fd = socket(s->addr->ai_family, s->addr->ai_socktype, s->addr->ai_protocol);
+    if (s->fd == -1)
+    {
+        fprintf(stderr, "%s", strerror(errno));
+        return 0;
+    }
+    if (s->ttl >= 0)
+    {
+        if (s->addr->ai_family == AF_INET6)
+            setsockopt(s->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &s->ttl, sizeof(s->ttl));
+        else
+            setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &s->ttl, sizeof(s->ttl));
+    }
+    for (i = 0; i < SINK_BATCH; i++)
+    {
+        s->dgram[i] = malloc(SINK_DGRAM_SIZE(s));
+        if (!s->dgram[i])
+        {
+            fprintf(stderr, "%s: out of memory for the datagrams\n", s->name);
+            while (i-- > 0)
+            {
+                free(s->dgram[i]);
+                s->dgram[i] = NULL;
+            }
+            close(s->fd);
+            s->fd = -1;
+            return 0;
+        }
+    }
+    fprintf(stderr, "AIS data will be sent to UDP %s port %s", s->host, s->port);
+    if (s->mtu)
+        fprintf(stderr, ", datagrams up to %d bytes, max latency %d ms", s->mtu, s->max_latency);
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+static void sink_free(struct sink *s)
+{
+    int i;
+    if (s->fd >= 0)
+        close(s->fd);
+    for (i = 0; i < SINK_BATCH; i++)
+        free(s->dgram[i]);
+    if (s->addr)
+        freeaddrinfo(s->addr);
+    if (s->spool)
+    {
+        spool_close(s->spool);
+        free(s->spool);
+    }
+    free(s->spool_dir);
+    if (s->archive)
+    {
+        archive_close(s->archive);
+        free(s->archive);
+    }
+    if (s->columnar)
+    {
+        columnar_close(s->columnar);
+        free(s->columnar);
+    }
+    ais_ring_free(&s->queue);
+    ais_ring_free(&s->urgent);
+    free(s->name);
+    free(s->host);
+    free(s->port);
+    free(s);
+}
+
+// Average and percentiles of a latency histogram, for print_stats().
+static void print_latency(const char *name, const struct metrics_latency *h)
+{
+    unsigned long count = 0;
+    int i, p50, p99;
+
+    for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+        count += METRIC_GET(h->bucket[i]);
+    if (count == 0)
+        return;
+    p50 = metrics_latency_quantile(h, 0.5);
+    p99 = metrics_latency_quantile(h, 0.99);
+    fprintf(stderr, "Latency %s: %lu messages, avg %.1f ms, p50 %s%d ms, p99 %s%d ms\n",
+            name, count, METRIC_GET(h->latency_us) / 1000.0 / count,
+            p50 < 0 ? "> " : "<= ", p50 < 0 ? METRICS_LATENCY_MAX_MS : p50,
+            p99 < 0 ? "> " : "<= ", p99 < 0 ? METRICS_LATENCY_MAX_MS : p99);
+}
+
+static void print_stats(void)
+{
+    struct sink *s;
+
+    if (_use_tcp)
+        printTcpStats();
+    print_latency("capture to emit", &metrics_capture);
+    print_latency("emit to socket", &metrics_send);
+    print_latency("priority emit to socket", &metrics_priority);
+    if (_thinning)
+    {
+        double hours = (now_ms() - thinning.started) / 3600000.0;
+        unsigned long total = thinning.passed_bytes + thinning.thinned_bytes;
+        fprintf(stderr, "Thinning: dropped %lu of %lu messages, saved %lu bytes (%.1f%%, %.0f bytes per hour)\n",
+                thinning.thinned, thinning.passed + thinning.thinned, thinning.thinned_bytes,
+                total ? 100.0 * thinning.thinned_bytes / total : 0.0,
+                hours > 0 ? thinning.thinned_bytes / hours : 0.0);
+    }
+    pthread_mutex_lock(&sink_lock);
+    for (s = sinks; s != NULL; s = s->next)
+    {
+        fprintf(stderr,
+                "%s: %lu sentences in %lu %s, %lu syscalls (%.3f per sentence), added latency avg %.1f ms, max %.1f ms\n",
+                s->name, s->sentences, s->datagrams, s->type == SINK_UDP ? "datagrams" : "writes", s->syscalls,
+                s->sentences ? (double)s->syscalls / s->sentences : 0.0,
+                s->sentences ? s->latency_sum / s->sentences : 0.0, s->latency_max);
+        fprintf(stderr, "%s: queued %u, dropped %lu, filtered %lu, errors %lu\n",
+                s->name, s->queue.count + s->urgent.count, s->dropped + s->queue.overwritten + s->urgent.overwritten,
+                s->filtered, s->errors);
+        if (s->spool)
+            fprintf(stderr, "%s: spool %llu bytes on disk, spooled %llu, replayed %llu, dropped %llu bytes, %lu syncs\n",
+                    s->name, s->spool->disk_bytes + s->spool->wlen, s->spool->spooled, s->spool->replayed,
+                    s->spool->dropped, s->spool->syncs);
+        if (s->archive)
+            fprintf(stderr, "%s: %llu records, %llu bytes in %lu segments\n",
+                    s->name, s->archive->records, s->archive->bytes, s->archive->segments);
+        if (s->columnar)
+            fprintf(stderr, "%s: %llu rows, %llu bytes in %lu row groups, %u rows not written yet\n",
+                    s->name, s->columnar->written, s->columnar->bytes, s->columnar->groups, s->columnar->nrows);
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+// Copy the counters to the shared statistics page every interval. The
+// decoder threads only update their own metrics blocks, this thread
+// does all the copying.
+static void *stats_thread_fn(void *arg)
+{
+    struct stats_shm st;
+    struct timespec ts;
+    struct sink *s;
+    unsigned int n;
+    int i;
+    (void)arg;
+
+    memset(&st, 0, sizeof(st));
+    while (stats_active)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            st.frames_ok[i] = METRIC_GET(metrics_demod.frames_ok[i]);
+            st.frames_crc[i] = METRIC_GET(metrics_demod.frames_crc[i]);
+            st.frames_size[i] = METRIC_GET(metrics_demod.frames_size[i]);
+            st.level[i] = METRIC_GET(metrics_demod.level[i]);
+        }
+        for (i = 0; i < STATS_SHM_TYPES && i <= METRICS_MAX_TYPE; i++)
+            st.types[i] = METRIC_GET(metrics_demod.types[i]);
+        for (i = 0; i < STATS_SHM_STAGES && i < METRICS_STAGES; i++)
+            st.dsp_ns[i] = METRIC_GET(metrics_demod.stage_ns[i]);
+        st.dsp_blocks = METRIC_GET(metrics_demod.blocks);
+        st.usb_buffers = METRIC_GET(metrics_usb.buffers);
+        st.usb_bytes = METRIC_GET(metrics_usb.bytes);
+        st.usb_overruns = METRIC_GET(metrics_usb.overruns);
+        if (_thinning)
+        {
+            st.thinned = METRIC_GET(thinning.thinned);
+            st.thinned_bytes = METRIC_GET(thinning.thinned_bytes);
+        }
+
+        pthread_mutex_lock(&sink_lock);
+        for (s = sinks, n = 0; s != NULL && n < STATS_SHM_SINKS; s = s->next, n++)
+        {
+            snprintf(st.sink[n].name, STATS_SHM_NAME, "%s", s->name);
+            st.sink[n].sentences = s->sentences;
+            st.sink[n].dropped = s->dropped + s->queue.overwritten;
+            st.sink[n].errors = s->errors;
+            st.sink[n].queued = s->queue.count;
+        }
+        pthread_mutex_unlock(&sink_lock);
+        st.nsinks = n;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        st.updated = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+        st.started = stats_page->started;
+        stats_shm_write(stats_page, &st);
+        usleep(stats_page->interval_ms * 1000);
+    }
+    return NULL;
+}
+
+// Output and thinning metrics, for the /metrics endpoint.
+static void sink_metrics(struct metrics_out *out)
 {
-    _debug_nmea = debug_nmea;
-    _debug = debug;
-    _use_tcp = use_tcp_listener;
+    struct sink *s;
+
+    pthread_mutex_lock(&sink_lock);
+    metrics_family(out, "rtl_ais_output_sentences_total", "counter", "Sentences sent by each output.");
+    for (s = sinks; s != NULL; s = s->next)
+        metrics_printf(out, "rtl_ais_output_sentences_total{output=\"%s\"} %lu\n", s->name, s->sentences);
+    metrics_family(out, "rtl_ais_output_queued", "gauge", "Messages waiting in the queue of each output.");
+    for (s = sinks; s != NULL; s = s->next)
+        metrics_printf(out, "rtl_ais_output_queued{output=\"%s\"} %u\n", s->name, s->queue.count + s->urgent.count);
+    metrics_family(out, "rtl_ais_output_dropped_total", "counter", "Messages dropped because the queue of an output was full.");
+    for (s = sinks; s != NULL; s = s->next)
+        metrics_printf(out, "rtl_ais_output_dropped_total{output=\"%s\"} %lu\n", s->name, s->dropped + s->queue.overwritten + s->urgent.overwritten);
+    metrics_family(out, "rtl_ais_output_errors_total", "counter", "Send errors of each output.");
+    for (s = sinks; s != NULL; s = s->next)
+        metrics_printf(out, "rtl_ais_output_errors_total{output=\"%s\"} %lu\n", s->name, s->errors);
+    pthread_mutex_unlock(&sink_lock);
+}
+
+static void thinning_metrics(struct metrics_out *out)
+{
+    // Only changed by the decoder thread, read without a lock.
+    metrics_family(out, "rtl_ais_thinned_total", "counter", "Reports dropped by thinning.");
+    metrics_printf(out, "rtl_ais_thinned_total %lu\n", METRIC_GET(thinning.thinned));
+    metrics_family(out, "rtl_ais_thinned_bytes_total", "counter", "Bytes saved by thinning.");
+    metrics_printf(out, "rtl_ais_thinned_bytes_total %lu\n", METRIC_GET(thinning.thinned_bytes));
+}
+
+// Without -T and -U, send to -h/-P over UDP as always.
+static char *legacy_output(const char *host, const char *port)
+{
+    char *spec = malloc(strlen(host) + strlen(port) + 8);
+    sprintf(spec, strchr(host, ':') ? "udp:[%s]:%s" : "udp:%s:%s", host, port);
+    return spec;
+}
+
+static int sender_start(void)
+{
+    if (pipe(sender_pipe) < 0)
+    {
+        perror("error allocating pipe");
+        return 0;
+    }
+    fcntl(sender_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(sender_pipe[1], F_SETFL, O_NONBLOCK);
+    sender_active = 1;
+    pthread_create(&sender_thread, NULL, sender_thread_fn, NULL);
+    metrics_add_collector(sink_metrics);
+    return 1;
+}
+
+int init_ais_decoder(struct rtl_ais_config *config, int buf_len)
+{
+    struct sink *s, **tail = &sinks;
+    char *host = config->host, *port = config->port;
+    char *legacy = NULL, **outputs = config->sinks;
+    int noutputs = config->nsinks;
+    int udp_mtu = config->udp_mtu, udp_max_latency = config->udp_max_latency;
+    int i;
+    _debug_nmea = config->debug_nmea;
+    _debug = config->debug;
+    _use_tcp = config->use_tcp_listener;
+    if (config->tag_block)
+        _tag_block = strcmp(config->tag_block, "ms") == 0 ? AIS_TAG_BLOCK_MS : AIS_TAG_BLOCK_S;
     pthread_mutex_init(&message_mutex, NULL);
+    pthread_mutex_init(&sink_lock, NULL);
     if (_debug)
         fprintf(stderr, "Log to console ON\n");
     if (_debug_nmea)
         fprintf(stderr, "Log NMEA sentences to console ON\n");
     else
         fprintf(stderr, "Log NMEA sentences to console OFF\n");
-    if (!_use_tcp)
+
+    if (config->thin_spec)
+    {
+        if (!thinning_init(&thinning, config->thin_spec, now_ms()))
+        {
+            fprintf(stderr, "Invalid thinning spec '%s'\n", config->thin_spec);
+            return EXIT_FAILURE;
+        }
+        _thinning = 1;
+        metrics_add_collector(thinning_metrics);
+        fprintf(stderr, "Thinning repeated reports ON, always forward after %.0f m or %u degrees\n",
+                thinning.min_dist, thinning.min_cog / 10);
+    }
+    if (config->coverage_spec)
+    {
+        if (!coverage_start(config->coverage_spec))
+        {
+            fprintf(stderr, "Invalid coverage spec '%s'\n", config->coverage_spec);
+            return EXIT_FAILURE;
+        }
+        _coverage = 1;
+    }
+    if (udp_mtu < 0)
+    {
+        fprintf(stderr, "Invalid UDP mtu %d\n", udp_mtu);
+        return EXIT_FAILURE;
+    }
+    if (udp_mtu > SINK_MAX_MTU)
+        udp_mtu = SINK_MAX_MTU;
+    if (udp_max_latency < 0)
+        udp_max_latency = SINK_DEFAULT_LATENCY;
+    if (!_use_tcp && noutputs == 0 && host && port)
     {
         fprintf(stderr, "Send NMEA sentences to UDP ON\n");
-        if (host && port && !initSocket(host, port))
+        legacy = legacy_output(host, port);
+        outputs = &legacy;
+        noutputs = 1;
+    }
+    for (i = 0; i < noutputs; i++)
+    {
+        s = sink_create(outputs[i], udp_mtu, udp_max_latency);
+        if (!s || !sink_open(s))
         {
-            fprintf(stderr, "Error to InitSocketto %s port %s\n", host, port);
+            fprintf(stderr, "Error to InitSocketto %s\n", outputs[i]);
+            free(legacy);
             return EXIT_FAILURE;
         }
+        *tail = s;
+        tail = &s->next;
+        nsinks++;
     }
-    else
+    free(legacy);
+    if (nsinks > 0 && !sender_start())
+        return EXIT_FAILURE;
+
+    if (_use_tcp)
     {
         fprintf(stderr, "Send NMEA sentences to TCP ON\n");
-        if (!initTcpSocket(port, debug, tcp_keep_ais_time, tcp_stream_forever))
+        if (!initTcpSocket(port, _debug, config->tcp_keep_ais_time, config->tcp_stream_forever, config->tcp_queue_kb, config->tcp_overflow,
+                           config->tcp_subscribe, config->tcp_snapshot_age, config->tcp_zport, config->tcp_zflush_ms, config->tcp_http_port))
         {
             fprintf(stderr, "Error to initTcpSocket %s port %s\n", host, port);
             return EXIT_FAILURE;
         }
     }
-    if (show_levels)
+    if (config->stats_shm)
+    {
+        stats_page = stats_shm_create(config->stats_shm, config->stats_shm_ms > 0 ? config->stats_shm_ms : STATS_SHM_DEFAULT_MS);
+        if (!stats_page)
+            return EXIT_FAILURE;
+        fprintf(stderr, "Statistics in shared memory %s, updated every %u ms\n", config->stats_shm, stats_page->interval_ms);
+        stats_active = 1;
+        pthread_create(&stats_thread, NULL, stats_thread_fn, NULL);
+    }
+    if (config->show_levels)
         on_sound_level_changed = sound_level_changed;
     on_nmea_sentence_received = nmea_sentence_received;
-    initSoundDecoder(buf_len, time_print_stats, add_sample_num, mmsi);
+    on_decoder_print_stats = print_stats;
+    initSoundDecoder(buf_len, config->seconds_for_decoder_stats, config->add_sample_num, config->mmsi);
     return 0;
 }
 
+// Change the outputs and the decoder settings that need no restart,
+// while the decoder keeps running. Returns 0 if everything was applied.
+int reload_ais_decoder(struct rtl_ais_config *config)
+{
+    struct sink_reload r;
+    char *legacy = NULL, **outputs = config->sinks;
+    int noutputs = config->nsinks;
+    int udp_mtu = config->udp_mtu, udp_max_latency = config->udp_max_latency;
+
+    if (udp_mtu < 0)
+    {
+        fprintf(stderr, "Reload: invalid UDP mtu %d, outputs not changed\n", udp_mtu);
+        return EXIT_FAILURE;
+    }
+    if (udp_mtu > SINK_MAX_MTU)
+        udp_mtu = SINK_MAX_MTU;
+    if (udp_max_latency < 0)
+        udp_max_latency = SINK_DEFAULT_LATENCY;
+    if (!_use_tcp && noutputs == 0 && config->host && config->port)
+    {
+        legacy = legacy_output(config->host, config->port);
+        outputs = &legacy;
+        noutputs = 1;
+    }
+    if (!sender_active && noutputs > 0 && !sender_start())
+    {
+        free(legacy);
+        return EXIT_FAILURE;
+    }
+    memset(&r, 0, sizeof(r));
+    r.outputs = outputs;
+    r.noutputs = noutputs;
+    r.udp_mtu = udp_mtu;
+    r.udp_max_latency = udp_max_latency;
+    if (sender_active)
+    {
+        pthread_mutex_lock(&sink_lock);
+        sink_reload_pending = &r;
+        sender_wakeup = 1;
+        if (write(sender_pipe[1], "", 1) < 0 && _debug)
+            perror("sender pipe");
+        while (!r.done)
+            pthread_cond_wait(&sink_reload_cond, &sink_lock);
+        pthread_mutex_unlock(&sink_lock);
+    }
+    else
+        r.ok = 1;
+    free(legacy);
+
+    reloadSoundDecoder(config->seconds_for_decoder_stats, config->mmsi);
+    if (_use_tcp)
+        setTcpKeepTime(config->tcp_keep_ais_time);
+    if (stats_page)
+        stats_page->interval_ms = config->stats_shm_ms > 0 ? config->stats_shm_ms : STATS_SHM_DEFAULT_MS;
+    return r.ok ? 0 : EXIT_FAILURE;
+}
+
 void run_rtlais_decoder(short *buff, int len)
 {
     run_mem_decoder(buff, len, MAX_BUFFER_LENGTH);
 }
+
+// Channels left idle by the squelch (-q) only count their samples.
+void squelch_rtlais_decoder(int open_a, int open_b)
+{
+    squelchSoundDecoder(open_a, open_b);
+}
+
+// The next block's first sample was captured at first_ms on the
+// monotonic clock, and each sample_ms after the one before.
+void stamp_rtlais_decoder(double first_ms, double sample_ms)
+{
+    stampSoundDecoder(first_ms, sample_ms);
+}
 int free_ais_decoder(void)
 {
+    struct sink *s;
     pthread_mutex_destroy(&message_mutex);
 
+    if (stats_active)
+    {
+        stats_active = 0;
+        pthread_join(stats_thread, NULL);
+        stats_shm_close(stats_page);
+        stats_page = NULL;
+    }
+
+    if (sender_active)
+    {
+        // Let the sender thread finish what is already queued.
+        sender_active = 0;
+        if (write(sender_pipe[1], "", 1) < 0 && _debug)
+            perror("sender pipe");
+        pthread_join(sender_thread, NULL);
+        for (s = sinks; s != NULL; s = s->next)
+            sink_drain(s);
+        close(sender_pipe[0]);
+        close(sender_pipe[1]);
+    }
+    while (sinks)
+    {
+        s = sinks;
+        sinks = s->next;
+        sink_free(s);
+    }
+    nsinks = 0;
+    if (_thinning)
+    {
+        thinning_free(&thinning);
+        _thinning = 0;
+    }
+    if (_coverage)
+    {
+        coverage_stop();
+        _coverage = 0;
+    }
+
     // free all stored messa ages
     free_message(last_message);
     last_message = NULL;
@@ -220,31 +1749,5 @@ int free_ais_decoder(void)
     }
 
     freeSoundDecoder();
-    freeaddrinfo(addr);
     return 0;
 }
-
-int initSocket(const char *host, const char *portname)
-{
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_protocol = IPPROTO_UDP;
-    int err = getaddrinfo(host, portname, &hints, &addr);
-    if (err != 0)
-    {
-        fprintf(stderr, "Failed to resolve remote socket address!\n");
-        return 0;
-    }
-    sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-    if (sock == -1)
-    {
-        fprintf(stderr, "%s", strerror(errno));
-        return 0;
-    }
-     if (_debug_nmea)
-        fprintf(stderr, "AIS data will be sent to %s port %s\n", host, portname);
-
-    return 1;
-}
@@ -1,7 +1,11 @@
 #ifndef __AIS_RL_AIS_INC_
 #define  __AIS_RL_AIS_INC_
-int init_ais_decoder(char * host, char * port,int show_levels,int _debug_nmea,int buf_len,int time_print_stats, int use_tcp_listener, int tcp_keep_ais_time, int tcp_stream_forever, int add_sample_num,unsigned long mmsi,int debug);
+struct rtl_ais_config;
+int init_ais_decoder(struct rtl_ais_config *config, int buf_len);
+int reload_ais_decoder(struct rtl_ais_config *config);
 void run_rtlais_decoder(short * buff, int len);
+void squelch_rtlais_decoder(int open_a, int open_b);
+void stamp_rtlais_decoder(double first_ms, double sample_ms);
 const char *aisdecoder_next_message();
 int free_ais_decoder(void);
 #endif
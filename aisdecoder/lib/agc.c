@@ -0,0 +1,176 @@
+/*
+ *	agc.c
+ *
+ *	Closed loop gain control for the tuner, from the 8 bit samples
+ *	the dongle delivers. The tuner's own AGC reacts to total power
+ *	in the band and a fixed -g is tuned by hand per site; this loop
+ *	looks at what matters for decoding instead: clipping of the ADC,
+ *	which garbles every frame while it lasts, and the noise floor,
+ *	which should be a few counts so weak frames are not lost in the
+ *	quantisation.
+ *
+ *	Every buffer is measured, once per AGC_WINDOW_MS of samples the
+ *	gain is stepped by one entry of the tuner's gain table: down on
+ *	clipping or a noise floor above the range, up when the floor is
+ *	below it and nothing clipped for the hold time. The range and the
+ *	hold time are the hysteresis that keeps the gain from hunting.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "agc.h"
+
+/*
+ *	Parse the -G spec, items separated by ';':
+ *	  100          step down above 100 clipped samples per million
+ *	  floor=lo-hi  keep the noise floor RMS in this range, ADC counts
+ *	  hold=s       seconds without clipping before stepping up
+ *	Returns 1 if ok, 0 if the spec is invalid.
+ */
+int agc_parse(struct agc *a, const char *spec)
+{
+	char item[256], *value, *end;
+	const char *p = spec, *next;
+	double lo, hi;
+	long v;
+	int len;
+
+	memset(a, 0, sizeof(*a));
+	a->clip_ppm = -1;
+	a->floor_lo = AGC_DEFAULT_FLOOR_LO;
+	a->floor_hi = AGC_DEFAULT_FLOOR_HI;
+	a->hold = AGC_DEFAULT_HOLD;
+	while (*p) {
+		next = strchr(p, ';');
+		len = next ? next - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			return 0;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = next ? next + 1 : p + len;
+		if (len == 0)
+			continue;
+
+		value = strchr(item, '=');
+		if (value)
+			*value++ = 0;
+		if (value && strcmp(item, "floor") == 0) {
+			if (sscanf(value, "%lf-%lf", &lo, &hi) != 2 || lo <= 0 || hi <= lo * 2 || hi > 100)
+				return 0;
+			a->floor_lo = lo * 10;
+			a->floor_hi = hi * 10;
+			continue;
+		}
+		v = strtol(value ? value : item, &end, 10);
+		if (*end || end == (value ? value : item))
+			return 0;
+		if (!value && v > 0 && v <= 1000000)
+			a->clip_ppm = v;
+		else if (value && strcmp(item, "hold") == 0 && v >= 1 && v <= 3600)
+			a->hold = v;
+		else
+			return 0;
+	}
+	return a->clip_ppm > 0;
+}
+
+/*
+ *	Start at the gain in the table nearest to gain (tenths of dB), rate
+ *	samples per second. Returns 1 if ok, 0 if out of memory.
+ */
+int agc_start(struct agc *a, const int *gains, int ngains, int gain, int rate)
+{
+	int i;
+
+	a->gains = malloc(ngains * sizeof(int));
+	if (!a->gains)
+		return 0;
+	memcpy(a->gains, gains, ngains * sizeof(int));
+	a->ngains = ngains;
+	a->index = 0;
+	for (i = 1; i < ngains; i++)
+		if (abs(gains[i] - gain) < abs(gains[a->index] - gain))
+			a->index = i;
+	/* I and Q both count */
+	a->window = (unsigned long long)rate * 2 * AGC_WINDOW_MS / 1000;
+	a->floor = -1;
+	return 1;
+}
+
+void agc_free(struct agc *a)
+{
+	free(a->gains);
+	a->gains = NULL;
+}
+
+/* One window is complete: the index of the gain for the next one */
+static int decide(struct agc *a)
+{
+	int index = a->index;
+
+	a->last_clip_ppm = a->clipped * 1000000 / a->samples;
+	a->last_floor = a->floor * 10;
+	if (a->last_clip_ppm > a->clip_ppm) {
+		a->quiet = 0;
+		return index - 1;
+	}
+	/* a little clipping is not yet a reason to step down, but to wait */
+	if (a->last_clip_ppm > a->clip_ppm / 4)
+		a->quiet = 0;
+	else
+		a->quiet++;
+	if (a->last_floor > a->floor_hi)
+		return index - 1;
+	if (a->last_floor < a->floor_lo && a->quiet >= a->hold) {
+		/* the next step up may follow after one window */
+		a->quiet = a->hold - 1;
+		return index + 1;
+	}
+	return index;
+}
+
+/*
+ *	Measure a buffer of I/Q samples as delivered by the dongle, minus
+ *	127. Returns the gain to set now (tenths of dB), or -1 to keep it.
+ */
+int agc_measure(struct agc *a, const int16_t *buf, int len)
+{
+	unsigned long long sum = 0;
+	unsigned int clipped = 0;
+	double rms;
+	int i, index;
+
+	for (i = 0; i < len; i++) {
+		sum += buf[i] * buf[i];
+		clipped += buf[i] <= -127 || buf[i] >= 128;
+	}
+	rms = sqrt((double)sum / len);
+	if (a->floor < 0 || rms < a->floor)
+		a->floor = rms;
+	a->samples += len;
+	a->clipped += clipped;
+	if (a->samples < a->window)
+		return -1;
+
+	index = decide(a);
+	a->samples = a->clipped = 0;
+	a->floor = -1;
+	if (index < 0 || index >= a->ngains || index == a->index)
+		return -1;
+	a->index = index;
+	a->steps++;
+	return a->gains[index];
+}
@@ -0,0 +1,59 @@
+/*
+ *	agc.h
+ *
+ *	Gain control from the raw dongle samples: keep the ADC out of
+ *	clipping with the noise floor in a useful range.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_AGC_H
+#define INC_AGC_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define AGC_WINDOW_MS 1000		/* decisions are taken this often */
+#define AGC_DEFAULT_FLOOR_LO 30		/* noise floor, RMS in 1/10 ADC counts */
+#define AGC_DEFAULT_FLOOR_HI 120
+#define AGC_DEFAULT_HOLD 10		/* seconds without clipping before stepping up */
+
+struct agc {
+	/* settings */
+	int clip_ppm;			/* step down above this many clipped samples per million */
+	int floor_lo, floor_hi;		/* step up below, down above, RMS in 1/10 counts */
+	int hold;
+
+	/* the tuner gains, tenths of dB, ascending */
+	int *gains, ngains, index;
+
+	/* the window being measured */
+	unsigned long long samples, clipped;
+	double floor;			/* RMS of the quietest buffer */
+	unsigned long long window;	/* samples per window */
+	int quiet;			/* windows since the last clipping */
+
+	/* of the last window, for the log */
+	int last_clip_ppm, last_floor;
+	unsigned long steps;
+};
+
+extern int agc_parse(struct agc *a, const char *spec);
+extern int agc_start(struct agc *a, const int *gains, int ngains, int gain, int rate);
+extern void agc_free(struct agc *a);
+extern int agc_measure(struct agc *a, const int16_t *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,321 @@
+/*
+ *	aismsg.c
+ *
+ *	Decoded header fields of an AIS message, and filters on them.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "aismsg.h"
+
+/*
+ *	Unsigned field of size bits at from, bits holds one bit per byte.
+ *	Bits past the end of the message read as 0.
+ */
+static unsigned long get_bits(const unsigned char *bits, int nbits, int from, int size)
+{
+	unsigned long v = 0;
+	int i;
+
+	for (i = from; i < from + size; i++)
+		v = (v << 1) | (i < nbits ? bits[i] : 0);
+	return v;
+}
+
+/*
+ *	Two's complement field
+ */
+static long get_signed(const unsigned char *bits, int nbits, int from, int size)
+{
+	unsigned long v = get_bits(bits, nbits, from, size);
+
+	if (v & (1UL << (size - 1)))
+		return (long)v - (1L << size);
+	return v;
+}
+
+/*
+ *	Text field of len six bit characters, trailing '@' and spaces
+ *	removed. s must have room for len + 1 characters.
+ */
+static void get_text(char *s, const unsigned char *bits, int nbits, int from, int len)
+{
+	static const char sixbit[] = "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_ !\"#$%&'()*+,-./0123456789:;<=>?";
+	int i;
+
+	for (i = 0; i < len; i++)
+		s[i] = sixbit[get_bits(bits, nbits, from + 6 * i, 6)];
+	while (i > 0 && (s[i - 1] == '@' || s[i - 1] == ' '))
+		i--;
+	s[i] = 0;
+}
+
+/*
+ *	lon and lat of size lonbits and lonbits - 1, scale is the factor
+ *	from the field unit to 1/10000 minute
+ */
+static void get_position(struct ais_msg *m, const unsigned char *bits, int nbits, int from, int lonbits, long scale)
+{
+	m->lon = get_signed(bits, nbits, from, lonbits) * scale;
+	m->lat = get_signed(bits, nbits, from + lonbits, lonbits - 1) * scale;
+	m->has_pos = m->lon >= -180 * 600000L && m->lon <= 180 * 600000L
+		&& m->lat >= -90 * 600000L && m->lat <= 90 * 600000L;
+}
+
+/* A 10 bit speed field, 1023 is not available */
+static unsigned short get_sog(const unsigned char *bits, int nbits, int from, int scale)
+{
+	unsigned short sog = get_bits(bits, nbits, from, 10);
+
+	return sog == 1023 ? AIS_SOG_NA : sog * scale;
+}
+
+void ais_msg_decode(struct ais_msg *m, const unsigned char *bits, int nbits, char chanid)
+{
+	memset(m, 0, sizeof(*m));
+	m->type = get_bits(bits, nbits, 0, 6);
+	m->repeat = get_bits(bits, nbits, 6, 2);
+	m->mmsi = get_bits(bits, nbits, 8, 30);
+	m->chanid = chanid;
+	m->sog = AIS_SOG_NA;
+	m->cog = AIS_COG_NA;
+	m->heading = AIS_HEADING_NA;
+	m->navstatus = AIS_NAVSTATUS_NA;
+
+	switch (m->type) {
+	case 1:		/* class A position report */
+	case 2:
+	case 3:
+		m->navstatus = get_bits(bits, nbits, 38, 4);
+		m->sog = get_sog(bits, nbits, 50, 1);
+		get_position(m, bits, nbits, 61, 28, 1);
+		m->cog = get_bits(bits, nbits, 116, 12);
+		m->heading = get_bits(bits, nbits, 128, 9);
+		break;
+	case 4:		/* base station report */
+	case 11:
+		get_position(m, bits, nbits, 79, 28, 1);
+		break;
+	case 5:		/* static and voyage data */
+		get_text(m->callsign, bits, nbits, 70, 7);
+		get_text(m->name, bits, nbits, 112, 20);
+		m->shiptype = get_bits(bits, nbits, 232, 8);
+		get_text(m->destination, bits, nbits, 302, 20);
+		break;
+	case 9:		/* SAR aircraft */
+		m->sog = get_sog(bits, nbits, 50, 10);	/* whole knots */
+		get_position(m, bits, nbits, 61, 28, 1);
+		m->cog = get_bits(bits, nbits, 116, 12);
+		break;
+	case 18:	/* class B position report */
+	case 19:
+		m->sog = get_sog(bits, nbits, 46, 1);
+		get_position(m, bits, nbits, 57, 28, 1);
+		m->cog = get_bits(bits, nbits, 112, 12);
+		m->heading = get_bits(bits, nbits, 124, 9);
+		if (m->type == 19) {
+			get_text(m->name, bits, nbits, 143, 20);
+			m->shiptype = get_bits(bits, nbits, 263, 8);
+		}
+		break;
+	case 21:	/* aid to navigation */
+		get_position(m, bits, nbits, 164, 28, 1);
+		break;
+	case 24:	/* class B static data, in two parts */
+		m->part = get_bits(bits, nbits, 38, 2);
+		if (m->part == 0) {
+			get_text(m->name, bits, nbits, 40, 20);
+		} else if (m->part == 1) {
+			m->shiptype = get_bits(bits, nbits, 40, 8);
+			get_text(m->callsign, bits, nbits, 90, 7);
+		}
+		break;
+	case 27:	/* long range broadcast, 1/10 minute and whole knots/degrees */
+		m->navstatus = get_bits(bits, nbits, 40, 4);
+		get_position(m, bits, nbits, 44, 18, 1000);
+		m->sog = get_bits(bits, nbits, 79, 6);
+		m->sog = m->sog == 63 ? AIS_SOG_NA : m->sog * 10;
+		m->cog = get_bits(bits, nbits, 85, 9);
+		m->cog = m->cog == 511 ? AIS_COG_NA : m->cog * 10;
+		break;
+	}
+}
+
+/*
+ *	Safety related traffic that must not wait behind position reports:
+ *	addressed binary and safety messages (6, 12), SAR aircraft (9),
+ *	safety broadcasts (14), and anything from an AIS-SART (970xxxxxx),
+ *	MOB (972xxxxxx) or EPIRB-AIS (974xxxxxx) device.
+ */
+int ais_msg_is_priority(const struct ais_msg *m)
+{
+	unsigned long prefix = m->mmsi / 1000000;
+
+	return m->type == 6 || m->type == 9 || m->type == 12 || m->type == 14
+		|| prefix == 970 || prefix == 972 || prefix == 974;
+}
+
+void ais_filter_clear(struct ais_filter *f)
+{
+	memset(f, 0, sizeof(*f));
+}
+
+/*
+ *	Set one filter item from a key=value pair:
+ *	  types=1-3,5,18   message types, single or ranges
+ *	  mmsi=123456789,987654321
+ *	  bbox=lat1,lon1,lat2,lon2  decimal degrees, corners of the box;
+ *	                   a box with lon1 > lon2 crosses 180 degrees
+ *	  channel=A        A or B
+ *	Returns 1 if done, 0 if the key is not a filter key, -1 if the
+ *	value is invalid.
+ */
+int ais_filter_set(struct ais_filter *f, const char *key, const char *value)
+{
+	const char *p = value;
+	char *end;
+
+	if (strcmp(key, "types") == 0) {
+		f->types = 0;
+		while (*p) {
+			long lo = strtol(p, &end, 10), hi = lo;
+			if (end == p)
+				return -1;
+			p = end;
+			if (*p == '-') {
+				hi = strtol(p + 1, &end, 10);
+				if (end == p + 1)
+					return -1;
+				p = end;
+			}
+			if (lo < 1 || hi > 31 || lo > hi)
+				return -1;
+			for (; lo <= hi; lo++)
+				f->types |= 1u << lo;
+			if (*p == ',')
+				p++;
+			else if (*p)
+				return -1;
+		}
+		return 1;
+	}
+	if (strcmp(key, "mmsi") == 0) {
+		f->nmmsi = 0;
+		while (*p) {
+			unsigned long mmsi = strtoul(p, &end, 10);
+			if (end == p || f->nmmsi == AIS_FILTER_MAX_MMSI)
+				return -1;
+			f->mmsi[f->nmmsi++] = mmsi;
+			p = end;
+			if (*p == ',')
+				p++;
+			else if (*p)
+				return -1;
+		}
+		return 1;
+	}
+	if (strcmp(key, "bbox") == 0) {
+		double lat1, lon1, lat2, lon2;
+		char c;
+		if (sscanf(value, "%lf,%lf,%lf,%lf%c", &lat1, &lon1, &lat2, &lon2, &c) != 4)
+			return -1;
+		if (lat1 < -90 || lat1 > 90 || lat2 < -90 || lat2 > 90
+		    || lon1 < -180 || lon1 > 180 || lon2 < -180 || lon2 > 180)
+			return -1;
+		f->has_bbox = 1;
+		f->lat_min = (lat1 < lat2 ? lat1 : lat2) * 600000;
+		f->lat_max = (lat1 < lat2 ? lat2 : lat1) * 600000;
+		f->lon_min = lon1 * 600000;
+		f->lon_max = lon2 * 600000;
+		return 1;
+	}
+	if (strcmp(key, "channel") == 0) {
+		if (strcmp(value, "A") == 0 || strcmp(value, "B") == 0)
+			f->chanid = value[0];
+		else if (strcmp(value, "AB") == 0 || strcmp(value, "*") == 0)
+			f->chanid = 0;
+		else
+			return -1;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ *	Apply a list of key=value items separated by ';' to a filter.
+ *	Returns 1 if all were filter items, or -1 with the failing item
+ *	copied to bad (up to badlen bytes).
+ */
+int ais_filter_parse(struct ais_filter *f, const char *spec, char *bad, int badlen)
+{
+	char item[256], *value;
+	const char *p = spec, *end;
+	int len;
+
+	while (*p) {
+		end = strchr(p, ';');
+		len = end ? end - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			len = sizeof(item) - 1;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = end ? end + 1 : p + strlen(p);
+		if (len == 0)
+			continue;
+		value = strchr(item, '=');
+		if (value)
+			*value++ = 0;
+		if (!value || ais_filter_set(f, item, value) != 1) {
+			if (bad)
+				snprintf(bad, badlen, "%s", item);
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int ais_filter_is_empty(const struct ais_filter *f)
+{
+	return !f->types && !f->nmmsi && !f->chanid && !f->has_bbox;
+}
+
+int ais_filter_match(const struct ais_filter *f, const struct ais_msg *m)
+{
+	int i;
+
+	if (f->types && !(f->types & (1u << m->type)))
+		return 0;
+	if (f->nmmsi) {
+		for (i = 0; i < f->nmmsi; i++)
+			if (f->mmsi[i] == m->mmsi)
+				break;
+		if (i == f->nmmsi)
+			return 0;
+	}
+	if (f->chanid && f->chanid != m->chanid)
+		return 0;
+	if (f->has_bbox) {
+		/* messages without a position are outside every box */
+		if (!m->has_pos || m->lat < f->lat_min || m->lat > f->lat_max)
+			return 0;
+		if (f->lon_min <= f->lon_max) {
+			if (m->lon < f->lon_min || m->lon > f->lon_max)
+				return 0;
+		} else if (m->lon < f->lon_min && m->lon > f->lon_max) {
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,80 @@
+/*
+ *	aismsg.h
+ *
+ *	Decoded header fields of an AIS message, and filters on them.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_AISMSG_H
+#define INC_AISMSG_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Positions are kept in the units of the message, 1/10000 minute,
+ *	so no floating point is needed to decode or filter them.
+ */
+#define AIS_LON_NA (181 * 600000L)
+#define AIS_LAT_NA (91 * 600000L)
+#define AIS_SOG_NA 0xFFFF	/* above any speed, type 9 reaches 10220 */
+#define AIS_COG_NA 3600
+#define AIS_HEADING_NA 511
+#define AIS_NAVSTATUS_NA 15
+
+struct ais_msg {
+	unsigned char type;
+	unsigned char repeat;
+	unsigned long mmsi;
+	char chanid;
+	int has_pos;			/* lat and lon are valid */
+	long lat, lon;			/* 1/10000 minute, north and east positive */
+	unsigned short sog;		/* 1/10 knot */
+	unsigned short cog;		/* 1/10 degree */
+	unsigned short heading;		/* degrees */
+	unsigned char navstatus;
+	unsigned char part;		/* type 24: 0 part A, 1 part B */
+	/* static data, types 5, 19 and 24, empty if not in the message */
+	char name[21];
+	char callsign[8];
+	char destination[21];
+	unsigned char shiptype;
+	unsigned char priority;		/* set by the decoder, see ais_msg_is_priority() */
+	double capture_ms;		/* set by the decoder: the frame start, ms on the
+					   monotonic clock, 0 if unknown */
+};
+
+#define AIS_FILTER_MAX_MMSI 64
+
+/* An empty filter (all zero) matches every message */
+struct ais_filter {
+	unsigned int types;		/* bit n set: accept type n, 0: any type */
+	int nmmsi;
+	unsigned long mmsi[AIS_FILTER_MAX_MMSI];
+	char chanid;			/* 'A' or 'B', 0: any channel */
+	int has_bbox;			/* only positions inside the box */
+	long lat_min, lat_max, lon_min, lon_max;
+};
+
+extern void ais_msg_decode(struct ais_msg *m, const unsigned char *bits, int nbits, char chanid);
+extern int ais_msg_is_priority(const struct ais_msg *m);
+
+extern void ais_filter_clear(struct ais_filter *f);
+extern int ais_filter_set(struct ais_filter *f, const char *key, const char *value);
+extern int ais_filter_parse(struct ais_filter *f, const char *spec, char *bad, int badlen);
+extern int ais_filter_is_empty(const struct ais_filter *f);
+extern int ais_filter_match(const struct ais_filter *f, const struct ais_msg *m);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,603 @@
+/*
+ *	archive.c
+ *
+ *	Append-only binary archive of received messages.
+ *
+ *	Messages are kept as their payload bits with the receive time,
+ *	channel and signal level, in one segment file per UTC hour. A
+ *	position report takes 29 bytes instead of 50 as NMEA text, plus 4
+ *	bytes in the index. When a segment is finished the index is
+ *	written next to it, mapping every second to the offset of its
+ *	first record and every MMSI to the offsets of its records. A query
+ *	maps both files and only reads the records the index points to.
+ *
+ *	A segment left without an index, by a crash or because it is
+ *	still being written, can still be read from start to end. The
+ *	writer indexes such segments when it starts.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "archive.h"
+
+#define ARCHIVE_NMEA_CHARS 56	/* payload characters per sentence, as protodec */
+
+/* ------------------------------------------------------------------ */
+/* Records */
+
+static unsigned int get_bits(const struct archive_record *r, unsigned int from, unsigned int n)
+{
+	unsigned int v = 0, i;
+
+	for (i = from; i < from + n; i++) {
+		v <<= 1;
+		if (i < ARCHIVE_MAX_BYTES * 8 && (r->data[i >> 3] & (0x80 >> (i & 7))))
+			v |= 1;
+	}
+	return v;
+}
+
+/*
+ *	Fill r from the sentences of one message. Returns the number of
+ *	bytes of r in use, 0 if the sentences cannot be parsed.
+ */
+unsigned int archive_encode(struct archive_record *r, const char *nmea, unsigned int length,
+			    int64_t time_ms, unsigned int level)
+{
+	const char *p = nmea, *end = nmea + length, *line_end, *q, *f[7];
+	unsigned int nbits = 0, fill = 0, v;
+	int n, b;
+
+	memset(r, 0, sizeof(*r));
+	r->time_ms = time_ms;
+	r->level = level > 100 ? 100 : level;
+	while (p < end) {
+		line_end = memchr(p, '\n', end - p);
+		if (!line_end)
+			line_end = end;
+		/* !AIVDM,count,number,sequence,channel,payload,fill*checksum */
+		n = 0;
+		f[n++] = p;
+		for (q = p; q < line_end && n < 7; q++)
+			if (*q == ',')
+				f[n++] = q + 1;
+		if (n < 7)
+			return 0;
+		if (f[4][0] == 'A' || f[4][0] == 'B')
+			r->channel = f[4][0];
+		for (q = f[5]; *q != ','; q++) {
+			v = (unsigned char)*q - 48;
+			if (v > 40)
+				v -= 8;
+			if (v > 63 || nbits + 6 > ARCHIVE_MAX_BYTES * 8)
+				return 0;
+			for (b = 5; b >= 0; b--, nbits++)
+				if (v & (1 << b))
+					r->data[nbits >> 3] |= 0x80 >> (nbits & 7);
+		}
+		fill = f[6][0] - '0';
+		p = line_end + 1;
+	}
+	if (fill > 5 || fill >= nbits)
+		return 0;
+	nbits -= fill;
+	if (nbits & 7)
+		r->data[nbits >> 3] &= 0xff00 >> (nbits & 7);
+	memset(r->data + (nbits + 7) / 8, 0, ARCHIVE_MAX_BYTES - (nbits + 7) / 8);
+	r->nbits = nbits;
+	return offsetof(struct archive_record, data) + (nbits + 7) / 8;
+}
+
+unsigned long archive_mmsi(const struct archive_record *r)
+{
+	return r->nbits >= 38 ? get_bits(r, 8, 30) : 0;
+}
+
+unsigned int archive_type(const struct archive_record *r)
+{
+	return get_bits(r, 0, 6);
+}
+
+/*
+ *	Write r as NMEA sentences, split as the decoder does. Returns the
+ *	length, -1 if buf is too small.
+ */
+int archive_nmea(const struct archive_record *r, char *buf, unsigned int size, int seqnr)
+{
+	unsigned int nchars = (r->nbits + 5) / 6, fill = nchars * 6 - r->nbits;
+	unsigned int sentences = (nchars + ARCHIVE_NMEA_CHARS - 1) / ARCHIVE_NMEA_CHARS;
+	unsigned int i, k, pos = 0, len = 0, v;
+	unsigned char check;
+	char line[128];
+	int n, m;
+
+	for (i = 1; i <= sentences; i++) {
+		n = sprintf(line, "!AIVDM,%u,%u,", sentences, i);
+		if (sentences > 1)
+			line[n++] = '0' + seqnr % 10;
+		line[n++] = ',';
+		if (r->channel)
+			line[n++] = r->channel;
+		line[n++] = ',';
+		for (k = 0; k < ARCHIVE_NMEA_CHARS && pos < nchars; k++, pos++) {
+			v = get_bits(r, pos * 6, 6);
+			line[n++] = v < 40 ? v + 48 : v + 56;
+		}
+		n += sprintf(line + n, ",%u*", i == sentences ? fill : 0);
+		check = 0;
+		for (m = 1; line[m] != '*'; m++)
+			check ^= line[m];
+		n += sprintf(line + n, "%02X\r\n", check);
+		if (len + n > size)
+			return -1;
+		memcpy(buf + len, line, n);
+		len += n;
+	}
+	return len;
+}
+
+/* ------------------------------------------------------------------ */
+/* Segments and their index */
+
+static void segment_path(const char *dir, int64_t start_ms, const char *ext, char *path, unsigned int size)
+{
+	time_t t = start_ms / 1000;
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	snprintf(path, size, "%s/%04d%02d%02d-%02d.%s", dir, tm.tm_year + 1900, tm.tm_mon + 1,
+		 tm.tm_mday, tm.tm_hour, ext);
+}
+
+/* The index file that belongs to the segment file path */
+static void index_path(const char *path, char *ipath, unsigned int size)
+{
+	unsigned int n = strlen(path);
+
+	snprintf(ipath, size, "%.*s.aisx", n > 5 ? n - 5 : n, path);
+}
+
+static void index_reset(struct archive_index *ix, int64_t start_ms)
+{
+	ix->start_ms = start_ms;
+	ix->size = sizeof(struct archive_header);
+	ix->last_ms = 0;
+	ix->next_second = 0;
+	ix->nentries = 0;
+}
+
+/* Note the record at the end of the segment */
+static int index_add(struct archive_index *ix, uint32_t time_ms, unsigned long mmsi, unsigned int length)
+{
+	struct archive_index_entry *e;
+	int second = time_ms / 1000;
+
+	while (ix->next_second <= second)
+		ix->second_offset[ix->next_second++] = ix->size;
+	if (ix->nentries == ix->alloc) {
+		e = realloc(ix->entry, (ix->alloc ? ix->alloc * 2 : 1024) * sizeof(*e));
+		if (!e)
+			return 0;
+		ix->entry = e;
+		ix->alloc = ix->alloc ? ix->alloc * 2 : 1024;
+	}
+	e = &ix->entry[ix->nentries++];
+	e->mmsi = mmsi;
+	e->offset = ix->size;
+	ix->size += length;
+	ix->last_ms = time_ms;
+	return 1;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct archive_index_entry *x = a, *y = b;
+
+	if (x->mmsi != y->mmsi)
+		return x->mmsi < y->mmsi ? -1 : 1;
+	if (x->offset != y->offset)
+		return x->offset < y->offset ? -1 : 1;
+	return 0;
+}
+
+/* Write the index of a finished segment, via a temporary file */
+static int index_write(struct archive_index *ix, const char *path)
+{
+	struct archive_index_header h;
+	struct archive_index_vessel v;
+	char ipath[1024], tmp[1040];
+	unsigned int i, n;
+	FILE *f;
+	int ok;
+
+	while (ix->next_second <= ARCHIVE_SEGMENT_SEC)
+		ix->second_offset[ix->next_second++] = ix->size;
+	qsort(ix->entry, ix->nentries, sizeof(*ix->entry), compare_entries);
+	for (i = 0, n = 0; i < ix->nentries; i++)
+		if (i == 0 || ix->entry[i].mmsi != ix->entry[i - 1].mmsi)
+			n++;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = ARCHIVE_INDEX_MAGIC;
+	h.version = ARCHIVE_VERSION;
+	h.start_ms = ix->start_ms;
+	h.data_size = ix->size;
+	h.nseconds = ARCHIVE_SEGMENT_SEC;
+	h.nvessels = n;
+	h.nrecords = ix->nentries;
+
+	index_path(path, ipath, sizeof(ipath));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ipath);
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return 0;
+	}
+	ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+	     fwrite(ix->second_offset, sizeof(uint32_t), ARCHIVE_SEGMENT_SEC + 1, f) == ARCHIVE_SEGMENT_SEC + 1;
+	for (i = 0; ok && i < ix->nentries; i += v.count) {
+		v.mmsi = ix->entry[i].mmsi;
+		v.first = i;
+		for (v.count = 1; i + v.count < ix->nentries && ix->entry[i + v.count].mmsi == v.mmsi; v.count++)
+			;
+		ok = fwrite(&v, sizeof(v), 1, f) == 1;
+	}
+	for (i = 0; ok && i < ix->nentries; i++)
+		ok = fwrite(&ix->entry[i].offset, sizeof(uint32_t), 1, f) == 1;
+	if (fclose(f) != 0 || !ok || rename(tmp, ipath) != 0) {
+		perror(ipath);
+		unlink(tmp);
+		return 0;
+	}
+	return 1;
+}
+
+/* Index the records of a mapped segment, up to the first damaged one */
+static int index_scan(struct archive_index *ix, const struct archive_segment *seg)
+{
+	struct archive_record r;
+	size_t offset = sizeof(struct archive_header), next;
+
+	index_reset(ix, seg->start_ms);
+	while ((next = archive_segment_record(seg, offset, &r)) != 0) {
+		if ((uint32_t)(r.time_ms - seg->start_ms) < ix->last_ms)
+			break;
+		if (!index_add(ix, r.time_ms - seg->start_ms, archive_mmsi(&r), next - offset))
+			return 0;
+		offset = next;
+	}
+	return 1;
+}
+
+static const void *map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+	return p;
+}
+
+/*
+ *	Map a segment and its index, if it has a valid one. Returns 1 if
+ *	ok, 0 if the segment cannot be read.
+ */
+int archive_segment_map(struct archive_segment *seg, const char *path)
+{
+	const struct archive_header *h;
+	char ipath[1024];
+
+	memset(seg, 0, sizeof(*seg));
+	seg->data = map_file(path, &seg->size);
+	if (!seg->data)
+		return 0;
+	h = (const struct archive_header *)seg->data;
+	if (seg->size < sizeof(*h) || h->magic != ARCHIVE_MAGIC || h->version != ARCHIVE_VERSION) {
+		archive_segment_unmap(seg);
+		return 0;
+	}
+	seg->start_ms = h->start_ms;
+
+	index_path(path, ipath, sizeof(ipath));
+	seg->index = map_file(ipath, &seg->index_size);
+	if (seg->index) {
+		const struct archive_index_header *x = seg->index;
+		if (seg->index_size < sizeof(*x) || x->magic != ARCHIVE_INDEX_MAGIC ||
+		    x->version != ARCHIVE_VERSION || x->start_ms != seg->start_ms ||
+		    x->nseconds != ARCHIVE_SEGMENT_SEC || x->data_size > seg->size ||
+		    seg->index_size != sizeof(*x) + (x->nseconds + 1) * sizeof(uint32_t) +
+				       (size_t)x->nvessels * sizeof(struct archive_index_vessel) +
+				       (size_t)x->nrecords * sizeof(uint32_t)) {
+			munmap((void *)seg->index, seg->index_size);
+			seg->index = NULL;
+		} else {
+			seg->second_offset = (const uint32_t *)(x + 1);
+			seg->vessel = (const struct archive_index_vessel *)(seg->second_offset + x->nseconds + 1);
+			seg->record_offset = (const uint32_t *)(seg->vessel + x->nvessels);
+		}
+	}
+	return 1;
+}
+
+void archive_segment_unmap(struct archive_segment *seg)
+{
+	if (seg->data)
+		munmap((void *)seg->data, seg->size);
+	if (seg->index)
+		munmap((void *)seg->index, seg->index_size);
+	memset(seg, 0, sizeof(*seg));
+}
+
+/*
+ *	Read the record at offset into r, if r is not NULL. Returns the
+ *	offset of the next record, 0 if there is no valid record.
+ */
+size_t archive_segment_record(const struct archive_segment *seg, size_t offset, struct archive_record *r)
+{
+	struct archive_record_header h;
+	unsigned int nbytes;
+
+	if (offset + sizeof(h) > seg->size)
+		return 0;
+	memcpy(&h, seg->data + offset, sizeof(h));
+	nbytes = (h.nbits + 7) / 8;
+	if (h.nbits == 0 || nbytes > ARCHIVE_MAX_BYTES || h.time_ms >= ARCHIVE_SEGMENT_SEC * 1000u ||
+	    offset + sizeof(h) + nbytes > seg->size)
+		return 0;
+	if (r) {
+		r->time_ms = seg->start_ms + h.time_ms;
+		r->nbits = h.nbits;
+		r->channel = h.channel;
+		r->level = h.level;
+		memcpy(r->data, seg->data + offset + sizeof(h), nbytes);
+		memset(r->data + nbytes, 0, ARCHIVE_MAX_BYTES - nbytes);
+	}
+	return offset + sizeof(h) + nbytes;
+}
+
+/* Write the index of the segment path. Returns 1 if ok, 0 on error. */
+int archive_index_segment(const char *path)
+{
+	struct archive_segment seg;
+	struct archive_index *ix;
+	int ok;
+
+	if (!archive_segment_map(&seg, path))
+		return 0;
+	ix = calloc(1, sizeof(*ix));
+	ok = ix && index_scan(ix, &seg) && index_write(ix, path);
+	if (ix)
+		free(ix->entry);
+	free(ix);
+	archive_segment_unmap(&seg);
+	return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* Writer */
+
+static void write_buffer(struct archive *ar)
+{
+	unsigned int done = 0;
+	ssize_t n;
+
+	while (done < ar->wlen) {
+		n = write(ar->fd, ar->wbuf + done, ar->wlen - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror(ar->dir);
+			ar->errors++;
+			break;
+		}
+		done += n;
+	}
+	ar->wlen = 0;
+}
+
+static void finish_segment(struct archive *ar)
+{
+	char path[1024];
+
+	write_buffer(ar);
+	fdatasync(ar->fd);
+	close(ar->fd);
+	ar->fd = -1;
+	segment_path(ar->dir, ar->index.start_ms, "aisa", path, sizeof(path));
+	if (!index_write(&ar->index, path))
+		ar->errors++;
+}
+
+/*
+ *	Open the segment starting at start_ms for appending. A segment
+ *	of an earlier run in the same hour is continued: its index is
+ *	rebuilt and a damaged record at its end cut off.
+ */
+static int open_segment(struct archive *ar, int64_t start_ms)
+{
+	struct archive_segment seg;
+	struct archive_header h;
+	char path[1024], ipath[1024];
+	struct stat st;
+
+	segment_path(ar->dir, start_ms, "aisa", path, sizeof(path));
+	ar->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (ar->fd < 0) {
+		perror(path);
+		return 0;
+	}
+	index_reset(&ar->index, start_ms);
+	if (fstat(ar->fd, &st) == 0 && st.st_size > 0) {
+		if (!archive_segment_map(&seg, path) || seg.start_ms != start_ms) {
+			fprintf(stderr, "%s: not an archive segment of this hour\n", path);
+			archive_segment_unmap(&seg);
+			close(ar->fd);
+			ar->fd = -1;
+			return 0;
+		}
+		index_scan(&ar->index, &seg);
+		archive_segment_unmap(&seg);
+		if (ftruncate(ar->fd, ar->index.size) < 0)
+			perror(path);
+		index_path(path, ipath, sizeof(ipath));
+		unlink(ipath);
+	} else {
+		memset(&h, 0, sizeof(h));
+		h.magic = ARCHIVE_MAGIC;
+		h.version = ARCHIVE_VERSION;
+		h.start_ms = start_ms;
+		if (write(ar->fd, &h, sizeof(h)) != sizeof(h)) {
+			perror(path);
+			close(ar->fd);
+			ar->fd = -1;
+			return 0;
+		}
+	}
+	ar->segments++;
+	return 1;
+}
+
+/*
+ *	Open the archive in dir, creating the directory if needed, and
+ *	index segments an earlier run left without an index. Returns 1 if
+ *	ok, 0 on error.
+ */
+int archive_open(struct archive *ar, const char *dir)
+{
+	char path[1024], ipath[1024];
+	struct dirent *e;
+	struct stat st;
+	unsigned int n;
+	DIR *d;
+
+	memset(ar, 0, sizeof(*ar));
+	ar->fd = -1;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return 0;
+	}
+	d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return 0;
+	}
+	while ((e = readdir(d)) != NULL) {
+		n = strlen(e->d_name);
+		if (n < 5 || strcmp(e->d_name + n - 5, ".aisa") != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		index_path(path, ipath, sizeof(ipath));
+		if (stat(ipath, &st) < 0 && !archive_index_segment(path))
+			fprintf(stderr, "%s: cannot index\n", path);
+	}
+	closedir(d);
+	ar->dir = strdup(dir);
+	ar->wbuf = malloc(ARCHIVE_WRITE_BUF);
+	if (!ar->dir || !ar->wbuf) {
+		archive_close(ar);
+		return 0;
+	}
+	return 1;
+}
+
+void archive_close(struct archive *ar)
+{
+	if (ar->fd >= 0)
+		finish_segment(ar);
+	free(ar->index.entry);
+	free(ar->wbuf);
+	free(ar->dir);
+	ar->index.entry = NULL;
+	ar->wbuf = NULL;
+	ar->dir = NULL;
+}
+
+/* Append a record. Returns 1, or 0 if it was dropped. */
+int archive_write(struct archive *ar, const struct archive_record *r, double now)
+{
+	const int64_t segment_ms = ARCHIVE_SEGMENT_SEC * 1000LL;
+	struct archive_record_header h;
+	int64_t start = r->time_ms - r->time_ms % segment_ms, t;
+	unsigned int nbytes = (r->nbits + 7) / 8;
+
+	if (r->nbits == 0 || nbytes > ARCHIVE_MAX_BYTES)
+		return 0;
+	if (ar->fd < 0 || start > ar->index.start_ms) {
+		if (ar->fd >= 0)
+			finish_segment(ar);
+		if (!open_segment(ar, start)) {
+			ar->errors++;
+			return 0;
+		}
+	}
+	/* Times within a segment never go back, even if the clock does */
+	t = r->time_ms - ar->index.start_ms;
+	if (t < ar->index.last_ms)
+		t = ar->index.last_ms;
+	h.time_ms = t;
+	h.nbits = r->nbits;
+	h.channel = r->channel;
+	h.level = r->level;
+
+	if (ar->wlen + sizeof(h) + nbytes > ARCHIVE_WRITE_BUF)
+		write_buffer(ar);
+	if (ar->wlen == 0)
+		ar->first_unflushed = now;
+	if (!index_add(&ar->index, h.time_ms, archive_mmsi(r), sizeof(h) + nbytes))
+		return 0;
+	memcpy(ar->wbuf + ar->wlen, &h, sizeof(h));
+	memcpy(ar->wbuf + ar->wlen + sizeof(h), r->data, nbytes);
+	ar->wlen += sizeof(h) + nbytes;
+	ar->records++;
+	ar->bytes += sizeof(h) + nbytes;
+	return 1;
+}
+
+/* Write out records older than ARCHIVE_FLUSH_MS, or all with force */
+void archive_flush(struct archive *ar, double now, int force)
+{
+	if (ar->fd >= 0 && ar->wlen > 0 && (force || now - ar->first_unflushed >= ARCHIVE_FLUSH_MS))
+		write_buffer(ar);
+}
+
+/* Milliseconds until archive_flush has work to do, or -1 if never */
+int archive_flush_timeout(struct archive *ar, double now)
+{
+	double t;
+
+	if (ar->fd < 0 || ar->wlen == 0)
+		return -1;
+	t = ar->first_unflushed + ARCHIVE_FLUSH_MS - now;
+	return t < 0 ? 0 : (int)t + 1;
+}
@@ -0,0 +1,150 @@
+/*
+ *	archive.h
+ *
+ *	Append-only binary archive of received messages, with an index
+ *	by time and MMSI for queries.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_ARCHIVE_H
+#define INC_ARCHIVE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARCHIVE_MAGIC 0x41534941u	/* "AISA" */
+#define ARCHIVE_INDEX_MAGIC 0x58534941u	/* "AISX" */
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_SEGMENT_SEC 3600	/* one segment per UTC hour */
+#define ARCHIVE_MAX_BYTES 128		/* payload, enough for 5 slots */
+#define ARCHIVE_WRITE_BUF (64 * 1024)
+#define ARCHIVE_FLUSH_MS 1000
+
+/*
+ * Files are in host byte order, which is little endian on every
+ * platform rtl_ais runs on. A segment YYYYMMDD-HH.aisa is a header
+ * followed by records, each a record header and (nbits + 7) / 8
+ * payload bytes, the message bits as received without stuffing and
+ * CRC.
+ */
+struct archive_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t start_ms;		/* unix time of the segment start */
+};
+
+struct archive_record_header {
+	uint32_t time_ms;		/* since the segment start */
+	uint16_t nbits;
+	uint8_t channel;		/* 'A', 'B' or 0 */
+	uint8_t level;			/* signal level of the channel, percent */
+};
+
+/*
+ * The index YYYYMMDD-HH.aisx of a finished segment: a header, for
+ * every second the offset of its first record, the vessels sorted by
+ * MMSI, and the offsets of the records of every vessel in the order
+ * they were received. Offsets are from the start of the segment file.
+ */
+struct archive_index_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t start_ms;
+	uint64_t data_size;		/* bytes of the segment covered */
+	uint32_t nseconds;		/* ARCHIVE_SEGMENT_SEC, second_offset has one more */
+	uint32_t nvessels;
+	uint32_t nrecords;
+	uint32_t pad;
+};
+
+struct archive_index_vessel {
+	uint32_t mmsi;
+	uint32_t first;			/* in the record offsets */
+	uint32_t count;
+};
+
+/* A record while the index is built */
+struct archive_index_entry {
+	uint32_t mmsi;
+	uint32_t offset;
+};
+
+/* A message in memory, time as unix time */
+struct archive_record {
+	int64_t time_ms;
+	unsigned int nbits;
+	char channel;
+	unsigned char level;
+	unsigned char data[ARCHIVE_MAX_BYTES];
+};
+
+/* Index of one segment while it is built */
+struct archive_index {
+	int64_t start_ms;
+	uint64_t size;			/* data written so far, with the header */
+	uint32_t last_ms;
+	int next_second;		/* second_offset is set below this */
+	uint32_t second_offset[ARCHIVE_SEGMENT_SEC + 1];
+	struct archive_index_entry *entry;
+	unsigned int nentries, alloc;
+};
+
+struct archive {
+	char *dir;
+	int fd;				/* the open segment, or -1 */
+	struct archive_index index;
+	unsigned char *wbuf;
+	unsigned int wlen;
+	double first_unflushed;		/* ms, time of the oldest data in wbuf */
+
+	/* statistics */
+	unsigned long long records, bytes;
+	unsigned long segments, errors;
+};
+
+/* A finished or open segment, mapped for reading */
+struct archive_segment {
+	int64_t start_ms;
+	const unsigned char *data;
+	size_t size;
+	const struct archive_index_header *index;	/* NULL if there is none */
+	size_t index_size;
+	const uint32_t *second_offset;
+	const struct archive_index_vessel *vessel;
+	const uint32_t *record_offset;
+};
+
+extern unsigned int archive_encode(struct archive_record *r, const char *nmea, unsigned int length,
+				   int64_t time_ms, unsigned int level);
+extern unsigned long archive_mmsi(const struct archive_record *r);
+extern unsigned int archive_type(const struct archive_record *r);
+extern int archive_nmea(const struct archive_record *r, char *buf, unsigned int size, int seqnr);
+
+extern int archive_open(struct archive *ar, const char *dir);
+extern void archive_close(struct archive *ar);
+extern int archive_write(struct archive *ar, const struct archive_record *r, double now);
+extern void archive_flush(struct archive *ar, double now, int force);
+extern int archive_flush_timeout(struct archive *ar, double now);
+
+extern int archive_segment_map(struct archive_segment *seg, const char *path);
+extern void archive_segment_unmap(struct archive_segment *seg);
+extern size_t archive_segment_record(const struct archive_segment *seg, size_t offset,
+				     struct archive_record *r);
+extern int archive_index_segment(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
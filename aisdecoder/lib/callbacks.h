@@ -5,14 +5,20 @@
 extern "C" {
 #endif
 
+struct ais_msg;
+
 typedef void (*receiver_on_level_changed)(float level, int channel, unsigned char high);
 typedef void (*decoder_on_nmea_sentence_received)(const char *sentence,
                                           unsigned int length,
                                           unsigned char sentences,
-                                          unsigned char sentencenum);
+                                          unsigned char sentencenum,
+                                          const struct ais_msg *msg);
+
+typedef void (*decoder_on_print_stats)(void);
 
 extern receiver_on_level_changed on_sound_level_changed;
 extern decoder_on_nmea_sentence_received on_nmea_sentence_received;
+extern decoder_on_print_stats on_decoder_print_stats;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,741 @@
+/*
+ *	columnar.c
+ *
+ *	Columnar files of decoded messages.
+ *
+ *	Rows are collected in memory up to max_rows and then written as a
+ *	row group, column by column. Every column is encoded so that its
+ *	values become small and repetitive, delta of delta for the time,
+ *	a dictionary for MMSIs and names, positions as the change since
+ *	the previous report of the same vessel, and then compressed with
+ *	zlib. Memory use is fixed by max_rows, however long the export.
+ *
+ *	The layout is described in columnar.h.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "columnar.h"
+
+#define DAY_MS (24 * 3600 * 1000LL)
+
+struct group_header {
+	uint32_t magic;
+	uint32_t rows;
+	int64_t first_ms, last_ms;
+	uint32_t columns;
+	uint32_t pad;
+};
+
+struct chunk_header {
+	uint8_t column;
+	uint8_t compression;
+	uint16_t pad;
+	uint32_t length;
+	uint32_t stored;
+};
+
+/* ------------------------------------------------------------------ */
+/* Encoding */
+
+static int buf_reserve(struct columnar_buf *b, size_t n)
+{
+	size_t alloc = b->alloc ? b->alloc : 4096;
+	unsigned char *p;
+
+	if (b->len + n <= b->alloc)
+		return 1;
+	while (alloc < b->len + n)
+		alloc *= 2;
+	p = realloc(b->data, alloc);
+	if (!p)
+		return 0;
+	b->data = p;
+	b->alloc = alloc;
+	return 1;
+}
+
+/* Space must have been reserved */
+static void put_varint(struct columnar_buf *b, uint64_t v)
+{
+	while (v >= 0x80) {
+		b->data[b->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b->data[b->len++] = v;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static const char *row_string(const struct columnar_row *r, int column)
+{
+	switch (column) {
+	case COLUMNAR_NAME:
+		return r->msg.name;
+	case COLUMNAR_CALLSIGN:
+		return r->msg.callsign;
+	}
+	return r->msg.destination;
+}
+
+static unsigned int hash_mask(struct columnar *c)
+{
+	unsigned int size = 1;
+
+	while (size < 2 * c->max_rows)
+		size *= 2;
+	return size - 1;
+}
+
+/*
+ *	Give every distinct MMSI of the group an index in c->ids, in the
+ *	order of their first row. Returns the number of MMSIs.
+ */
+static unsigned int mmsi_dictionary(struct columnar *c)
+{
+	unsigned int mask = hash_mask(c), i, h, n = 0;
+	unsigned long mmsi;
+
+	memset(c->hash, 0, (mask + 1) * sizeof(uint32_t));
+	for (i = 0; i < c->nrows; i++) {
+		mmsi = c->rows[i].msg.mmsi;
+		h = (unsigned int)(mmsi * 2654435761u) & mask;
+		while (c->hash[h] && c->rows[c->hash[h] - 1].msg.mmsi != mmsi)
+			h = (h + 1) & mask;
+		if (c->hash[h]) {
+			c->ids[i] = c->ids[c->hash[h] - 1];
+		} else {
+			c->hash[h] = i + 1;
+			c->ids[i] = n++;
+		}
+	}
+	return n;
+}
+
+/* A string column, 0 for empty strings, others 1 + dictionary index */
+static void encode_strings(struct columnar *c, int column, uint32_t *ids)
+{
+	unsigned int mask = hash_mask(c), i, h, n = 0, next = 1, len;
+	const unsigned char *s;
+
+	memset(c->hash, 0, (mask + 1) * sizeof(uint32_t));
+	for (i = 0; i < c->nrows; i++) {
+		s = (const unsigned char *)row_string(&c->rows[i], column);
+		if (!*s) {
+			ids[i] = 0;
+			continue;
+		}
+		for (h = 2166136261u; *s; s++)
+			h = (h ^ *s) * 16777619u;
+		h &= mask;
+		s = (const unsigned char *)row_string(&c->rows[i], column);
+		while (c->hash[h] && strcmp(row_string(&c->rows[c->hash[h] - 1], column), (const char *)s) != 0)
+			h = (h + 1) & mask;
+		if (c->hash[h]) {
+			ids[i] = ids[c->hash[h] - 1];
+		} else {
+			c->hash[h] = i + 1;
+			ids[i] = ++n;
+		}
+	}
+	put_varint(&c->raw, n);
+	for (i = 0; i < c->nrows; i++) {
+		if (ids[i] != next)
+			continue;
+		s = (const unsigned char *)row_string(&c->rows[i], column);
+		len = strlen((const char *)s);
+		put_varint(&c->raw, len);
+		memcpy(c->raw.data + c->raw.len, s, len);
+		c->raw.len += len;
+		next++;
+	}
+	for (i = 0; i < c->nrows; i++)
+		put_varint(&c->raw, ids[i]);
+}
+
+static void encode_column(struct columnar *c, int column, unsigned int nmmsi)
+{
+	const struct columnar_row *r;
+	int64_t prev = 0, delta, prev_delta = 0;
+	int32_t *last;
+	unsigned int i, next = 0;
+	long v;
+
+	c->raw.len = 0;
+	switch (column) {
+	case COLUMNAR_TIME:
+		for (i = 0; i < c->nrows; i++) {
+			delta = c->rows[i].time_ms - prev;
+			put_varint(&c->raw, zigzag(delta - prev_delta));
+			prev = c->rows[i].time_ms;
+			prev_delta = delta;
+		}
+		break;
+	case COLUMNAR_MMSI:
+		put_varint(&c->raw, nmmsi);
+		for (i = 0; i < c->nrows; i++) {
+			if (c->ids[i] != next)
+				continue;
+			put_varint(&c->raw, zigzag((int64_t)c->rows[i].msg.mmsi - prev));
+			prev = c->rows[i].msg.mmsi;
+			next++;
+		}
+		for (i = 0; i < c->nrows; i++)
+			put_varint(&c->raw, c->ids[i]);
+		break;
+	case COLUMNAR_LAT:
+	case COLUMNAR_LON:
+		last = column == COLUMNAR_LAT ? c->prev_lat : c->prev_lon;
+		memset(last, 0, nmmsi * sizeof(int32_t));
+		for (i = 0; i < c->nrows; i++) {
+			r = &c->rows[i];
+			if (!r->msg.has_pos)
+				continue;
+			v = column == COLUMNAR_LAT ? r->msg.lat : r->msg.lon;
+			put_varint(&c->raw, zigzag(v - last[c->ids[i]]));
+			last[c->ids[i]] = v;
+		}
+		break;
+	case COLUMNAR_NAME:
+	case COLUMNAR_CALLSIGN:
+	case COLUMNAR_DESTINATION:
+		encode_strings(c, column, c->ids + c->max_rows);
+		break;
+	default:
+		for (i = 0; i < c->nrows; i++) {
+			r = &c->rows[i];
+			switch (column) {
+			case COLUMNAR_TYPE:
+				v = r->msg.type;
+				break;
+			case COLUMNAR_CHANNEL:
+				v = (unsigned char)r->msg.chanid;
+				break;
+			case COLUMNAR_HAS_POS:
+				v = r->msg.has_pos;
+				break;
+			case COLUMNAR_SOG:
+				/* no valid speed is 1023, type 9 counts whole knots */
+				v = r->msg.sog == AIS_SOG_NA ? 1023 : r->msg.sog;
+				break;
+			case COLUMNAR_COG:
+				v = r->msg.cog;
+				break;
+			case COLUMNAR_HEADING:
+				v = r->msg.heading;
+				break;
+			case COLUMNAR_NAVSTATUS:
+				v = r->msg.navstatus;
+				break;
+			default:
+				v = r->msg.shiptype;
+				break;
+			}
+			put_varint(&c->raw, v);
+		}
+		break;
+	}
+}
+
+/* Compress the encoded column and write it as a chunk */
+static int write_chunk(struct columnar *c, int column)
+{
+	struct chunk_header h;
+	uLongf stored = compressBound(c->raw.len);
+	const unsigned char *data = c->raw.data;
+
+	memset(&h, 0, sizeof(h));
+	h.column = column;
+	h.length = c->raw.len;
+	h.stored = c->raw.len;
+	c->packed.len = 0;
+	if (buf_reserve(&c->packed, stored) &&
+	    compress2(c->packed.data, &stored, c->raw.data, c->raw.len, 6) == Z_OK && stored < c->raw.len) {
+		h.compression = 1;
+		h.stored = stored;
+		data = c->packed.data;
+	}
+	if (fwrite(&h, sizeof(h), 1, c->f) != 1 || fwrite(data, 1, h.stored, c->f) != h.stored)
+		return 0;
+	c->bytes += sizeof(h) + h.stored;
+	return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Writing */
+
+/*
+ *	Length of the complete row groups at the start of f. A group cut
+ *	off by a crash is overwritten by the next one.
+ */
+static long valid_length(FILE *f)
+{
+	struct group_header g;
+	struct chunk_header h;
+	long end, pos, size;
+	unsigned int i;
+
+	if (fseek(f, 0, SEEK_END) != 0)
+		return -1;
+	size = ftell(f);
+	end = 2 * sizeof(uint32_t);
+	while (fseek(f, end, SEEK_SET) == 0 && fread(&g, sizeof(g), 1, f) == 1 &&
+	       g.magic == COLUMNAR_GROUP_MAGIC) {
+		pos = end + sizeof(g);
+		for (i = 0; i < g.columns; i++) {
+			if (fread(&h, sizeof(h), 1, f) != 1)
+				return end;
+			pos += sizeof(h) + h.stored;
+			if (pos > size || fseek(f, pos, SEEK_SET) != 0)
+				return end;
+		}
+		end = pos;
+	}
+	return end;
+}
+
+static int open_file(struct columnar *c, const char *path)
+{
+	uint32_t header[2] = {COLUMNAR_MAGIC, COLUMNAR_VERSION};
+	long end;
+
+	c->f = fopen(path, "r+");
+	if (!c->f)
+		c->f = fopen(path, "w+");
+	if (!c->f) {
+		perror(path);
+		return 0;
+	}
+	fseek(c->f, 0, SEEK_END);
+	if (ftell(c->f) == 0) {
+		if (fwrite(header, sizeof(header), 1, c->f) != 1) {
+			perror(path);
+			fclose(c->f);
+			c->f = NULL;
+			return 0;
+		}
+	} else {
+		/* Continue a file of an earlier run */
+		rewind(c->f);
+		end = columnar_read_header(c->f) ? valid_length(c->f) : -1;
+		if (end < 0 || ftruncate(fileno(c->f), end) < 0 || fseek(c->f, end, SEEK_SET) != 0) {
+			fprintf(stderr, "%s: not a columnar file\n", path);
+			fclose(c->f);
+			c->f = NULL;
+			return 0;
+		}
+	}
+	free(c->path);
+	c->path = strdup(path);
+	return 1;
+}
+
+static int init(struct columnar *c, unsigned int max_rows)
+{
+	unsigned int mask;
+
+	memset(c, 0, sizeof(*c));
+	c->day = -1;
+	if (max_rows == 0)
+		max_rows = COLUMNAR_DEFAULT_ROWS;
+	if (max_rows > COLUMNAR_MAX_ROWS)
+		max_rows = COLUMNAR_MAX_ROWS;
+	c->max_rows = max_rows;
+	mask = hash_mask(c);
+	c->rows = malloc(max_rows * sizeof(struct columnar_row));
+	c->hash = malloc((mask + 1) * sizeof(uint32_t));
+	c->ids = malloc(2 * max_rows * sizeof(uint32_t));
+	c->prev_lat = malloc(max_rows * sizeof(int32_t));
+	c->prev_lon = malloc(max_rows * sizeof(int32_t));
+	if (!c->rows || !c->hash || !c->ids || !c->prev_lat || !c->prev_lon ||
+	    !buf_reserve(&c->raw, (size_t)max_rows * 48 + 64)) {
+		columnar_close(c);
+		return 0;
+	}
+	return 1;
+}
+
+/* Write to one file. Returns 1 if ok, 0 on error. */
+int columnar_create(struct columnar *c, const char *path, unsigned int max_rows)
+{
+	if (!init(c, max_rows))
+		return 0;
+	if (!open_file(c, path)) {
+		columnar_close(c);
+		return 0;
+	}
+	return 1;
+}
+
+/* Write to daily files YYYYMMDD.aisc (UTC) in dir. Returns 1 if ok. */
+int columnar_open_dir(struct columnar *c, const char *dir, unsigned int max_rows)
+{
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return 0;
+	}
+	if (!init(c, max_rows))
+		return 0;
+	c->dir = strdup(dir);
+	return c->dir != NULL;
+}
+
+/* Add a row. Returns 1, or 0 if it was dropped. */
+int columnar_add(struct columnar *c, int64_t time_ms, const struct ais_msg *msg, double now)
+{
+	char path[1024];
+	time_t t;
+	struct tm tm;
+	long day = time_ms / DAY_MS;
+
+	if (c->dir && day != c->day) {
+		columnar_flush(c);
+		if (c->f)
+			fclose(c->f);
+		c->f = NULL;
+		c->day = day;
+		t = time_ms / 1000;
+		gmtime_r(&t, &tm);
+		snprintf(path, sizeof(path), "%s/%04d%02d%02d.aisc", c->dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+		if (!open_file(c, path))
+			c->errors++;
+	}
+	if (!c->f)
+		return 0;
+	if (c->nrows == 0)
+		c->first_added = now;
+	c->rows[c->nrows].time_ms = time_ms;
+	c->rows[c->nrows].msg = *msg;
+	if (++c->nrows == c->max_rows)
+		columnar_flush(c);
+	return 1;
+}
+
+/* Write the rows collected so far as a row group. Returns 1 if ok. */
+int columnar_flush(struct columnar *c)
+{
+	struct group_header g;
+	unsigned int nmmsi, i;
+	int ok;
+
+	if (!c->f || c->nrows == 0)
+		return 1;
+	memset(&g, 0, sizeof(g));
+	g.magic = COLUMNAR_GROUP_MAGIC;
+	g.rows = c->nrows;
+	g.first_ms = c->rows[0].time_ms;
+	g.last_ms = c->rows[c->nrows - 1].time_ms;
+	g.columns = COLUMNAR_COLUMNS;
+	nmmsi = mmsi_dictionary(c);
+	ok = fwrite(&g, sizeof(g), 1, c->f) == 1;
+	c->bytes += sizeof(g);
+	for (i = 0; ok && i < COLUMNAR_COLUMNS; i++) {
+		encode_column(c, i, nmmsi);
+		ok = write_chunk(c, i);
+	}
+	if (fflush(c->f) != 0)
+		ok = 0;
+	if (!ok) {
+		perror(c->path);
+		c->errors++;
+	} else {
+		c->written += c->nrows;
+		c->groups++;
+	}
+	c->nrows = 0;
+	return ok;
+}
+
+/* Milliseconds until the rows collected must be written, -1 if none */
+int columnar_flush_timeout(struct columnar *c, double now)
+{
+	double t;
+
+	if (c->nrows == 0)
+		return -1;
+	t = c->first_added + COLUMNAR_FLUSH_MS - now;
+	return t < 0 ? 0 : (int)t + 1;
+}
+
+void columnar_close(struct columnar *c)
+{
+	columnar_flush(c);
+	if (c->f)
+		fclose(c->f);
+	free(c->rows);
+	free(c->hash);
+	free(c->ids);
+	free(c->prev_lat);
+	free(c->prev_lon);
+	free(c->raw.data);
+	free(c->packed.data);
+	free(c->dir);
+	free(c->path);
+	memset(c, 0, sizeof(*c));
+}
+
+/* ------------------------------------------------------------------ */
+/* Reading */
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		*v |= (uint64_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static char *row_field(struct columnar_row *r, int column, unsigned int *size)
+{
+	switch (column) {
+	case COLUMNAR_NAME:
+		*size = sizeof(r->msg.name);
+		return r->msg.name;
+	case COLUMNAR_CALLSIGN:
+		*size = sizeof(r->msg.callsign);
+		return r->msg.callsign;
+	}
+	*size = sizeof(r->msg.destination);
+	return r->msg.destination;
+}
+
+struct decode_state {
+	uint32_t *ids;			/* MMSI dictionary index per row */
+	unsigned long *mmsi;
+	unsigned int nmmsi;
+	int have_pos;			/* has_pos was read */
+	int32_t *last;
+	const unsigned char **strings;
+	unsigned int *lengths;
+};
+
+static int decode_column(struct columnar_row *rows, unsigned int n, int column,
+			 const unsigned char *p, const unsigned char *end, struct decode_state *st)
+{
+	int64_t prev = 0, delta = 0;
+	uint64_t v, count;
+	unsigned int i, size;
+	char *field;
+
+	switch (column) {
+	case COLUMNAR_TIME:
+		for (i = 0; i < n; i++) {
+			if (!get_varint(&p, end, &v))
+				return 0;
+			delta += unzigzag(v);
+			prev += delta;
+			rows[i].time_ms = prev;
+		}
+		return 1;
+	case COLUMNAR_MMSI:
+		if (!get_varint(&p, end, &count) || count > n)
+			return 0;
+		for (i = 0; i < count; i++) {
+			if (!get_varint(&p, end, &v))
+				return 0;
+			prev += unzigzag(v);
+			st->mmsi[i] = prev;
+		}
+		st->nmmsi = count;
+		for (i = 0; i < n; i++) {
+			if (!get_varint(&p, end, &v) || v >= count)
+				return 0;
+			st->ids[i] = v;
+			rows[i].msg.mmsi = st->mmsi[v];
+		}
+		return 1;
+	case COLUMNAR_LAT:
+	case COLUMNAR_LON:
+		if (!st->have_pos || !st->nmmsi)
+			return 0;
+		memset(st->last, 0, st->nmmsi * sizeof(int32_t));
+		for (i = 0; i < n; i++) {
+			if (!rows[i].msg.has_pos)
+				continue;
+			if (!get_varint(&p, end, &v))
+				return 0;
+			st->last[st->ids[i]] += unzigzag(v);
+			if (column == COLUMNAR_LAT)
+				rows[i].msg.lat = st->last[st->ids[i]];
+			else
+				rows[i].msg.lon = st->last[st->ids[i]];
+		}
+		return 1;
+	case COLUMNAR_NAME:
+	case COLUMNAR_CALLSIGN:
+	case COLUMNAR_DESTINATION:
+		if (!get_varint(&p, end, &count) || count > n)
+			return 0;
+		for (i = 0; i < count; i++) {
+			if (!get_varint(&p, end, &v) || v > (uint64_t)(end - p))
+				return 0;
+			st->strings[i] = p;
+			st->lengths[i] = v;
+			p += v;
+		}
+		for (i = 0; i < n; i++) {
+			if (!get_varint(&p, end, &v) || v > count)
+				return 0;
+			field = row_field(&rows[i], column, &size);
+			if (v == 0) {
+				field[0] = 0;
+				continue;
+			}
+			snprintf(field, size, "%.*s", st->lengths[v - 1], st->strings[v - 1]);
+		}
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (!get_varint(&p, end, &v))
+			return 0;
+		switch (column) {
+		case COLUMNAR_TYPE:
+			rows[i].msg.type = v;
+			break;
+		case COLUMNAR_CHANNEL:
+			rows[i].msg.chanid = v;
+			break;
+		case COLUMNAR_HAS_POS:
+			rows[i].msg.has_pos = v;
+			st->have_pos = 1;
+			break;
+		case COLUMNAR_SOG:
+			rows[i].msg.sog = v == 1023 ? AIS_SOG_NA : v;
+			break;
+		case COLUMNAR_COG:
+			rows[i].msg.cog = v;
+			break;
+		case COLUMNAR_HEADING:
+			rows[i].msg.heading = v;
+			break;
+		case COLUMNAR_NAVSTATUS:
+			rows[i].msg.navstatus = v;
+			break;
+		case COLUMNAR_SHIPTYPE:
+			rows[i].msg.shiptype = v;
+			break;
+		default:
+			return 1;	/* a column added later */
+		}
+	}
+	return 1;
+}
+
+/* Check the file header. Returns 1 if ok. */
+int columnar_read_header(FILE *f)
+{
+	uint32_t header[2];
+
+	return fread(header, sizeof(header), 1, f) == 1 && header[0] == COLUMNAR_MAGIC &&
+	       header[1] == COLUMNAR_VERSION;
+}
+
+/*
+ *	Read the next row group into *rows, which is grown as needed.
+ *	Returns 1 if ok, 0 at the end of the file, -1 if it is damaged.
+ */
+int columnar_read_group(FILE *f, struct columnar_row **rows, unsigned int *nrows)
+{
+	struct group_header g;
+	struct chunk_header h;
+	struct decode_state st;
+	struct columnar_row *r;
+	unsigned char *stored = NULL, *raw = NULL;
+	uLongf length;
+	unsigned int i;
+	int ok = 1;
+
+	if (fread(&g, sizeof(g), 1, f) != 1)
+		return 0;
+	if (g.magic != COLUMNAR_GROUP_MAGIC || g.rows == 0 || g.rows > COLUMNAR_MAX_ROWS)
+		return -1;
+	r = realloc(*rows, g.rows * sizeof(struct columnar_row));
+	if (!r)
+		return -1;
+	*rows = r;
+	*nrows = g.rows;
+	for (i = 0; i < g.rows; i++) {
+		memset(&r[i].msg, 0, sizeof(r[i].msg));
+		r[i].time_ms = 0;
+		r[i].msg.lat = AIS_LAT_NA;
+		r[i].msg.lon = AIS_LON_NA;
+		r[i].msg.sog = AIS_SOG_NA;
+		r[i].msg.cog = AIS_COG_NA;
+		r[i].msg.heading = AIS_HEADING_NA;
+		r[i].msg.navstatus = AIS_NAVSTATUS_NA;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.ids = malloc(g.rows * sizeof(uint32_t));
+	st.mmsi = malloc(g.rows * sizeof(unsigned long));
+	st.last = malloc(g.rows * sizeof(int32_t));
+	st.strings = malloc(g.rows * sizeof(char *));
+	st.lengths = malloc(g.rows * sizeof(unsigned int));
+	if (!st.ids || !st.mmsi || !st.last || !st.strings || !st.lengths)
+		ok = 0;
+	for (i = 0; ok && i < g.columns; i++) {
+		if (fread(&h, sizeof(h), 1, f) != 1 || h.length > 64u * 1024 * 1024 || h.stored > 64u * 1024 * 1024) {
+			ok = 0;
+			break;
+		}
+		free(stored);
+		free(raw);
+		raw = NULL;
+		stored = malloc(h.stored + 1);
+		if (!stored || fread(stored, 1, h.stored, f) != h.stored) {
+			ok = 0;
+			break;
+		}
+		if (h.compression == 1) {
+			raw = malloc(h.length + 1);
+			length = h.length;
+			if (!raw || uncompress(raw, &length, stored, h.stored) != Z_OK || length != h.length) {
+				ok = 0;
+				break;
+			}
+		} else if (h.compression != 0 || h.length != h.stored) {
+			ok = 0;
+			break;
+		}
+		ok = decode_column(r, g.rows, h.column, raw ? raw : stored, (raw ? raw : stored) + h.length, &st);
+	}
+	free(stored);
+	free(raw);
+	free(st.ids);
+	free(st.mmsi);
+	free(st.last);
+	free(st.strings);
+	free(st.lengths);
+	return ok ? 1 : -1;
+}
@@ -0,0 +1,121 @@
+/*
+ *	columnar.h
+ *
+ *	Columnar files of decoded messages, for loading into analytics
+ *	tools without parsing NMEA.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_COLUMNAR_H
+#define INC_COLUMNAR_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "aismsg.h"
+
+#define COLUMNAR_MAGIC 0x43534941u		/* "AISC" */
+#define COLUMNAR_GROUP_MAGIC 0x47534941u	/* "AISG" */
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_DEFAULT_ROWS 16384
+#define COLUMNAR_MAX_ROWS (1024 * 1024)
+#define COLUMNAR_FLUSH_MS (5 * 60 * 1000)	/* rows are written at the latest after this */
+
+/*
+ * Layout, all integers in host byte order (little endian on every
+ * platform rtl_ais runs on):
+ *
+ *   file:      uint32 magic, uint32 version, then row groups until the end
+ *   row group: uint32 magic, uint32 rows, int64 first and last time (ms),
+ *              uint32 columns, uint32 0, then the column chunks
+ *   chunk:     uint8 column, uint8 compression (0 none, 1 zlib), uint16 0,
+ *              uint32 length, uint32 stored length, then the stored bytes
+ *
+ * Every row group can be read on its own. A column is a sequence of
+ * varints (LEB128, signed values zigzag encoded):
+ *
+ *   time         delta of delta of the unix time in ms, signed
+ *   mmsi         dictionary: count, the MMSIs as signed deltas, then
+ *                per row the index into the dictionary
+ *   lat, lon     only rows with has_pos set: the signed delta to the
+ *                previous position of the same MMSI in the row group,
+ *                in 1/10000 minute
+ *   name, callsign, destination
+ *                dictionary: count, every string as length and bytes,
+ *                then per row 0 for empty or 1 + index
+ *   sog          1/10 knot, 1023 for not available
+ *   the others   the value as in struct ais_msg
+ */
+#define COLUMNAR_TIME 0
+#define COLUMNAR_MMSI 1
+#define COLUMNAR_TYPE 2
+#define COLUMNAR_CHANNEL 3
+#define COLUMNAR_HAS_POS 4
+#define COLUMNAR_LAT 5
+#define COLUMNAR_LON 6
+#define COLUMNAR_SOG 7
+#define COLUMNAR_COG 8
+#define COLUMNAR_HEADING 9
+#define COLUMNAR_NAVSTATUS 10
+#define COLUMNAR_SHIPTYPE 11
+#define COLUMNAR_NAME 12
+#define COLUMNAR_CALLSIGN 13
+#define COLUMNAR_DESTINATION 14
+#define COLUMNAR_COLUMNS 15
+
+struct columnar_row {
+	int64_t time_ms;
+	struct ais_msg msg;
+};
+
+struct columnar_buf {
+	unsigned char *data;
+	size_t len, alloc;
+};
+
+struct columnar {
+	char *dir;			/* daily files YYYYMMDD.aisc in dir, or NULL */
+	char *path;			/* the open file */
+	FILE *f;
+	long day;			/* of the open daily file */
+	struct columnar_row *rows;	/* the row group being collected */
+	unsigned int nrows, max_rows;
+	double first_added;		/* ms, when the first row was added */
+
+	/* scratch space for encoding, sized for max_rows */
+	struct columnar_buf raw, packed;
+	uint32_t *hash;			/* 2 * max_rows slots, 0: free, else 1 + row */
+	uint32_t *ids;			/* dictionary index per row */
+	int32_t *prev_lat, *prev_lon;	/* per dictionary index */
+
+	/* statistics */
+	unsigned long long written, bytes;
+	unsigned long groups, errors;
+};
+
+extern int columnar_create(struct columnar *c, const char *path, unsigned int max_rows);
+extern int columnar_open_dir(struct columnar *c, const char *dir, unsigned int max_rows);
+extern int columnar_add(struct columnar *c, int64_t time_ms, const struct ais_msg *msg, double now);
+extern int columnar_flush(struct columnar *c);
+extern int columnar_flush_timeout(struct columnar *c, double now);
+extern void columnar_close(struct columnar *c);
+
+extern int columnar_read_header(FILE *f);
+extern int columnar_read_group(FILE *f, struct columnar_row **rows, unsigned int *nrows);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
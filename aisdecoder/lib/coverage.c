@@ -0,0 +1,395 @@
+/*
+ *	coverage.c
+ *
+ *	Reception coverage of the station, kept up to date from the
+ *	decoded positions instead of computed from the archives later.
+ *
+ *	Every position report, unless relayed by a repeater, is placed
+ *	relative to the station: its bearing selects one of
+ *	COVERAGE_BEARINGS sectors, where a histogram of the range gives
+ *	percentiles and the farthest position is kept exactly. Positions
+ *	farther than the maximum range are a bad GPS or a bad decode, not
+ *	coverage, and are only counted. The position is also counted in a
+ *	cell of a lat/lon grid, kept in a fixed size hash table; once it
+ *	is 3/4 full new cells are only counted as well. Both take constant
+ *	memory and constant time per message.
+ *
+ *	The totals since the start are written to a text file every
+ *	interval, through a temporary file so a reader never sees half
+ *	of it, and served on /coverage by the HTTP server (-w).
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "coverage.h"
+#include "metrics.h"
+
+#define GRID_SIZE (1u << COVERAGE_GRID_BITS)
+#define EARTH_KM 6371.0
+#define UNITS_PER_DEGREE 600000.0	/* of the positions, 1/10000 minute */
+
+struct sector {
+	unsigned int range[COVERAGE_RANGE_BINS];
+	unsigned long count;
+	double max_km;
+};
+
+struct cell {
+	int32_t lat, lon;		/* index of the cell */
+	uint32_t count;			/* 0: free */
+};
+
+static struct coverage {
+	/* settings */
+	double lat, lon;		/* of the station, degrees */
+	double max_km;
+	long cell;			/* grid size in position units */
+	char *path;
+	int interval;
+
+	pthread_mutex_t lock;
+	struct sector sector[COVERAGE_BEARINGS];
+	struct cell *grid;
+	unsigned int cells;
+	time_t started;
+
+	/* copied under lock and formatted after, protected by cov_lock */
+	struct sector snap_sector[COVERAGE_BEARINGS];
+	struct cell *snap_grid;
+
+	pthread_t thread;
+	pthread_mutex_t stop_m;
+	pthread_cond_t stop_c;
+	int stop;
+
+	/* statistics */
+	unsigned long positions, far, grid_full;
+} *cov = NULL;
+
+/* The HTTP server may format while it is stopped, the decoder thread only adds */
+static pthread_mutex_t cov_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ *	Parse the -N spec, items separated by ';':
+ *	  lat,lon      position of the station, degrees
+ *	  file=path    write the totals here every interval
+ *	  interval=s   seconds (default: 60)
+ *	  cell=deg     size of the grid cells (default: 0.01)
+ *	  max=km       farther positions are ignored (default: 500)
+ *	Returns 1 if ok, 0 if the spec is invalid.
+ */
+static int parse(struct coverage *c, const char *spec)
+{
+	char item[1024], *value, *end;
+	const char *p = spec, *next;
+	double v;
+	int len, has_pos = 0;
+
+	c->max_km = COVERAGE_DEFAULT_MAX_KM;
+	c->cell = lrint(COVERAGE_DEFAULT_CELL * UNITS_PER_DEGREE);
+	c->interval = COVERAGE_DEFAULT_INTERVAL;
+	while (*p) {
+		next = strchr(p, ';');
+		len = next ? next - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			return 0;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = next ? next + 1 : p + len;
+		if (len == 0)
+			continue;
+
+		value = strchr(item, '=');
+		if (!value) {
+			if (sscanf(item, "%lf,%lf", &c->lat, &c->lon) != 2 || fabs(c->lat) > 85 || fabs(c->lon) > 180)
+				return 0;
+			has_pos = 1;
+			continue;
+		}
+		*value++ = 0;
+		if (strcmp(item, "file") == 0) {
+			free(c->path);
+			c->path = strdup(value);
+			continue;
+		}
+		v = strtod(value, &end);
+		if (*end || end == value)
+			return 0;
+		if (strcmp(item, "interval") == 0 && v >= 1 && v <= 86400)
+			c->interval = (int)v;
+		else if (strcmp(item, "cell") == 0 && v >= 0.001 && v <= 10)
+			c->cell = lrint(v * UNITS_PER_DEGREE);
+		else if (strcmp(item, "max") == 0 && v >= 1 && v <= 1000)
+			c->max_km = v;
+		else
+			return 0;
+	}
+	return has_pos;
+}
+
+/* Index of the grid cell a position is in, rounding towards the south and west */
+static int32_t cell_index(long pos, long cell)
+{
+	return pos >= 0 ? pos / cell : -((-pos + cell - 1) / cell);
+}
+
+static void add_cell(struct coverage *c, int32_t lat, int32_t lon)
+{
+	uint32_t h = ((uint32_t)lat * 73856093u) ^ ((uint32_t)lon * 19349663u);
+	unsigned int i;
+
+	for (i = h & (GRID_SIZE - 1);; i = (i + 1) & (GRID_SIZE - 1)) {
+		if (c->grid[i].count == 0)
+			break;
+		if (c->grid[i].lat == lat && c->grid[i].lon == lon) {
+			c->grid[i].count++;
+			return;
+		}
+	}
+	if (c->cells >= GRID_SIZE / 4 * 3) {
+		c->grid_full++;
+		return;
+	}
+	c->grid[i].lat = lat;
+	c->grid[i].lon = lon;
+	c->grid[i].count = 1;
+	c->cells++;
+}
+
+/* A decoded message, called by the decoder thread */
+void coverage_add(const struct ais_msg *m)
+{
+	struct coverage *c = cov;
+	struct sector *s;
+	double lat, north, east, km, bearing;
+	int bin;
+
+	if (!c || !m->has_pos || m->repeat > 0)
+		return;
+	/* flat earth at the mean latitude, within 1 % up to the 1000 km allowed */
+	lat = m->lat / UNITS_PER_DEGREE;
+	north = (lat - c->lat) * M_PI / 180 * EARTH_KM;
+	east = (m->lon / UNITS_PER_DEGREE - c->lon);
+	if (east > 180)
+		east -= 360;
+	else if (east < -180)
+		east += 360;
+	east *= M_PI / 180 * EARTH_KM * cos((lat + c->lat) / 2 * M_PI / 180);
+	km = sqrt(north * north + east * east);
+
+	pthread_mutex_lock(&c->lock);
+	c->positions++;
+	if (km > c->max_km) {
+		c->far++;
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	bearing = atan2(east, north) * 180 / M_PI;
+	if (bearing < 0)
+		bearing += 360;
+	s = &c->sector[(int)(bearing * COVERAGE_BEARINGS / 360) % COVERAGE_BEARINGS];
+	bin = (int)(km * COVERAGE_RANGE_BINS / c->max_km);
+	s->range[bin < COVERAGE_RANGE_BINS ? bin : COVERAGE_RANGE_BINS - 1]++;
+	s->count++;
+	if (km > s->max_km)
+		s->max_km = km;
+	add_cell(c, cell_index(m->lat, c->cell), cell_index(m->lon, c->cell));
+	pthread_mutex_unlock(&c->lock);
+}
+
+/* The range within which percent of the positions in the sector are, upper edge of the bin */
+static double percentile(const struct coverage *c, const struct sector *s, int percent)
+{
+	unsigned long want = (s->count * percent + 99) / 100, sum = 0;
+	double km;
+	int i;
+
+	for (i = 0; i < COVERAGE_RANGE_BINS - 1; i++) {
+		sum += s->range[i];
+		if (sum >= want)
+			break;
+	}
+	km = (i + 1) * c->max_km / COVERAGE_RANGE_BINS;
+	return km < s->max_km ? km : s->max_km;
+}
+
+/*
+ *	The totals as text, in a buffer the caller frees. Returns NULL if
+ *	coverage is off or out of memory. Lines starting with P are the
+ *	sectors that heard anything, G the grid cells, by south-west corner.
+ */
+char *coverage_format(unsigned int *length)
+{
+	struct coverage *c;
+	struct metrics_out out;
+	const struct sector *s;
+	const struct cell *g;
+	unsigned long positions, far, grid_full;
+	char stamp[32];
+	struct tm tm;
+	double cell;
+	unsigned int i;
+
+	pthread_mutex_lock(&cov_lock);
+	c = cov;
+	if (!c) {
+		pthread_mutex_unlock(&cov_lock);
+		return NULL;
+	}
+	out.size = 65536;
+	out.len = 0;
+	out.buf = malloc(out.size);
+	if (!out.buf) {
+		pthread_mutex_unlock(&cov_lock);
+		return NULL;
+	}
+	cell = c->cell / UNITS_PER_DEGREE;
+	gmtime_r(&c->started, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+	/* the decoder thread waits for the copy only, not for the text */
+	pthread_mutex_lock(&c->lock);
+	memcpy(c->snap_sector, c->sector, sizeof(c->sector));
+	memcpy(c->snap_grid, c->grid, GRID_SIZE * sizeof(struct cell));
+	positions = c->positions;
+	far = c->far;
+	grid_full = c->grid_full;
+	pthread_mutex_unlock(&c->lock);
+
+	metrics_printf(&out, "# rtl_ais coverage of %.5f,%.5f since %s\n", c->lat, c->lon, stamp);
+	metrics_printf(&out, "# positions %lu, farther than %.0f km %lu, not in the full grid %lu\n",
+		       positions, c->max_km, far, grid_full);
+	metrics_printf(&out, "# P bearing_deg count p50_km p90_km p99_km max_km\n");
+	for (i = 0; i < COVERAGE_BEARINGS; i++) {
+		s = &c->snap_sector[i];
+		if (s->count == 0)
+			continue;
+		metrics_printf(&out, "P %g %lu %.1f %.1f %.1f %.1f\n", (double)i * 360 / COVERAGE_BEARINGS, s->count,
+			       percentile(c, s, 50), percentile(c, s, 90), percentile(c, s, 99), s->max_km);
+	}
+	metrics_printf(&out, "# G lat lon count, cells of %g degrees\n", cell);
+	for (i = 0; i < GRID_SIZE; i++) {
+		g = &c->snap_grid[i];
+		if (g->count)
+			metrics_printf(&out, "G %.4f %.4f %u\n", g->lat * cell, g->lon * cell, g->count);
+	}
+	pthread_mutex_unlock(&cov_lock);
+	*length = out.len;
+	return out.buf;
+}
+
+static void write_file(struct coverage *c)
+{
+	char part[1040];
+	unsigned int length;
+	char *text = coverage_format(&length);
+	FILE *f;
+	int ok;
+
+	if (!text)
+		return;
+	snprintf(part, sizeof(part), "%s.part", c->path);
+	f = fopen(part, "w");
+	if (!f) {
+		perror(part);
+		free(text);
+		return;
+	}
+	ok = fwrite(text, 1, length, f) == length;
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(part, c->path) < 0) {
+		perror(c->path);
+		unlink(part);
+	}
+	free(text);
+}
+
+static void *coverage_thread_fn(void *arg)
+{
+	struct coverage *c = arg;
+	struct timespec until;
+
+	pthread_mutex_lock(&c->stop_m);
+	while (!c->stop) {
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += c->interval;
+		while (!c->stop && pthread_cond_timedwait(&c->stop_c, &c->stop_m, &until) == 0)
+			;
+		pthread_mutex_unlock(&c->stop_m);
+		write_file(c);
+		pthread_mutex_lock(&c->stop_m);
+	}
+	pthread_mutex_unlock(&c->stop_m);
+	return NULL;
+}
+
+/* Returns 1 if ok, 0 if the spec is invalid or out of memory */
+int coverage_start(const char *spec)
+{
+	struct coverage *c = calloc(1, sizeof(*c));
+
+	if (!c)
+		return 0;
+	if (!parse(c, spec) || !(c->grid = calloc(GRID_SIZE, sizeof(struct cell)))
+	    || !(c->snap_grid = malloc(GRID_SIZE * sizeof(struct cell)))) {
+		free(c->grid);
+		free(c->path);
+		free(c);
+		return 0;
+	}
+	c->started = time(NULL);
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_mutex_init(&c->stop_m, NULL);
+	pthread_cond_init(&c->stop_c, NULL);
+	cov = c;
+	if (c->path)
+		pthread_create(&c->thread, NULL, coverage_thread_fn, c);
+	fprintf(stderr, "Coverage of %.5f,%.5f up to %.0f km in %d sectors and %g degree cells%s%s\n",
+		c->lat, c->lon, c->max_km, COVERAGE_BEARINGS, c->cell / UNITS_PER_DEGREE,
+		c->path ? ", written to " : "", c->path ? c->path : "");
+	return 1;
+}
+
+/* Writes the file a last time */
+void coverage_stop(void)
+{
+	struct coverage *c = cov;
+
+	if (!c)
+		return;
+	if (c->path) {
+		pthread_mutex_lock(&c->stop_m);
+		c->stop = 1;
+		pthread_cond_signal(&c->stop_c);
+		pthread_mutex_unlock(&c->stop_m);
+		pthread_join(c->thread, NULL);
+	}
+	pthread_mutex_lock(&cov_lock);
+	cov = NULL;
+	pthread_mutex_unlock(&cov_lock);
+	pthread_mutex_destroy(&c->lock);
+	pthread_mutex_destroy(&c->stop_m);
+	pthread_cond_destroy(&c->stop_c);
+	free(c->grid);
+	free(c->snap_grid);
+	free(c->path);
+	free(c);
+}
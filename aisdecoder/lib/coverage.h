@@ -0,0 +1,41 @@
+/*
+ *	coverage.h
+ *
+ *	Where the station hears vessels: range by bearing and counts on
+ *	a lat/lon grid, aggregated from the decoded positions.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_COVERAGE_H
+#define INC_COVERAGE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "aismsg.h"
+
+#define COVERAGE_BEARINGS 72		/* 5 degree sectors */
+#define COVERAGE_RANGE_BINS 256		/* per sector, up to the maximum range */
+#define COVERAGE_DEFAULT_MAX_KM 500	/* farther positions are taken as bogus */
+#define COVERAGE_DEFAULT_CELL 0.01	/* degrees */
+#define COVERAGE_GRID_BITS 16		/* at most 3/4 of 1 << COVERAGE_GRID_BITS cells */
+#define COVERAGE_DEFAULT_INTERVAL 60	/* seconds between writes of the file */
+
+extern int coverage_start(const char *spec);
+extern void coverage_stop(void);
+extern void coverage_add(const struct ais_msg *m);
+extern char *coverage_format(unsigned int *length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,201 @@
+/*
+ *	drift.c
+ *
+ *	Keeps the channels centred while the dongle's crystal drifts, for
+ *	example as it warms up in the sun. A few ppm move both channels by
+ *	hundreds of Hz, enough to lose most frames in the decoder.
+ *
+ *	The mean phase step from sample to sample over a GMSK frame is the
+ *	frame's frequency offset; it is taken as the angle of the sum of
+ *	s[n] * conj(s[n - 1]), which unlike averaging the discriminator
+ *	output does not depend on how exact its atan2 approximation is.
+ *	Frames are found as bursts of power well above
+ *	the noise floor of the channel, lasting at least DRIFT_FRAME_MS;
+ *	noise alone averages to no offset and is left out. Every
+ *	DRIFT_WINDOW_SEC the median over the frames of both channels, which
+ *	is robust against a single ship with a bad transmitter, is taken
+ *	as the remaining error and added to the correction.
+ *
+ *	The correction is applied by a numerically controlled oscillator
+ *	on the complex samples before they are split into the channels, so
+ *	unlike a retune with rtlsdr_set_freq_correction() there is no gap
+ *	or glitch in the samples.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "drift.h"
+
+#define DRIFT_NCO_SIZE (1 << DRIFT_NCO_BITS)
+#define DRIFT_GAP 4			/* samples below the threshold within a frame */
+#define DRIFT_NOISE_STEP 8		/* every so many samples count for the noise floor */
+
+/*
+ *	max_hz limits the correction, nco_rate is the sample rate where
+ *	drift_nco() runs, rate the one of the channels measured, freq the
+ *	tuned frequency. Returns 1 if ok.
+ */
+int drift_start(struct drift *d, int max_hz, int nco_rate, int rate, double freq)
+{
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	d->sine = malloc(DRIFT_NCO_SIZE * sizeof(int16_t));
+	if (!d->sine)
+		return 0;
+	for (i = 0; i < DRIFT_NCO_SIZE; i++)
+		d->sine[i] = (int16_t)lrint(sin(2 * M_PI * i / DRIFT_NCO_SIZE) * (1 << 14));
+	d->max_hz = max_hz;
+	d->nco_rate = nco_rate;
+	d->rate = rate;
+	d->freq = freq;
+	return 1;
+}
+
+void drift_free(struct drift *d)
+{
+	free(d->sine);
+	free(d->scratch);
+	d->sine = NULL;
+	d->scratch = NULL;
+}
+
+/* Shift interleaved I/Q samples down by the correction */
+void drift_nco(struct drift *d, int16_t *iq, int len)
+{
+	uint32_t phase = d->phase, step = d->step;
+	int i, s, c, re, im;
+
+	if (step == 0)
+		return;
+	for (i = 0; i < len - 1; i += 2) {
+		s = d->sine[phase >> (32 - DRIFT_NCO_BITS)];
+		c = d->sine[((phase >> (32 - DRIFT_NCO_BITS)) + DRIFT_NCO_SIZE / 4) & (DRIFT_NCO_SIZE - 1)];
+		re = iq[i];
+		im = iq[i + 1];
+		iq[i] = (re * c - im * s) >> 14;
+		iq[i + 1] = (im * c + re * s) >> 14;
+		phase += step;
+	}
+	d->phase = phase;
+}
+
+static void frame_done(struct drift *d, struct drift_channel *ch)
+{
+	if (ch->len >= d->rate * DRIFT_FRAME_MS / 1000 && d->nframes < DRIFT_MAX_FRAMES)
+		d->frames[d->nframes++] = atan2(ch->sum_j, ch->sum_r) * d->rate / (2 * M_PI);
+	ch->sum_r = ch->sum_j = 0;
+	ch->len = 0;
+	ch->gap = 0;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ *	The noise floor of a block: a low percentile of the power, frames
+ *	take much less than three quarters of the time on a channel.
+ */
+static double block_noise(struct drift *d, const int16_t *iq, int len)
+{
+	int i, n = 0;
+
+	if (d->nscratch < len / DRIFT_NOISE_STEP + 1) {
+		free(d->scratch);
+		d->nscratch = len / DRIFT_NOISE_STEP + 1;
+		d->scratch = malloc(d->nscratch * sizeof(float));
+		if (!d->scratch) {
+			d->nscratch = 0;
+			return -1;
+		}
+	}
+	for (i = 0; i < len; i += DRIFT_NOISE_STEP)
+		d->scratch[n++] = (float)iq[2 * i] * iq[2 * i] + (float)iq[2 * i + 1] * iq[2 * i + 1];
+	qsort(d->scratch, n, sizeof(float), compare_float);
+	return d->scratch[n / 4];
+}
+
+/*
+ *	Look for frames in a block of len complex samples of channel c.
+ */
+void drift_measure(struct drift *d, int c, const int16_t *iq, int len)
+{
+	struct drift_channel *ch = &d->ch[c];
+	double p, noise = block_noise(d, iq, len);
+	int i, re, im;
+
+	if (noise < 0)
+		return;
+	if (ch->noise <= 0)
+		ch->noise = noise;
+	ch->noise += (noise - ch->noise) / 8;
+	noise = ch->noise < 1 ? 1 : ch->noise;
+	for (i = 0; i < len; i++) {
+		re = iq[2 * i];
+		im = iq[2 * i + 1];
+		p = (double)re * re + (double)im * im;
+		if (p > noise * DRIFT_SNR) {
+			ch->sum_r += (int64_t)re * ch->pre_r + (int64_t)im * ch->pre_j;
+			ch->sum_j += (int64_t)im * ch->pre_r - (int64_t)re * ch->pre_j;
+			ch->len++;
+			ch->gap = 0;
+		} else if (ch->len > 0 && ++ch->gap > DRIFT_GAP)
+			frame_done(d, ch);
+		ch->pre_r = re;
+		ch->pre_j = im;
+	}
+	if (c == 0)
+		d->samples += len;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ *	After every block: at the end of a window, correct by the median
+ *	offset of its frames. Returns 1 if the correction changed.
+ */
+int drift_update(struct drift *d)
+{
+	double correction;
+
+	if (d->samples < (unsigned long long)d->rate * DRIFT_WINDOW_SEC)
+		return 0;
+	d->samples = 0;
+	d->used = d->nframes;
+	d->nframes = 0;
+	if (d->used < DRIFT_MIN_FRAMES)
+		return 0;
+	qsort(d->frames, d->used, sizeof(double), compare_double);
+	d->residual = d->used % 2 ? d->frames[d->used / 2] : (d->frames[d->used / 2 - 1] + d->frames[d->used / 2]) / 2;
+
+	correction = d->correction + d->residual;
+	if (correction > d->max_hz)
+		correction = d->max_hz;
+	if (correction < -d->max_hz)
+		correction = -d->max_hz;
+	if (fabs(correction - d->correction) < 1)
+		return 0;
+	d->correction = correction;
+	d->step = (uint32_t)(int64_t)llrint(-correction / d->nco_rate * 4294967296.0);
+	return 1;
+}
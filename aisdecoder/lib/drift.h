@@ -0,0 +1,72 @@
+/*
+ *	drift.h
+ *
+ *	Tracking of the dongle's frequency error from the received frames,
+ *	corrected by a digital oscillator in the channel path.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_DRIFT_H
+#define INC_DRIFT_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define DRIFT_WINDOW_SEC 20		/* an estimate is taken this often */
+#define DRIFT_MIN_FRAMES 8		/* in the window, fewer change nothing */
+#define DRIFT_MAX_FRAMES 256
+#define DRIFT_FRAME_MS 15		/* bursts shorter than this are not frames */
+#define DRIFT_SNR 10			/* a burst is this much stronger than the noise (power) */
+#define DRIFT_NCO_BITS 10		/* sine table of 1 << DRIFT_NCO_BITS entries */
+
+struct drift_channel {
+	double noise;			/* power of the noise floor, averaged over blocks */
+	int64_t sum_r, sum_j;		/* s[n] * conj(s[n - 1]) over the burst so far */
+	int pre_r, pre_j;		/* the last sample of the previous block */
+	int len, gap;			/* samples in the burst, below the threshold at its end */
+};
+
+struct drift {
+	int max_hz;			/* never correct more than this */
+	int rate;			/* of the channels, samples per second */
+	int nco_rate;			/* where the oscillator runs */
+	double freq;			/* tuned, Hz, for ppm */
+
+	struct drift_channel ch[2];
+	double frames[DRIFT_MAX_FRAMES];	/* mean offset of each frame in the window, Hz */
+	int nframes;
+	unsigned long long samples;	/* in the window, per channel */
+	float *scratch;			/* for the noise floor */
+	int nscratch;
+
+	/* the oscillator */
+	double correction;		/* Hz the channels are shifted down by */
+	uint32_t phase, step;
+	int16_t *sine;
+
+	/* of the last estimate, for the log */
+	double residual;
+	int used;
+};
+
+extern int drift_start(struct drift *d, int max_hz, int nco_rate, int rate, double freq);
+extern void drift_free(struct drift *d);
+extern void drift_nco(struct drift *d, int16_t *iq, int len);
+extern void drift_measure(struct drift *d, int c, const int16_t *iq, int len);
+extern int drift_update(struct drift *d);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
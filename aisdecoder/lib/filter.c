@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "hmalloc.h"
 #include "filter.h"
@@ -143,3 +144,94 @@ short filter_run_buf(struct filter *f, short *in, float *out, int step, int len)
 }
 
 /* ---------------------------------------------------------------------- */
+
+struct filter_q15 *filter_q15_init(int len, float *taps)
+{
+	struct filter_q15 *f;
+	int i;
+
+	f = (struct filter_q15 *) hmalloc(sizeof(struct filter_q15));
+	memset(f, 0, sizeof(struct filter_q15));
+
+	f->taps = (short *) hmalloc(len * sizeof(short));
+	f->first = len;
+	f->last = -1;
+	for (i = 0; i < len; i++) {
+		f->taps[i] = (short) (taps[i] * 32768 + 0.5);
+		if (f->taps[i] != 0) {
+			if (f->first == len)
+				f->first = i;
+			f->last = i;
+		}
+	}
+
+	f->length = len;
+	f->pointer = f->length;
+
+	return f;
+}
+
+void filter_q15_free(struct filter_q15 *f)
+{
+	if (f) {
+		hfree(f->taps);
+		hfree(f);
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * The output is in Q15 of the input, saturated: the sum of the taps
+ * may exceed 1. It is accumulated in 64 bits, which MIPS does in its
+ * multiply unit, and keeps its sign for the slicer however small.
+ */
+short filter_q15_run_buf(struct filter_q15 *f, short *in, int *out, int step, int len)
+{
+	int id = 0;
+	int od = 0;
+	int i;
+	short maxval = 0;
+	int pointer = f->pointer;
+	short *buffer = f->buffer;
+	const short *taps = f->taps;
+	const short *x;
+	long long sum;
+
+	while (od < len) {
+		buffer[pointer] = in[id];
+
+		// look for peak volume
+		if (in[id] > maxval)
+			maxval = in[id];
+
+		x = &buffer[pointer - f->length];
+		sum = 0;
+		for (i = f->first; i <= f->last; i++)
+			sum += (int) x[i] * taps[i];
+		if (sum > INT_MAX)
+			out[od] = INT_MAX;
+		else if (sum < INT_MIN)
+			out[od] = INT_MIN;
+		else
+			out[od] = (int) sum;
+		pointer++;
+
+		/* the buffer is much smaller than the incoming chunks */
+		if (pointer == BufferLen) {
+			memcpy(buffer,
+			       buffer + BufferLen - f->length,
+			       f->length * sizeof(short));
+			pointer = f->length;
+		}
+
+		id += step;
+		od++;
+	}
+
+	f->pointer = pointer;
+
+	return maxval;
+}
+
+/* ---------------------------------------------------------------------- */
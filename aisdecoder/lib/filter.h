@@ -69,4 +69,24 @@ extern short filter_run_buf(struct filter *f, short *in, float *out, int step, i
 
 /* ---------------------------------------------------------------------- */
 
+/*
+ * The same filter with Q15 taps and integer arithmetic only, for CPUs
+ * without an FPU. Taps that round to 0 are skipped, but still count
+ * for the delay.
+ */
+struct filter_q15 {
+	int length;
+	int first, last;
+	short *taps;
+	short buffer[BufferLen];
+	int pointer;
+};
+
+extern struct filter_q15 *filter_q15_init(int len, float *taps);
+extern void filter_q15_free(struct filter_q15 *f);
+
+extern short filter_q15_run_buf(struct filter_q15 *f, short *in, int *out, int step, int len);
+
+/* ---------------------------------------------------------------------- */
+
 #endif				/* _FILTER_H */
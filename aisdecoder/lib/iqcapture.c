@@ -0,0 +1,275 @@
+/*
+ *	iqcapture.c
+ *
+ *	Rolling capture of the raw dongle samples, for looking at what the
+ *	receiver heard after something went wrong.
+ *
+ *	The USB callback copies every buffer into the next slot of a ring
+ *	allocated and touched up front, so the hot path is one memcpy and
+ *	an atomic store. A thread of its own checks the triggers every
+ *	IQCAPTURE_POLL_MS: a request (SIGUSR1 or the API), or the CRC
+ *	failure rate of the decoder over the last IQCAPTURE_CRC_WINDOW
+ *	seconds. While it writes the ring to a .cu8 file the callback
+ *	leaves the ring alone, so the file is one consistent stretch of
+ *	samples up to the trigger.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "iqcapture.h"
+#include "metrics.h"
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ *	Parse the -C spec, items separated by ';':
+ *	  30           seconds to keep
+ *	  dir=path     where dumps are written (default: .)
+ *	  crc=percent  dump when this share of the frames fails the CRC
+ *	Returns 1 if ok, 0 if the spec is invalid.
+ */
+int iq_capture_parse(struct iq_capture *c, const char *spec)
+{
+	char item[1024], *value, *end;
+	const char *p = spec, *next;
+	long v;
+	int len;
+
+	memset(c, 0, sizeof(*c));
+	while (*p) {
+		next = strchr(p, ';');
+		len = next ? next - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			return 0;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = next ? next + 1 : p + len;
+		if (len == 0)
+			continue;
+
+		value = strchr(item, '=');
+		if (value)
+			*value++ = 0;
+		if (value && strcmp(item, "dir") == 0) {
+			free(c->dir);
+			c->dir = strdup(value);
+			continue;
+		}
+		v = strtol(value ? value : item, &end, 10);
+		if (*end || end == (value ? value : item))
+			return 0;
+		if (!value && v > 0 && v <= IQCAPTURE_MAX_SEC)
+			c->seconds = v;
+		else if (value && strcmp(item, "crc") == 0 && v > 0 && v <= 100)
+			c->crc_percent = v;
+		else
+			return 0;
+	}
+	if (!c->dir)
+		c->dir = strdup(".");
+	return c->seconds > 0;
+}
+
+void iq_capture_put(struct iq_capture *c, const unsigned char *buf, unsigned int len)
+{
+	unsigned long long head;
+	unsigned int slot;
+
+	if (__atomic_load_n(&c->frozen, __ATOMIC_SEQ_CST))
+		return;
+	head = c->head;
+	slot = head % c->nslots;
+	if (len > c->slot_size)
+		len = c->slot_size;
+	memcpy(c->mem + (size_t)slot * c->slot_size, buf, len);
+	c->slot_len[slot] = len;
+	__atomic_store_n(&c->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Safe to call from a signal handler */
+void iq_capture_request(struct iq_capture *c)
+{
+	c->requested = 1;
+}
+
+/*
+ *	Write the ring, oldest first. The slot a callback may be filling
+ *	right now is the oldest one, it is left out.
+ */
+static void dump(struct iq_capture *c, const char *reason)
+{
+	char path[1024], part[1040], stamp[32];
+	unsigned long long head, i;
+	unsigned int slot;
+	size_t bytes = 0;
+	time_t t = time(NULL);
+	struct tm tm;
+	FILE *f;
+	int ok = 1, n;
+
+	gmtime_r(&t, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(path, sizeof(path), "%s/rtl_ais-%s-%dHz-%dsps.cu8", c->dir, stamp, c->freq, c->rate);
+	for (n = 2; access(path, F_OK) == 0; n++)
+		snprintf(path, sizeof(path), "%s/rtl_ais-%s.%d-%dHz-%dsps.cu8", c->dir, stamp, n, c->freq, c->rate);
+	snprintf(part, sizeof(part), "%s.part", path);
+
+	__atomic_store_n(&c->frozen, 1, __ATOMIC_SEQ_CST);
+	head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+	f = fopen(part, "wb");
+	if (!f) {
+		perror(part);
+		ok = 0;
+	}
+	for (i = head > c->nslots ? head - c->nslots + 1 : 0; ok && i < head; i++) {
+		slot = i % c->nslots;
+		if (fwrite(c->mem + (size_t)slot * c->slot_size, 1, c->slot_len[slot], f) != c->slot_len[slot]) {
+			perror(part);
+			ok = 0;
+		}
+		bytes += c->slot_len[slot];
+	}
+	__atomic_store_n(&c->frozen, 0, __ATOMIC_SEQ_CST);
+
+	if (f && fclose(f) != 0 && ok) {
+		perror(part);
+		ok = 0;
+	}
+	if (ok && rename(part, path) < 0) {
+		perror(path);
+		ok = 0;
+	}
+	if (!ok) {
+		unlink(part);
+		c->errors++;
+		return;
+	}
+	c->dumps++;
+	fprintf(stderr, "IQ capture (%s): %.1f s of samples written to %s\n",
+		reason, bytes / 2.0 / c->rate, path);
+}
+
+/* The CRC failure rate over the window, in percent, or -1 while too few frames were seen */
+static int crc_rate(struct iq_capture *c)
+{
+	unsigned int w = c->second % IQCAPTURE_CRC_WINDOW;
+	unsigned long ok, crc, dok, dcrc;
+
+	ok = METRIC_GET(metrics_demod.frames_ok[0]) + METRIC_GET(metrics_demod.frames_ok[1]);
+	crc = METRIC_GET(metrics_demod.frames_crc[0]) + METRIC_GET(metrics_demod.frames_crc[1]);
+	dok = ok - c->ok[w];
+	dcrc = crc - c->crc[w];
+	c->ok[w] = ok;
+	c->crc[w] = crc;
+	if (++c->second <= IQCAPTURE_CRC_WINDOW || dok + dcrc < IQCAPTURE_CRC_MIN_FRAMES)
+		return -1;
+	return dcrc * 100 / (dok + dcrc);
+}
+
+static void *capture_thread_fn(void *arg)
+{
+	struct iq_capture *c = arg;
+	struct timespec poll = {0, IQCAPTURE_POLL_MS * 1000000L};
+	double next_second = now_ms();
+	char reason[64];
+	int rate, armed = 1;
+
+	while (!c->stop) {
+		nanosleep(&poll, NULL);
+		if (c->requested) {
+			c->requested = 0;
+			dump(c, "requested");
+		}
+		if (now_ms() < next_second)
+			continue;
+		next_second += 1000;
+		rate = crc_rate(c);
+		if (!c->crc_percent || rate < 0)
+			continue;
+		/* One dump per storm, the next after the rate went down again */
+		if (rate < c->crc_percent) {
+			armed = 1;
+		} else if (armed) {
+			snprintf(reason, sizeof(reason), "%d%% CRC failures", rate);
+			dump(c, reason);
+			armed = 0;
+		}
+	}
+	return NULL;
+}
+
+/*
+ *	Allocate the ring for rate samples per second, buffers of buf_len
+ *	bytes, and start the trigger thread. Returns 1 if ok.
+ */
+int iq_capture_start(struct iq_capture *c, int rate, int freq, unsigned int buf_len)
+{
+	unsigned long long bytes = (unsigned long long)c->seconds * rate * 2;
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (mkdir(c->dir, 0755) < 0 && errno != EEXIST) {
+		perror(c->dir);
+		return 0;
+	}
+	c->rate = rate;
+	c->freq = freq;
+	c->slot_size = (buf_len + page - 1) / page * page;
+	c->nslots = (bytes + buf_len - 1) / buf_len + 1;
+	c->slot_len = calloc(c->nslots, sizeof(unsigned int));
+	if (!c->slot_len || posix_memalign((void **)&c->mem, page, (size_t)c->nslots * c->slot_size) != 0) {
+		fprintf(stderr, "Not enough memory for %d s of IQ capture\n", c->seconds);
+		free(c->slot_len);
+		c->slot_len = NULL;
+		c->mem = NULL;
+		return 0;
+	}
+	/* Touch every page now, not in the USB callback */
+	memset(c->mem, 0, (size_t)c->nslots * c->slot_size);
+	if (pthread_create(&c->thread, NULL, capture_thread_fn, c) != 0) {
+		free(c->mem);
+		free(c->slot_len);
+		c->mem = NULL;
+		c->slot_len = NULL;
+		return 0;
+	}
+	fprintf(stderr, "Keeping the last %d s of raw IQ (%llu MB), dumped to %s on SIGUSR1%s\n",
+		c->seconds, (unsigned long long)c->nslots * c->slot_size >> 20, c->dir,
+		c->crc_percent ? " or CRC failures" : "");
+	return 1;
+}
+
+void iq_capture_stop(struct iq_capture *c)
+{
+	if (c->mem) {
+		c->stop = 1;
+		pthread_join(c->thread, NULL);
+	}
+	free(c->mem);
+	free(c->slot_len);
+	free(c->dir);
+	c->mem = NULL;
+	c->slot_len = NULL;
+	c->dir = NULL;
+}
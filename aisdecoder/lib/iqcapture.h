@@ -0,0 +1,65 @@
+/*
+ *	iqcapture.h
+ *
+ *	Ring of the last seconds of raw dongle samples, written to a
+ *	.cu8 file when something goes wrong.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_IQCAPTURE_H
+#define INC_IQCAPTURE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <signal.h>
+#include <pthread.h>
+
+#define IQCAPTURE_MAX_SEC 300
+#define IQCAPTURE_POLL_MS 100		/* triggers are checked this often */
+#define IQCAPTURE_CRC_WINDOW 10		/* seconds the CRC failure rate is taken over */
+#define IQCAPTURE_CRC_MIN_FRAMES 20	/* in the window, fewer never trigger */
+
+struct iq_capture {
+	/* the ring, one slot per USB buffer */
+	unsigned char *mem;		/* nslots * slot_size, page aligned */
+	unsigned int slot_size, nslots;
+	unsigned int *slot_len;
+	unsigned long long head;	/* slots written, only by the USB callback */
+	int frozen;			/* the callback skips the ring while it is dumped */
+
+	char *dir;
+	int seconds, rate, freq;
+	int crc_percent;		/* dump when CRC failures exceed this, 0: never */
+
+	pthread_t thread;
+	int stop;
+	volatile sig_atomic_t requested;
+
+	/* CRC failure rate, per second over the window */
+	unsigned long ok[IQCAPTURE_CRC_WINDOW], crc[IQCAPTURE_CRC_WINDOW];
+	unsigned int second;
+
+	/* statistics */
+	unsigned long dumps, errors;
+};
+
+extern int iq_capture_parse(struct iq_capture *c, const char *spec);
+extern int iq_capture_start(struct iq_capture *c, int rate, int freq, unsigned int buf_len);
+extern void iq_capture_stop(struct iq_capture *c);
+extern void iq_capture_put(struct iq_capture *c, const unsigned char *buf, unsigned int len);
+extern void iq_capture_request(struct iq_capture *c);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,203 @@
+/*
+ *	metrics.c
+ *
+ *	Counters for the /metrics endpoint, in Prometheus text format.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "metrics.h"
+
+struct metrics_usb metrics_usb;
+struct metrics_demod metrics_demod;
+struct metrics_latency metrics_capture;
+struct metrics_latency metrics_send;
+struct metrics_latency metrics_priority;
+
+/* Only changed at startup, before any scrape */
+static metrics_collector collectors[METRICS_MAX_COLLECTORS];
+static int ncollectors = 0;
+
+static const char *stage_names[METRICS_STAGES] = {"downsample", "demodulate", "upsample", "decode"};
+static const int latency_bounds_ms[METRICS_LATENCY_BUCKETS - 1] = METRICS_LATENCY_BOUNDS_MS;
+
+int metrics_add_collector(metrics_collector fn)
+{
+	if (ncollectors == METRICS_MAX_COLLECTORS)
+		return 0;
+	collectors[ncollectors++] = fn;
+	return 1;
+}
+
+void metrics_printf(struct metrics_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	char *p;
+	int n;
+
+	if (out->buf == NULL)
+		return;
+	while (1) {
+		va_start(ap, fmt);
+		n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if ((unsigned int)n < out->size - out->len)
+			break;
+		p = realloc(out->buf, out->size * 2);
+		if (p == NULL) {
+			free(out->buf);
+			out->buf = NULL;
+			return;
+		}
+		out->buf = p;
+		out->size *= 2;
+	}
+	out->len += n;
+}
+
+void metrics_family(struct metrics_out *out, const char *name, const char *type, const char *help)
+{
+	metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void print_decoder(struct metrics_out *out)
+{
+	int c, i;
+
+	metrics_family(out, "rtl_ais_frames_total", "counter", "Received frames by channel and result.");
+	for (c = 0; c < 2; c++) {
+		metrics_printf(out, "rtl_ais_frames_total{channel=\"%c\",result=\"ok\"} %lu\n", 'A' + c, METRIC_GET(metrics_demod.frames_ok[c]));
+		metrics_printf(out, "rtl_ais_frames_total{channel=\"%c\",result=\"crc\"} %lu\n", 'A' + c, METRIC_GET(metrics_demod.frames_crc[c]));
+		metrics_printf(out, "rtl_ais_frames_total{channel=\"%c\",result=\"size\"} %lu\n", 'A' + c, METRIC_GET(metrics_demod.frames_size[c]));
+	}
+	metrics_family(out, "rtl_ais_messages_total", "counter", "Decoded messages by message type.");
+	for (i = 1; i <= METRICS_MAX_TYPE; i++)
+		metrics_printf(out, "rtl_ais_messages_total{type=\"%d\"} %lu\n", i, METRIC_GET(metrics_demod.types[i]));
+	metrics_family(out, "rtl_ais_priority_messages_total", "counter", "Decoded safety messages, sent through the priority lane.");
+	metrics_printf(out, "rtl_ais_priority_messages_total %lu\n", METRIC_GET(metrics_demod.priority));
+	metrics_family(out, "rtl_ais_level_percent", "gauge", "Peak audio level of the last block.");
+	for (c = 0; c < 2; c++)
+		metrics_printf(out, "rtl_ais_level_percent{channel=\"%c\"} %u\n", 'A' + c, METRIC_GET(metrics_demod.level[c]));
+}
+
+static void print_dsp(struct metrics_out *out)
+{
+	int i;
+
+	metrics_family(out, "rtl_ais_usb_buffers_total", "counter", "Sample buffers received from the dongle.");
+	metrics_printf(out, "rtl_ais_usb_buffers_total %lu\n", METRIC_GET(metrics_usb.buffers));
+	metrics_family(out, "rtl_ais_usb_bytes_total", "counter", "Sample bytes received from the dongle.");
+	metrics_printf(out, "rtl_ais_usb_bytes_total %llu\n", METRIC_GET(metrics_usb.bytes));
+	metrics_family(out, "rtl_ais_usb_overruns_total", "counter", "Sample buffers lost because the demodulator fell behind.");
+	metrics_printf(out, "rtl_ais_usb_overruns_total %lu\n", METRIC_GET(metrics_usb.overruns));
+	metrics_family(out, "rtl_ais_usb_reopens_total", "counter", "Times the dongle was reopened after its samples stopped (-W).");
+	metrics_printf(out, "rtl_ais_usb_reopens_total %lu\n", METRIC_GET(metrics_usb.reopens));
+	if (METRIC_GET(metrics_demod.agc)) {
+		metrics_family(out, "rtl_ais_agc_gain_db", "gauge", "Tuner gain set by the AGC (-G).");
+		metrics_printf(out, "rtl_ais_agc_gain_db %.1f\n", METRIC_GET(metrics_demod.gain) / 10.0);
+		metrics_family(out, "rtl_ais_agc_steps_total", "counter", "Gain changes by the AGC (-G).");
+		metrics_printf(out, "rtl_ais_agc_steps_total %lu\n", METRIC_GET(metrics_demod.gain_steps));
+	}
+	if (METRIC_GET(metrics_demod.drift)) {
+		metrics_family(out, "rtl_ais_drift_correction_hz", "gauge", "Frequency error corrected by the drift tracker (-K).");
+		metrics_printf(out, "rtl_ais_drift_correction_hz %d\n", METRIC_GET(metrics_demod.drift_hz));
+	}
+	if (METRIC_GET(metrics_demod.squelch)) {
+		metrics_family(out, "rtl_ais_squelch_skipped_total", "counter", "Blocks the squelch (-q) found idle and did not decode.");
+		for (i = 0; i < 2; i++)
+			metrics_printf(out, "rtl_ais_squelch_skipped_total{channel=\"%c\"} %lu\n", 'A' + i, METRIC_GET(metrics_demod.squelched[i]));
+	}
+	metrics_family(out, "rtl_ais_dsp_blocks_total", "counter", "Sample buffers demodulated.");
+	metrics_printf(out, "rtl_ais_dsp_blocks_total %lu\n", METRIC_GET(metrics_demod.blocks));
+	metrics_family(out, "rtl_ais_dsp_seconds_total", "counter", "Time spent in each demodulator stage.");
+	for (i = 0; i < METRICS_STAGES; i++)
+		metrics_printf(out, "rtl_ais_dsp_seconds_total{stage=\"%s\"} %.6f\n", stage_names[i], METRIC_GET(metrics_demod.stage_ns[i]) / 1e9);
+}
+
+static void print_latency(struct metrics_out *out, const char *name, const char *help, const struct metrics_latency *h)
+{
+	unsigned long count = 0;
+	int i;
+
+	metrics_family(out, name, "histogram", help);
+	for (i = 0; i < METRICS_LATENCY_BUCKETS - 1; i++) {
+		count += METRIC_GET(h->bucket[i]);
+		metrics_printf(out, "%s_bucket{le=\"%g\"} %lu\n", name, latency_bounds_ms[i] / 1000.0, count);
+	}
+	count += METRIC_GET(h->bucket[i]);
+	metrics_printf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, count);
+	metrics_printf(out, "%s_sum %.6f\n", name, METRIC_GET(h->latency_us) / 1e6);
+	metrics_printf(out, "%s_count %lu\n", name, count);
+}
+
+/* Count a latency of ms in h, from any thread */
+void metrics_latency_add(struct metrics_latency *h, double ms)
+{
+	int i;
+
+	if (ms < 0)
+		ms = 0;
+	for (i = 0; i < METRICS_LATENCY_BUCKETS - 1 && ms > latency_bounds_ms[i]; i++)
+		;
+	METRIC_ADD_SHARED(h->bucket[i], 1);
+	METRIC_ADD_SHARED(h->latency_us, (unsigned long long)(ms * 1000));
+}
+
+/*
+ *	The upper bound in ms of the bucket holding the q quantile of h,
+ *	-1 if that is the last bucket, which has none, or h is empty.
+ */
+int metrics_latency_quantile(const struct metrics_latency *h, double q)
+{
+	unsigned long count = 0, n = 0;
+	int i;
+
+	for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		count += METRIC_GET(h->bucket[i]);
+	for (i = 0; i < METRICS_LATENCY_BUCKETS - 1; i++) {
+		n += METRIC_GET(h->bucket[i]);
+		if (count > 0 && n >= q * count)
+			return latency_bounds_ms[i];
+	}
+	return -1;
+}
+
+/*
+ *	All metrics as text, in a buffer the caller frees. Returns NULL
+ *	if out of memory.
+ */
+char *metrics_format(unsigned int *length)
+{
+	struct metrics_out out;
+	int i;
+
+	out.size = 16384;
+	out.len = 0;
+	out.buf = malloc(out.size);
+	print_decoder(&out);
+	print_dsp(&out);
+	print_latency(&out, "rtl_ais_capture_latency_seconds",
+		"From capturing the start of a frame, by the USB buffer time, to the decoder emitting it.", &metrics_capture);
+	print_latency(&out, "rtl_ais_send_latency_seconds",
+		"From the decoder emitting a message to handing it to a socket, per output and TCP client.", &metrics_send);
+	print_latency(&out, "rtl_ais_priority_latency_seconds",
+		"From the decoder emitting a priority message to handing it to a socket, per output and TCP client.", &metrics_priority);
+	for (i = 0; i < ncollectors; i++)
+		collectors[i](&out);
+	*length = out.len;
+	return out.buf;
+}
@@ -0,0 +1,124 @@
+/*
+ *	metrics.h
+ *
+ *	Counters for the /metrics endpoint, in Prometheus text format.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_METRICS_H
+#define INC_METRICS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_MAX_TYPE 27
+#define METRICS_MAX_COLLECTORS 8
+
+/*
+ * Every thread that counts in the hot path has a block of its own,
+ * aligned to a cache line, and is the only writer of it. An update is
+ * then a plain load and store, never a locked instruction, and no
+ * other thread ever writes to the same cache line. The relaxed atomics
+ * only keep the compiler from tearing or caching the values a scrape
+ * reads.
+ */
+#define METRIC_ADD(c, n) __atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED)
+#define METRIC_SET(c, v) __atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#define METRIC_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+/*
+ * Counters written by several threads, the latency histograms of the
+ * outputs, take a locked add. That is cheap at the rate of AIS messages.
+ */
+#define METRIC_ADD_SHARED(c, n) __atomic_fetch_add(&(c), (n), __ATOMIC_RELAXED)
+
+/* Timed stages of the demodulator thread */
+#define METRICS_DOWNSAMPLE 0
+#define METRICS_DEMOD 1
+#define METRICS_UPSAMPLE 2
+#define METRICS_DECODE 3
+#define METRICS_STAGES 4
+
+/* Written by the rtlsdr thread */
+struct metrics_usb {
+	unsigned long buffers;
+	unsigned long long bytes;
+	unsigned long overruns;		/* buffers overwritten before they were demodulated */
+	unsigned long reopens;		/* by the watchdog (-W) after the stream stalled */
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+/* Written by the demodulator thread, which also runs the decoder */
+struct metrics_demod {
+	unsigned long blocks;
+	unsigned long long stage_ns[METRICS_STAGES];
+	unsigned long frames_ok[2];	/* channel A, B */
+	unsigned long frames_crc[2];
+	unsigned long frames_size[2];
+	unsigned long types[METRICS_MAX_TYPE + 1];
+	unsigned int level[2];		/* peak level of the last block, percent */
+	int agc;			/* the AGC (-G) sets the gain */
+	int gain;			/* tuner gain set by the AGC, tenths of dB */
+	unsigned long gain_steps;
+	int drift;			/* the frequency error is tracked (-K) */
+	int drift_hz;			/* correction applied */
+	int squelch;			/* idle channels are skipped (-q) */
+	unsigned long squelched[2];	/* blocks skipped, channel A, B */
+	unsigned long priority;		/* safety messages decoded, see ais_msg_is_priority() */
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+/*
+ * A latency histogram. Upper bounds of the buckets in ms, the last one
+ * has none.
+ */
+#define METRICS_LATENCY_BUCKETS 11
+#define METRICS_LATENCY_BOUNDS_MS {1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500}
+#define METRICS_LATENCY_MAX_MS 2500	/* the last bound */
+
+struct metrics_latency {
+	unsigned long bucket[METRICS_LATENCY_BUCKETS];
+	unsigned long long latency_us;
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+extern struct metrics_usb metrics_usb;
+extern struct metrics_demod metrics_demod;
+/* capture of the frame start, from the USB buffer time, to the decoder emitting it */
+extern struct metrics_latency metrics_capture;
+/* emitted to handed to a socket, per output and TCP client that sent it */
+extern struct metrics_latency metrics_send;
+/* the same for priority messages only */
+extern struct metrics_latency metrics_priority;
+
+/* Text being built for a scrape */
+struct metrics_out {
+	char *buf;
+	unsigned int len, size;
+};
+
+/*
+ * Counters that are kept under a lock anyway, like queue depths, are
+ * not copied into blocks. Their owners register a collector instead,
+ * which is called on every scrape and prints them.
+ */
+typedef void (*metrics_collector)(struct metrics_out *out);
+
+extern int metrics_add_collector(metrics_collector fn);
+extern void metrics_family(struct metrics_out *out, const char *name, const char *type, const char *help);
+extern void metrics_printf(struct metrics_out *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+extern char *metrics_format(unsigned int *length);
+extern void metrics_latency_add(struct metrics_latency *h, double ms);
+extern int metrics_latency_quantile(const struct metrics_latency *h, double q);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
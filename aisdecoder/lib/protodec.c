@@ -27,6 +27,7 @@
 
 #include "protodec.h"
 #include "hmalloc.h"
+#include "metrics.h"
 
 decoder_on_nmea_sentence_received on_nmea_sentence_received = NULL;
 
@@ -236,7 +237,7 @@ void protodec_generate_nmea(struct demod_state_t *d, int bufferlen, int fillbits
 			inc = sprintf(&d->nmea[k + 3], "%02X\r\n", nmeachk);
 		}
 		if (on_nmea_sentence_received != NULL)
-			on_nmea_sentence_received(d->nmea, k + 3 + inc, sentences, sentencenum);
+			on_nmea_sentence_received(d->nmea, k + 3 + inc, sentences, sentencenum, &d->msg);
 	} while (sentencenum < sentences);
 }
 /*void getLetter(struct demod_state_t *d){
@@ -283,6 +284,14 @@ void protodec_getdata(int bufferlen, struct demod_state_t *d)
 		bufferlen = bufferlen + fillbits;
 	}
 
+	ais_msg_decode(&d->msg, d->rbuffer, bufferlen - fillbits, d->chanid);
+	METRIC_ADD(metrics_demod.types[type], 1);
+	/* safety traffic takes the priority lane of the outputs */
+	d->msg.priority = ais_msg_is_priority(&d->msg);
+	if (d->msg.priority)
+		METRIC_ADD(metrics_demod.priority, 1);
+	if (d->block_ms > 0)
+		d->msg.capture_ms = d->block_ms + (long)(d->startsample - d->block_sample - 1) * d->sample_ms;
 	protodec_generate_nmea(d, bufferlen, fillbits, received_t);
 
 	d->seqnr++;
@@ -431,16 +440,19 @@ void protodec_decode(char *in, int count, struct demod_state_t *d, unsigned long
 				if (correct)
 				{
 					d->receivedframes++;
+					METRIC_ADD(metrics_demod.frames_ok[d->chanid == 'B'], 1);
 					protodec_getdata(bufferlength, d);
 				}
 				else
 				{
 					d->lostframes++;
+					METRIC_ADD(metrics_demod.frames_crc[d->chanid == 'B'], 1);
 				}
 			}
 			else
 			{
 				d->lostframes2++;
+				METRIC_ADD(metrics_demod.frames_size[d->chanid == 'B'], 1);
 			}
 			protodec_reset(d);
 			break;
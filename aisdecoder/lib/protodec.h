@@ -23,6 +23,8 @@
 #ifndef INC_PROTODEC_H
 #define INC_PROTODEC_H
 
+#include "aismsg.h"
+
 #define ST_SKURR 1
 #define ST_PREAMBLE 2
 #define ST_STARTSIGN 3
@@ -59,11 +61,16 @@ struct demod_state_t {
 
     unsigned long startsample;
     int add_sample_num;
+    /* capture time of the sample after block_sample, ms on the
+       monotonic clock, 0 if unknown, and of each one after that */
+    double block_ms, sample_ms;
+    unsigned long block_sample;
 
 	struct serial_state_t *serial;
 	
 	char *nmea;
 	unsigned long mmsi;
+	struct ais_msg msg;	/* header of the message being output */
 };
 
 void protodec_initialize(struct demod_state_t *d, struct serial_state_t *serial, char chanid, int add_sample_num,unsigned long mmsi);
@@ -29,6 +29,7 @@
 #include "receiver.h"
 #include "hmalloc.h"
 #include "filter.h"
+#include "metrics.h"
 
 static int sound_levellog=1;
 
@@ -54,7 +55,11 @@ struct receiver *init_receiver(char name, int num_ch, int ch_ofs, int add_sample
 	rx = (struct receiver *) hmalloc(sizeof(struct receiver));
 	memset(rx, 0, sizeof(struct receiver));
 
+#ifdef FIXED_POINT
+	rx->filter = filter_q15_init(COEFFS_L, coeffs);
+#else
 	rx->filter = filter_init(COEFFS_L, coeffs);
+#endif
 
     rx->decoder = hmalloc(sizeof(struct demod_state_t));
 	protodec_initialize(rx->decoder, NULL, name, add_sample_num,mmsi);
@@ -74,7 +79,11 @@ struct receiver *init_receiver(char name, int num_ch, int ch_ofs, int add_sample
 void free_receiver(struct receiver *rx)
 {
 	if (rx) {
+#ifdef FIXED_POINT
+		filter_q15_free(rx->filter);
+#else
 		filter_free(rx->filter);
+#endif
 		hfree(rx);
 	}
 }
@@ -82,27 +91,33 @@ void free_receiver(struct receiver *rx)
 #define	INC	16
 #define FILTERED_LEN 8192
 
-void receiver_run(struct receiver *rx, short *buf, int len)
+/*
+ * Built with -DFIXED_POINT (make FIXED_POINT=1) the filter, the slicer
+ * and the level take no floating point, which CPUs without an FPU
+ * emulate at a fraction of the speed.
+ */
+static short receiver_process(struct receiver *rx, short *buf, int step, int len)
 {
+#ifdef FIXED_POINT
+	int out;
+	int filtered[FILTERED_LEN];
+#else
 	float out;
+	float filtered[FILTERED_LEN];
+#endif
 	int curr, bit;
 	char b;
 	short maxval = 0;
-	int level_distance;
-	float level;
-	int rx_num_ch = rx->num_ch;
-    float filtered[FILTERED_LEN];
 	int i;
 	
-	/* len is number of samples available in buffer for each
-	 * channels - something like 1024, regardless of number of channels */
-	
-	buf += rx->ch_ofs;
-	
 	if (len > FILTERED_LEN)
 		abort();
 
-	maxval = filter_run_buf(rx->filter, buf, filtered, rx_num_ch, len);
+#ifdef FIXED_POINT
+	maxval = filter_q15_run_buf(rx->filter, buf, filtered, step, len);
+#else
+	maxval = filter_run_buf(rx->filter, buf, filtered, step, len);
+#endif
 	
 	for (i = 0; i < len; i++) {
         rx->samplenum++;
@@ -133,12 +148,32 @@ void receiver_run(struct receiver *rx, short *buf, int len)
 			rx->pll &= 0xffff;
 		}
 	}
-	
+
+	return maxval;
+}
+
+static void receiver_level(struct receiver *rx, short maxval)
+{
+#ifdef FIXED_POINT
+	int level;
+#else
+	float level;
+#endif
+	int high;
+	int level_distance;
+
 	/* calculate level, and log it */
+#ifdef FIXED_POINT
+	level = maxval * 100 / 32768;
+	high = maxval * 100 > 95 * 32768;
+#else
 	level = (float)maxval / (float)32768 * (float)100;
+	high = level > 95.0;
+#endif
+	METRIC_SET(metrics_demod.level[rx->ch_ofs & 1], (unsigned int)level);
 	level_distance = time(NULL) - rx->last_levellog;
 	
-    if (level > 95.0 && (level_distance >= 30 || level_distance >= sound_levellog)) {
+    if (high && (level_distance >= 30 || level_distance >= sound_levellog)) {
         if (on_sound_level_changed != NULL) on_sound_level_changed(level, rx->ch_ofs, 1);
         time(&rx->last_levellog);
     } else if (sound_levellog != 0 && level_distance >= sound_levellog) {
@@ -147,3 +182,64 @@ void receiver_run(struct receiver *rx, short *buf, int len)
     }
 }
 
+void receiver_run(struct receiver *rx, short *buf, int len)
+{
+	/* len is number of samples available in buffer for each
+	 * channels - something like 1024, regardless of number of channels */
+	
+	buf += rx->ch_ofs;
+
+	/* the end of what the squelch skipped, a frame may start there,
+	 * with the bit clock taken back to its start */
+	if (rx->prerolled > 0) {
+		rx->samplenum -= rx->prerolled;
+		rx->pll = (rx->pll - rx->pllinc * rx->prerolled) & 0xffff;
+		receiver_process(rx, rx->preroll, 1, rx->prerolled);
+		rx->prerolled = 0;
+	}
+
+	receiver_level(rx, receiver_process(rx, buf, rx->num_ch, len));
+}
+
+/*
+ * Samples the squelch found idle: counted, so the sample numbers stay
+ * right, and the last RECEIVER_PREROLL of them kept for receiver_run().
+ * The bit clock runs on as it would in noise, and the deframer starts
+ * over, it may be in a frame it found in noise.
+ */
+void receiver_skip(struct receiver *rx, short *buf, int len)
+{
+	short maxval = 0;
+	int i, keep;
+
+	buf += rx->ch_ofs;
+	for (i = 0; i < len; i++)
+		if (buf[i * rx->num_ch] > maxval)
+			maxval = buf[i * rx->num_ch];
+
+	keep = len < RECEIVER_PREROLL ? len : RECEIVER_PREROLL;
+	if (rx->prerolled + keep > RECEIVER_PREROLL) {
+		memmove(rx->preroll, rx->preroll + rx->prerolled + keep - RECEIVER_PREROLL,
+			(RECEIVER_PREROLL - keep) * sizeof(short));
+		rx->prerolled = RECEIVER_PREROLL - keep;
+	}
+	for (i = len - keep; i < len; i++)
+		rx->preroll[rx->prerolled++] = buf[i * rx->num_ch];
+
+	protodec_reset(rx->decoder);
+	rx->pll = (rx->pll + rx->pllinc * len) & 0xffff;
+	rx->samplenum += len;
+	receiver_level(rx, maxval);
+}
+
+/*
+ * The next samples were captured at first_ms on the monotonic clock, and
+ * each sample_ms after the one before. Frames started before them, in
+ * the preroll or an earlier block, are timed back from there.
+ */
+void receiver_stamp(struct receiver *rx, double first_ms, double sample_ms)
+{
+	rx->decoder->block_ms = first_ms;
+	rx->decoder->sample_ms = sample_ms;
+	rx->decoder->block_sample = rx->samplenum;
+}
@@ -35,8 +35,14 @@ extern "C" {
 #include "protodec.h"
 #include "callbacks.h"
 
+#define RECEIVER_PREROLL 1024	/* samples run before a block after the squelch skipped */
+
 struct receiver {
+#ifdef FIXED_POINT
+	struct filter_q15 *filter;
+#else
 	struct filter *filter;
+#endif
 	char name;
 	int lastbit;
 	int num_ch;
@@ -48,12 +54,16 @@ struct receiver {
 	time_t last_levellog;
     unsigned long samplenum;
 	unsigned long mmsi;
+	short preroll[RECEIVER_PREROLL];
+	int prerolled;
 };
 
 extern struct receiver *init_receiver(char name, int num_ch, int ch_ofs, int add_sample_num,unsigned long mmsi);
 extern void free_receiver(struct receiver *rx);
 
 extern void receiver_run(struct receiver *rx, short *buf, int len);
+extern void receiver_skip(struct receiver *rx, short *buf, int len);
+extern void receiver_stamp(struct receiver *rx, double first_ms, double sample_ms);
 
 #ifdef __cplusplus
 }
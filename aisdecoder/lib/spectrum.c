@@ -0,0 +1,276 @@
+/*
+ *	spectrum.c
+ *
+ *	A look at the whole band the dongle captures, for finding the
+ *	interference that costs frames: the power spectrum, averaged over
+ *	an interval and appended to a file as one rtl_power CSV line,
+ *	which heatmap/heatmap.py turns into a waterfall.
+ *
+ *	The demodulator thread offers the first bins complex samples of
+ *	each buffer, while it holds the buffer anyway; they are copied
+ *	into a small ring if a slot is free and dropped otherwise, so the
+ *	decoder never waits and never copies more than a few kB. Taking
+ *	one frame per buffer decimates in time, a few hundred
+ *	milliseconds of a ten second interval are plenty for an average.
+ *	A thread of its own windows (Hann) and transforms the frames and
+ *	writes the lines.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "spectrum.h"
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ *	Parse the -e spec, items separated by ';':
+ *	  path         the CSV file, appended to
+ *	  bins=N       FFT size, a power of two (default: 512)
+ *	  interval=s   seconds averaged per line (default: 10)
+ *	Returns 1 if ok, 0 if the spec is invalid.
+ */
+int spectrum_parse(struct spectrum *s, const char *spec)
+{
+	char item[1024], *value, *end;
+	const char *p = spec, *next;
+	long v;
+	int len;
+
+	memset(s, 0, sizeof(*s));
+	s->bins = SPECTRUM_DEFAULT_BINS;
+	s->interval = SPECTRUM_DEFAULT_INTERVAL;
+	while (*p) {
+		next = strchr(p, ';');
+		len = next ? next - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			return 0;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = next ? next + 1 : p + len;
+		if (len == 0)
+			continue;
+
+		value = strchr(item, '=');
+		if (!value) {
+			free(s->path);
+			s->path = strdup(item);
+			continue;
+		}
+		*value++ = 0;
+		v = strtol(value, &end, 10);
+		if (*end || end == value)
+			return 0;
+		if (strcmp(item, "bins") == 0 && v >= SPECTRUM_MIN_BINS && v <= SPECTRUM_MAX_BINS && !(v & (v - 1)))
+			s->bins = v;
+		else if (strcmp(item, "interval") == 0 && v >= 1 && v <= SPECTRUM_MAX_INTERVAL)
+			s->interval = v;
+		else
+			return 0;
+	}
+	return s->path != NULL;
+}
+
+/* Offer len interleaved I/Q values, takes the first bins complex samples */
+void spectrum_put(struct spectrum *s, const int16_t *iq, int len)
+{
+	unsigned long long head = s->head;
+
+	if (len < 2 * s->bins)
+		return;
+	if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >= SPECTRUM_SLOTS) {
+		s->dropped++;
+		return;
+	}
+	memcpy(s->slots + (size_t)(head % SPECTRUM_SLOTS) * 2 * s->bins, iq, 2 * s->bins * sizeof(int16_t));
+	__atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* In place radix-2 FFT of re/im, bins long */
+static void fft(struct spectrum *s)
+{
+	float *re = s->re, *im = s->im, tr, ti, c, si;
+	int n = s->bins, i, j, k, m, half;
+
+	for (i = 1, j = 0; i < n; i++) {
+		for (k = n >> 1; j & k; k >>= 1)
+			j ^= k;
+		j |= k;
+		if (i < j) {
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+	for (m = 2; m <= n; m <<= 1) {
+		half = m >> 1;
+		for (i = 0; i < n; i += m) {
+			for (j = 0; j < half; j++) {
+				c = s->cos_sin[2 * (j * (n / m))];
+				si = s->cos_sin[2 * (j * (n / m)) + 1];
+				k = i + j + half;
+				tr = re[k] * c + im[k] * si;
+				ti = im[k] * c - re[k] * si;
+				re[k] = re[i + j] - tr;
+				im[k] = im[i + j] - ti;
+				re[i + j] += tr;
+				im[i + j] += ti;
+			}
+		}
+	}
+}
+
+static void add_frame(struct spectrum *s, const int16_t *iq)
+{
+	int i;
+
+	for (i = 0; i < s->bins; i++) {
+		s->re[i] = iq[2 * i] * s->window[i];
+		s->im[i] = iq[2 * i + 1] * s->window[i];
+	}
+	fft(s);
+	for (i = 0; i < s->bins; i++)
+		s->power[i] += (double)s->re[i] * s->re[i] + (double)s->im[i] * s->im[i];
+	s->frames++;
+}
+
+/*
+ *	One line for the interval that started at t, lowest frequency
+ *	first: the upper half of the FFT holds the negative ones. dB are
+ *	relative to a full scale sine in the bin.
+ */
+static void write_line(struct spectrum *s, time_t t)
+{
+	char stamp[32];
+	double full = 0, p;
+	struct tm tm;
+	int i, k, freq = __atomic_load_n(&s->freq, __ATOMIC_RELAXED);
+
+	for (i = 0; i < s->bins; i++)
+		full += s->window[i];
+	full = full * 128 * full * 128;
+
+	localtime_r(&t, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d, %H:%M:%S", &tm);
+	fprintf(s->file, "%s, %d, %d, %.2f, %lu", stamp, freq - s->rate / 2, freq + s->rate / 2,
+		(double)s->rate / s->bins, s->frames * s->bins);
+	for (i = 0; i < s->bins; i++) {
+		k = (i + s->bins / 2) % s->bins;
+		p = s->power[k] / s->frames / full;
+		fprintf(s->file, ", %.2f", 10 * log10(p > 1e-20 ? p : 1e-20));
+	}
+	fputc('\n', s->file);
+	if (fflush(s->file) != 0)
+		perror(s->path);
+	s->lines++;
+}
+
+static void *spectrum_thread_fn(void *arg)
+{
+	struct spectrum *s = arg;
+	struct timespec poll = {0, SPECTRUM_POLL_MS * 1000000L};
+	double next_line = now_ms() + s->interval * 1000.0;
+	time_t start = time(NULL);
+	unsigned long long head;
+
+	while (!s->stop) {
+		nanosleep(&poll, NULL);
+		head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+		while (s->tail < head) {
+			add_frame(s, s->slots + (size_t)(s->tail % SPECTRUM_SLOTS) * 2 * s->bins);
+			__atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+		}
+		if (now_ms() < next_line)
+			continue;
+		next_line += s->interval * 1000.0;
+		if (s->frames)
+			write_line(s, start);
+		memset(s->power, 0, s->bins * sizeof(double));
+		s->frames = 0;
+		start = time(NULL);
+	}
+	/* the last, shorter interval */
+	if (s->frames)
+		write_line(s, start);
+	return NULL;
+}
+
+/*
+ *	Open the file and start the thread for a dongle at freq, rate
+ *	samples per second. Returns 1 if ok.
+ */
+int spectrum_start(struct spectrum *s, int rate, int freq)
+{
+	int i;
+
+	s->rate = rate;
+	s->freq = freq;
+	s->slots = malloc((size_t)SPECTRUM_SLOTS * 2 * s->bins * sizeof(int16_t));
+	s->window = malloc(s->bins * sizeof(float));
+	s->cos_sin = malloc(s->bins * sizeof(float));
+	s->re = malloc(s->bins * sizeof(float));
+	s->im = malloc(s->bins * sizeof(float));
+	s->power = calloc(s->bins, sizeof(double));
+	if (!s->slots || !s->window || !s->cos_sin || !s->re || !s->im || !s->power) {
+		fprintf(stderr, "Not enough memory for a %d bin spectrum\n", s->bins);
+		spectrum_stop(s);
+		return 0;
+	}
+	for (i = 0; i < s->bins; i++)
+		s->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / s->bins);
+	for (i = 0; i < s->bins / 2; i++) {
+		s->cos_sin[2 * i] = cos(2 * M_PI * i / s->bins);
+		s->cos_sin[2 * i + 1] = sin(2 * M_PI * i / s->bins);
+	}
+	s->file = fopen(s->path, "a");
+	if (!s->file) {
+		perror(s->path);
+		spectrum_stop(s);
+		return 0;
+	}
+	if (pthread_create(&s->thread, NULL, spectrum_thread_fn, s) != 0) {
+		fclose(s->file);
+		s->file = NULL;
+		spectrum_stop(s);
+		return 0;
+	}
+	fprintf(stderr, "Spectrum: %d bins of %.0f Hz every %d s appended to %s\n",
+		s->bins, (double)rate / s->bins, s->interval, s->path);
+	return 1;
+}
+
+/* Also frees what a failed spectrum_start() left */
+void spectrum_stop(struct spectrum *s)
+{
+	if (s->file) {
+		s->stop = 1;
+		pthread_join(s->thread, NULL);
+		fclose(s->file);
+	}
+	free(s->slots);
+	free(s->window);
+	free(s->cos_sin);
+	free(s->re);
+	free(s->im);
+	free(s->power);
+	free(s->path);
+	memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,67 @@
+/*
+ *	spectrum.h
+ *
+ *	Power spectrum of the band the dongle captures, averaged and
+ *	written as rtl_power CSV lines for heatmap/heatmap.py.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_SPECTRUM_H
+#define INC_SPECTRUM_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SPECTRUM_DEFAULT_BINS 512
+#define SPECTRUM_MIN_BINS 16
+#define SPECTRUM_MAX_BINS 16384
+#define SPECTRUM_DEFAULT_INTERVAL 10	/* seconds per CSV line */
+#define SPECTRUM_MAX_INTERVAL 3600
+#define SPECTRUM_SLOTS 8		/* frames waiting for the FFT */
+#define SPECTRUM_POLL_MS 50
+
+struct spectrum {
+	/* settings */
+	char *path;
+	int bins, interval;
+	int rate, freq;			/* of the dongle, freq may change on a reload */
+
+	/* frames of bins complex samples, one per buffer at most */
+	int16_t *slots;
+	unsigned long long head;	/* frames written, only by the demodulator */
+	unsigned long long tail;	/* frames taken, only by the spectrum thread */
+
+	/* the FFT, run by the spectrum thread */
+	float *window, *cos_sin, *re, *im;
+	double *power;			/* summed over the frames of the interval */
+	unsigned long frames;
+
+	FILE *file;
+	pthread_t thread;
+	int stop;
+
+	/* statistics */
+	unsigned long lines, dropped;
+};
+
+extern int spectrum_parse(struct spectrum *s, const char *spec);
+extern int spectrum_start(struct spectrum *s, int rate, int freq);
+extern void spectrum_stop(struct spectrum *s);
+extern void spectrum_put(struct spectrum *s, const int16_t *iq, int len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,398 @@
+/*
+ *	spool.c
+ *
+ *	On-disk store-and-forward log for outputs whose link is down.
+ *
+ *	The spool is a directory of segment files, 0000000001.nmea,
+ *	0000000002.nmea and so on, holding plain NMEA text. Appends are
+ *	collected in memory and written in large blocks, and the disk is
+ *	synced at most every SPOOL_SYNC_MS, so a spool costs a few
+ *	sequential writes per second. Segments are replayed in order and
+ *	removed once replayed. When the spool would grow beyond its limit
+ *	the oldest segment is dropped.
+ *
+ *	Delivery is at least once: what was read but not confirmed sent
+ *	is read again. The reading position is saved in the file "cursor"
+ *	on close, after a crash the oldest segment is replayed from its
+ *	start.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+static void segment_path(struct spool *sp, unsigned long seq, char *path, unsigned int size)
+{
+	snprintf(path, size, "%s/%010lu.nmea", sp->dir, seq);
+}
+
+static int open_segment(struct spool *sp, unsigned long seq)
+{
+	char path[1024];
+	int fd;
+
+	segment_path(sp, seq, path, sizeof(path));
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_TRUNC, 0644);
+	if (fd < 0)
+		perror(path);
+	return fd;
+}
+
+/* A segment of this size was removed */
+static void forget(struct spool *sp, off_t size)
+{
+	if ((unsigned long long)size > sp->disk_bytes)
+		size = sp->disk_bytes;
+	sp->disk_bytes -= size;
+}
+
+/* Write out the append buffer. Data that cannot be written is dropped. */
+static void write_buffer(struct spool *sp)
+{
+	unsigned int done = 0;
+	ssize_t n;
+
+	while (done < sp->wlen) {
+		n = write(sp->wfd, sp->wbuf + done, sp->wlen - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror(sp->dir);
+			sp->dropped += sp->wlen - done;
+			break;
+		}
+		done += n;
+	}
+	sp->wsize += done;
+	sp->disk_bytes += done;
+	sp->unsynced = 1;
+	sp->wlen = 0;
+}
+
+/* Start a new segment when the current one is full */
+static void rotate(struct spool *sp)
+{
+	int fd;
+
+	if (sp->wsize < sp->segment_bytes)
+		return;
+	fd = open_segment(sp, sp->wseq + 1);
+	if (fd < 0)
+		return;
+	fdatasync(sp->wfd);
+	close(sp->wfd);
+	sp->wfd = fd;
+	sp->wseq++;
+	sp->wsize = 0;
+	sp->unsynced = 0;
+}
+
+/* Drop the oldest segments while the spool is over its limit */
+static void enforce_limit(struct spool *sp)
+{
+	char path[1024];
+	struct stat st;
+
+	while (sp->disk_bytes > sp->max_bytes && sp->first_seq < sp->wseq) {
+		segment_path(sp, sp->first_seq, path, sizeof(path));
+		if (stat(path, &st) == 0) {
+			forget(sp, st.st_size);
+			if (sp->rseq <= sp->first_seq) {
+				sp->dropped += st.st_size - sp->roff;
+				if (sp->rfd >= 0)
+					close(sp->rfd);
+				sp->rfd = -1;
+				sp->roff = 0;
+			}
+			unlink(path);
+		}
+		sp->first_seq++;
+		if (sp->rseq < sp->first_seq)
+			sp->rseq = sp->first_seq;
+	}
+}
+
+static void cursor_path(struct spool *sp, char *path, unsigned int size)
+{
+	snprintf(path, size, "%s/cursor", sp->dir);
+}
+
+/* Continue where the last run stopped, if it closed the spool cleanly */
+static void load_cursor(struct spool *sp)
+{
+	char path[1024];
+	unsigned long seq;
+	unsigned long long off;
+	FILE *f;
+
+	cursor_path(sp, path, sizeof(path));
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (fscanf(f, "%lu %llu", &seq, &off) == 2 && seq == sp->first_seq && seq < sp->wseq)
+		sp->roff = off;
+	fclose(f);
+	unlink(path);
+}
+
+static void save_cursor(struct spool *sp)
+{
+	char path[1024];
+	FILE *f;
+
+	cursor_path(sp, path, sizeof(path));
+	if (spool_empty(sp)) {
+		/* Everything was sent, nothing to replay next time */
+		unlink(path);
+		segment_path(sp, sp->wseq, path, sizeof(path));
+		unlink(path);
+		return;
+	}
+	f = fopen(path, "w");
+	if (!f)
+		return;
+	fprintf(f, "%lu %llu\n", sp->rseq, sp->roff);
+	fclose(f);
+}
+
+/*
+ *	Open the spool in dir, creating the directory if needed. Segments
+ *	left from an earlier run are kept and replayed first. Returns 1 if
+ *	ok, 0 on error.
+ */
+int spool_open(struct spool *sp, const char *dir, unsigned long long max_bytes, double now)
+{
+	char path[1024];
+	struct dirent *e;
+	struct stat st;
+	unsigned long seq;
+	DIR *d;
+
+	memset(sp, 0, sizeof(*sp));
+	sp->rfd = sp->wfd = -1;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return 0;
+	}
+	d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return 0;
+	}
+	sp->dir = strdup(dir);
+	sp->segment_bytes = max_bytes / 8;
+	if (sp->segment_bytes < SPOOL_MIN_SEGMENT)
+		sp->segment_bytes = SPOOL_MIN_SEGMENT;
+	if (sp->segment_bytes > SPOOL_MAX_SEGMENT)
+		sp->segment_bytes = SPOOL_MAX_SEGMENT;
+	sp->max_bytes = max_bytes > 2ULL * sp->segment_bytes ? max_bytes : 2ULL * sp->segment_bytes;
+
+	while ((e = readdir(d)) != NULL) {
+		if (strspn(e->d_name, "0123456789") != 10 || strcmp(e->d_name + 10, ".nmea") != 0)
+			continue;
+		seq = strtoul(e->d_name, NULL, 10);
+		if (seq == 0)
+			continue;
+		segment_path(sp, seq, path, sizeof(path));
+		if (stat(path, &st) < 0)
+			continue;
+		if (sp->first_seq == 0 || seq < sp->first_seq)
+			sp->first_seq = seq;
+		if (seq > sp->wseq)
+			sp->wseq = seq;
+		sp->disk_bytes += st.st_size;
+	}
+	closedir(d);
+	if (sp->first_seq == 0)
+		sp->first_seq = 1;
+	/* Never append to a segment of an earlier run, it may end in a torn line */
+	sp->wseq++;
+	sp->rseq = sp->first_seq;
+	load_cursor(sp);
+
+	sp->wbuf = malloc(SPOOL_WRITE_BUF);
+	sp->wfd = open_segment(sp, sp->wseq);
+	if (!sp->wbuf || sp->wfd < 0) {
+		spool_close(sp);
+		return 0;
+	}
+	sp->last_sync = now;
+	enforce_limit(sp);
+	return 1;
+}
+
+void spool_close(struct spool *sp)
+{
+	if (sp->wfd >= 0) {
+		spool_flush(sp, 0, 1);
+		save_cursor(sp);
+		close(sp->wfd);
+	}
+	if (sp->rfd >= 0)
+		close(sp->rfd);
+	free(sp->wbuf);
+	free(sp->dir);
+	sp->wbuf = NULL;
+	sp->dir = NULL;
+	sp->rfd = sp->wfd = -1;
+}
+
+/* Add whole messages at the end. Returns 1, or 0 if they were dropped. */
+int spool_append(struct spool *sp, const char *data, unsigned int length, double now)
+{
+	if (length > SPOOL_WRITE_BUF) {
+		sp->dropped += length;
+		return 0;
+	}
+	if (sp->wlen + length > SPOOL_WRITE_BUF) {
+		write_buffer(sp);
+		rotate(sp);
+		enforce_limit(sp);
+	}
+	if (sp->wlen == 0)
+		sp->first_unflushed = now;
+	memcpy(sp->wbuf + sp->wlen, data, length);
+	sp->wlen += length;
+	sp->spooled += length;
+	return 1;
+}
+
+/*
+ *	Write out appends older than SPOOL_FLUSH_MS and sync the disk
+ *	every SPOOL_SYNC_MS, or do both now with force.
+ */
+void spool_flush(struct spool *sp, double now, int force)
+{
+	if (sp->wlen > 0 && (force || now - sp->first_unflushed >= SPOOL_FLUSH_MS)) {
+		write_buffer(sp);
+		rotate(sp);
+		enforce_limit(sp);
+	}
+	if (sp->unsynced && (force || now - sp->last_sync >= SPOOL_SYNC_MS)) {
+		fdatasync(sp->wfd);
+		sp->syncs++;
+		sp->unsynced = 0;
+		sp->last_sync = now;
+	}
+}
+
+/* Milliseconds until spool_flush has work to do, or -1 if never */
+int spool_flush_timeout(struct spool *sp, double now)
+{
+	double t;
+
+	if (sp->wlen == 0 && !sp->unsynced)
+		return -1;
+	if (sp->wlen > 0)
+		t = sp->first_unflushed + SPOOL_FLUSH_MS - now;
+	else
+		t = sp->last_sync + SPOOL_SYNC_MS - now;
+	if (sp->wlen > 0 && sp->unsynced && sp->last_sync + SPOOL_SYNC_MS - now < t)
+		t = sp->last_sync + SPOOL_SYNC_MS - now;
+	return t < 0 ? 0 : (int)t + 1;
+}
+
+int spool_empty(struct spool *sp)
+{
+	return sp->rseq == sp->wseq && sp->roff >= sp->wsize && sp->wlen == 0;
+}
+
+/*
+ *	Read the oldest data not read yet, whole lines of at most size
+ *	bytes, all from one segment. Returns the length, 0 if there is
+ *	nothing to read.
+ */
+unsigned int spool_read(struct spool *sp, char *buf, unsigned int size)
+{
+	char path[1024];
+	struct stat st;
+	ssize_t n;
+	unsigned int len;
+
+	while (1) {
+		if (sp->rseq == sp->wseq && sp->roff >= sp->wsize) {
+			if (sp->wlen == 0) {
+				/* Caught up, reuse the segment from its start */
+				if (sp->wsize > 0 && ftruncate(sp->wfd, 0) == 0) {
+					sp->disk_bytes -= sp->wsize;
+					sp->wsize = sp->roff = 0;
+				}
+				return 0;
+			}
+			write_buffer(sp);
+		}
+		if (sp->rfd < 0) {
+			segment_path(sp, sp->rseq, path, sizeof(path));
+			sp->rfd = open(path, O_RDONLY);
+			if (sp->rfd < 0) {
+				if (sp->rseq == sp->wseq)
+					return 0;
+				sp->rseq++;	/* a missing segment */
+				sp->first_seq = sp->rseq;
+				sp->roff = 0;
+				continue;
+			}
+		}
+		n = pread(sp->rfd, buf, size, sp->roff);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (sp->rseq == sp->wseq)
+				return 0;
+			/* An old segment is done, remove it */
+			if (fstat(sp->rfd, &st) == 0)
+				forget(sp, st.st_size);
+			close(sp->rfd);
+			sp->rfd = -1;
+			segment_path(sp, sp->rseq, path, sizeof(path));
+			unlink(path);
+			sp->rseq++;
+			sp->first_seq = sp->rseq;
+			sp->roff = 0;
+			continue;
+		}
+		for (len = n; len > 0 && buf[len - 1] != '\n'; len--)
+			;
+		if (len == 0) {
+			if ((unsigned int)n == size) {
+				len = n;	/* a line longer than buf, should not happen */
+			} else if (sp->rseq < sp->wseq) {
+				/* A torn line at the end of an old segment */
+				sp->roff += n;
+				sp->dropped += n;
+				continue;
+			} else {
+				return 0;
+			}
+		}
+		sp->roff += len;
+		sp->replayed += len;
+		return len;
+	}
+}
+
+/* Give back the last length bytes of the last spool_read */
+void spool_unread(struct spool *sp, unsigned int length)
+{
+	if (length > sp->roff)
+		length = sp->roff;	/* the segment was dropped meanwhile */
+	sp->roff -= length;
+	sp->replayed -= length;
+}
@@ -0,0 +1,68 @@
+/*
+ *	spool.h
+ *
+ *	On-disk store-and-forward log for outputs whose link is down.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_SPOOL_H
+#define INC_SPOOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPOOL_WRITE_BUF (64 * 1024)	/* appends are written in blocks of this size */
+#define SPOOL_FLUSH_MS 1000		/* at the latest after this long */
+#define SPOOL_SYNC_MS 5000		/* and synced to disk this often */
+#define SPOOL_MIN_SEGMENT (64 * 1024)
+#define SPOOL_MAX_SEGMENT (4 * 1024 * 1024)
+#define SPOOL_DEFAULT_MB 256
+
+struct spool {
+	char *dir;
+	unsigned long long max_bytes;	/* on disk, including what was not replayed yet */
+	unsigned int segment_bytes;
+
+	/* segments first_seq .. wseq exist, wseq is being written */
+	unsigned long first_seq, wseq;
+	unsigned long long disk_bytes;	/* in all segment files */
+	int wfd;
+	unsigned long long wsize;	/* bytes in segment wseq, on disk */
+	char *wbuf;
+	unsigned int wlen;
+	double first_unflushed;		/* ms, time of the oldest data in wbuf */
+	double last_sync;
+	int unsynced;
+
+	/* reading position */
+	int rfd;
+	unsigned long rseq;
+	unsigned long long roff;
+
+	/* statistics, in bytes */
+	unsigned long long spooled, replayed, dropped;
+	unsigned long syncs;
+};
+
+extern int spool_open(struct spool *sp, const char *dir, unsigned long long max_bytes, double now);
+extern void spool_close(struct spool *sp);
+extern int spool_append(struct spool *sp, const char *data, unsigned int length, double now);
+extern void spool_flush(struct spool *sp, double now, int force);
+extern int spool_flush_timeout(struct spool *sp, double now);
+extern int spool_empty(struct spool *sp);
+extern unsigned int spool_read(struct spool *sp, char *buf, unsigned int size);
+extern void spool_unread(struct spool *sp, unsigned int length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
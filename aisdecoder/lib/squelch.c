@@ -0,0 +1,85 @@
+/*
+ *	squelch.c
+ *
+ *	Most of the time an AIS channel carries nothing but noise, and
+ *	the receiver still filters it, tracks its bit clock and hands
+ *	every bit to the deframer, which keeps finding preambles in it.
+ *	At a quiet site that is nearly all of the CPU time.
+ *
+ *	Each block of channel samples, taken where they are decimated,
+ *	is cut into windows of SQUELCH_WINDOW samples and their mean
+ *	power compared to the noise floor: the quietest window, followed
+ *	quickly down and slowly up so frames do not lift it. A block
+ *	with a window above the floor by the threshold opens the channel
+ *	for itself and SQUELCH_HANG blocks after it, for the tail of a
+ *	frame that runs over the end of the block. The start of a frame
+ *	in the block before is covered by the receiver's pre-roll.
+ *
+ *	Integer arithmetic only, it runs in the FIXED_POINT build too.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "squelch.h"
+
+/* Open db above the noise floor, 1 to 30. Returns 1 if ok. */
+int squelch_start(struct squelch *s, int db)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if (db < 1 || db > 30)
+		return 0;
+	s->db = db;
+	/* 10^(db/10) in Q8, by steps of 1 dB */
+	s->ratio = 256;
+	for (i = 0; i < db; i++)
+		s->ratio = s->ratio * 10313 / 8192;
+	s->ch[0].noise = s->ch[1].noise = -1;
+	return 1;
+}
+
+/*
+ *	A block of len interleaved I/Q values of channel c. Returns 1 if
+ *	the channel is to be decoded.
+ */
+int squelch_measure(struct squelch *s, int c, const int16_t *iq, int len)
+{
+	struct squelch_channel *ch = &s->ch[c];
+	int64_t power, low = -1, high = 0;
+	int i, j, n = len / 2;
+
+	for (i = 0; i + SQUELCH_WINDOW <= n; i += SQUELCH_WINDOW) {
+		power = 0;
+		for (j = 2 * i; j < 2 * (i + SQUELCH_WINDOW); j += 2)
+			power += (int32_t)iq[j] * iq[j] + (int32_t)iq[j + 1] * iq[j + 1];
+		if (low < 0 || power < low)
+			low = power;
+		if (power > high)
+			high = power;
+	}
+	if (low < 0)
+		return 1;
+	if (ch->noise < 0 || low < ch->noise)
+		ch->noise = low;
+	else
+		ch->noise += (low - ch->noise) / 16;
+
+	if (high * 256 > (ch->noise + SQUELCH_WINDOW) * s->ratio)
+		ch->hang = SQUELCH_HANG + 1;
+	if (ch->hang > 0) {
+		ch->hang--;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *	squelch.h
+ *
+ *	Energy detection on the channels, so idle ones skip the receiver
+ *	and the deframer.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_SQUELCH_H
+#define INC_SQUELCH_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SQUELCH_WINDOW 64		/* complex samples the power is averaged over */
+#define SQUELCH_HANG 1			/* blocks kept open after the last one with energy */
+
+struct squelch_channel {
+	int64_t noise;			/* power of the quietest window, per window, smoothed */
+	int hang;			/* blocks left open */
+};
+
+struct squelch {
+	int db;
+	int64_t ratio;			/* above the noise floor, Q8 */
+	struct squelch_channel ch[2];
+};
+
+extern int squelch_start(struct squelch *s, int db);
+extern int squelch_measure(struct squelch *s, int c, const int16_t *iq, int len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,171 @@
+/*
+ *	stats_shm.c
+ *
+ *	Statistics page in shared memory, for local monitoring tools.
+ *
+ *	The page is a POSIX shared memory object when the name has no
+ *	'/' after the first character, like "/rtl_ais", or else a file
+ *	that is mapped, like "/run/rtl_ais.stats". One writer updates it
+ *	under a sequence lock, so readers never block the writer and
+ *	never see a half written update.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats_shm.h"
+
+/* Start of the part protected by seq */
+#define BODY offsetof(struct stats_shm, started)
+
+static int is_shm_name(const char *name)
+{
+	return name[0] == '/' && strchr(name + 1, '/') == NULL;
+}
+
+static int open_page(const char *name, int flags)
+{
+	if (is_shm_name(name))
+		return shm_open(name, flags, 0644);
+	return open(name, flags, 0644);
+}
+
+/*
+ *	Copy in 32 bit words with relaxed atomics, so that a copy racing
+ *	with the writer is harmless; seq tells the reader to retry.
+ */
+static void copy_words(void *dst, const void *src, size_t len)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+	size_t i;
+
+	for (i = 0; i < len / 4; i++)
+		__atomic_store_n(&d[i], __atomic_load_n(&s[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+struct stats_shm *stats_shm_create(const char *name, unsigned int interval_ms)
+{
+	struct stats_shm *shm;
+	int fd;
+
+	fd = open_page(name, O_RDWR | O_CREAT);
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(struct stats_shm)) < 0) {
+		perror(name);
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(struct stats_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror(name);
+		return NULL;
+	}
+	/* Invalidate the old contents first, a reader may still be attached */
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	memset((char *)shm + sizeof(shm->magic), 0, sizeof(struct stats_shm) - sizeof(shm->magic));
+	shm->version = STATS_SHM_VERSION;
+	shm->size = sizeof(struct stats_shm);
+	shm->pid = getpid();
+	shm->interval_ms = interval_ms;
+	shm->started = time(NULL);
+	__atomic_store_n(&shm->magic, STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+/*
+ *	Map an existing page read only. Returns NULL, with a message, if
+ *	it does not exist or has an unknown layout.
+ */
+struct stats_shm *stats_shm_attach(const char *name)
+{
+	struct stats_shm *shm;
+	struct stat st;
+	int fd;
+
+	fd = open_page(name, O_RDONLY);
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)BODY) {
+		fprintf(stderr, "%s: not a statistics page\n", name);
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror(name);
+		return NULL;
+	}
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATS_SHM_MAGIC
+	    || shm->version != STATS_SHM_VERSION || shm->size != sizeof(struct stats_shm)
+	    || st.st_size < (off_t)sizeof(struct stats_shm)) {
+		fprintf(stderr, "%s: unknown statistics layout (version %u, %u bytes)\n",
+			name, shm->version, shm->size);
+		munmap(shm, st.st_size);
+		return NULL;
+	}
+	return shm;
+}
+
+/* Publish everything from src->started on. Only one writer per page. */
+void stats_shm_write(struct stats_shm *shm, const struct stats_shm *src)
+{
+	uint32_t seq = shm->seq;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	copy_words((char *)shm + BODY, (const char *)src + BODY, sizeof(struct stats_shm) - BODY);
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ *	Take a consistent copy of the page. Returns 1, or 0 if the writer
+ *	kept it busy for every try.
+ */
+int stats_shm_read(const struct stats_shm *shm, struct stats_shm *dst)
+{
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			usleep(10);
+			continue;
+		}
+		copy_words(dst, shm, sizeof(struct stats_shm));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return 1;
+	}
+	return 0;
+}
+
+void stats_shm_close(struct stats_shm *shm)
+{
+	if (shm)
+		munmap(shm, sizeof(struct stats_shm));
+}
@@ -0,0 +1,91 @@
+/*
+ *	stats_shm.h
+ *
+ *	Statistics page in shared memory, for local monitoring tools.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_STATS_SHM_H
+#define INC_STATS_SHM_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define STATS_SHM_MAGIC 0x53494152u	/* "RAIS" */
+#define STATS_SHM_VERSION 1
+#define STATS_SHM_SINKS 16
+#define STATS_SHM_NAME 64
+#define STATS_SHM_TYPES 28
+#define STATS_SHM_STAGES 4
+#define STATS_SHM_DEFAULT_MS 250
+
+/*
+ * The layout is fixed: only fixed size fields, 8 byte aligned, no
+ * pointers. Fields are only ever added at the end, with a new
+ * version. Readers check magic, version and size before use.
+ */
+struct stats_shm_sink {
+	char name[STATS_SHM_NAME];	/* the -U spec without options */
+	uint64_t sentences;
+	uint64_t dropped;
+	uint64_t errors;
+	uint32_t queued;
+	uint32_t pad;
+};
+
+struct stats_shm {
+	/* Header, set once when the page is created */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;			/* sizeof(struct stats_shm) */
+	uint32_t pid;
+	uint32_t interval_ms;		/* update interval */
+
+	/* Odd while the writer is updating what follows. A reader copies
+	 * the page and retries if seq was odd or changed meanwhile. */
+	uint32_t seq;
+
+	int64_t started;		/* unix time, seconds */
+	int64_t updated;		/* unix time, milliseconds */
+
+	uint64_t frames_ok[2];		/* channel A, B */
+	uint64_t frames_crc[2];
+	uint64_t frames_size[2];
+	uint64_t types[STATS_SHM_TYPES];	/* messages by type */
+	uint32_t level[2];		/* percent */
+
+	uint64_t usb_buffers;
+	uint64_t usb_bytes;
+	uint64_t usb_overruns;
+	uint64_t dsp_blocks;
+	uint64_t dsp_ns[STATS_SHM_STAGES];	/* downsample, demodulate, upsample, decode */
+
+	uint64_t thinned;
+	uint64_t thinned_bytes;
+
+	uint32_t nsinks;
+	uint32_t pad;
+	struct stats_shm_sink sink[STATS_SHM_SINKS];
+};
+
+extern struct stats_shm *stats_shm_create(const char *name, unsigned int interval_ms);
+extern struct stats_shm *stats_shm_attach(const char *name);
+extern void stats_shm_write(struct stats_shm *shm, const struct stats_shm *src);
+extern int stats_shm_read(const struct stats_shm *shm, struct stats_shm *dst);
+extern void stats_shm_close(struct stats_shm *shm);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,235 @@
+/*
+ *	thinning.c
+ *
+ *	Per-MMSI rate limiting of repeated reports, for slow uplinks.
+ *
+ *	For every vessel and message type the last forwarded report is
+ *	remembered. A new one is dropped if it comes sooner than the
+ *	interval for its type, unless the vessel moved, turned or changed
+ *	its navigation status noticeably since.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "thinning.h"
+#include "metrics.h"
+
+/* Types a bare interval applies to: position and base station reports */
+#define THIN_POSITION_TYPES ((1u << 1) | (1u << 2) | (1u << 3) | (1u << 4) \
+	| (1u << 18) | (1u << 19) | (1u << 21) | (1u << 27))
+
+/*
+ *	Parse the -X spec, items separated by ';':
+ *	  30           interval in seconds for all position reports
+ *	  1-3,18=60    interval for the given message types
+ *	  dist=100     always forward after moving this many metres
+ *	  cog=10       always forward after turning this many degrees
+ *	Returns 1 if ok, 0 if the spec is invalid.
+ */
+int thinning_init(struct ais_thinning *t, const char *spec, double now)
+{
+	char item[128], *value, *end;
+	const char *p = spec, *next;
+	struct ais_filter f;
+	unsigned int types, ms;
+	double v;
+	int i, len;
+
+	memset(t, 0, sizeof(*t));
+	t->min_dist = THIN_DEFAULT_DIST;
+	t->min_cog = THIN_DEFAULT_COG * 10;
+	t->started = now;
+
+	while (*p) {
+		next = strchr(p, ';');
+		len = next ? next - p : (int)strlen(p);
+		if (len >= (int)sizeof(item))
+			return 0;
+		memcpy(item, p, len);
+		item[len] = 0;
+		p = next ? next + 1 : p + len;
+		if (len == 0)
+			continue;
+
+		value = strchr(item, '=');
+		if (value)
+			*value++ = 0;
+		v = strtod(value ? value : item, &end);
+		if (*end || end == (value ? value : item) || v < 0)
+			return 0;
+
+		if (!value) {
+			types = THIN_POSITION_TYPES;
+		} else if (strcmp(item, "dist") == 0) {
+			t->min_dist = v;
+			continue;
+		} else if (strcmp(item, "cog") == 0) {
+			t->min_cog = v * 10;
+			continue;
+		} else {
+			ais_filter_clear(&f);
+			if (ais_filter_set(&f, "types", item) != 1)
+				return 0;
+			types = f.types;
+			if (types & THIN_EXEMPT_TYPES)
+				return 0;
+		}
+		ms = v * 1000;
+		for (i = 0; i < 32; i++)
+			if (types & (1u << i))
+				t->interval[i] = ms;
+		if (ms > t->max_interval)
+			t->max_interval = ms;
+	}
+
+	t->size = THIN_MIN_SIZE;
+	t->entry = calloc(t->size, sizeof(struct thin_entry));
+	return t->entry != NULL;
+}
+
+void thinning_free(struct ais_thinning *t)
+{
+	free(t->entry);
+	t->entry = NULL;
+}
+
+static unsigned int thin_hash(struct ais_thinning *t, unsigned long key)
+{
+	return (unsigned int)((key * 2654435761u) >> 7) & (t->size - 1);
+}
+
+/*
+ *	Make room for a new entry. Entries older than the longest interval
+ *	are of no use any more and are dropped on the way, the table only
+ *	grows if it is still more than a quarter full after that.
+ */
+static int thin_rebuild(struct ais_thinning *t, double now)
+{
+	struct thin_entry *old = t->entry;
+	unsigned int old_size = t->size, i, h, live = 0;
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].key && now - old[i].last < t->max_interval)
+			live++;
+	t->size = old_size;
+	while ((live + 1) * 4 > t->size)
+		t->size *= 2;
+	t->entry = calloc(t->size, sizeof(struct thin_entry));
+	if (t->entry == NULL) {
+		t->entry = old;
+		t->size = old_size;
+		return 0;
+	}
+	t->count = 0;
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].key || now - old[i].last >= t->max_interval)
+			continue;
+		h = thin_hash(t, old[i].key);
+		while (t->entry[h].key)
+			h = (h + 1) & (t->size - 1);
+		t->entry[h] = old[i];
+		t->count++;
+	}
+	free(old);
+	return 1;
+}
+
+/*
+ *	Distance in metres between two positions in 1/10000 minute,
+ *	flat earth is good enough at these distances.
+ */
+static double thin_distance(long lat1, long lon1, long lat2, long lon2)
+{
+	double k = 1852.0 / 10000.0;	/* metres per 1/10000 minute of latitude */
+	double dy = (lat2 - lat1) * k;
+	double dlon = lon2 - lon1;
+	double dx;
+
+	if (dlon > 180 * 600000L)
+		dlon -= 360 * 600000L;
+	else if (dlon < -180 * 600000L)
+		dlon += 360 * 600000L;
+	dx = dlon * k * cos((lat1 + lat2) / 2.0 / 600000.0 * M_PI / 180.0);
+	return sqrt(dx * dx + dy * dy);
+}
+
+static int thin_changed(struct ais_thinning *t, const struct thin_entry *e, const struct ais_msg *m)
+{
+	int dcog;
+
+	if (e->navstatus != m->navstatus || e->has_pos != m->has_pos)
+		return 1;
+	if (m->has_pos && thin_distance(e->lat, e->lon, m->lat, m->lon) >= t->min_dist)
+		return 1;
+	if (e->cog != m->cog) {
+		if (e->cog >= AIS_COG_NA || m->cog >= AIS_COG_NA)
+			return 1;
+		dcog = abs((int)e->cog - (int)m->cog);
+		if (dcog > 1800)
+			dcog = 3600 - dcog;
+		if ((unsigned int)dcog >= t->min_cog)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ *	Decide on one message of length bytes. Returns 1 if it should be
+ *	forwarded, 0 if it is thinned out.
+ */
+int thinning_check(struct ais_thinning *t, const struct ais_msg *m, unsigned int length, double now)
+{
+	struct thin_entry *e;
+	unsigned long key;
+	unsigned int h;
+
+	if (m->type >= 32 || t->interval[m->type] == 0 || m->mmsi == 0)
+		goto pass;
+
+	key = (m->mmsi << 6) | m->type;
+	h = thin_hash(t, key);
+	while (t->entry[h].key && t->entry[h].key != key)
+		h = (h + 1) & (t->size - 1);
+	e = &t->entry[h];
+
+	if (e->key) {
+		if (now - e->last < t->interval[m->type] && !thin_changed(t, e, m)) {
+			/* also read by /metrics scrapes */
+			METRIC_ADD(t->thinned, 1);
+			METRIC_ADD(t->thinned_bytes, length);
+			return 0;
+		}
+	} else {
+		if ((t->count + 1) * 2 > t->size) {
+			if (!thin_rebuild(t, now))
+				goto pass;
+			return thinning_check(t, m, length, now);
+		}
+		e->key = key;
+		t->count++;
+	}
+	e->last = now;
+	e->lat = m->lat;
+	e->lon = m->lon;
+	e->has_pos = m->has_pos;
+	e->cog = m->cog;
+	e->navstatus = m->navstatus;
+
+pass:
+	t->passed++;
+	t->passed_bytes += length;
+	return 1;
+}
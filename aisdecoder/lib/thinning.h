@@ -0,0 +1,64 @@
+/*
+ *	thinning.h
+ *
+ *	Per-MMSI rate limiting of repeated reports, for slow uplinks.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ */
+
+#ifndef INC_THINNING_H
+#define INC_THINNING_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "aismsg.h"
+
+/* Defaults for the change thresholds that always let a report through */
+#define THIN_DEFAULT_DIST 100		/* metres */
+#define THIN_DEFAULT_COG 10		/* degrees */
+#define THIN_MIN_SIZE 1024
+
+/* Static, safety related and SAR messages are never thinned */
+#define THIN_EXEMPT_TYPES ((1u << 5) | (1u << 9) | (1u << 12) | (1u << 13) | (1u << 14) | (1u << 24))
+
+struct thin_entry {
+	unsigned long key;		/* mmsi << 6 | type, 0: free */
+	double last;			/* ms, when the last report was forwarded */
+	long lat, lon;
+	unsigned short cog;
+	unsigned char navstatus;
+	unsigned char has_pos;
+};
+
+struct ais_thinning {
+	unsigned int interval[32];	/* ms per message type, 0: never thinned */
+	unsigned int max_interval;
+	double min_dist;		/* metres */
+	unsigned int min_cog;		/* 1/10 degree */
+
+	struct thin_entry *entry;	/* open addressing, linear probing */
+	unsigned int size, count;
+
+	/* statistics */
+	double started;
+	unsigned long passed, thinned;
+	unsigned long passed_bytes, thinned_bytes;
+};
+
+extern int thinning_init(struct ais_thinning *t, const char *spec, double now);
+extern void thinning_free(struct ais_thinning *t);
+extern int thinning_check(struct ais_thinning *t, const struct ais_msg *m, unsigned int length, double now);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
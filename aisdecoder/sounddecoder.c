@@ -40,6 +40,9 @@ static FILE *fp=NULL;
 static void readBuffers();
 static time_t tprev=0;
 static int time_print_stats=0;
+static int open_a=1, open_b=1;
+
+decoder_on_print_stats on_decoder_print_stats=NULL;
 
 int initSoundDecoder(int buf_len,int _time_print_stats, int add_sample_num,unsigned long mmsi) 
 {
@@ -53,6 +56,32 @@ int initSoundDecoder(int buf_len,int _time_print_stats, int add_sample_num,unsig
     return 1;
 }
 
+// Called from another thread while the decoder runs, single words only.
+void reloadSoundDecoder(int _time_print_stats, unsigned long mmsi)
+{
+    __atomic_store_n(&time_print_stats, _time_print_stats, __ATOMIC_RELAXED);
+    if (rx_a != NULL)
+        __atomic_store_n(&rx_a->decoder->mmsi, mmsi, __ATOMIC_RELAXED);
+    if (rx_b != NULL)
+        __atomic_store_n(&rx_b->decoder->mmsi, mmsi, __ATOMIC_RELAXED);
+}
+
+// Which channels the squelch lets through, for the next run_mem_decoder().
+void squelchSoundDecoder(int _open_a, int _open_b)
+{
+    open_a = _open_a;
+    open_b = _open_b;
+}
+
+// Capture time of the next run_mem_decoder() block, for the latency.
+void stampSoundDecoder(double first_ms, double sample_ms)
+{
+    if (rx_a != NULL)
+        receiver_stamp(rx_a, first_ms, sample_ms);
+    if (rx_b != NULL)
+        receiver_stamp(rx_b, first_ms, sample_ms);
+}
+
 void run_mem_decoder(short * buf, int len,int max_buf_len)
 {	
 	int offset=0;
@@ -83,6 +112,8 @@ void run_mem_decoder(short * buf, int len,int max_buf_len)
 				"B: Received correctly: %d packets, wrong CRC: %d packets, wrong size: %d packets\n",
 				d->receivedframes, d->lostframes,
 				d->lostframes2);
+		if (on_decoder_print_stats != NULL)
+			on_decoder_print_stats();
 	}
 }
 void runSoundDecoder(int *stop) {
@@ -94,12 +125,21 @@ void runSoundDecoder(int *stop) {
 
 static void readBuffers() {
     if (buffer_read <= 0) return;
-    if (rx_a != NULL && sound_channels != SOUND_CHANNELS_RIGHT)
-        receiver_run(rx_a, buffer, buffer_read);
+    if (rx_a != NULL && sound_channels != SOUND_CHANNELS_RIGHT) {
+        if (open_a)
+            receiver_run(rx_a, buffer, buffer_read);
+        else
+            receiver_skip(rx_a, buffer, buffer_read);
+    }
 
     if (rx_b != NULL &&
         (sound_channels == SOUND_CHANNELS_STEREO || sound_channels == SOUND_CHANNELS_RIGHT)
-    ) receiver_run(rx_b, buffer, buffer_read);
+    ) {
+        if (open_b)
+            receiver_run(rx_b, buffer, buffer_read);
+        else
+            receiver_skip(rx_b, buffer, buffer_read);
+    }
 }
 
 void freeSoundDecoder(void) {
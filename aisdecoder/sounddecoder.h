@@ -26,6 +26,9 @@ extern char errorSoundDecoder[];
 int initSoundDecoder(int buf_len,int _time_print_stats, int add_sample_num,unsigned long mmsi);
 void runSoundDecoder(int *stop);
 void freeSoundDecoder(void);
+void reloadSoundDecoder(int _time_print_stats, unsigned long mmsi);
+void squelchSoundDecoder(int _open_a, int _open_b);
+void stampSoundDecoder(double first_ms, double sample_ms);
 void run_mem_decoder(short * buf, int len,int max_buf_len);
 
 #ifdef __cplusplus
@@ -48,16 +48,99 @@ void usage(void)
 			"\t[-g tuner_gain (default: automatic)]\n"
 			"\t[-p ppm_error (default: 0)]\n"
 			"\t[-R enable RTL chip AGC (default: off)]\n"
+			"\t[-G clip_ppm[;floor=lo-hi][;hold=s] set the tuner gain from the samples:\n"
+			"\t    step down when more than clip_ppm samples per million clip the ADC\n"
+			"\t    or the noise floor RMS is above hi, up when it is below lo (default:\n"
+			"\t    3-12 ADC counts) and nothing clipped for s seconds (default: 10).\n"
+			"\t    Starts at -g, changes are logged with the -I sample index (default: off)]\n"
+			"\t[-K max_ppm track the frequency error of the dongle in the received frames\n"
+			"\t    and shift the channels to correct it, by at most max_ppm. Applied\n"
+			"\t    digitally, without retuning; the estimate is logged (default: off)]\n"
+			"\t[-W seconds reopen the dongle when it delivers no samples, or only a stuck\n"
+			"\t    value, for this long or its USB stream ends. The decoder and its\n"
+			"\t    clients carry on meanwhile (default: off, exit when the stream ends)]\n"
+			"\t[-q dB only decode a channel while its power is dB (1-30, try 6) above\n"
+			"\t    its noise floor, saves CPU time at quiet sites (default: off)]\n"
 			"\t[-A turn off built-in AIS decoder (default: on)]\n"
 			"\t    use this option to output samples to file or stdout.\n"
 			"\tBuilt-in AIS decoder options:\n"
 			"\t[-h host (default: 127.0.0.1)]\n"
 			"\t[-P port (default: 10110)]\n"
+			"\t[-u mtu[,max_latency_ms] pack UDP sentences into datagrams of up to mtu bytes,\n"
+			"\t    sent at most max_latency_ms (default: 100) after the first sentence\n"
+			"\t    (default: off, one sentence per datagram). Safety and SAR messages (types 6,\n"
+			"\t    9, 12, 14 and SART, MOB and EPIRB MMSIs) never wait for a batch and go\n"
+			"\t    ahead of queued messages, to every output and TCP client]\n"
+			"\t[-U udp:host:port[;option...] or tcp:host:port[;option...] send to this\n"
+			"\t    destination instead of -h/-P, can be given up to 16 times.\n"
+			"\t    archive:dir[;option...] keeps the messages in binary hourly files in dir,\n"
+			"\t    with an index by time and MMSI. Query them with ais_query (make ais_query).\n"
+			"\t    columnar:dir[;rows=N] writes the decoded messages to daily columnar files\n"
+			"\t    YYYYMMDD.aisc in dir, N rows per row group (default: 16384). Convert them to\n"
+			"\t    CSV for duckdb or pandas with ais_columns (make ais_columns).\n"
+			"\t    IPv6 addresses are written as [addr]. Options, separated by ';':\n"
+			"\t    types, mmsi, bbox and channel as for -F,\n"
+			"\t    mtu=bytes and latency=ms as for -u, queue=kbytes (default: 256),\n"
+			"\t    ttl=hops for multicast. For tcp, spool=dir keeps what cannot be sent while the\n"
+			"\t    link is down in dir, spool_mb=N limits it (default: 256, the oldest data is\n"
+			"\t    dropped first) and replay=kB/s limits its resending (default: 64). Lost\n"
+			"\t    connections are retried after 1 s, doubling up to 60 s]\n"
+			"\t[-X spec drop repeated reports of a vessel, for slow uplinks. Items separated\n"
+			"\t    by ';': seconds (minimum interval of position reports), types=seconds\n"
+			"\t    (e.g. 1-3,18=60), dist=metres (default: 100) and cog=degrees (default: 10)\n"
+			"\t    always forward a report after that much movement or turning, or a\n"
+			"\t    navigation status change. Static, safety and SAR messages are never\n"
+			"\t    dropped. (default: off)]\n"
 			"\t[-T use TCP communication, rtl-ais is tcp server ( -h is ignored)\n"
 			"\t[-t time to keep ais messages in sec, using tcp listener (default: 15)\n"
 			"\t[-k keep TCP socket open and write new messages to it as they arrive\n"
+			"\t[-V seconds: instead of the -t history, send new TCP clients the latest\n"
+			"\t    position and static reports of every vessel heard in the last\n"
+			"\t    seconds (default: 0=off)]\n"
+			"\t[-Q kbytes[,policy] TCP client send queue size (default: 512)\n"
+			"\t    policy when a slow client's queue is full: drop (default),\n"
+			"\t    coalesce (drop its oldest unsent messages) or disconnect\n"
+			"\t[-z port[,flush_ms] also serve a deflate compressed feed on this TCP port,\n"
+			"\t    with -T, flushed every flush_ms (default: 250). Inflate with the dictionary in\n"
+			"\t    tcp_listener/ais_dict.h, for example with ais_inflate (make ais_inflate)\n"
+			"\t[-w port also serve HTTP on this port, with -T: GET /vessels returns the\n"
+			"\t    latest state of every vessel as JSON, a WebSocket on /ws streams each\n"
+			"\t    message as JSON. Filter with /ws?types=1-3&channel=A or SUB text frames\n"
+			"\t    (keys as for -F). Prometheus metrics on /metrics: frames per channel,\n"
+			"\t    messages per type, levels, USB overruns, DSP stage times, queue depths,\n"
+			"\t    latency from the USB buffer to the decoder and on to the sockets]\n"
+			"\t[-F let TCP clients filter what they receive by sending a line\n"
+			"\t    SUB key=value;... within a second of connecting, or any time later.\n"
+			"\t    Keys: types=1-3,5 mmsi=a,b bbox=lat1,lon1,lat2,lon2 channel=A|B\n"
+			"\t    (default: off, any data from a client closes its connection)]\n"
+			"\t[-N lat,lon[;file=path][;interval=s][;cell=deg][;max=km] aggregate the\n"
+			"\t    decoded positions into the coverage of a station at lat,lon: count,\n"
+			"\t    50/90/99th percentile and maximum range in 5 degree sectors, and\n"
+			"\t    positions per grid cell of deg degrees (default: 0.01). Farther than\n"
+			"\t    km (default: 500, max 1000) is taken as bogus. Written to path every s seconds\n"
+			"\t    (default: 60) and served on /coverage with -w (default: off)]\n"
+			"\t[-m name[,interval_ms] publish decoder, level, USB and output statistics\n"
+			"\t    in a shared memory page, updated every interval_ms (default: 250).\n"
+			"\t    A name like /rtl_ais is a POSIX shared memory object, a path with\n"
+			"\t    more slashes is a file. Read it with ais_stats (make ais_stats)]\n"
+			"\t[-C seconds[;dir=path][;crc=percent] keep the last seconds (max 300) of raw\n"
+			"\t    dongle samples in memory and write them to a .cu8 file in dir\n"
+			"\t    (default: .) on SIGUSR1, or when more than percent of the frames of\n"
+			"\t    the last 10 s failed the CRC, once until the rate drops below it again]\n"
+			"\t[-f file.cu8 decode raw samples from a file instead of the dongle, as\n"
+			"\t    written by -C, with the same -l and -r]\n"
+			"\t[-e file[;bins=N][;interval=s] append the power spectrum of the band the\n"
+			"\t    dongle captures to file, averaged over s seconds (default: 10) in N\n"
+			"\t    bins (power of two, default: 512), as rtl_power CSV for heatmap.py]\n"
+			"\t[-c file read more options from file, separated by white space, # starts\n"
+			"\t    a comment. They override the command line, -U adds to it. On SIGHUP\n"
+			"\t    the command line and the file are read again: outputs, filters, -M,\n"
+			"\t    -t, -S, -m interval, -u, -g, -p, -R, -D and -l/-r at the same spacing\n"
+			"\t    change without reopening the dongle, the rest needs a restart]\n"
 			"\t[-n log NMEA sentences to console (stderr) (default off)]\n"
 			"\t[-I add sample index to NMEA messages (default off)]\n"
+			"\t[-J s|ms prefix every sentence with an NMEA 4.10 TAG block holding the time\n"
+			"\t    the frame was received, c: in UNIX seconds or milliseconds (default off)]\n"
 			"\t[-M your MMSI identification number\n"
 			"\t[-v Debug and verbosity \n"
 			"\t[-L log sound levels to console (stderr) (default off)]\n\n"
@@ -84,112 +167,310 @@ static void sighandler(int signum)
 	do_exit = 1;
 }
 
-int main(int argc, char **argv)
+static volatile sig_atomic_t do_capture = 0;
+static void capture_sighandler(int signum)
 {
-	struct sigaction sigact;
+	(void)(signum); // unused argument
+	do_capture = 1;
+}
 
-	sigact.sa_handler = sighandler;
-	sigemptyset(&sigact.sa_mask);
-	sigact.sa_flags = 0;
-	sigaction(SIGINT, &sigact, NULL);
-	sigaction(SIGTERM, &sigact, NULL);
-	sigaction(SIGQUIT, &sigact, NULL);
-	sigaction(SIGPIPE, &sigact, NULL);
-	int opt;
+static volatile sig_atomic_t do_reload = 0;
+static void reload_sighandler(int signum)
+{
+	(void)(signum); // unused argument
+	do_reload = 1;
+}
 
-	struct rtl_ais_config config;
-	rtl_ais_default_config(&config);
+/* -c: options in a file, separated by white space, # starts a comment */
+static char *config_file = NULL;
 
-	config.host = strdup("localhost");
-	config.port = strdup("10110");
+/* The options, from the command line or a -c file. Returns -1 if one is invalid. */
+static int parse_options(struct rtl_ais_config *config, int argc, char **argv)
+{
+	int opt;
 
-	while ((opt = getopt(argc, argv, "l:r:s:o:EODd:g:p:RATIktv:P:h:nLS:M:?")) != -1)
+	optind = 0; /* start over, also for a second list */
+	while ((opt = getopt(argc, argv, "l:r:s:o:EODd:g:p:RATIkt:v:P:h:nLS:M:Q:FV:z:w:u:U:X:m:C:f:c:G:K:W:q:e:N:J:?")) != -1)
 	{
 		switch (opt)
 		{
 		case 'l':
-			config.left_freq = (int)atofs(optarg);
+			config->left_freq = (int)atofs(optarg);
 			break;
 		case 'r':
-			config.right_freq = (int)atofs(optarg);
+			config->right_freq = (int)atofs(optarg);
 			break;
 		case 's':
-			config.sample_rate = (int)atofs(optarg);
+			config->sample_rate = (int)atofs(optarg);
 			break;
 		case 'o':
-			config.output_rate = (int)atofs(optarg);
+			config->output_rate = (int)atofs(optarg);
 			break;
 		case 'E':
-			config.edge = !config.edge;
+			config->edge = !config->edge;
 			break;
 		case 'D':
-			config.dc_filter = !config.dc_filter;
+			config->dc_filter = !config->dc_filter;
 			break;
 		case 'O':
-			config.oversample = !config.oversample;
+			config->oversample = !config->oversample;
 			break;
 		case 'd':
-			config.dev_index = verbose_device_search(optarg);
-			config.dev_given = 1;
+			free(config->device);
+			config->device = strdup(optarg);
 			break;
 		case 'g':
-			config.gain = (int)(atof(optarg) * 10);
+			config->gain = (int)(atof(optarg) * 10);
 			break;
 		case 'p':
-			config.ppm_error = atoi(optarg);
-			config.custom_ppm = 1;
+			config->ppm_error = atoi(optarg);
+			config->custom_ppm = 1;
 			break;
 		case 'R':
-			config.rtl_agc = 1;
+			config->rtl_agc = 1;
 			break;
 		case 'I':
-			config.add_sample_num = 1;
+			config->add_sample_num = 1;
 			break;
 		case 'P':
-			config.port = strdup(optarg);
+			free(config->port);
+			config->port = strdup(optarg);
 			break;
 		case 'T':
-			config.use_tcp_listener = 1;
+			config->use_tcp_listener = 1;
+			break;
+		case 'u':
+			config->udp_mtu = atoi(optarg);
+			if (strchr(optarg, ','))
+				config->udp_max_latency = atoi(strchr(optarg, ',') + 1);
+			break;
+		case 'U':
+			if (config->nsinks == MAX_OUTPUT_SINKS) {
+				fprintf(stderr, "Too many output destinations, max %d\n", MAX_OUTPUT_SINKS);
+				return -1;
+			}
+			config->sinks[config->nsinks++] = strdup(optarg);
+			break;
+		case 'X':
+			free(config->thin_spec);
+			config->thin_spec = strdup(optarg);
+			break;
+		case 'C':
+			free(config->capture_spec);
+			config->capture_spec = strdup(optarg);
+			break;
+		case 'G':
+			free(config->agc_spec);
+			config->agc_spec = strdup(optarg);
+			break;
+		case 'K':
+			config->drift_ppm = atoi(optarg);
+			break;
+		case 'W':
+			config->watchdog_sec = atoi(optarg);
+			break;
+		case 'q':
+			config->squelch_db = atoi(optarg);
+			break;
+		case 'e':
+			free(config->spectrum_spec);
+			config->spectrum_spec = strdup(optarg);
+			break;
+		case 'N':
+			free(config->coverage_spec);
+			config->coverage_spec = strdup(optarg);
+			break;
+		case 'J':
+			free(config->tag_block);
+			config->tag_block = strdup(optarg);
+			break;
+		case 'f':
+			free(config->replay_file);
+			config->replay_file = strdup(optarg);
 			break;
 		case 't':
-			config.tcp_keep_ais_time = atoi(optarg);
+			config->tcp_keep_ais_time = atoi(optarg);
 			break;
 		case 'k':
-			config.tcp_stream_forever = 1;
+			config->tcp_stream_forever = 1;
+			break;
+		case 'Q':
+			config->tcp_queue_kb = atoi(optarg);
+			if (strchr(optarg, ','))
+			{
+				free(config->tcp_overflow);
+				config->tcp_overflow = strdup(strchr(optarg, ',') + 1);
+			}
+			break;
+		case 'F':
+			config->tcp_subscribe = 1;
+			break;
+		case 'z':
+			free(config->tcp_zport);
+			config->tcp_zport = strdup(optarg);
+			if (strchr(config->tcp_zport, ','))
+			{
+				config->tcp_zflush_ms = atoi(strchr(config->tcp_zport, ',') + 1);
+				*strchr(config->tcp_zport, ',') = 0;
+			}
+			break;
+		case 'm':
+			free(config->stats_shm);
+			config->stats_shm = strdup(optarg);
+			if (strchr(config->stats_shm, ','))
+			{
+				config->stats_shm_ms = atoi(strchr(config->stats_shm, ',') + 1);
+				*strchr(config->stats_shm, ',') = 0;
+			}
+			break;
+		case 'w':
+			free(config->tcp_http_port);
+			config->tcp_http_port = strdup(optarg);
+			break;
+		case 'V':
+			config->tcp_snapshot_age = atoi(optarg);
 			break;
 		case 'h':
-			config.host = strdup(optarg);
+			free(config->host);
+			config->host = strdup(optarg);
 			break;
 		case 'L':
-			config.show_levels = 1;
+			config->show_levels = 1;
 			break;
 		case 'S':
-			config.seconds_for_decoder_stats = atoi(optarg);
+			config->seconds_for_decoder_stats = atoi(optarg);
 			break;
 		case 'n':
-			config.debug_nmea = 1;
+			config->debug_nmea = 1;
 			break;
 		case 'v':
-			config.debug = 1;
+			config->debug = 1;
 			break;
 		case 'M':
-			config.mmsi = atoi(optarg);
+			config->mmsi = atoi(optarg);
+			break;
+		case 'c':
+			if (!config_file)
+				config_file = strdup(optarg);
 			break;
 		case '?':
 		default:
-			usage();
-			return 2;
+			return -1;
 		}
 	}
+	return 0;
+}
+
+static int parse_config_file(struct rtl_ais_config *config, const char *path)
+{
+	char *args[512], word[1024];
+	int nargs = 1, len = 0, c, ret;
+	FILE *f = fopen(path, "r");
 
-	if (argc <= optind)
+	if (!f)
 	{
-		config.filename = "-";
+		perror(path);
+		return -1;
 	}
-	else
+	args[0] = "rtl_ais";
+	do
+	{
+		c = fgetc(f);
+		if (c == '#')
+			while (c != EOF && c != '\n')
+				c = fgetc(f);
+		if (c == EOF || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+		{
+			if (len > 0 && nargs < (int)(sizeof(args) / sizeof(args[0])) - 1)
+			{
+				word[len] = 0;
+				args[nargs++] = strdup(word);
+			}
+			len = 0;
+		}
+		else if (len < (int)sizeof(word) - 1)
+			word[len++] = c;
+	} while (c != EOF);
+	fclose(f);
+	args[nargs] = NULL;
+
+	ret = parse_options(config, nargs, args);
+	if (ret == 0 && optind < nargs)
 	{
-		config.filename = argv[optind];
+		fprintf(stderr, "%s: unexpected '%s'\n", path, args[optind]);
+		ret = -1;
 	}
+	for (c = 1; c < nargs; c++)
+		free(args[c]);
+	return ret;
+}
+
+/* The defaults, then the command line, then the -c file if there is one */
+static int load_config(struct rtl_ais_config *config, int argc, char **argv)
+{
+	int i, ret;
+
+	rtl_ais_default_config(config);
+	config->host = strdup("localhost");
+	config->port = strdup("10110");
+	ret = parse_options(config, argc, argv);
+	if (ret < 0)
+		return ret;
+	i = optind;
+	if (config_file && parse_config_file(config, config_file) < 0)
+		return -1;
+	optind = i;
+	return 0;
+}
+
+/* The strings load_config allocated */
+static void free_config(struct rtl_ais_config *config)
+{
+	int i;
+
+	free(config->device);
+	free(config->host);
+	free(config->port);
+	for (i = 0; i < config->nsinks; i++)
+		free(config->sinks[i]);
+	free(config->thin_spec);
+	free(config->capture_spec);
+	free(config->agc_spec);
+	free(config->spectrum_spec);
+	free(config->coverage_spec);
+	free(config->tag_block);
+	free(config->replay_file);
+	free(config->tcp_overflow);
+	free(config->tcp_zport);
+	free(config->stats_shm);
+	free(config->tcp_http_port);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sigact;
+
+	sigact.sa_handler = sighandler;
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_flags = 0;
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGPIPE, &sigact, NULL);
+	sigact.sa_handler = capture_sighandler;
+	sigaction(SIGUSR1, &sigact, NULL);
+	sigact.sa_handler = reload_sighandler;
+	sigaction(SIGHUP, &sigact, NULL);
+	struct rtl_ais_config config;
+	char *filename;
+
+	if (load_config(&config, argc, argv) < 0)
+	{
+		usage();
+		return 2;
+	}
+	filename = argc <= optind ? "-" : argv[optind];
+	config.filename = filename;
 
 	if (config.edge)
 	{
@@ -234,6 +515,27 @@ nmea_sentence_received() in aidecoder.c
 		struct timespec five = {0, 50 * 1000 * 1000};
 #endif
 		const char *str;
+		if (do_capture)
+		{
+			do_capture = 0;
+			if (!rtl_ais_capture_dump(ctx))
+				fprintf(stderr, "SIGUSR1 ignored, no IQ capture (-C)\n");
+		}
+		if (do_reload)
+		{
+			struct rtl_ais_config reload;
+			do_reload = 0;
+			fprintf(stderr, "SIGHUP, reloading%s%s\n", config_file ? " " : "", config_file ? config_file : "");
+			if (load_config(&reload, argc, argv) < 0)
+				fprintf(stderr, "Reload: invalid options, nothing changed\n");
+			else
+			{
+				reload.filename = filename;
+				if (rtl_ais_reload(ctx, &reload) != 0)
+					fprintf(stderr, "Reload: not everything was applied\n");
+			}
+			free_config(&reload);
+		}
 			// dequeue
 			while ((str = rtl_ais_next_message(ctx)))
 			{
@@ -246,5 +548,6 @@ nmea_sentence_received() in aidecoder.c
 #endif
 	}
 	rtl_ais_cleanup(ctx);
+	free_config(&config);
 	return 0;
 }
@@ -19,7 +19,6 @@
  * support left > right
  * thread left/right channels
  * more array sharing
- * something to correct for clock drift (look at demod's dc bias?)
  * 4x oversampling (with cic up/down)
  * droop correction
  * alsa integration
@@ -34,16 +33,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
 #include "pthread.h"
 #include <rtl-sdr.h>
 #include "rtl_ais.h"
 #include "convenience.h"
 #include "aisdecoder/aisdecoder.h"
+#include "aisdecoder/lib/metrics.h"
+#include "aisdecoder/lib/iqcapture.h"
+#include "aisdecoder/lib/agc.h"
+#include "aisdecoder/lib/drift.h"
+#include "aisdecoder/lib/squelch.h"
+#include "aisdecoder/lib/spectrum.h"
 
 
 #define DEFAULT_ASYNC_BUF_NUMBER 12
 #define DEFAULT_BUF_LENGTH (16 * 16384)
 #define AUTO_GAIN 33
+#define WATCHDOG_POLL_MS 250
+#define WATCHDOG_CANCEL_MS 5000 /* for rtlsdr_read_async to return after a cancel */
+#define WATCHDOG_RETRY_MAX 30	/* seconds between attempts to reopen, at most */
 
 /* signals are not threadsafe by default */
 #define safe_cond_signal(n, m) \
@@ -321,11 +331,18 @@ static void arbitrary_upsample(int16_t *buf1, int16_t *buf2, int len1, int len2)
 	int i = 1;
 	int j = 0;
 	int tick = 0;
+#ifndef FIXED_POINT
 	double frac; // use integers...
+#endif
 	while (j < len2)
 	{
+#ifdef FIXED_POINT
+		/* tick <= len2 < 65536, the products fit in 32 bits */
+		buf2[j] = (int16_t)((buf1[i - 1] * (len2 - tick) + buf1[i] * tick) / len2);
+#else
 		frac = (double)tick / (double)len2;
 		buf2[j] = (int16_t)((double)buf1[i - 1] * (1 - frac) + (double)buf1[i] * frac);
+#endif
 		j++;
 		tick += len1;
 		if (tick > len2)
@@ -350,10 +367,48 @@ struct rtl_ais_context
 
 	pthread_cond_t ready;
 	pthread_mutex_t ready_m;
+	int buf_pending; /* both.buf not demodulated yet, protected by both.rw */
+	long long buf_ms; /* monotonic time both.buf arrived, protected by both.rw */
 
 	rtlsdr_dev_t *dev;
 	FILE *file;
 
+	/* -C ring of raw samples, -f samples read from a file instead of the dongle */
+	struct iq_capture capture;
+	int capturing;
+	FILE *replay;
+	int demod_done;
+
+	/* -G gain control from the samples, run by the demodulator thread */
+	struct agc agc;
+	int agc_on;
+	unsigned long long agc_sample; /* decoder samples per channel so far, as -I counts them */
+
+	/* -K frequency error tracking, corrected before the channels are split */
+	struct drift drift;
+	int drift_on;
+
+	/* -q idle channels skip the receiver */
+	struct squelch squelch;
+	int squelch_on;
+
+	/* -e power spectrum of the band, a few samples of each buffer go to its thread */
+	struct spectrum spectrum;
+	int spectrum_on;
+
+	/* the settings it was started with, the ones applied by a reload updated */
+	struct rtl_ais_config config;
+	int dongle_freq;
+	int dongle_rate;
+
+	/* -W the dongle is reopened when its samples stop, ctx->dev changes under dev_lock */
+	int watchdog_ms;
+	pthread_t watchdog_thread;
+	pthread_mutex_t dev_lock;
+	volatile long long last_samples; /* CLOCK_MONOTONIC ms of the last buffer that was not stuck */
+	volatile int usb_done;		 /* rtlsdr_read_async returned */
+	char serial[256];		 /* to find the dongle again, empty if not unique */
+
 	/* complex iq pairs */
 	struct downsample_state both;
 	struct downsample_state left;
@@ -365,30 +420,256 @@ struct rtl_ais_context
 	struct upsample_stereo stereo;
 };
 
+static long long monotonic_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
 static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *arg)
 {
 	struct rtl_ais_context *ctx = arg;
 	unsigned i;
+	unsigned char stuck = 0;
 	if (!ctx->active)
 	{
 		return;
 	}
+	if (ctx->capturing)
+		iq_capture_put(&ctx->capture, buf, len);
 	pthread_rwlock_wrlock(&ctx->both.rw);
 	for (i = 0; i < len; i++)
+	{
 		ctx->both.buf[i] = ((int16_t)buf[i]) - 127;
-
+	}
+	/* a hung tuner can keep the stream going with zeros or one value */
+	if (ctx->watchdog_ms)
+	{
+		/* samples that move end this at once */
+		for (i = 1; i < len && !stuck; i++)
+			stuck = buf[i] ^ buf[0];
+		if (stuck)
+			ctx->last_samples = monotonic_ms();
+	}
+	if (ctx->buf_pending)
+		METRIC_ADD(metrics_usb.overruns, 1);
+	ctx->buf_pending = 1;
+	ctx->buf_ms = monotonic_ms();
 	pthread_rwlock_unlock(&ctx->both.rw);
+	METRIC_ADD(metrics_usb.buffers, 1);
+	METRIC_ADD(metrics_usb.bytes, len);
 	safe_cond_signal(&ctx->ready, &ctx->ready_m);
 }
 
 static void *rtlsdr_thread_fn(void *arg)
 {
 	struct rtl_ais_context *ctx = arg;
-	rtlsdr_read_async(ctx->dev, rtlsdr_callback, arg,
+	rtlsdr_dev_t *dev;
+	int r;
+
+	pthread_mutex_lock(&ctx->dev_lock);
+	dev = ctx->dev;
+	pthread_mutex_unlock(&ctx->dev_lock);
+	r = rtlsdr_read_async(dev, rtlsdr_callback, arg,
 					  DEFAULT_ASYNC_BUF_NUMBER,
 					  DEFAULT_BUF_LENGTH);
 
+	pthread_mutex_lock(&ctx->dev_lock);
+	if (dev != ctx->dev)
+	{
+		/* the watchdog gave up on this handle and left it to be closed here */
+		pthread_mutex_unlock(&ctx->dev_lock);
+		rtlsdr_close(dev);
+		return 0;
+	}
+	/* the watchdog reopens the dongle, or it is the end */
+	if (ctx->watchdog_ms && ctx->active)
+	{
+		if (r < 0)
+			fprintf(stderr, "Watchdog: reading from the dongle failed (%d)\n", r);
+	}
+	else
+		ctx->active = 0;
+	ctx->usb_done = 1;
+	pthread_mutex_unlock(&ctx->dev_lock);
+	return 0;
+}
+
+/*
+ * Open the dongle again, found by its serial number as the index may
+ * change when it reappears on the bus, and restore the tuner settings
+ * of the running configuration. Called with dev_lock held.
+ */
+static int reopen_device(struct rtl_ais_context *ctx)
+{
+	struct rtl_ais_config *config = &ctx->config;
+	int index = config->dev_index;
+
+	if (ctx->serial[0])
+	{
+		index = rtlsdr_get_index_by_serial(ctx->serial);
+		if (index < 0)
+			return -1;
+	}
+	if (rtlsdr_open(&ctx->dev, (uint32_t)index) < 0)
+	{
+		ctx->dev = NULL;
+		return -1;
+	}
+	if (ctx->agc_on)
+	{
+		rtlsdr_set_tuner_gain_mode(ctx->dev, 1);
+		verbose_gain_set(ctx->dev, ctx->agc.gains[ctx->agc.index]);
+	}
+	else if (config->gain == AUTO_GAIN)
+		verbose_auto_gain(ctx->dev);
+	else
+		verbose_gain_set(ctx->dev, nearest_gain(ctx->dev, config->gain));
+	if (config->rtl_agc)
+		rtlsdr_set_agc_mode(ctx->dev, 1);
+	verbose_ppm_set(ctx->dev, config->ppm_error);
+	verbose_set_frequency(ctx->dev, ctx->dongle_freq);
+	verbose_set_sample_rate(ctx->dev, ctx->dongle_rate);
+	verbose_reset_buffer(ctx->dev);
+	return 0;
+}
+
+/* Close the stalled dongle and retry opening it until it is back */
+static void watchdog_restart(struct rtl_ais_context *ctx)
+{
+	long long start = monotonic_ms();
+	int i, retry = 1;
+
+	if (ctx->usb_done)
+		fprintf(stderr, "Watchdog: the USB stream ended, reopening the dongle\n");
+	else
+		fprintf(stderr, "Watchdog: no samples for %0.1f s, reopening the dongle\n", (start - ctx->last_samples) / 1000.0);
+
+	pthread_mutex_lock(&ctx->dev_lock);
+	rtlsdr_cancel_async(ctx->dev);
+	pthread_mutex_unlock(&ctx->dev_lock);
+	/* the USB thread takes dev_lock on its way out */
+	for (i = 0; i < WATCHDOG_CANCEL_MS / WATCHDOG_POLL_MS && !ctx->usb_done; i++)
+		usleep(WATCHDOG_POLL_MS * 1000);
+	pthread_mutex_lock(&ctx->dev_lock);
+	if (ctx->usb_done)
+	{
+		pthread_join(ctx->rtlsdr_thread, NULL);
+		rtlsdr_close(ctx->dev);
+	}
+	else
+	{
+		/* closing under a transfer that never returns would crash, the thread closes it if it does */
+		fprintf(stderr, "Watchdog: the USB thread does not return, abandoning its handle\n");
+		pthread_detach(ctx->rtlsdr_thread);
+	}
+	ctx->dev = NULL;
+
+	while (ctx->active && reopen_device(ctx) < 0)
+	{
+		fprintf(stderr, "Watchdog: failed to reopen the dongle, retrying in %d s\n", retry);
+		pthread_mutex_unlock(&ctx->dev_lock);
+		for (i = 0; i < retry * 1000 / WATCHDOG_POLL_MS && ctx->active; i++)
+			usleep(WATCHDOG_POLL_MS * 1000);
+		pthread_mutex_lock(&ctx->dev_lock);
+		if (retry < WATCHDOG_RETRY_MAX)
+			retry *= 2;
+	}
+	if (ctx->dev)
+	{
+		ctx->usb_done = 0;
+		ctx->last_samples = monotonic_ms();
+		pthread_create(&ctx->rtlsdr_thread, NULL, rtlsdr_thread_fn, ctx);
+		METRIC_ADD(metrics_usb.reopens, 1);
+		fprintf(stderr, "Watchdog: dongle reopened after %0.1f s\n", (monotonic_ms() - start) / 1000.0);
+	}
+	pthread_mutex_unlock(&ctx->dev_lock);
+}
+
+static void *watchdog_thread_fn(void *arg)
+{
+	struct rtl_ais_context *ctx = arg;
+
+	while (ctx->active)
+	{
+		usleep(WATCHDOG_POLL_MS * 1000);
+		if (ctx->active && (ctx->usb_done || monotonic_ms() - ctx->last_samples > ctx->watchdog_ms))
+			watchdog_restart(ctx);
+	}
+	return 0;
+}
+
+/* Remember the serial number of the dongle, if no other one has the same */
+static void watchdog_serial(struct rtl_ais_context *ctx, int index)
+{
+	char vendor[256], product[256], serial[256];
+	int i, n = rtlsdr_get_device_count(), same = 0;
+
+	ctx->serial[0] = 0;
+	if (rtlsdr_get_device_usb_strings((uint32_t)index, vendor, product, ctx->serial) < 0)
+	{
+		ctx->serial[0] = 0;
+		return;
+	}
+	for (i = 0; i < n; i++)
+		if (rtlsdr_get_device_usb_strings((uint32_t)i, vendor, product, serial) == 0 && strcmp(serial, ctx->serial) == 0)
+			same++;
+	if (same != 1 || !ctx->serial[0])
+	{
+		fprintf(stderr, "Watchdog: the dongle has no unique serial number, it is reopened by index %d\n", index);
+		ctx->serial[0] = 0;
+	}
+}
+
+/* Wait until the demodulator has taken the last buffer */
+static void wait_demodulated(struct rtl_ais_context *ctx)
+{
+	int pending = 1;
+	while (pending && ctx->active)
+	{
+		pthread_rwlock_rdlock(&ctx->both.rw);
+		pending = ctx->buf_pending;
+		pthread_rwlock_unlock(&ctx->both.rw);
+		if (pending)
+		{
+			/* the signal is lost when it comes while a buffer is demodulated */
+			safe_cond_signal(&ctx->ready, &ctx->ready_m);
+			usleep(1000);
+		}
+	}
+}
+
+/*
+ * Feed a .cu8 file through the callback, as fast as the demodulator
+ * takes it, then let the demodulator thread finish and flush the outputs.
+ */
+static void *replay_thread_fn(void *arg)
+{
+	struct rtl_ais_context *ctx = arg;
+	unsigned char *buf = malloc(DEFAULT_BUF_LENGTH);
+	size_t len;
+
+	if (!buf)
+	{
+		fprintf(stderr, "Replay: out of memory\n");
+		ctx->active = 0;
+	}
+	while (ctx->active && (len = fread(buf, 1, DEFAULT_BUF_LENGTH, ctx->replay)) > 0)
+	{
+		/* pad the last buffer with silence */
+		memset(buf + len, 127, DEFAULT_BUF_LENGTH - len);
+		wait_demodulated(ctx);
+		rtlsdr_callback(buf, DEFAULT_BUF_LENGTH, ctx);
+	}
+	wait_demodulated(ctx);
 	ctx->active = 0;
+	while (!ctx->demod_done)
+	{
+		safe_cond_signal(&ctx->ready, &ctx->ready_m);
+		usleep(1000);
+	}
+	free(buf);
 	return 0;
 }
 
@@ -402,54 +683,174 @@ static void pre_output(struct rtl_ais_context *ctx)
 	}
 }
 
+/* Add the time since *t to a stage of the metrics, and restart *t */
+static void stage_done(struct timespec *t, int stage)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	METRIC_ADD(metrics_demod.stage_ns[stage], (now.tv_sec - t->tv_sec) * 1000000000LL + (now.tv_nsec - t->tv_nsec));
+	*t = now;
+}
+
+/* Outside the lock on the buffer, the dongle keeps delivering meanwhile */
+static void agc_set_gain(struct rtl_ais_context *ctx, int gain)
+{
+	int old = METRIC_GET(metrics_demod.gain);
+	int r = -1;
+
+	/* the watchdog sets it when the dongle is reopened */
+	pthread_mutex_lock(&ctx->dev_lock);
+	if (ctx->dev)
+		r = rtlsdr_set_tuner_gain(ctx->dev, gain);
+	pthread_mutex_unlock(&ctx->dev_lock);
+	if (r < 0)
+	{
+		fprintf(stderr, "AGC: failed to set the tuner gain to %0.1f dB\n", gain / 10.0);
+		return;
+	}
+	METRIC_SET(metrics_demod.gain, gain);
+	METRIC_ADD(metrics_demod.gain_steps, 1);
+	fprintf(stderr, "AGC: gain %0.1f -> %0.1f dB at sample %llu (clipped %d ppm, noise floor %0.1f)\n",
+			old / 10.0, gain / 10.0, ctx->agc_sample, ctx->agc.last_clip_ppm, ctx->agc.last_floor / 10.0);
+}
+
+/* Hand the gain to the -G loop, starting at -g or in the middle of the table */
+static void agc_init(struct rtl_ais_context *ctx, int gain, int rate)
+{
+	int n = rtlsdr_get_tuner_gains(ctx->dev, NULL);
+	int *gains;
+
+	if (n <= 0)
+	{
+		fprintf(stderr, "AGC: the tuner has no gain table, -G ignored\n");
+		return;
+	}
+	gains = malloc(n * sizeof(int));
+	if (gains)
+		rtlsdr_get_tuner_gains(ctx->dev, gains);
+	if (!gains || !agc_start(&ctx->agc, gains, n, gain == AUTO_GAIN ? gains[n / 2] : gain, rate))
+	{
+		fprintf(stderr, "AGC: out of memory, -G ignored\n");
+		free(gains);
+		return;
+	}
+	free(gains);
+	rtlsdr_set_tuner_gain_mode(ctx->dev, 1);
+	gain = ctx->agc.gains[ctx->agc.index];
+	rtlsdr_set_tuner_gain(ctx->dev, gain);
+	METRIC_SET(metrics_demod.gain, gain);
+	METRIC_SET(metrics_demod.agc, 1);
+	fprintf(stderr, "AGC on: %0.1f dB, down above %d clipped samples per million, noise floor %0.1f-%0.1f\n",
+			gain / 10.0, ctx->agc.clip_ppm, ctx->agc.floor_lo / 10.0, ctx->agc.floor_hi / 10.0);
+	ctx->agc_on = 1;
+}
+
+static void drift_log(struct rtl_ais_context *ctx)
+{
+	struct drift *d = &ctx->drift;
+
+	METRIC_SET(metrics_demod.drift_hz, (int)lrint(d->correction));
+	fprintf(stderr, "Drift: %+.0f Hz off in %d frames, correcting %+.0f Hz (%+.2f ppm on top of -p) at sample %llu\n",
+			d->residual, d->used, d->correction, -d->correction / d->freq * 1e6, ctx->agc_sample);
+}
+
 static void *demod_thread_fn(void *arg)
 {
 	struct rtl_ais_context *ctx = arg;
+	struct timespec t;
+	int gain = -1;
+	int open_a = 1, open_b = 1;
+	long long capture_ms;
 	while (ctx->active)
 	{
 		safe_cond_wait(&ctx->ready, &ctx->ready_m);
+		if (!ctx->active)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &t);
 		pthread_rwlock_wrlock(&ctx->both.rw);
+		ctx->buf_pending = 0;
+		capture_ms = ctx->buf_ms;
+		if (ctx->agc_on)
+			gain = agc_measure(&ctx->agc, ctx->both.buf, ctx->both.len_in);
+		if (ctx->spectrum_on)
+			spectrum_put(&ctx->spectrum, ctx->both.buf, ctx->both.len_in);
 		downsample(&ctx->both);
+		if (ctx->drift_on)
+			drift_nco(&ctx->drift, ctx->both.buf, ctx->both.len_out);
 		memcpy(ctx->left.buf, ctx->both.buf, 2 * ctx->both.len_out);
 		memcpy(ctx->right.buf, ctx->both.buf, 2 * ctx->both.len_out);
 		pthread_rwlock_unlock(&ctx->both.rw);
+		ctx->agc_sample += ctx->stereo.bl_len;
+		if (gain >= 0)
+		{
+			agc_set_gain(ctx, gain);
+			gain = -1;
+		}
 		rotate_90(ctx->left.buf, ctx->left.len_in);
 		downsample(&ctx->left);
+		if (ctx->squelch_on)
+			open_a = squelch_measure(&ctx->squelch, 0, ctx->left.buf, ctx->left.len_out);
+		stage_done(&t, METRICS_DOWNSAMPLE);
 		memcpy(ctx->left_demod.buf, ctx->left.buf, 2 * ctx->left.len_out);
 		demodulate(&ctx->left_demod);
+		if (ctx->drift_on)
+			drift_measure(&ctx->drift, 0, ctx->left_demod.buf, ctx->left_demod.result_len);
 		if (ctx->dc_filter)
 		{
 			dc_block_filter(&ctx->left_demod);
 		}
+		stage_done(&t, METRICS_DEMOD);
 		// if (oversample) {
 		//	downsample(&left);}
 		//fprintf(stderr,"\nUpsample result_len:%d stereo.bl_len:%d :%f\n",&ctx->left_demod.result_len,&ctx->stereo.bl_len,(float)&ctx->stereo.bl_len/(float)&ctx->left_demod.result_len);
 		arbitrary_upsample(ctx->left_demod.result, ctx->stereo.buf_left, ctx->left_demod.result_len, ctx->stereo.bl_len);
+		stage_done(&t, METRICS_UPSAMPLE);
 		rotate_m90(ctx->right.buf, ctx->right.len_in);
 		downsample(&ctx->right);
+		if (ctx->squelch_on)
+			open_b = squelch_measure(&ctx->squelch, 1, ctx->right.buf, ctx->right.len_out);
+		stage_done(&t, METRICS_DOWNSAMPLE);
 		memcpy(ctx->right_demod.buf, ctx->right.buf, 2 * ctx->right.len_out);
 		demodulate(&ctx->right_demod);
+		if (ctx->drift_on)
+			drift_measure(&ctx->drift, 1, ctx->right_demod.buf, ctx->right_demod.result_len);
 		if (ctx->dc_filter)
 		{
 			dc_block_filter(&ctx->right_demod);
 		}
+		stage_done(&t, METRICS_DEMOD);
 		// if (oversample) {
 		//	downsample(&right);}
 		arbitrary_upsample(ctx->right_demod.result, ctx->stereo.buf_right, ctx->right_demod.result_len, ctx->stereo.br_len);
 		pre_output(ctx);
+		stage_done(&t, METRICS_UPSAMPLE);
 		if (ctx->use_internal_aisdecoder)
 		{
 			// stereo.result -> int_16
 			// stereo.result_len -> number of samples for each channel
+			if (ctx->squelch_on)
+			{
+				squelch_rtlais_decoder(open_a, open_b);
+				METRIC_ADD(metrics_demod.squelched[0], !open_a);
+				METRIC_ADD(metrics_demod.squelched[1], !open_b);
+			}
+			/* the buffer arrived with its last sample */
+			stamp_rtlais_decoder(capture_ms - 1000.0 * ctx->stereo.bl_len / ctx->stereo.rate,
+								 1000.0 / ctx->stereo.rate);
 			run_rtlais_decoder(ctx->stereo.result, ctx->stereo.result_len);
 		}
 		else
 		{
 			fwrite(ctx->stereo.result, 2, ctx->stereo.result_len, ctx->file);
 		}
+		stage_done(&t, METRICS_DECODE);
+		METRIC_ADD(metrics_demod.blocks, 1);
+		if (ctx->drift_on && drift_update(&ctx->drift))
+			drift_log(ctx);
 	}
 
 	free_ais_decoder();
+	ctx->demod_done = 1;
 	return 0;
 }
 
@@ -492,6 +893,7 @@ void rtl_ais_default_config(struct rtl_ais_config *config)
 	config->gain = AUTO_GAIN; /* tenths of a dB */
 	config->dev_index = 0;
 	config->dev_given = 0;
+	config->device = NULL;
 	config->ppm_error = 0;
 	config->rtl_agc = 0;
 	config->custom_ppm = 0;
@@ -504,6 +906,28 @@ void rtl_ais_default_config(struct rtl_ais_config *config)
 	config->use_tcp_listener = 0, 
 	config->tcp_keep_ais_time = 15;
 	config->tcp_stream_forever = 0;
+	config->tcp_queue_kb = 0;
+	config->tcp_overflow = NULL;
+	config->tcp_subscribe = 0;
+	config->tcp_snapshot_age = 0;
+	config->tcp_zport = NULL;
+	config->tcp_zflush_ms = 0;
+	config->tcp_http_port = NULL;
+	config->udp_mtu = 0;
+	config->udp_max_latency = -1;
+	config->thin_spec = NULL;
+	config->stats_shm = NULL;
+	config->stats_shm_ms = 0;
+	config->nsinks = 0;
+	config->capture_spec = NULL;
+	config->replay_file = NULL;
+	config->agc_spec = NULL;
+	config->drift_ppm = 0;
+	config->watchdog_sec = 0;
+	config->squelch_db = 0;
+	config->spectrum_spec = NULL;
+	config->coverage_spec = NULL;
+	config->tag_block = NULL;
 	config->use_internal_aisdecoder = 1;
 	config->seconds_for_decoder_stats = 0;
 	/* Aisdecoder */
@@ -527,6 +951,21 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 
 	struct rtl_ais_context *ctx = malloc(sizeof(struct rtl_ais_context));
 	ctx->active = 1;
+	ctx->buf_pending = 0;
+	ctx->dev = NULL;
+	ctx->file = NULL;
+	ctx->capturing = 0;
+	ctx->replay = NULL;
+	ctx->demod_done = 0;
+	ctx->agc_on = 0;
+	ctx->agc_sample = 0;
+	ctx->drift_on = 0;
+	ctx->squelch_on = 0;
+	ctx->spectrum_on = 0;
+	ctx->watchdog_ms = 0;
+	ctx->usb_done = 0;
+	ctx->serial[0] = 0;
+	pthread_mutex_init(&ctx->dev_lock, NULL);
 
 	/* precompute rates */
 	int dongle_freq, dongle_rate, delta, i;
@@ -592,12 +1031,54 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 	ctx->stereo.result_len = ctx->stereo.br_len * 2;
 	ctx->stereo.rate = config->output_rate;
 
-	if (!config->dev_given)
+	if (config->capture_spec && !iq_capture_parse(&ctx->capture, config->capture_spec))
+	{
+		fprintf(stderr, "Invalid IQ capture spec '%s'\n", config->capture_spec);
+		exit(1);
+	}
+
+	if (config->spectrum_spec && !spectrum_parse(&ctx->spectrum, config->spectrum_spec))
+	{
+		fprintf(stderr, "Invalid spectrum spec '%s'\n", config->spectrum_spec);
+		exit(1);
+	}
+
+	if (config->tag_block && strcmp(config->tag_block, "s") != 0 && strcmp(config->tag_block, "ms") != 0)
+	{
+		fprintf(stderr, "Invalid TAG block unit '%s', use s or ms\n", config->tag_block);
+		exit(1);
+	}
+
+	if (config->agc_spec && !agc_parse(&ctx->agc, config->agc_spec))
+	{
+		fprintf(stderr, "Invalid AGC spec '%s'\n", config->agc_spec);
+		exit(1);
+	}
+
+	if (config->replay_file)
+	{
+		ctx->replay = fopen(config->replay_file, "rb");
+		if (!ctx->replay)
+		{
+			fprintf(stderr, "Failed to open %s\n", config->replay_file);
+			exit(1);
+		}
+		/* dumps are named ...-<freq>Hz-<rate>sps.cu8 */
+		const char *tag = strstr(config->replay_file, "Hz-");
+		if (tag && atoi(tag + 3) != dongle_rate)
+			fprintf(stderr, "Warning: %s was recorded at %d samples/s, these frequencies need %d\n",
+					config->replay_file, atoi(tag + 3), dongle_rate);
+	}
+	else if (config->device)
+	{
+		config->dev_index = verbose_device_search(config->device);
+	}
+	else if (!config->dev_given)
 	{
 		config->dev_index = verbose_device_search("0");
 	}
 
-	if (config->dev_index < 0)
+	if (!ctx->replay && config->dev_index < 0)
 	{
 		exit(1);
 	}
@@ -609,7 +1090,7 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 	demod_init(&ctx->right_demod);
 	stereo_init(&ctx->stereo);
 
-	int r = rtlsdr_open(&ctx->dev, (uint32_t)config->dev_index);
+	int r = ctx->replay ? 0 : rtlsdr_open(&ctx->dev, (uint32_t)config->dev_index);
 	if (r < 0)
 	{
 		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", config->dev_index);
@@ -635,19 +1116,82 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 	}
 	else
 	{ // Internal AIS decoder
-		int ret = init_ais_decoder(config->host, config->port, config->show_levels, config->debug_nmea, ctx->stereo.bl_len, config->seconds_for_decoder_stats, config->use_tcp_listener, config->tcp_keep_ais_time, config->tcp_stream_forever, config->add_sample_num, config->mmsi,config->debug);
+		int ret = init_ais_decoder(config, ctx->stereo.bl_len);
 		if (ret != 0)
 		{
 			fprintf(stderr, "Error initializing built-in AIS decoder\n");
-			rtlsdr_cancel_async(ctx->dev);
-			rtlsdr_close(ctx->dev);
+			if (ctx->dev)
+			{
+				rtlsdr_cancel_async(ctx->dev);
+				rtlsdr_close(ctx->dev);
+			}
 			exit(1);
 		}
 	}
 	ctx->use_internal_aisdecoder = config->use_internal_aisdecoder;
 
+	ctx->config = *config;
+	ctx->dongle_freq = dongle_freq;
+	ctx->dongle_rate = dongle_rate;
+
+	if (config->drift_ppm > 0)
+	{
+		if (!drift_start(&ctx->drift, (int)((double)config->drift_ppm * dongle_freq / 1e6), ctx->both.rate_out, ctx->left.rate_out, dongle_freq))
+			exit(1);
+		METRIC_SET(metrics_demod.drift, 1);
+		fprintf(stderr, "Tracking the frequency error, up to %d ppm\n", config->drift_ppm);
+		ctx->drift_on = 1;
+	}
+
+	if (config->squelch_db > 0 && !config->use_internal_aisdecoder)
+		fprintf(stderr, "The squelch needs the built-in decoder, -q ignored\n");
+	else if (config->squelch_db > 0)
+	{
+		if (!squelch_start(&ctx->squelch, config->squelch_db))
+		{
+			fprintf(stderr, "Invalid squelch level %d dB, 1 to 30\n", config->squelch_db);
+			exit(1);
+		}
+		METRIC_SET(metrics_demod.squelch, 1);
+		fprintf(stderr, "Squelch: channels %d dB above the noise floor are decoded\n", config->squelch_db);
+		ctx->squelch_on = 1;
+	}
+
+	if (config->capture_spec)
+	{
+		if (!iq_capture_start(&ctx->capture, dongle_rate, dongle_freq, DEFAULT_BUF_LENGTH))
+			exit(1);
+		ctx->capturing = 1;
+	}
+
+	if (config->spectrum_spec)
+	{
+		if (!spectrum_start(&ctx->spectrum, dongle_rate, dongle_freq))
+			exit(1);
+		ctx->spectrum_on = 1;
+	}
+
+	pthread_cond_init(&ctx->ready, NULL);
+	pthread_mutex_init(&ctx->ready_m, NULL);
+
+	if (ctx->replay)
+	{
+		if (config->agc_spec)
+			fprintf(stderr, "No tuner while replaying a file, -G ignored\n");
+		if (config->watchdog_sec > 0)
+			fprintf(stderr, "No dongle while replaying a file, -W ignored\n");
+		fprintf(stderr, "Replaying raw IQ from %s\n", config->replay_file);
+		pthread_create(&ctx->demod_thread, NULL, demod_thread_fn, ctx);
+		pthread_create(&ctx->rtlsdr_thread, NULL, replay_thread_fn, ctx);
+		return ctx;
+	}
+
 	/* Set the tuner gain */
-	if (config->gain == AUTO_GAIN)
+	if (config->agc_spec)
+	{
+		agc_init(ctx, config->gain, dongle_rate);
+	}
+	else if (config->gain == AUTO_GAIN)
 	{
 		verbose_auto_gain(ctx->dev);
 	}
@@ -675,6 +1219,7 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 	}
 
 	verbose_ppm_set(ctx->dev, config->ppm_error);
+	ctx->config.ppm_error = config->ppm_error;
 
 	/* Set the tuner frequency */
 	verbose_set_frequency(ctx->dev, dongle_freq);
@@ -685,21 +1230,173 @@ struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config)
 	/* Reset endpoint before we start reading from it (mandatory) */
 	verbose_reset_buffer(ctx->dev);
 
-	pthread_cond_init(&ctx->ready, NULL);
-	pthread_mutex_init(&ctx->ready_m, NULL);
-
-	/* create two threads */
+	/* create two threads, and the watchdog */
 	pthread_create(&ctx->demod_thread, NULL, demod_thread_fn, ctx);
 	pthread_create(&ctx->rtlsdr_thread, NULL, rtlsdr_thread_fn, ctx);
+	if (config->watchdog_sec > 0)
+	{
+		watchdog_serial(ctx, config->dev_index);
+		ctx->last_samples = monotonic_ms();
+		ctx->watchdog_ms = config->watchdog_sec * 1000;
+		pthread_create(&ctx->watchdog_thread, NULL, watchdog_thread_fn, ctx);
+		fprintf(stderr, "Watchdog: reopening the dongle after %d s without samples\n", config->watchdog_sec);
+	}
 
 	return ctx;
 }
 
 int rtl_ais_isactive(struct rtl_ais_context *ctx)
 {
+	/* a replay is over when everything read was decoded */
+	if (ctx->replay)
+		return !ctx->demod_done;
 	return ctx->active;
 }
 
+/* Dump the -C ring to a file, can be called from a signal handler */
+int rtl_ais_capture_dump(struct rtl_ais_context *ctx)
+{
+	if (!ctx->capturing)
+		return 0;
+	iq_capture_request(&ctx->capture);
+	return 1;
+}
+
+static int restart_int(const char *option, int running, int wanted)
+{
+	if (running == wanted)
+		return 0;
+	fprintf(stderr, "Reload: %s changed, needs a restart, ignored\n", option);
+	return 1;
+}
+
+static int restart_str(const char *option, const char *running, const char *wanted)
+{
+	if (running == wanted || (running && wanted && strcmp(running, wanted) == 0))
+		return 0;
+	fprintf(stderr, "Reload: %s changed, needs a restart, ignored\n", option);
+	return 1;
+}
+
+/*
+ * Apply a changed configuration without closing the dongle: outputs,
+ * filters and decoder settings, and the tuner frequency, gain and
+ * correction. What changes the sample rate or what was set up once
+ * at the start is reported and left as it is. Returns 0 if all of it
+ * could be applied.
+ */
+int rtl_ais_reload(struct rtl_ais_context *ctx, struct rtl_ais_config *config)
+{
+	struct rtl_ais_config *run = &ctx->config;
+	int dongle_freq, rate_changed = 0, ignored, ret = 0;
+
+	dongle_freq = config->left_freq / 2 + config->right_freq / 2;
+	if (config->edge)
+		dongle_freq -= config->sample_rate / 2;
+
+	/* the sample rates follow from the channel spacing */
+	if (config->right_freq - config->left_freq != run->right_freq - run->left_freq)
+	{
+		fprintf(stderr, "Reload: channel spacing changed, needs a restart, ignored\n");
+		rate_changed++;
+	}
+	rate_changed += restart_int("-s", run->sample_rate, config->sample_rate);
+	rate_changed += restart_int("-o", run->output_rate, config->output_rate);
+	rate_changed += restart_int("-E", run->edge, config->edge);
+	ignored = rate_changed;
+	ignored += restart_int("-A", run->use_internal_aisdecoder, config->use_internal_aisdecoder);
+	ignored += restart_int("-O", run->oversample, config->oversample);
+	ignored += restart_str("-d", run->device, config->device);
+	ignored += restart_int("-d", run->dev_given ? run->dev_index : -1, config->dev_given ? config->dev_index : -1);
+	ignored += restart_int("-L", run->show_levels, config->show_levels);
+	ignored += restart_int("-n", run->debug_nmea, config->debug_nmea);
+	ignored += restart_int("-I", run->add_sample_num, config->add_sample_num);
+	ignored += restart_int("-v", run->debug, config->debug);
+	ignored += restart_int("-T", run->use_tcp_listener, config->use_tcp_listener);
+	ignored += restart_int("-k", run->tcp_stream_forever, config->tcp_stream_forever);
+	ignored += restart_int("-Q", run->tcp_queue_kb, config->tcp_queue_kb);
+	ignored += restart_str("-Q policy", run->tcp_overflow, config->tcp_overflow);
+	ignored += restart_int("-F", run->tcp_subscribe, config->tcp_subscribe);
+	ignored += restart_int("-V", run->tcp_snapshot_age, config->tcp_snapshot_age);
+	ignored += restart_str("-z", run->tcp_zport, config->tcp_zport);
+	ignored += restart_int("-z flush", run->tcp_zflush_ms, config->tcp_zflush_ms);
+	ignored += restart_str("-w", run->tcp_http_port, config->tcp_http_port);
+	ignored += restart_str("-X", run->thin_spec, config->thin_spec);
+	ignored += restart_str("-m", run->stats_shm, config->stats_shm);
+	ignored += restart_str("-C", run->capture_spec, config->capture_spec);
+	ignored += restart_str("-G", run->agc_spec, config->agc_spec);
+	ignored += restart_int("-K", run->drift_ppm, config->drift_ppm);
+	ignored += restart_int("-W", run->watchdog_sec, config->watchdog_sec);
+	ignored += restart_int("-q", run->squelch_db, config->squelch_db);
+	ignored += restart_str("-e", run->spectrum_spec, config->spectrum_spec);
+	ignored += restart_str("-N", run->coverage_spec, config->coverage_spec);
+	ignored += restart_str("-J", run->tag_block, config->tag_block);
+	ignored += restart_str("-f", run->replay_file, config->replay_file);
+	if (!run->use_internal_aisdecoder || run->use_tcp_listener)
+		ignored += restart_str("-P", run->port, config->port);
+	if (!run->use_internal_aisdecoder)
+		ignored += restart_str("output file", run->filename, config->filename);
+
+	/* the front end, a replay has none */
+	pthread_mutex_lock(&ctx->dev_lock);
+	if (ctx->dev)
+	{
+		if (dongle_freq != ctx->dongle_freq && !rate_changed)
+		{
+			verbose_set_frequency(ctx->dev, dongle_freq);
+			ctx->dongle_freq = dongle_freq;
+			if (ctx->capturing)
+				ctx->capture.freq = dongle_freq;
+			if (ctx->spectrum_on)
+				__atomic_store_n(&ctx->spectrum.freq, dongle_freq, __ATOMIC_RELAXED);
+			run->left_freq = config->left_freq;
+			run->right_freq = config->right_freq;
+		}
+		if (config->gain != run->gain && ctx->agc_on)
+			fprintf(stderr, "Reload: the AGC (-G) sets the gain, -g ignored\n");
+		else if (config->gain != run->gain)
+		{
+			if (config->gain == AUTO_GAIN)
+				verbose_auto_gain(ctx->dev);
+			else
+				verbose_gain_set(ctx->dev, nearest_gain(ctx->dev, config->gain));
+			run->gain = config->gain;
+		}
+		if (config->rtl_agc != run->rtl_agc)
+		{
+			if (rtlsdr_set_agc_mode(ctx->dev, config->rtl_agc) < 0)
+				fprintf(stderr, "Error setting RTL AGC mode\n");
+			else
+				fprintf(stderr, "RTL AGC mode %s\n", config->rtl_agc ? "ON" : "OFF");
+			run->rtl_agc = config->rtl_agc;
+		}
+		if (config->custom_ppm && config->ppm_error != run->ppm_error)
+		{
+			verbose_ppm_set(ctx->dev, config->ppm_error);
+			run->ppm_error = config->ppm_error;
+		}
+	}
+	else if (ctx->replay && dongle_freq != ctx->dongle_freq)
+		fprintf(stderr, "Reload: no tuner while replaying a file, frequency ignored\n");
+	else if (!ctx->replay)
+		fprintf(stderr, "Reload: the dongle is being reopened, tuner settings ignored\n");
+	pthread_mutex_unlock(&ctx->dev_lock);
+	ctx->dc_filter = run->dc_filter = config->dc_filter;
+
+	if (run->use_internal_aisdecoder)
+	{
+		ret = reload_ais_decoder(config);
+		if (ret == 0)
+		{
+			run->seconds_for_decoder_stats = config->seconds_for_decoder_stats;
+			run->tcp_keep_ais_time = config->tcp_keep_ais_time;
+			run->stats_shm_ms = config->stats_shm_ms;
+			run->mmsi = config->mmsi;
+		}
+	}
+	return ret != 0 || ignored ? 1 : 0;
+}
+
 const char *rtl_ais_next_message(struct rtl_ais_context *ctx)
 {
 	(void)(ctx); // unused for now
@@ -708,11 +1405,53 @@ const char *rtl_ais_next_message(struct rtl_ais_context *ctx)
 
 void rtl_ais_cleanup(struct rtl_ais_context *ctx)
 {
-	rtlsdr_cancel_async(ctx->dev);
 	ctx->active = 0;
-
-	pthread_detach(ctx->demod_thread);
-	pthread_detach(ctx->rtlsdr_thread);
+	if (ctx->replay)
+	{
+		/* the replay thread waits for the demodulator to finish */
+		pthread_join(ctx->rtlsdr_thread, NULL);
+		fclose(ctx->replay);
+	}
+	else
+	{
+		/* the watchdog must not reopen what is closed here */
+		if (ctx->watchdog_ms)
+			pthread_join(ctx->watchdog_thread, NULL);
+		/* without a handle the watchdog joined or abandoned the USB thread */
+		if (ctx->dev)
+		{
+			rtlsdr_cancel_async(ctx->dev);
+			pthread_join(ctx->rtlsdr_thread, NULL);
+		}
+	}
+	/* the demodulator may be waiting for a buffer, or still using the spectrum */
+	while (!ctx->demod_done)
+	{
+		safe_cond_signal(&ctx->ready, &ctx->ready_m);
+		usleep(1000);
+	}
+	pthread_join(ctx->demod_thread, NULL);
+	/* no callback runs any more, the -C ring can go */
+	if (ctx->capturing)
+	{
+		ctx->capturing = 0;
+		iq_capture_stop(&ctx->capture);
+	}
+	if (ctx->spectrum_on)
+	{
+		ctx->spectrum_on = 0;
+		spectrum_stop(&ctx->spectrum);
+	}
+	if (ctx->agc_on)
+	{
+		ctx->agc_on = 0;
+		agc_free(&ctx->agc);
+	}
+	if (ctx->drift_on)
+	{
+		ctx->drift_on = 0;
+		drift_free(&ctx->drift);
+	}
 
 	if (ctx->file != stdout)
 	{
@@ -720,12 +1459,12 @@ void rtl_ais_cleanup(struct rtl_ais_context *ctx)
 			fclose(ctx->file);
 	}
 
-	rtlsdr_cancel_async(ctx->dev);
-	safe_cond_signal(&ctx->ready, &ctx->ready_m);
 	pthread_cond_destroy(&ctx->ready);
 	pthread_mutex_destroy(&ctx->ready_m);
 
-	rtlsdr_close(ctx->dev);
+	if (ctx->dev)
+		rtlsdr_close(ctx->dev);
+	pthread_mutex_destroy(&ctx->dev_lock);
 
 	free(ctx);
 }
@@ -16,16 +16,39 @@
  */
 
 
+#define MAX_OUTPUT_SINKS 16
+
 struct rtl_ais_context;
 struct rtl_ais_config
 {
     int gain, dev_index, dev_given, ppm_error, rtl_agc, custom_ppm;
+    char *device;	/* -d index or serial, searched for at the start instead of dev_index */
     int left_freq, right_freq, sample_rate, output_rate, dongle_freq;
     int dongle_rate, delta, edge;
 
     int oversample, dc_filter, use_internal_aisdecoder;
     int seconds_for_decoder_stats;
     int use_tcp_listener, tcp_keep_ais_time, tcp_stream_forever;
+    int tcp_queue_kb;
+    char *tcp_overflow;
+    int tcp_subscribe, tcp_snapshot_age;
+    char *tcp_zport;
+    int tcp_zflush_ms;
+    char *tcp_http_port;
+    int udp_mtu, udp_max_latency;
+    char *thin_spec;
+    char *stats_shm;
+    int stats_shm_ms;
+    char *sinks[MAX_OUTPUT_SINKS];
+    int nsinks;
+    char *capture_spec, *replay_file;
+    char *agc_spec;
+    int drift_ppm;
+    int watchdog_sec;
+    int squelch_db;
+    char *spectrum_spec;
+    char *coverage_spec;
+    char *tag_block;	/* "s" or "ms": NMEA TAG block with the capture time */
     /* Aisdecoder */
     int	show_levels, debug_nmea;
     char *port, *host,*filename;
@@ -39,5 +62,7 @@ struct rtl_ais_config
 void rtl_ais_default_config(struct rtl_ais_config *config);
 struct rtl_ais_context *rtl_ais_start(struct rtl_ais_config *config);
 int rtl_ais_isactive(struct rtl_ais_context *ctx);
+int rtl_ais_capture_dump(struct rtl_ais_context *ctx);
+int rtl_ais_reload(struct rtl_ais_context *ctx, struct rtl_ais_config *config);
 const char *rtl_ais_next_message(struct rtl_ais_context *ctx);
 void rtl_ais_cleanup(struct rtl_ais_context *ctx);
\ No newline at end of file
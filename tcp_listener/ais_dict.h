@@ -0,0 +1,26 @@
+// -------------------------------------------------------
+// ais_dict.h
+// Preset deflate dictionary for the compressed TCP feed.
+// Clients need the very same bytes to inflate the stream,
+// see ais_inflate.c. Never change it, add a new one.
+// -------------------------------------------------------
+#ifndef __AIS_DICT_H_
+#define __AIS_DICT_H_
+
+// Typical sentences, most frequent last: deflate reaches back to the
+// end of the dictionary most cheaply.
+static const char ais_dict[] =
+	"!AIVDM,1,1,,A,H00000000000000000000000000,2*\r\n"
+	"!AIVDM,1,1,,B,B0000000000000000000000000000,0*\r\n"
+	"!AIVDM,2,1,1,A,50000000000000000000000000000000000000000000000000000000000,0*\r\n"
+	"!AIVDM,2,2,1,A,00000000000,2*\r\n"
+	"!AIVDM,2,1,2,B,50000000000000000000000000000000000000000000000000000000000,0*\r\n"
+	"!AIVDM,2,2,2,B,88888888880,2*\r\n"
+	"!AIVDM,1,1,,A,4000000000000000000000000000,0*\r\n"
+	"!AIVDM,1,1,,B,3000000000000000000000000000,0*\r\n"
+	"!AIVDM,1,1,,A,13000000000000000000000000000,0*\r\n"
+	"!AIVDM,1,1,,B,15000000000000000000000000000,0*\r\n"
+	"!AIVDM,1,1,,A,1000000000000000000000000000,0*\r\n"
+	"!AIVDM,1,1,,B,1000000000000000000000000000,0*\r\n";
+
+#endif
@@ -0,0 +1,107 @@
+// ------------------------------------------------------------
+// ais_inflate.c
+// Client for the compressed TCP feed (rtl_ais -z): connects to
+// host:port and writes the NMEA sentences to stdout.
+//
+// The feed is a sequence of zlib streams, all with the preset
+// dictionary from ais_dict.h.
+// ------------------------------------------------------------
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#include "ais_dict.h"
+
+static int connect_to(const char *host, const char *port)
+{
+	struct addrinfo hints, *addr, *a;
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr) != 0)
+	{
+		fprintf(stderr, "Failed to resolve %s\n", host);
+		return -1;
+	}
+	for (a = addr; a != NULL; a = a->ai_next)
+	{
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addr);
+	if (fd < 0)
+		fprintf(stderr, "Failed to connect to %s port %s: %s\n", host, port, strerror(errno));
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char in[16384], out[65536];
+	unsigned long total_in = 0, total_out = 0;
+	z_stream z;
+	ssize_t n;
+	int fd, rc;
+
+	if (argc < 3 || argc > 4)
+	{
+		fprintf(stderr, "Usage: ais_inflate host port [\"SUB key=value;...\"]\n");
+		return 1;
+	}
+	fd = connect_to(argv[1], argv[2]);
+	if (fd < 0)
+		return 1;
+	if (argc == 4)
+	{
+		char line[512];
+		snprintf(line, sizeof(line), "%s\r\n", argv[3]);
+		if (write(fd, line, strlen(line)) < 0)
+			perror("write");
+	}
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit(&z) != Z_OK)
+		return 1;
+	while ((n = read(fd, in, sizeof(in))) > 0)
+	{
+		total_in += n;
+		z.next_in = in;
+		z.avail_in = n;
+		while (z.avail_in > 0)
+		{
+			z.next_out = out;
+			z.avail_out = sizeof(out);
+			rc = inflate(&z, Z_SYNC_FLUSH);
+			if (rc == Z_NEED_DICT)
+				rc = inflateSetDictionary(&z, (const unsigned char *)ais_dict, sizeof(ais_dict) - 1);
+			if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+			{
+				fprintf(stderr, "Corrupt stream: %s\n", z.msg ? z.msg : "unknown error");
+				return 1;
+			}
+			fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+			total_out += sizeof(out) - z.avail_out;
+			// The next segment is a new zlib stream.
+			if (rc == Z_STREAM_END)
+				inflateReset(&z);
+			else if (rc == Z_BUF_ERROR)
+				break;
+		}
+		fflush(stdout);
+	}
+	inflateEnd(&z);
+	close(fd);
+	fprintf(stderr, "%lu bytes received, %lu bytes of NMEA\n", total_in, total_out);
+	return 0;
+}
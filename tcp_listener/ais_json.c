@@ -0,0 +1,184 @@
+// ------------------------------------------------------------
+// ais_json.c
+// JSON for decoded messages and vessels.
+//
+// Everything is written directly into the caller's buffer, nothing
+// is allocated. Positions and speeds come from the decoded struct
+// ais_msg, the NMEA text is only copied along.
+// ------------------------------------------------------------
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "ais_json.h"
+
+typedef struct t_json_out
+{
+	char *p;
+	char *end;	// leaves room for the terminating nul
+	int full;
+} JSON_OUT;
+
+static void put(JSON_OUT *j, const char *s, unsigned int n)
+{
+	if (j->full || n > (unsigned int)(j->end - j->p))
+	{
+		j->full = 1;
+		return;
+	}
+	memcpy(j->p, s, n);
+	j->p += n;
+}
+
+static void put_fmt(JSON_OUT *j, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (j->full)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(j->p, j->end - j->p + 1, fmt, ap);
+	va_end(ap);
+	if (n < 0 || n > j->end - j->p)
+		j->full = 1;
+	else
+		j->p += n;
+}
+
+// A quoted string. AIS text is plain ASCII, but may contain '"' and '\'.
+static void put_string(JSON_OUT *j, const char *s, unsigned int n)
+{
+	unsigned int i, start = 0;
+
+	put(j, "\"", 1);
+	for (i = 0; i < n; i++)
+	{
+		if (s[i] != '"' && s[i] != '\\' && (unsigned char)s[i] >= 0x20)
+			continue;
+		put(j, s + start, i - start);
+		if (s[i] == '"' || s[i] == '\\')
+		{
+			put(j, "\\", 1);
+			put(j, s + i, 1);
+		}
+		else
+			put_fmt(j, "\\u%04x", (unsigned char)s[i]);
+		start = i + 1;
+	}
+	put(j, s + start, n - start);
+	put(j, "\"", 1);
+}
+
+static void put_key_string(JSON_OUT *j, const char *key, const char *s)
+{
+	put_fmt(j, ",\"%s\":", key);
+	put_string(j, s, strlen(s));
+}
+
+// Position and motion, only the fields the message has.
+static void put_position(JSON_OUT *j, const struct ais_msg *m)
+{
+	if (m->has_pos)
+		put_fmt(j, ",\"lat\":%.6f,\"lon\":%.6f", m->lat / 600000.0, m->lon / 600000.0);
+	if (m->sog < AIS_SOG_NA)
+		put_fmt(j, ",\"sog\":%.1f", m->sog / 10.0);
+	if (m->cog < AIS_COG_NA)
+		put_fmt(j, ",\"cog\":%.1f", m->cog / 10.0);
+	if (m->heading < 360)
+		put_fmt(j, ",\"heading\":%u", m->heading);
+	if (m->navstatus != AIS_NAVSTATUS_NA)
+		put_fmt(j, ",\"navstatus\":%u", m->navstatus);
+}
+
+static void put_static(JSON_OUT *j, const struct ais_msg *m)
+{
+	if (m->name[0])
+		put_key_string(j, "name", m->name);
+	if (m->callsign[0])
+		put_key_string(j, "callsign", m->callsign);
+	if (m->destination[0])
+		put_key_string(j, "destination", m->destination);
+	if (m->shiptype)
+		put_fmt(j, ",\"shiptype\":%u", m->shiptype);
+}
+
+static int finish(JSON_OUT *j, char *buf)
+{
+	if (j->full)
+		return -1;
+	*j->p = 0;
+	return j->p - buf;
+}
+
+int ais_json_message(char *buf, unsigned int size, const struct timeval *timestamp, const struct ais_msg *msg, const char *nmea, unsigned int length)
+{
+	JSON_OUT j;
+	unsigned int i, start;
+	int first = 1;
+
+	if (size == 0)
+		return -1;
+	j.p = buf;
+	j.end = buf + size - 1;
+	j.full = 0;
+
+	put_fmt(&j, "{\"time\":%ld.%03ld,\"type\":%u,\"repeat\":%u,\"mmsi\":%lu",
+			(long)timestamp->tv_sec, (long)timestamp->tv_usec / 1000, msg->type, msg->repeat, msg->mmsi);
+	if (msg->chanid)
+		put_fmt(&j, ",\"channel\":\"%c\"", msg->chanid);
+	if (msg->type == 24)
+		put_fmt(&j, ",\"part\":%u", msg->part);
+	put_position(&j, msg);
+	put_static(&j, msg);
+
+	// The sentences, without line ends.
+	put(&j, ",\"nmea\":[", 9);
+	for (i = start = 0; i <= length; i++)
+	{
+		if (i < length && nmea[i] != '\r' && nmea[i] != '\n')
+			continue;
+		if (i > start)
+		{
+			if (!first)
+				put(&j, ",", 1);
+			put_string(&j, nmea + start, i - start);
+			first = 0;
+		}
+		start = i + 1;
+	}
+	put(&j, "]}", 2);
+	return finish(&j, buf);
+}
+
+int ais_json_vessel(char *buf, unsigned int size, const VESSEL *v)
+{
+	const VESSEL_REPORT *dyn = &v->report[VESSEL_DYNAMIC];
+	JSON_OUT j;
+	int k;
+
+	if (size == 0)
+		return -1;
+	j.p = buf;
+	j.end = buf + size - 1;
+	j.full = 0;
+
+	put_fmt(&j, "{\"mmsi\":%lu,\"last_seen\":%ld", v->mmsi, (long)v->last_seen);
+	if (dyn->length)
+	{
+		put_fmt(&j, ",\"type\":%u,\"time\":%ld", dyn->msg.type, (long)dyn->timestamp.tv_sec);
+		put_position(&j, &dyn->msg);
+	}
+	// Static data from type 5, else from the type 24 parts.
+	for (k = VESSEL_STATIC; k <= VESSEL_STATIC_B; k++)
+	{
+		if (v->report[k].length)
+		{
+			put_static(&j, &v->report[k].msg);
+			if (k == VESSEL_STATIC)
+				break;
+		}
+	}
+	put(&j, "}", 1);
+	return finish(&j, buf);
+}
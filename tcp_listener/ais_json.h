@@ -0,0 +1,19 @@
+// -------------------------------------------------------
+// ais_json.h
+// JSON for decoded messages and vessels, written straight
+// into a caller supplied buffer.
+// -------------------------------------------------------
+#ifndef __AIS_JSON_H_
+#define __AIS_JSON_H_
+
+#include <sys/time.h>
+
+#include "../aisdecoder/lib/aismsg.h"
+#include "vessel_cache.h"
+
+// Both return the length written (without the terminating nul), or
+// -1 if the buffer was too small.
+int ais_json_message(char *buf, unsigned int size, const struct timeval *timestamp, const struct ais_msg *msg, const char *nmea, unsigned int length);
+int ais_json_vessel(char *buf, unsigned int size, const VESSEL *v);
+
+#endif
@@ -0,0 +1,194 @@
+// ------------------------------------------------------------
+// ais_ring.c
+// Time ordered ring of variable length records.
+//
+// Records are appended at the head and evicted from the tail, both
+// in O(1). Each record is a header with the receive time and the
+// length, followed by the data, padded to 8 bytes. When a record does
+// not fit before the end of the buffer, the rest of the buffer is
+// skipped (marked with AIS_RING_WRAP if a header still fits there).
+// ------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+
+#include "ais_ring.h"
+
+typedef struct t_ais_rec
+{
+	struct timeval timestamp;
+	unsigned int length;
+} AIS_REC, *P_AIS_REC;
+
+#define AIS_RING_WRAP 0xffffffffu
+#define AIS_REC_ALIGN(n) (((n) + 7) & ~7u)
+#define AIS_REC_SIZE(len) AIS_REC_ALIGN(sizeof(AIS_REC) + (len))
+
+int ais_ring_init(P_AIS_RING r, unsigned int size)
+{
+	memset(r, 0, sizeof(AIS_RING));
+	r->size = AIS_REC_ALIGN(size);
+	r->buf = malloc(r->size);
+	if (r->buf == NULL)
+		return 0;
+	return 1;
+}
+
+void ais_ring_free(P_AIS_RING r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+// ------------------------------------------------------------
+// Return the record at logical position *pos, skipping over the
+// unused end of the buffer. *pos is moved to the record found.
+// ------------------------------------------------------------
+static P_AIS_REC record_at(P_AIS_RING r, unsigned long long *pos)
+{
+	unsigned int off = *pos % r->size;
+	P_AIS_REC rec;
+
+	if (r->size - off >= sizeof(AIS_REC))
+	{
+		rec = (P_AIS_REC)(r->buf + off);
+		if (rec->length != AIS_RING_WRAP)
+			return rec;
+	}
+	*pos += r->size - off;
+	return (P_AIS_REC)r->buf;
+}
+
+static void evict_oldest(P_AIS_RING r)
+{
+	P_AIS_REC rec = record_at(r, &r->tail);
+	r->tail += AIS_REC_SIZE(rec->length);
+	r->count--;
+}
+
+// ------------------------------------------------------------
+// Oldest record, or NULL if the ring is empty. The data stays valid
+// until the record is popped or overwritten by a push.
+// ------------------------------------------------------------
+const char *ais_ring_peek(P_AIS_RING r, struct timeval *timestamp, unsigned int *length)
+{
+	P_AIS_REC rec;
+	unsigned long long pos = r->tail;
+
+	if (r->count == 0)
+		return NULL;
+	rec = record_at(r, &pos);
+	if (timestamp != NULL)
+		*timestamp = rec->timestamp;
+	*length = rec->length;
+	return (const char *)(rec + 1);
+}
+
+void ais_ring_pop(P_AIS_RING r)
+{
+	if (r->count > 0)
+		evict_oldest(r);
+}
+
+// ------------------------------------------------------------
+// Append a record, evicting the oldest ones if there is no room.
+// Returns 0 if the record can never fit.
+// ------------------------------------------------------------
+int ais_ring_push(P_AIS_RING r, const struct timeval *timestamp, const char *data, unsigned int length)
+{
+	unsigned int need = AIS_REC_SIZE(length);
+	unsigned int off = r->head % r->size;
+	unsigned int pad = 0;
+	P_AIS_REC rec;
+
+	if (need > r->size / 2)
+		return 0;
+	if (r->size - off < need)
+		pad = r->size - off;
+	while (r->size - (r->head - r->tail) < pad + need)
+	{
+		evict_oldest(r);
+		r->overwritten++;
+	}
+	if (pad)
+	{
+		if (pad >= sizeof(AIS_REC))
+			((P_AIS_REC)(r->buf + off))->length = AIS_RING_WRAP;
+		r->head += pad;
+	}
+
+	rec = (P_AIS_REC)(r->buf + r->head % r->size);
+	rec->timestamp = *timestamp;
+	rec->length = length;
+	memcpy(rec + 1, data, length);
+
+	if (r->count == 0 || timestamp->tv_sec != r->last_sec)
+	{
+		AIS_RING_INDEX_SLOT *slot = &r->index[timestamp->tv_sec % AIS_RING_INDEX];
+		slot->sec = timestamp->tv_sec;
+		slot->pos = r->head;
+		r->last_sec = timestamp->tv_sec;
+	}
+	r->head += need;
+	r->count++;
+	return 1;
+}
+
+// ------------------------------------------------------------
+// Evict records received before older_than. Returns the number of
+// records removed.
+// ------------------------------------------------------------
+unsigned int ais_ring_expire(P_AIS_RING r, time_t older_than)
+{
+	unsigned int n = 0;
+	while (r->count > 0)
+	{
+		unsigned long long pos = r->tail;
+		if (record_at(r, &pos)->timestamp.tv_sec >= older_than)
+			break;
+		evict_oldest(r);
+		n++;
+	}
+	return n;
+}
+
+// ------------------------------------------------------------
+// Call fn for every record received in [from, to], oldest first.
+// The start is looked up in the per-second index, so only records
+// in the range are touched. Returns the number of records replayed.
+// ------------------------------------------------------------
+unsigned int ais_ring_replay(P_AIS_RING r, time_t from, time_t to, ais_ring_replay_fn fn, void *arg)
+{
+	unsigned long long pos = r->tail;
+	unsigned int n = 0;
+	time_t s;
+
+	if (r->count == 0 || from > r->last_sec)
+		return 0;
+	if (r->last_sec - from < AIS_RING_INDEX)
+	{
+		for (s = from; s <= r->last_sec; s++)
+		{
+			AIS_RING_INDEX_SLOT *slot = &r->index[s % AIS_RING_INDEX];
+			if (slot->sec == s)
+			{
+				if (slot->pos > r->tail)
+					pos = slot->pos;
+				break;
+			}
+		}
+	}
+
+	while (pos < r->head)
+	{
+		P_AIS_REC rec = record_at(r, &pos);
+		if (rec->timestamp.tv_sec > to)
+			break;
+		if (rec->timestamp.tv_sec >= from)
+		{
+			fn(arg, &rec->timestamp, (const char *)(rec + 1), rec->length);
+			n++;
+		}
+		pos += AIS_REC_SIZE(rec->length);
+	}
+	return n;
+}
@@ -0,0 +1,47 @@
+// -------------------------------------------------------
+// ais_ring.h
+// Time ordered ring of variable length records, used for
+// the -t message history of the tcp listener.
+// -------------------------------------------------------
+#ifndef __AIS_RING_H_
+#define __AIS_RING_H_
+
+#include <time.h>
+#include <sys/time.h>
+
+// Number of one second slots in the time index. Ranges further back
+// than this are found by scanning from the oldest record.
+#define AIS_RING_INDEX 1024
+
+typedef struct t_ais_ring_index
+{
+	time_t sec;
+	unsigned long long pos;
+} AIS_RING_INDEX_SLOT;
+
+typedef struct t_ais_ring
+{
+	char *buf;
+	unsigned int size;
+	// Logical positions, they only ever grow. The offset in buf is
+	// pos % size, a record never wraps around the end of buf.
+	unsigned long long head;
+	unsigned long long tail;
+	unsigned int count;
+	time_t last_sec;
+	AIS_RING_INDEX_SLOT index[AIS_RING_INDEX];
+	// Records evicted before their time because the ring was full.
+	unsigned long overwritten;
+} AIS_RING, *P_AIS_RING;
+
+typedef void (*ais_ring_replay_fn)(void *arg, const struct timeval *timestamp, const char *data, unsigned int length);
+
+int ais_ring_init(P_AIS_RING r, unsigned int size);
+void ais_ring_free(P_AIS_RING r);
+int ais_ring_push(P_AIS_RING r, const struct timeval *timestamp, const char *data, unsigned int length);
+unsigned int ais_ring_expire(P_AIS_RING r, time_t older_than);
+const char *ais_ring_peek(P_AIS_RING r, struct timeval *timestamp, unsigned int *length);
+void ais_ring_pop(P_AIS_RING r);
+unsigned int ais_ring_replay(P_AIS_RING r, time_t from, time_t to, ais_ring_replay_fn fn, void *arg);
+
+#endif
@@ -4,19 +4,63 @@
 // ------------------------------------------------------------
 #include <getopt.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <zlib.h>
+
+#include "tcp_listener.h"
+#include "ais_ring.h"
+#include "vessel_cache.h"
+#include "ais_dict.h"
+#include "ais_json.h"
+#include "websocket.h"
+#include "../aisdecoder/lib/aismsg.h"
+#include "../aisdecoder/lib/metrics.h"
+#include "../aisdecoder/lib/coverage.h"
+
+// ------------------------------------------------------------
+// Per-client send queue. Messages are stored as records with a
+// six byte prefix in a fixed size ring: the length, and the time the
+// decoder emitted the message (ms on the monotonic clock, truncated to
+// 32 bits, 0 for backlog, compressed data and http replies), so the decoder thread
+// only ever does a memcpy and the client thread sends whatever the
+// socket accepts without blocking.
+// ------------------------------------------------------------
+typedef struct t_send_queue
+{
+	char *buf;
+	unsigned int size;	// ring capacity in bytes
+	unsigned int head;	// offset of the oldest record
+	unsigned int used;	// bytes in use, including length prefixes
+	unsigned int sent;	// bytes of the head record already sent
+	unsigned int msgs;	// records in the ring
+} SEND_QUEUE, *P_SEND_QUEUE;
+
+#define SQ_HDR 6
+#define SQ_IOV 32
+
+// A priority message waiting to be sent, ahead of the send queue.
+typedef struct t_priority_msg
+{
+	double queued;		// ms, CLOCK_MONOTONIC
+	unsigned int len, sent;
+	char data[TCP_PRIORITY_MAX];
+} PRIORITY_MSG;
 
 typedef struct t_sockIo
 {
@@ -28,17 +72,71 @@ typedef struct t_sockIo
 	struct t_sockIo *next;
 
 	// An active listener thread has a `pipe()` allocated, whose file
-	// descriptors are stored here. This pipe is written to with new
-	// AIS messages as they are decoded if `_tcp_stream_forever` is set.
+	// descriptors are stored here. A single byte is written to it to wake
+	// the thread when its send queue goes from empty to non-empty.
 	int msgpipe[2];
 
+	// Outgoing data, filled by the decoder thread (live messages) and the
+	// listener thread (backlog replay), drained by the client thread.
+	pthread_mutex_t sq_lock;
+	SEND_QUEUE sq;
+	int overflowed;		// disconnect policy triggered
+	PRIORITY_MSG urgent[TCP_PRIORITY_SLOTS];
+	unsigned int urgent_head, urgent_count;
+
+	// Subscription filter, protected by ais_lock. While sub_pending is
+	// set the client gets nothing, it may still send its first SUB line.
+	struct ais_filter filter;
+	int sub_pending;
+	long sub_deadline;	// ms since the epoch
+	char line[TCP_SUBSCRIBE_LINE];
+	unsigned int line_len;
+
+	// Clients of the compressed port (-z). While joining, and while it
+	// has a filter, a client has its own compressor in zs. Otherwise it
+	// gets the shared stream. Both are only used under ais_lock.
+	int compressed;
+	z_stream *zs;
+	int zpending;		// input not flushed yet
+
+	// Clients of the http port (-w). Until websocket is set, line
+	// collects the request and the client gets no messages.
+	int http;
+	int websocket;
+
+	// Metrics
+	unsigned long queued_msgs;
+	unsigned long sent_bytes;
+	unsigned long dropped_msgs;
+	unsigned long coalesced_msgs;
+	unsigned long filtered_msgs;
+	unsigned int max_queued;
+	time_t connected;
+
 } TCP_SOCK, *P_TCP_SOCK;
 
 static int sockfd;
+static int zsockfd = -1;
+static int zportno = 0;
+static int httpsockfd = -1;
+static int httpportno = 0;
 static int _debug = 0;
 static int _tcp_keep_ais_time = 15;
 static int _tcp_stream_forever = 0;
 static int portno;
+static unsigned int _send_queue_size = TCP_DEFAULT_QUEUE_KB * 1024;
+static int _overflow_policy = TCP_OVERFLOW_DROP;
+static int _allow_subscribe = 0;
+static int _snapshot_age = 0;
+static int _vessel_age = 0;	// vessels are kept this long, 0: no vessel cache
+static int _zflush_ms = TCP_ZFLUSH_MS;
+
+static const char *overflow_policy_names[] = {"drop", "coalesce", "disconnect"};
+
+// Totals over all clients, including those already disconnected.
+static unsigned long total_dropped_msgs = 0;
+static unsigned long total_coalesced_msgs = 0;
+static unsigned long total_overflow_disconnects = 0;
 
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 ;
@@ -48,19 +146,37 @@ P_TCP_SOCK head = (P_TCP_SOCK)NULL;
 P_TCP_SOCK end = (P_TCP_SOCK)NULL;
 
 pthread_t tcp_listener_thread;
+pthread_t ztcp_listener_thread;
+pthread_t http_listener_thread;
 
-typedef struct t_ais_mess
-{
-	char message[100]; // max on nmea message is 83 char's
-	char *plmess;
-	int length;
-	struct timeval timestamp;
-	struct t_ais_mess *next;
-} AIS_MESS, *P_AIS_MESS;
+// Saved ais messages, replayed to new clients. Protected by ais_lock.
+// Each record is the decoded struct ais_msg followed by the sentences,
+// so replays can be filtered.
+AIS_RING ais_history;
+
+// With -V, new clients get the latest reports per vessel instead of
+// the history. Also the source of the http vessel list. Protected by
+// ais_lock.
+VESSEL_CACHE vessels;
 
-// Linked list ais messages.
-P_AIS_MESS ais_head = (P_AIS_MESS)NULL;
-P_AIS_MESS ais_end = (P_AIS_MESS)NULL;
+// ------------------------------------------------------------
+// Compressed feed. All clients that are at the same point of the
+// stream share one compressor. The shared stream is cut into
+// segments, each a complete zlib stream with the preset dictionary,
+// so a new client can start at any segment boundary. Until then it
+// gets a private stream of its own, which ends right at the boundary.
+// Protected by ais_lock.
+// ------------------------------------------------------------
+static z_stream zshared;
+static int zseg_open = 0;	// a shared segment has been started
+static int zseg_pending = 0;	// input not flushed yet
+static time_t zseg_start;
+static unsigned long zseg_in;
+static unsigned char zout[TCP_ZCHUNK];
+static pthread_t zflush_thread;
+
+static unsigned long zshared_in = 0, zshared_out = 0;
+static unsigned long zprivate_in = 0, zprivate_out = 0;
 
 pthread_mutex_t ais_lock = PTHREAD_MUTEX_INITIALIZER;
 ;
@@ -69,61 +185,197 @@ pthread_mutex_t ais_lock = PTHREAD_MUTEX_INITIALIZER;
 P_TCP_SOCK init_node();
 void add_node(P_TCP_SOCK new_node);
 void delete_node(P_TCP_SOCK p);
-int accept_c(P_TCP_SOCK p_tcp_sock);
+int accept_c(P_TCP_SOCK p_tcp_sock, int fd);
+static int open_listen_socket(int port);
 int error_category(int rc);
 static void *tcp_listener_fn(void *arg);
 void *handle_remote_close(void *arg);
-void delete_ais_node(P_AIS_MESS p);
 void remove_old_ais_messages();
+static int queue_message(P_TCP_SOCK t, const char *mess, unsigned int length, int policy, double emitted);
+static int queue_priority(P_TCP_SOCK t, const char *mess, unsigned int length, double queued);
+static int send_queued(P_TCP_SOCK t);
+static void replay_ais_messages(P_TCP_SOCK t);
+static int read_subscription(P_TCP_SOCK t);
+static int read_http(P_TCP_SOCK t);
+static void handle_client_line(P_TCP_SOCK t, char *line);
+static void start_stream(P_TCP_SOCK t);
+static void client_message(P_TCP_SOCK t, const char *mess, unsigned int length, int policy);
+static void *zflush_fn(void *arg);
+static void tcp_metrics(struct metrics_out *out);
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-#include "tcp_listener.h"
+// Size the history for a busy site over the whole keep time.
+static unsigned int ais_history_size(int keep_time)
+{
+	unsigned long long size = (unsigned long long)keep_time * AIS_HISTORY_BYTES_PER_SEC;
+	if (size < AIS_HISTORY_MIN_SIZE)
+		size = AIS_HISTORY_MIN_SIZE;
+	if (size > AIS_HISTORY_MAX_SIZE)
+		size = AIS_HISTORY_MAX_SIZE;
+	return size;
+}
 
-int initTcpSocket(const char *portnumber, int debug, int tcp_keep_ais_time, int tcp_stream_forever)
+int initTcpSocket(const char *portnumber, int debug, int tcp_keep_ais_time, int tcp_stream_forever, int send_queue_kb, const char *overflow_policy, int allow_subscribe, int snapshot_age, const char *zportnumber, int zflush_ms, const char *http_portnumber)
 {
 	_debug = debug;
+	_allow_subscribe = allow_subscribe;
+	_snapshot_age = snapshot_age;
+	_vessel_age = snapshot_age;
+	if (http_portnumber != NULL && _vessel_age <= 0)
+		_vessel_age = TCP_HTTP_VESSEL_AGE;
 	_tcp_keep_ais_time = tcp_keep_ais_time;
 	_tcp_stream_forever = tcp_stream_forever;
+	int i;
+	if (send_queue_kb > 0)
+		_send_queue_size = send_queue_kb * 1024;
+	if (overflow_policy != NULL)
+	{
+		_overflow_policy = -1;
+		for (i = 0; i < 3; i++)
+			if (strcmp(overflow_policy, overflow_policy_names[i]) == 0)
+				_overflow_policy = i;
+		if (_overflow_policy < 0)
+		{
+			fprintf(stderr, "Unknown TCP overflow policy '%s' (use drop, coalesce or disconnect)\n", overflow_policy);
+			return 0;
+		}
+	}
+	unsigned int history_size = ais_history_size(_tcp_keep_ais_time);
+	if (!ais_ring_init(&ais_history, history_size))
+	{
+		fprintf(stderr, "Failed to allocate %u bytes of message history\n", history_size);
+		return 0;
+	}
+
+	if (_vessel_age > 0 && !vessel_cache_init(&vessels))
+	{
+		fprintf(stderr, "Failed to allocate the vessel cache\n");
+		return 0;
+	}
+
+	portno = atoi(portnumber);
+	if ((sockfd = open_listen_socket(portno)) < 0)
+		return 0;
+
+	if (zportnumber != NULL)
+	{
+		if (zflush_ms > 0)
+			_zflush_ms = zflush_ms;
+		zportno = atoi(zportnumber);
+		if ((zsockfd = open_listen_socket(zportno)) < 0)
+			return 0;
+		if (deflateInit2(&zshared, TCP_ZLEVEL, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			fprintf(stderr, "Failed to initialize compression\n");
+			return 0;
+		}
+		pthread_create(&zflush_thread, NULL, zflush_fn, (void *)NULL);
+		pthread_create(&ztcp_listener_thread, NULL, tcp_listener_fn, (void *)&zsockfd);
+	}
+	if (http_portnumber != NULL)
+	{
+		httpportno = atoi(http_portnumber);
+		if ((httpsockfd = open_listen_socket(httpportno)) < 0)
+			return 0;
+		metrics_add_collector(tcp_metrics);
+		pthread_create(&http_listener_thread, NULL, tcp_listener_fn, (void *)&httpsockfd);
+	}
+	pthread_create(&tcp_listener_thread, NULL, tcp_listener_fn, (void *)&sockfd);
+
+	return 1;
+}
+
+// ------------------------------------------------------------
+// Create a socket listening on all addresses. Returns -1 on error.
+// ------------------------------------------------------------
+static int open_listen_socket(int port)
+{
 	struct sockaddr_in serv_addr;
-	if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
 	{
 		fprintf(stderr, "Failed to create socket! error %d\n", errno);
-		return 0;
+		return -1;
 	}
 	memset((char *)&serv_addr, 0, sizeof(serv_addr));
-	portno = atoi(portnumber);
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	serv_addr.sin_port = htons(portno);
+	serv_addr.sin_port = htons(port);
 
-	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0)
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0)
 	{
 		fprintf(stderr, "setsockopt(SO_REUSEADDR) failed! error %d\n", errno);
-		return 0;
+		close(fd);
+		return -1;
 	}
 
-	if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+	if (bind(fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
 	{
 		fprintf(stderr, "Failed to bind socket! error %d\n", errno);
-		return 0;
+		close(fd);
+		return -1;
 	}
 
-	if (listen(sockfd, MAX_TCP_CONNECTIONS) < 0)
+	if (listen(fd, MAX_TCP_CONNECTIONS) < 0)
 	{
 		fprintf(stderr, "listen failed with error %d\n", errno);
-		return 0;
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
 
-	pthread_create(&tcp_listener_thread, NULL, tcp_listener_fn, (void *)NULL);
+static void history_copy_one(void *arg, const struct timeval *timestamp, const char *data, unsigned int length)
+{
+	ais_ring_push((P_AIS_RING)arg, timestamp, data, length);
+}
 
-	return 1;
+// ------------------------------------------------------------
+// Change the keep time (-t) while running. The history is moved
+// to a ring of the new size, when it shrinks the newest stay.
+// ------------------------------------------------------------
+void setTcpKeepTime(int tcp_keep_ais_time)
+{
+	AIS_RING ring;
+	unsigned int size = ais_history_size(tcp_keep_ais_time);
+
+	pthread_mutex_lock(&ais_lock);
+	_tcp_keep_ais_time = tcp_keep_ais_time;
+	if (size != ais_history.size)
+	{
+		if (ais_ring_init(&ring, size))
+		{
+			ais_ring_replay(&ais_history, 0, time(NULL) + 1, history_copy_one, &ring);
+			ais_ring_free(&ais_history);
+			ais_history = ring;
+		}
+		else
+			fprintf(stderr, "Failed to allocate %u bytes of message history, keeping the old size\n", size);
+	}
+	pthread_mutex_unlock(&ais_lock);
 }
 
 void closeTcpSocket()
 {
 	// wait for socket shutdown complete
 	shutdown(sockfd, 2);
+	if (zsockfd >= 0)
+		shutdown(zsockfd, 2);
+	if (httpsockfd >= 0)
+		shutdown(httpsockfd, 2);
 	sleep(3);
 	close(sockfd);
+	if (zsockfd >= 0)
+		close(zsockfd);
+	if (httpsockfd >= 0)
+		close(httpsockfd);
 }
 
 // ------------------------------------------------------------
@@ -133,16 +385,34 @@ static void *tcp_listener_fn(void *arg)
 {
 	int rc;
 	P_TCP_SOCK t;
-	(void)(arg); // not used, avoid compiling warnings
+	int fd = *(int *)arg;
+	int compressed = fd == zsockfd;
+	int http = fd == httpsockfd;
 
-	fprintf(stderr, "Tcp listen port %d\nAis message timeout with %d\n", portno, _tcp_keep_ais_time);
+	if (compressed)
+	{
+		fprintf(stderr, "Tcp compressed listen port %d, flush every %d ms\n", zportno, _zflush_ms);
+	}
+	else if (http)
+	{
+		fprintf(stderr, "Http listen port %d, WebSocket JSON stream on /ws, vessel list on /vessels, metrics on /metrics\n", httpportno);
+	}
+	else
+	{
+		fprintf(stderr, "Tcp listen port %d\nAis message timeout with %d\n", portno, _tcp_keep_ais_time);
+		fprintf(stderr, "Tcp client send queue %u kB, overflow policy %s\n", _send_queue_size / 1024, overflow_policy_names[_overflow_policy]);
+		if (_allow_subscribe)
+			fprintf(stderr, "Tcp client subscriptions ON\n");
+		if (_snapshot_age > 0)
+			fprintf(stderr, "Tcp clients get a snapshot of vessels heard in the last %d s\n", _snapshot_age);
+	}
 
 	while (1)
 	{
 
 		t = init_node();
 
-		rc = accept_c(t);
+		rc = accept_c(t, fd);
 
 		if (rc == -1)
 			break;
@@ -150,13 +420,29 @@ static void *tcp_listener_fn(void *arg)
 		if (rc == -2)
 		{
 			close(t->sock);
+			close(t->msgpipe[0]);
+			close(t->msgpipe[1]);
+			free(t->sq.buf);
 			free(t);
 			continue;
 		}
+		t->compressed = compressed;
+		t->http = http;
+		// Queue the backlog and register for live messages in one step, so
+		// that no message is missed or sent twice. A client that may still
+		// subscribe gets both once its filter is known.
+		pthread_mutex_lock(&ais_lock);
+		if (http)
+			; // nothing to send before the request
+		else if (_allow_subscribe)
+			t->sub_pending = 1;
+		else
+			replay_ais_messages(t);
 		add_node(t);
+		pthread_mutex_unlock(&ais_lock);
 		pthread_create(&t->thread_t, NULL, handle_remote_close, (void *)t);
 	}
-	shutdown(sockfd, 2);
+	shutdown(fd, 2);
 	close(t->sock);
 	return 0;
 }
@@ -167,56 +453,87 @@ static void *tcp_listener_fn(void *arg)
 void *handle_remote_close(void *arg)
 {
 	P_TCP_SOCK t = (P_TCP_SOCK)arg;
-	P_AIS_MESS ais_temp;
-
-	// On connect, send all saved ais_messages to new socket
-	pthread_mutex_lock(&ais_lock);
-	ais_temp = ais_head;
-	while (ais_temp != NULL)
-	{
-		int rc;
-		if (ais_temp->plmess != NULL)
-			rc = send(t->sock, ais_temp->plmess, ais_temp->length, 0);
-		else
-			rc = send(t->sock, ais_temp->message, ais_temp->length, 0);
-		if (_debug)
-			fprintf(stdout, "%ld: Send to %s, <%.*s>, rc=%d\n", ais_temp->timestamp.tv_sec, t->from_ip, ais_temp->length, ais_temp->message, rc);
-		ais_temp = ais_temp->next;
-	}
-	pthread_mutex_unlock(&ais_lock);
 
 	while (1)
 	{
-		fd_set fds;
-		int res;
+		fd_set fds, wfds;
+		struct timespec grace, *timeout = NULL;
+		int res, pending;
 		int msgfd = t->msgpipe[0];
 		const int nfds = (t->sock > msgfd ? t->sock : msgfd) + 1;
 
-		// Listen on the client socket, and on the internal pipe which receives
-		// new messages. (New messages will only be sent to this pipe when the
-		// program is launched with the '-k' flag.)
+		pthread_mutex_lock(&t->sq_lock);
+		pending = t->sq.msgs > 0 || t->urgent_count > 0;
+		res = t->overflowed;
+		pthread_mutex_unlock(&t->sq_lock);
+		if (res)
+		{
+			if (_debug)
+				fprintf(stderr, "%s: send queue overflow, disconnecting\n", t->from_ip);
+			break;
+		}
+
+		// Listen on the client socket, and on the internal pipe which signals
+		// newly queued messages. Wait for the socket to become writable only
+		// while there is something left to send.
 		FD_ZERO(&fds);
+		FD_ZERO(&wfds);
 		FD_SET(t->sock, &fds);
 		FD_SET(msgfd, &fds);
+		if (pending)
+			FD_SET(t->sock, &wfds);
+
+		if (t->sub_pending)
+		{
+			// Waiting for a first SUB line, but not forever.
+			struct timeval now;
+			long ms;
+			gettimeofday(&now, NULL);
+			ms = t->sub_deadline - (now.tv_sec * 1000L + now.tv_usec / 1000);
+			if (ms <= 0)
+			{
+				if (_debug)
+					fprintf(stderr, "%s: no subscription, sending everything\n", t->from_ip);
+				start_stream(t);
+				continue;
+			}
+			grace.tv_sec = ms / 1000;
+			grace.tv_nsec = (ms % 1000) * 1000000L;
+			timeout = &grace;
+		}
 
-		res = pselect(nfds, &fds, NULL, NULL, NULL, NULL);
+		res = pselect(nfds, &fds, &wfds, NULL, timeout, NULL);
 		if (res < 0)
 		{
+			if (errno == EINTR)
+				continue;
 			if (_debug)
 				perror("select error");
 			break;
 		}
 
 		// Service remote client socket: If the client sends any data, close the
-		// socket (legacy behavior).
-		if (FD_ISSET(t->sock, &fds))
+		// socket (legacy behavior), unless subscriptions are enabled.
+		if (FD_ISSET(t->sock, &fds) && t->http)
+		{
+			if (read_http(t) < 0)
+				break;
+		}
+		else if (FD_ISSET(t->sock, &fds) && _allow_subscribe)
+		{
+			if (read_subscription(t) < 0)
+				break;
+		}
+		else if (FD_ISSET(t->sock, &fds))
 		{
 			unsigned char buff[100];
 			int rc;
 			rc = recv(t->sock, (char *)buff, 99, 0);
 			if (rc < 0)
 			{
-				if (_debug && errno != EAGAIN)
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				if (_debug)
 					perror("socket error");
 				break;
 			}
@@ -228,13 +545,13 @@ void *handle_remote_close(void *arg)
 			}
 		}
 
-		// If new messages became available internally, send them to the client.
+		// Drain the wakeup pipe, the messages themselves are in the queue.
 		if (FD_ISSET(msgfd, &fds))
 		{
-			unsigned char buff[1024];
+			unsigned char buff[64];
 			int rc;
-			rc = read(msgfd, (char *)buff, 1024);
-			if (rc < 0)
+			rc = read(msgfd, (char *)buff, sizeof(buff));
+			if (rc < 0 && errno != EAGAIN && errno != EINTR)
 			{
 				if (_debug)
 				{
@@ -250,16 +567,18 @@ void *handle_remote_close(void *arg)
 				}
 				break;
 			}
+		}
 
-			rc = send(t->sock, buff, rc, 0);
-			if (rc < 0)
-			{
-				if (_debug)
-					perror("error writing to client");
-				break;
-			}
+		if (send_queued(t) < 0)
+		{
+			if (_debug)
+				perror("error writing to client");
+			break;
 		}
 	}
+	if (_debug)
+		fprintf(stderr, "%s: disconnected, sent %lu bytes, dropped %lu, coalesced %lu messages\n",
+				t->from_ip, t->sent_bytes, t->dropped_msgs, t->coalesced_msgs);
 	shutdown(t->sock, 2);
 	close(t->sock);
 	delete_node(t);
@@ -267,189 +586,1191 @@ void *handle_remote_close(void *arg)
 }
 
 // ------------------------------------------------------------
-// Accept call
+// Send queue helpers. All of them expect t->sq_lock to be held.
 // ------------------------------------------------------------
-int accept_c(P_TCP_SOCK p_tcp_sock)
+static void sq_copy_in(P_SEND_QUEUE q, unsigned int pos, const char *src, unsigned int len)
 {
+	unsigned int first;
+	pos %= q->size;
+	first = q->size - pos;
+	if (first > len)
+		first = len;
+	memcpy(q->buf + pos, src, first);
+	memcpy(q->buf, src + first, len - first);
+}
 
-	int optval = 1; // Keep alive
-	socklen_t optlen = sizeof(optval);
-	socklen_t clilen = sizeof(p_tcp_sock->cli_addr);
+static unsigned int sq_record_len(P_SEND_QUEUE q, unsigned int pos)
+{
+	unsigned char hi = q->buf[pos % q->size];
+	unsigned char lo = q->buf[(pos + 1) % q->size];
+	return (hi << 8) | lo;
+}
 
-	/* wait for connection on local port.*/
-	if ((p_tcp_sock->sock = accept(sockfd, (struct sockaddr *)&p_tcp_sock->cli_addr, &clilen)) < 0)
-	{
-		fprintf(stderr, "Failed to accept socket!, error = %d\n", errno);
-		if (errno == 22)
-			return -1;
-		return error_category(errno);
-	}
+static unsigned int sq_record_emitted(P_SEND_QUEUE q, unsigned int pos)
+{
+	unsigned int i, v = 0;
+	for (i = 2; i < SQ_HDR; i++)
+		v = (v << 8) | (unsigned char)q->buf[(pos + i) % q->size];
+	return v;
+}
 
-	if (setsockopt(p_tcp_sock->sock, SOL_SOCKET, SO_KEEPALIVE, (char *)&optval, optlen) < 0)
+// Drop the oldest record that has not been partially sent yet.
+static int sq_drop_oldest(P_SEND_QUEUE q)
+{
+	unsigned int pos = q->head, len;
+	if (q->sent > 0)
 	{
-		fprintf(stderr, "Failed to set option keepalive!, error = %d\n", errno);
-		return error_category(errno);
+		// The head record is on its way, keep it and drop the next one.
+		if (q->msgs < 2)
+			return 0;
+		len = sq_record_len(q, pos);
+		pos = (pos + SQ_HDR + len) % q->size;
+		unsigned int victim = SQ_HDR + sq_record_len(q, pos);
+		// Close the gap by moving the head record forward over the victim.
+		unsigned int i = SQ_HDR + len;
+		while (i-- > 0)
+			q->buf[(q->head + i + victim) % q->size] = q->buf[(q->head + i) % q->size];
+		q->head = (q->head + victim) % q->size;
+		q->used -= victim;
 	}
-
-	sprintf(p_tcp_sock->from_ip, "%.*s", 19, inet_ntoa(p_tcp_sock->cli_addr.sin_addr));
-	if (_debug)
+	else
 	{
-		fprintf(stdout, "connect from %s\n", p_tcp_sock->from_ip);
+		if (q->msgs < 1)
+			return 0;
+		len = SQ_HDR + sq_record_len(q, pos);
+		q->head = (q->head + len) % q->size;
+		q->used -= len;
 	}
-
-	p_tcp_sock->sesion_active = 1;
-
-	return 0;
+	q->msgs--;
+	return 1;
 }
 
 // ------------------------------------------------------------
-// Remove messages older than timeout
+// Append a message to a client's send queue, applying the overflow
+// policy when it does not fit. emitted is the time the decoder emitted
+// a live message, 0 for anything else. Expects t->sq_lock to be held.
+// Returns 1 if queued, 0 if not.
 // ------------------------------------------------------------
-void remove_old_ais_messages()
+static int queue_message(P_TCP_SOCK t, const char *mess, unsigned int length, int policy, double emitted)
 {
-	struct timeval now;
-	P_AIS_MESS temp_1;
-	P_AIS_MESS temp;
-	gettimeofday(&now, NULL);
-
-	temp = ais_head;
+	P_SEND_QUEUE q = &t->sq;
+	unsigned char hdr[SQ_HDR];
+	unsigned int stamp = (unsigned int)(long long)emitted;
 
-	while (temp != NULL)
+	if (t->overflowed)
+		return 0;
+	if (length == 0 || length > 0xffff || length + SQ_HDR > q->size)
+	{
+		t->dropped_msgs++;
+		total_dropped_msgs++;
+		return 0;
+	}
+	while (q->used + SQ_HDR + length > q->size)
 	{
-		if ((int)(now.tv_sec - temp->timestamp.tv_sec) > _tcp_keep_ais_time)
+		if (policy == TCP_OVERFLOW_COALESCE && sq_drop_oldest(q))
 		{
-			if (_debug)
-				fprintf(stdout, "remove mess <%.*s>, timeout %ld\n", temp->length, temp->message, (long)(now.tv_sec - temp->timestamp.tv_sec));
-			temp_1 = temp->next;
-			pthread_mutex_lock(&ais_lock);
-			delete_ais_node(temp);
-			pthread_mutex_unlock(&ais_lock);
-			temp = temp_1;
+			t->coalesced_msgs++;
+			total_coalesced_msgs++;
+			continue;
 		}
-		else
+		if (policy == TCP_OVERFLOW_DISCONNECT)
 		{
-			temp = temp->next;
+			t->overflowed = 1;
+			total_overflow_disconnects++;
 		}
+		t->dropped_msgs++;
+		total_dropped_msgs++;
+		return 0;
 	}
+	hdr[0] = length >> 8;
+	hdr[1] = length & 0xff;
+	hdr[2] = stamp >> 24;
+	hdr[3] = (stamp >> 16) & 0xff;
+	hdr[4] = (stamp >> 8) & 0xff;
+	hdr[5] = stamp & 0xff;
+	sq_copy_in(q, q->head + q->used, (const char *)hdr, SQ_HDR);
+	sq_copy_in(q, q->head + q->used + SQ_HDR, mess, length);
+	q->used += SQ_HDR + length;
+	q->msgs++;
+	t->queued_msgs++;
+	if (q->used > t->max_queued)
+		t->max_queued = q->used;
+	return 1;
 }
 
 // ------------------------------------------------------------
-// send ais message to all clients
+// Put a priority message in a free slot, to be sent before the next
+// record of the send queue. Expects t->sq_lock to be held.
+// Returns 1 if queued, 0 if it has to take the send queue.
 // ------------------------------------------------------------
-int add_nmea_ais_message(const char *mess, unsigned int length)
+static int queue_priority(P_TCP_SOCK t, const char *mess, unsigned int length, double queued)
 {
-	P_AIS_MESS new_node;
-	// remove eventually old messages
-	remove_old_ais_messages();
+	PRIORITY_MSG *p;
 
-	pthread_mutex_lock(&ais_lock);
+	if (t->overflowed || length == 0 || length > TCP_PRIORITY_MAX || t->urgent_count == TCP_PRIORITY_SLOTS)
+		return 0;
+	p = &t->urgent[(t->urgent_head + t->urgent_count) % TCP_PRIORITY_SLOTS];
+	memcpy(p->data, mess, length);
+	p->len = length;
+	p->sent = 0;
+	p->queued = queued;
+	t->urgent_count++;
+	t->queued_msgs++;
+	return 1;
+}
+
+// ------------------------------------------------------------
+// Send the priority messages. Expects t->sq_lock to be held, and to
+// be called between two records of the send queue.
+// Returns 1 when all are sent, 0 when the socket is full, -1 on a
+// socket error.
+// ------------------------------------------------------------
+static int send_priority(P_TCP_SOCK t)
+{
+	PRIORITY_MSG *p;
+	ssize_t rc;
 
-	// allocate an add the new message
-	new_node = (P_AIS_MESS)malloc(sizeof(AIS_MESS));
-	if (length >= sizeof(new_node->message))
+	while (t->urgent_count > 0)
 	{
-		new_node->plmess = malloc(length);
-		if (new_node->plmess == NULL)
+		p = &t->urgent[t->urgent_head];
+		rc = send(t->sock, p->data + p->sent, p->len - p->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0)
 		{
-			free(new_node);
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
 			return -1;
 		}
-		strncpy(new_node->plmess, mess, length);
-		new_node->message[0] = 0; // Just in case
-	}
-	else
-	{
-		new_node->plmess = NULL;
-		strncpy(new_node->message, mess, length);
-	}
-	new_node->length = length;
-	gettimeofday(&new_node->timestamp, NULL);
-
-	if (ais_head == NULL)
-	{
-		ais_head = new_node;
-		ais_end = new_node;
+		t->sent_bytes += rc;
+		p->sent += rc;
+		if (p->sent < p->len)
+			return 0; // socket buffer is full
+		metrics_latency_add(&metrics_send, now_ms() - p->queued);
+		metrics_latency_add(&metrics_priority, now_ms() - p->queued);
+		t->urgent_head = (t->urgent_head + 1) % TCP_PRIORITY_SLOTS;
+		t->urgent_count--;
 	}
-	ais_end->next = new_node;
-	new_node->next = NULL;
-	ais_end = new_node;
+	return 1;
+}
 
-	pthread_mutex_unlock(&ais_lock);
+// ------------------------------------------------------------
+// Send as much of the queue as the socket takes without blocking,
+// priority messages first. Returns -1 on a socket error.
+// ------------------------------------------------------------
+static int send_queued(P_TCP_SOCK t)
+{
+	P_SEND_QUEUE q = &t->sq;
+	struct iovec iov[SQ_IOV];
+	struct msghdr msg;
+	unsigned int pos, len, skip, n, i, emitted, now;
+	ssize_t rc;
 
-	// Send the message to all active clients.
-	if (_tcp_stream_forever)
+	pthread_mutex_lock(&t->sq_lock);
+	while (1)
 	{
-		P_TCP_SOCK tcp_client;
+		// Priority messages never split a record of the queue.
+		if (q->sent == 0 && (rc = send_priority(t)) <= 0)
+		{
+			pthread_mutex_unlock(&t->sq_lock);
+			return rc;
+		}
+		if (q->msgs == 0)
+			break;
 
-		pthread_mutex_lock(&lock);
-		tcp_client = head;
-		while (tcp_client != NULL)
+		// Gather whole records, skipping their length prefixes.
+		n = 0;
+		pos = q->head;
+		skip = q->sent;
+		for (i = 0; i < q->msgs && n + 2 <= SQ_IOV; i++)
 		{
-			write(tcp_client->msgpipe[1], mess, length);
-			tcp_client = tcp_client->next;
+			unsigned int start, first;
+			len = sq_record_len(q, pos);
+			start = (pos + SQ_HDR + skip) % q->size;
+			first = q->size - start;
+			if (first >= len - skip)
+			{
+				iov[n].iov_base = q->buf + start;
+				iov[n++].iov_len = len - skip;
+			}
+			else
+			{
+				iov[n].iov_base = q->buf + start;
+				iov[n++].iov_len = first;
+				iov[n].iov_base = q->buf;
+				iov[n++].iov_len = len - skip - first;
+			}
+			pos = (pos + SQ_HDR + len) % q->size;
+			skip = 0;
 		}
-		pthread_mutex_unlock(&lock);
-	}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		rc = sendmsg(t->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0)
+		{
+			pthread_mutex_unlock(&t->sq_lock);
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			return -1;
+		}
+		t->sent_bytes += rc;
 
+		// Release fully sent records.
+		now = (unsigned int)(long long)now_ms();
+		while (rc > 0)
+		{
+			len = sq_record_len(q, q->head);
+			if (q->sent + rc < len)
+			{
+				q->sent += rc;
+				break;
+			}
+			emitted = sq_record_emitted(q, q->head);
+			if (emitted)
+				metrics_latency_add(&metrics_send, (unsigned int)(now - emitted));
+			rc -= len - q->sent;
+			q->sent = 0;
+			q->head = (q->head + SQ_HDR + len) % q->size;
+			q->used -= SQ_HDR + len;
+			q->msgs--;
+		}
+		if (q->sent > 0)
+			break; // socket buffer is full
+	}
+	pthread_mutex_unlock(&t->sq_lock);
 	return 0;
 }
 
 // ------------------------------------------------------------
-// deletes the specified node pointed to by 'p' from the list
+// Wake a client thread. The pipe is non-blocking, if it is full a
+// wakeup is already pending.
 // ------------------------------------------------------------
-void delete_ais_node(P_AIS_MESS p)
+static void wake_client(P_TCP_SOCK t)
 {
-	P_AIS_MESS temp;
-	P_AIS_MESS prev;
+	if (write(t->msgpipe[1], "", 1) < 0 && errno != EAGAIN && _debug)
+		perror("pipe write");
+}
 
-	temp = p;
-	prev = ais_head;
+// ------------------------------------------------------------
+// Compression helpers. All of them expect ais_lock to be held.
+// ------------------------------------------------------------
 
-	if (temp == prev)
+// Queue compressed data for one client, or with t NULL, for all
+// clients on the shared stream (then lock must be held as well).
+// A compressed stream cannot skip anything, so a client that falls
+// behind is disconnected whatever the overflow policy.
+static void zdeliver(P_TCP_SOCK t, const unsigned char *data, unsigned int length)
+{
+	P_TCP_SOCK c;
+	int queued, overflowed;
+
+	for (c = t ? t : head; c != NULL; c = t ? NULL : c->next)
 	{
-		ais_head = ais_head->next;
-		if (ais_end == temp)
-			ais_end = ais_end->next;
+		if (!t && (!c->compressed || c->zs != NULL || c->sub_pending))
+			continue;
+		pthread_mutex_lock(&c->sq_lock);
+		queued = queue_message(c, (const char *)data, length, TCP_OVERFLOW_DISCONNECT, 0);
+		overflowed = c->overflowed;
+		pthread_mutex_unlock(&c->sq_lock);
+		if (queued || overflowed)
+			wake_client(c);
 	}
-	else
+}
+
+// Run the compressor on length bytes of input with the given flush
+// mode, and deliver the output to t (NULL: the shared stream).
+static void zrun(z_stream *z, P_TCP_SOCK t, const char *in, unsigned int length, int flush)
+{
+	unsigned int n;
+
+	z->next_in = (unsigned char *)in;
+	z->avail_in = length;
+	do
 	{
-		while (prev->next != temp)
+		z->next_out = zout;
+		z->avail_out = sizeof(zout);
+		deflate(z, flush);
+		n = sizeof(zout) - z->avail_out;
+		if (n > 0)
 		{
-			prev = prev->next;
+			zdeliver(t, zout, n);
+			if (t)
+				zprivate_out += n;
+			else
+				zshared_out += n;
 		}
-		prev->next = temp->next;
-		if (ais_end == temp)
-			ais_end = prev;
+	} while (z->avail_out == 0);
+	if (t)
+		zprivate_in += length;
+	else
+		zshared_in += length;
+}
+
+// Give a new client its own compressor, it joins the shared stream at
+// the next segment boundary. Returns 0 if out of memory.
+static int zclient_start(P_TCP_SOCK t)
+{
+	t->zs = calloc(1, sizeof(z_stream));
+	if (t->zs == NULL)
+		return 0;
+	if (deflateInit2(t->zs, TCP_ZLEVEL, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free(t->zs);
+		t->zs = NULL;
+		return 0;
 	}
-	if (p->plmess != NULL)
-		free(p->plmess);
-	free(p);
+	deflateSetDictionary(t->zs, (const unsigned char *)ais_dict, sizeof(ais_dict) - 1);
+	return 1;
+}
+
+static void zclient_end(P_TCP_SOCK t)
+{
+	if (t->zs == NULL)
+		return;
+	deflateEnd(t->zs);
+	free(t->zs);
+	t->zs = NULL;
 }
 
 // ------------------------------------------------------------
-// initnode : Allocates a theads data structure
+// Queue one message for a client, compressing it if needed.
 // ------------------------------------------------------------
-P_TCP_SOCK init_node()
+static void client_message(P_TCP_SOCK t, const char *mess, unsigned int length, int policy)
 {
-	P_TCP_SOCK ptr;
-	int pipestatus;
+	if (t->compressed)
+	{
+		if (t->zs)
+		{
+			zrun(t->zs, t, mess, length, Z_NO_FLUSH);
+			t->zpending = 1;
+		}
+		return;
+	}
+	pthread_mutex_lock(&t->sq_lock);
+	queue_message(t, mess, length, policy, 0);
+	pthread_mutex_unlock(&t->sq_lock);
+}
 
-	ptr = (P_TCP_SOCK)malloc(sizeof(TCP_SOCK));
+// ------------------------------------------------------------
+// Flush the compressed streams every _zflush_ms, so no message waits
+// longer than that in a compressor, and move joining clients to the
+// shared stream between two segments.
+// ------------------------------------------------------------
+static void *zflush_fn(void *arg)
+{
+	P_TCP_SOCK t;
+	int shared;
+	(void)(arg); // not used
 
-	memset(ptr, 0, sizeof(TCP_SOCK));
+	while (1)
+	{
+		usleep(_zflush_ms * 1000);
+		pthread_mutex_lock(&ais_lock);
+		pthread_mutex_lock(&lock);
+
+		shared = 0;
+		for (t = head; t != NULL; t = t->next)
+			if (t->compressed && t->zs == NULL && !t->sub_pending)
+				shared++;
+		if (zseg_open && (!shared || time(NULL) - zseg_start >= TCP_ZSEGMENT_SEC || zseg_in >= TCP_ZSEGMENT_BYTES))
+		{
+			zrun(&zshared, NULL, NULL, 0, Z_FINISH);
+			zseg_open = 0;
+			zseg_pending = 0;
+		}
+		else if (zseg_pending)
+		{
+			zrun(&zshared, NULL, NULL, 0, Z_SYNC_FLUSH);
+			zseg_pending = 0;
+		}
+
+		for (t = head; t != NULL; t = t->next)
+		{
+			if (!t->compressed || t->zs == NULL)
+				continue;
+			if (!zseg_open && ais_filter_is_empty(&t->filter))
+			{
+				// Between two segments: end the private stream here, the
+				// next shared segment follows right after it.
+				zrun(t->zs, t, NULL, 0, Z_FINISH);
+				zclient_end(t);
+				if (_debug)
+					fprintf(stderr, "%s: joined the shared compressed stream\n", t->from_ip);
+			}
+			else if (t->zpending)
+			{
+				zrun(t->zs, t, NULL, 0, Z_SYNC_FLUSH);
+				t->zpending = 0;
+			}
+		}
+
+		pthread_mutex_unlock(&lock);
+		pthread_mutex_unlock(&ais_lock);
+	}
+	return 0;
+}
+
+// ------------------------------------------------------------
+// Copy the saved ais messages into a new client's queue. Only
+// memory is touched here, the client thread does the sending.
+// Expects ais_lock to be held. The backlog always keeps the newest
+// messages when it does not fit in the queue.
+// ------------------------------------------------------------
+static void replay_one(void *arg, const struct timeval *timestamp, const char *data, unsigned int length)
+{
+	P_TCP_SOCK t = (P_TCP_SOCK)arg;
+	struct ais_msg msg;
+	(void)(timestamp);
+
+	memcpy(&msg, data, sizeof(msg));
+	if (!ais_filter_match(&t->filter, &msg))
+	{
+		t->filtered_msgs++;
+		return;
+	}
+	client_message(t, data + sizeof(msg), length - sizeof(msg), TCP_OVERFLOW_COALESCE);
+}
+
+static void snapshot_one(void *arg, const struct timeval *timestamp, const struct ais_msg *msg, const char *data, unsigned int length)
+{
+	P_TCP_SOCK t = (P_TCP_SOCK)arg;
+	(void)(timestamp);
+
+	if (!ais_filter_match(&t->filter, msg))
+	{
+		t->filtered_msgs++;
+		return;
+	}
+	client_message(t, data, length, TCP_OVERFLOW_COALESCE);
+}
+
+static void replay_ais_messages(P_TCP_SOCK t)
+{
+	time_t now = time(NULL);
+	unsigned int queued;
+
+	if (t->compressed && !zclient_start(t))
+	{
+		pthread_mutex_lock(&t->sq_lock);
+		t->overflowed = 1;
+		pthread_mutex_unlock(&t->sq_lock);
+		return;
+	}
+	if (_snapshot_age > 0)
+		vessel_cache_replay(&vessels, now - _snapshot_age, snapshot_one, t);
+	else
+		ais_ring_replay(&ais_history, now - _tcp_keep_ais_time, now, replay_one, t);
+	pthread_mutex_lock(&t->sq_lock);
+	queued = t->sq.msgs;
+	pthread_mutex_unlock(&t->sq_lock);
+	if (_debug)
+		fprintf(stderr, "%s: queued %u saved messages\n", t->from_ip, queued);
+	if (queued > 0)
+		wake_client(t);
+}
+
+// ------------------------------------------------------------
+// Replay the backlog to a client that was waiting to subscribe,
+// and start sending it live messages.
+// ------------------------------------------------------------
+static void start_stream(P_TCP_SOCK t)
+{
+	pthread_mutex_lock(&ais_lock);
+	if (t->sub_pending)
+	{
+		replay_ais_messages(t);
+		t->sub_pending = 0;
+	}
+	pthread_mutex_unlock(&ais_lock);
+}
+
+// ------------------------------------------------------------
+// One line from a client. "SUB key=value;key=value" replaces its
+// filter, a bare "SUB" clears it. Anything else is ignored.
+// ------------------------------------------------------------
+static void handle_client_line(P_TCP_SOCK t, char *line)
+{
+	struct ais_filter filter;
+	char bad[64];
+
+	if (strncmp(line, "SUB", 3) != 0 || (line[3] != 0 && line[3] != ' '))
+	{
+		if (_debug && line[0])
+			fprintf(stderr, "%s: ignoring '%s'\n", t->from_ip, line);
+		return;
+	}
+	line += 3;
+	while (*line == ' ')
+		line++;
+	ais_filter_clear(&filter);
+	if (ais_filter_parse(&filter, line, bad, sizeof(bad)) < 0)
+	{
+		if (_debug)
+			fprintf(stderr, "%s: invalid subscription item '%s'\n", t->from_ip, bad);
+		return;
+	}
+	pthread_mutex_lock(&ais_lock);
+	if (t->compressed && t->zs == NULL && !t->sub_pending && !ais_filter_is_empty(&filter))
+	{
+		// Filtering needs a compressor of its own, which can only start
+		// at the beginning of the connection.
+		pthread_mutex_unlock(&ais_lock);
+		if (_debug)
+			fprintf(stderr, "%s: cannot filter a shared compressed stream, ignoring '%s'\n", t->from_ip, line);
+		return;
+	}
+	t->filter = filter;
+	pthread_mutex_unlock(&ais_lock);
+	if (_debug)
+		fprintf(stderr, "%s: subscribed to '%s'\n", t->from_ip, line);
+	start_stream(t);
+}
+
+// ------------------------------------------------------------
+// Read subscription commands from a client. Returns -1 if the
+// client closed the connection or sent garbage.
+// ------------------------------------------------------------
+static int read_subscription(P_TCP_SOCK t)
+{
+	char *nl, *p;
+	int rc;
+
+	rc = recv(t->sock, t->line + t->line_len, sizeof(t->line) - 1 - t->line_len, 0);
+	if (rc < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		if (_debug)
+			perror("socket error");
+		return -1;
+	}
+	if (rc == 0)
+	{
+		if (_debug)
+			fprintf(stdout, "client closed the socket\n");
+		return -1;
+	}
+	t->line_len += rc;
+	t->line[t->line_len] = 0;
+
+	p = t->line;
+	while ((nl = strchr(p, '\n')) != NULL)
+	{
+		*nl = 0;
+		if (nl > p && nl[-1] == '\r')
+			nl[-1] = 0;
+		handle_client_line(t, p);
+		p = nl + 1;
+	}
+	t->line_len -= p - t->line;
+	memmove(t->line, p, t->line_len);
+	if (t->line_len == sizeof(t->line) - 1)
+	{
+		if (_debug)
+			fprintf(stderr, "%s: command line too long\n", t->from_ip);
+		return -1;
+	}
+	return 0;
+}
+
+// ------------------------------------------------------------
+// HTTP and WebSocket clients (-w)
+// ------------------------------------------------------------
+
+// Make a WebSocket text frame with the JSON for a message in buf,
+// which has room for WS_MAX_HEADER + TCP_JSON_MAX bytes. The frame
+// ends at the end of buf's JSON, *start is set to where it begins.
+// Returns the frame length, or -1 if the JSON does not fit.
+static int ws_json_frame(char *buf, const struct timeval *timestamp, const struct ais_msg *msg, const char *mess, unsigned int length, char **start)
+{
+	unsigned char hdr[WS_MAX_HEADER];
+	unsigned int hlen;
+	int n;
+
+	n = ais_json_message(buf + WS_MAX_HEADER, TCP_JSON_MAX, timestamp, msg, mess, length);
+	if (n < 0)
+		return -1;
+	hlen = ws_frame_header(hdr, WS_OP_TEXT, n);
+	*start = buf + WS_MAX_HEADER - hlen;
+	memcpy(*start, hdr, hlen);
+	return hlen + n;
+}
+
+// Send all of buf, waiting for the socket as needed. Only used for
+// replies that end the connection, so the client thread may block.
+static int http_send_all(P_TCP_SOCK t, const char *buf, unsigned int length)
+{
+	fd_set wfds;
+	struct timeval timeout;
+	ssize_t rc;
+
+	while (length > 0)
+	{
+		rc = send(t->sock, buf, length, MSG_NOSIGNAL);
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		{
+			FD_ZERO(&wfds);
+			FD_SET(t->sock, &wfds);
+			timeout.tv_sec = TCP_HTTP_TIMEOUT_SEC;
+			timeout.tv_usec = 0;
+			if (select(t->sock + 1, NULL, &wfds, NULL, &timeout) <= 0)
+				return -1;
+			continue;
+		}
+		if (rc < 0)
+			return -1;
+		pthread_mutex_lock(&t->sq_lock);
+		t->sent_bytes += rc;
+		pthread_mutex_unlock(&t->sq_lock);
+		buf += rc;
+		length -= rc;
+	}
+	return 0;
+}
+
+static int http_reply(P_TCP_SOCK t, const char *status, const char *type, const char *body, unsigned int length)
+{
+	char head[256];
+	int n;
+
+	n = snprintf(head, sizeof(head),
+				 "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+				 "Access-Control-Allow-Origin: *\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+				 status, type, length);
+	if (http_send_all(t, head, n) < 0)
+		return -1;
+	return http_send_all(t, body, length);
+}
+
+typedef struct t_json_list
+{
+	char *buf;
+	unsigned int len;
+	unsigned int size;
+} JSON_LIST;
+
+static void vessel_json_one(void *arg, const VESSEL *v)
+{
+	JSON_LIST *l = (JSON_LIST *)arg;
+	char *p;
+	int n;
+
+	if (l->buf == NULL)
+		return;
+	while (1)
+	{
+		n = ais_json_vessel(l->buf + l->len + 1, l->size - l->len - 2, v);
+		if (n >= 0)
+			break;
+		p = realloc(l->buf, l->size * 2);
+		if (p == NULL)
+		{
+			free(l->buf);
+			l->buf = NULL;
+			return;
+		}
+		l->buf = p;
+		l->size *= 2;
+	}
+	l->buf[l->len] = l->len > 1 ? ',' : '\n';
+	l->len += n + 1;
+}
+
+// The vessel list, a JSON array of the latest state of each vessel.
+static int http_send_vessels(P_TCP_SOCK t)
+{
+	JSON_LIST l;
+	int rc;
+
+	l.size = 64 * 1024;
+	l.buf = malloc(l.size);
+	if (l.buf == NULL)
+		return -1;
+	l.buf[0] = '[';
+	l.len = 1;
+	pthread_mutex_lock(&ais_lock);
+	vessel_cache_foreach(&vessels, time(NULL) - _vessel_age, vessel_json_one, &l);
+	pthread_mutex_unlock(&ais_lock);
+	if (l.buf == NULL)
+		return -1;
+	l.buf[l.len++] = '\n';
+	l.buf[l.len++] = ']';
+	rc = http_reply(t, "200 OK", "application/json", l.buf, l.len);
+	free(l.buf);
+	return rc;
+}
+
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static void url_decode(char *s)
+{
+	char *d = s;
+
+	for (; *s; s++)
+	{
+		if (*s == '%' && hexval(s[1]) >= 0 && hexval(s[2]) >= 0)
+		{
+			*d++ = hexval(s[1]) * 16 + hexval(s[2]);
+			s += 2;
+		}
+		else
+			*d++ = *s == '+' ? ' ' : *s;
+	}
+	*d = 0;
+}
+
+// Value of a request header, or NULL. Header names are case insensitive.
+static char *http_header(char *headers, const char *name)
+{
+	unsigned int len = strlen(name);
+	char *p = headers;
+
+	while ((p = strstr(p, "\r\n")) != NULL)
+	{
+		p += 2;
+		if (strncasecmp(p, name, len) == 0 && p[len] == ':')
+		{
+			p += len + 1;
+			while (*p == ' ')
+				p++;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// ------------------------------------------------------------
+// Handle a complete request in t->line. Returns 0 if the connection
+// is now a WebSocket, -1 if it is done.
+// ------------------------------------------------------------
+static int handle_http_request(P_TCP_SOCK t)
+{
+	static const char not_found[] = "Not found. Try /vessels, /metrics, /coverage or a WebSocket on /ws\n";
+	struct ais_filter filter;
+	char *path, *query, *end, *upgrade, *key, *item, *value, *save = NULL;
+	char accept[29], reply[256];
+	int n;
+
+	if (strncmp(t->line, "GET ", 4) != 0)
+	{
+		http_reply(t, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+		return -1;
+	}
+	path = t->line + 4;
+	end = strchr(path, ' ');
+	if (end == NULL)
+		return -1;
+	*end = 0;
+	upgrade = http_header(end + 1, "Upgrade");
+	key = http_header(end + 1, "Sec-WebSocket-Key");
+	if (key)
+		key[strcspn(key, "\r\n")] = 0;
+	query = strchr(path, '?');
+	if (query)
+		*query++ = 0;
+	if (_debug)
+		fprintf(stderr, "%s: GET %s\n", t->from_ip, path);
+
+	if (strcmp(path, "/vessels") == 0)
+	{
+		http_send_vessels(t);
+		return -1;
+	}
+	if (strcmp(path, "/metrics") == 0)
+	{
+		char *text;
+		unsigned int length;
+		text = metrics_format(&length);
+		if (text)
+			http_reply(t, "200 OK", "text/plain; version=0.0.4", text, length);
+		free(text);
+		return -1;
+	}
+	if (strcmp(path, "/coverage") == 0)
+	{
+		char *text;
+		unsigned int length;
+		text = coverage_format(&length);
+		if (text)
+			http_reply(t, "200 OK", "text/plain", text, length);
+		else
+			http_reply(t, "404 Not Found", "text/plain", "Coverage is off, see -N\n", 24);
+		free(text);
+		return -1;
+	}
+	if (strcmp(path, "/ws") != 0 && strcmp(path, "/") != 0)
+	{
+		http_reply(t, "404 Not Found", "text/plain", not_found, sizeof(not_found) - 1);
+		return -1;
+	}
+	if (upgrade == NULL || strncasecmp(upgrade, "websocket", 9) != 0 || key == NULL)
+	{
+		http_reply(t, "426 Upgrade Required", "text/plain", "WebSocket only\n", 15);
+		return -1;
+	}
+
+	// Filter items as query parameters, /ws?types=1-3&channel=A
+	ais_filter_clear(&filter);
+	for (item = query ? strtok_r(query, "&", &save) : NULL; item; item = strtok_r(NULL, "&", &save))
+	{
+		value = strchr(item, '=');
+		if (value)
+			*value++ = 0;
+		if (value)
+			url_decode(value);
+		if (!value || ais_filter_set(&filter, item, value) != 1)
+		{
+			http_reply(t, "400 Bad Request", "text/plain", "Invalid filter\n", 15);
+			return -1;
+		}
+	}
+
+	ws_accept_key(key, accept);
+	n = snprintf(reply, sizeof(reply),
+				 "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+				 "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+	pthread_mutex_lock(&t->sq_lock);
+	queue_message(t, reply, n, TCP_OVERFLOW_DROP, 0);
+	pthread_mutex_unlock(&t->sq_lock);
+	// From here on the client gets every new message that passes the filter.
+	pthread_mutex_lock(&ais_lock);
+	t->filter = filter;
+	t->websocket = 1;
+	pthread_mutex_unlock(&ais_lock);
+	return 0;
+}
+
+// A frame from a WebSocket client. Text frames are subscription
+// commands, as on the -F port. Returns -1 to close the connection.
+static int handle_ws_frame(P_TCP_SOCK t, int opcode, unsigned char *payload, unsigned int length)
+{
+	unsigned char frame[WS_MAX_HEADER + 125];
+	char line[TCP_SUBSCRIBE_LINE];
+	unsigned int n;
+
+	switch (opcode)
+	{
+	case WS_OP_TEXT:
+		if (length >= sizeof(line))
+			return -1;
+		memcpy(line, payload, length);
+		line[length] = 0;
+		line[strcspn(line, "\r\n")] = 0;
+		handle_client_line(t, line);
+		return 0;
+	case WS_OP_PING:
+		if (length > 125)
+			return -1;
+		n = ws_frame_header(frame, WS_OP_PONG, length);
+		memcpy(frame + n, payload, length);
+		pthread_mutex_lock(&t->sq_lock);
+		queue_message(t, (const char *)frame, n + length, TCP_OVERFLOW_DROP, 0);
+		pthread_mutex_unlock(&t->sq_lock);
+		return 0;
+	case WS_OP_PONG:
+		return 0;
+	}
+	return -1; // close, or something we do not speak
+}
+
+// ------------------------------------------------------------
+// Read from an http client: the request, or WebSocket frames.
+// Returns -1 when the connection should be closed.
+// ------------------------------------------------------------
+static int read_http(P_TCP_SOCK t)
+{
+	unsigned char *payload;
+	unsigned int length;
+	int rc, opcode;
+
+	rc = recv(t->sock, t->line + t->line_len, sizeof(t->line) - 1 - t->line_len, 0);
+	if (rc < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	if (rc == 0)
+		return -1;
+	t->line_len += rc;
+	t->line[t->line_len] = 0;
+
+	if (!t->websocket)
+	{
+		if (strstr(t->line, "\r\n\r\n") == NULL)
+			return t->line_len == sizeof(t->line) - 1 ? -1 : 0;
+		rc = handle_http_request(t);
+		t->line_len = 0; // a WebSocket client sends nothing before the reply
+		return rc;
+	}
+
+	while ((rc = ws_parse_frame((unsigned char *)t->line, t->line_len, &opcode, &payload, &length)) > 0)
+	{
+		if (handle_ws_frame(t, opcode, payload, length) < 0)
+			return -1;
+		t->line_len -= rc;
+		memmove(t->line, t->line + rc, t->line_len);
+	}
+	if (rc < 0 || t->line_len == sizeof(t->line) - 1)
+		return -1;
+	return 0;
+}
+
+// ------------------------------------------------------------
+// Accept call
+// ------------------------------------------------------------
+int accept_c(P_TCP_SOCK p_tcp_sock, int fd)
+{
+
+	int optval = 1; // Keep alive
+	socklen_t optlen = sizeof(optval);
+	socklen_t clilen = sizeof(p_tcp_sock->cli_addr);
+
+	/* wait for connection on local port.*/
+	if ((p_tcp_sock->sock = accept(fd, (struct sockaddr *)&p_tcp_sock->cli_addr, &clilen)) < 0)
+	{
+		fprintf(stderr, "Failed to accept socket!, error = %d\n", errno);
+		if (errno == 22)
+			return -1;
+		return error_category(errno);
+	}
+
+	if (setsockopt(p_tcp_sock->sock, SOL_SOCKET, SO_KEEPALIVE, (char *)&optval, optlen) < 0)
+	{
+		fprintf(stderr, "Failed to set option keepalive!, error = %d\n", errno);
+		return error_category(errno);
+	}
+
+	// Sends never block, a slow client only fills its own queue.
+	if (fcntl(p_tcp_sock->sock, F_SETFL, fcntl(p_tcp_sock->sock, F_GETFL) | O_NONBLOCK) < 0)
+	{
+		fprintf(stderr, "Failed to set socket non-blocking!, error = %d\n", errno);
+		return error_category(errno);
+	}
+
+	sprintf(p_tcp_sock->from_ip, "%.*s", 19, inet_ntoa(p_tcp_sock->cli_addr.sin_addr));
+	if (_debug)
+	{
+		fprintf(stdout, "connect from %s\n", p_tcp_sock->from_ip);
+	}
+
+	p_tcp_sock->sesion_active = 1;
+	p_tcp_sock->connected = time(NULL);
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		p_tcp_sock->sub_deadline = now.tv_sec * 1000L + now.tv_usec / 1000 + TCP_SUBSCRIBE_GRACE_MS;
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------
+// Remove messages older than timeout
+// ------------------------------------------------------------
+void remove_old_ais_messages()
+{
+	static time_t last_vessel_expiry = 0;
+	time_t now = time(NULL);
+	unsigned int n = ais_ring_expire(&ais_history, now - _tcp_keep_ais_time);
+	if (_debug && n > 0)
+		fprintf(stdout, "removed %u messages older than %d s\n", n, _tcp_keep_ais_time);
+
+	// The vessel cache is scanned as a whole, once a second is plenty.
+	if (_vessel_age > 0 && now != last_vessel_expiry)
+	{
+		last_vessel_expiry = now;
+		n = vessel_cache_expire(&vessels, now - _vessel_age);
+		if (_debug && n > 0)
+			fprintf(stdout, "removed %u vessels not heard for %d s\n", n, _vessel_age);
+	}
+}
+
+// ------------------------------------------------------------
+// send ais message to all clients
+// ------------------------------------------------------------
+int add_nmea_ais_message(const char *mess, unsigned int length, const struct ais_msg *msg)
+{
+	static char *record = NULL;
+	static unsigned int record_size = 0;
+	struct ais_msg none;
+	struct timeval now;
+	double queued_ms = now_ms();
+	gettimeofday(&now, NULL);
+
+	if (msg == NULL)
+	{
+		memset(&none, 0, sizeof(none));
+		msg = &none;
+	}
+
+	pthread_mutex_lock(&ais_lock);
+
+	// remove eventually old messages, and save the new one
+	remove_old_ais_messages();
+	if (record_size < sizeof(*msg) + length)
+	{
+		free(record);
+		record_size = sizeof(*msg) + length;
+		record = malloc(record_size);
+		if (record == NULL)
+		{
+			record_size = 0;
+			pthread_mutex_unlock(&ais_lock);
+			return -1;
+		}
+	}
+	memcpy(record, msg, sizeof(*msg));
+	memcpy(record + sizeof(*msg), mess, length);
+	if (!ais_ring_push(&ais_history, &now, record, sizeof(*msg) + length))
+	{
+		pthread_mutex_unlock(&ais_lock);
+		return -1;
+	}
+	if (_vessel_age > 0)
+		vessel_cache_update(&vessels, &now, msg, mess, length);
+
+	// Queue the message for all active clients. This only copies into
+	// their send queues, so a slow client can never stall the decoder.
+	if (_tcp_stream_forever)
+	{
+		P_TCP_SOCK tcp_client;
+		int shared = 0;
+		static char ws_frame[WS_MAX_HEADER + TCP_JSON_MAX];
+		char *ws_start = NULL;
+		int ws_len = 0; // JSON frame, made once for all WebSocket clients
+
+		pthread_mutex_lock(&lock);
+		tcp_client = head;
+		while (tcp_client != NULL)
+		{
+			int was_empty, queued, overflowed;
+			if (tcp_client->http)
+			{
+				if (tcp_client->websocket && ais_filter_match(&tcp_client->filter, msg))
+				{
+					if (ws_len == 0)
+						ws_len = ws_json_frame(ws_frame, &now, msg, mess, length, &ws_start);
+					if (ws_len > 0)
+					{
+						pthread_mutex_lock(&tcp_client->sq_lock);
+						was_empty = tcp_client->sq.msgs == 0 && tcp_client->urgent_count == 0;
+						queued = (msg->priority && queue_priority(tcp_client, ws_start, ws_len, queued_ms))
+							|| queue_message(tcp_client, ws_start, ws_len, _overflow_policy, queued_ms);
+						overflowed = tcp_client->overflowed;
+						pthread_mutex_unlock(&tcp_client->sq_lock);
+						if ((queued && (was_empty || msg->priority)) || overflowed)
+							wake_client(tcp_client);
+					}
+				}
+				else if (tcp_client->websocket)
+					tcp_client->filtered_msgs++;
+				tcp_client = tcp_client->next;
+				continue;
+			}
+			if (tcp_client->sub_pending)
+			{
+				tcp_client = tcp_client->next;
+				continue;
+			}
+			if (!ais_filter_match(&tcp_client->filter, msg))
+			{
+				tcp_client->filtered_msgs++;
+				tcp_client = tcp_client->next;
+				continue;
+			}
+			if (tcp_client->compressed)
+			{
+				if (tcp_client->zs)
+				{
+					client_message(tcp_client, mess, length, _overflow_policy);
+					if (msg->priority)
+					{
+						// A compressed stream cannot reorder, but it
+						// need not wait for the next flush either.
+						zrun(tcp_client->zs, tcp_client, NULL, 0, Z_SYNC_FLUSH);
+						tcp_client->zpending = 0;
+					}
+				}
+				else
+					shared = 1;
+				tcp_client = tcp_client->next;
+				continue;
+			}
+			pthread_mutex_lock(&tcp_client->sq_lock);
+			was_empty = tcp_client->sq.msgs == 0 && tcp_client->urgent_count == 0;
+			queued = (msg->priority && queue_priority(tcp_client, mess, length, queued_ms))
+				|| queue_message(tcp_client, mess, length, _overflow_policy, queued_ms);
+			overflowed = tcp_client->overflowed;
+			pthread_mutex_unlock(&tcp_client->sq_lock);
+			if ((queued && (was_empty || msg->priority)) || overflowed)
+				wake_client(tcp_client);
+			tcp_client = tcp_client->next;
+		}
+
+		// Compress once for all clients on the shared stream.
+		if (shared)
+		{
+			if (!zseg_open)
+			{
+				deflateReset(&zshared);
+				deflateSetDictionary(&zshared, (const unsigned char *)ais_dict, sizeof(ais_dict) - 1);
+				zseg_open = 1;
+				zseg_start = time(NULL);
+				zseg_in = 0;
+			}
+			zrun(&zshared, NULL, mess, length, msg->priority ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+			zseg_in += length;
+			zseg_pending = !msg->priority;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	pthread_mutex_unlock(&ais_lock);
+
+	return 0;
+}
+
+// ------------------------------------------------------------
+// initnode : Allocates a theads data structure
+// ------------------------------------------------------------
+P_TCP_SOCK init_node()
+{
+	P_TCP_SOCK ptr;
+	int pipestatus;
+
+	ptr = (P_TCP_SOCK)malloc(sizeof(TCP_SOCK));
 
 	if (ptr == NULL)
 		return (P_TCP_SOCK)NULL;
 
-	// Allocate pipe for publishing newly-arriving messages to
-	// connected clients.
+	memset(ptr, 0, sizeof(TCP_SOCK));
+
+	ptr->sq.size = _send_queue_size;
+	ptr->sq.buf = malloc(ptr->sq.size);
+	if (ptr->sq.buf == NULL)
+	{
+		free(ptr);
+		return (P_TCP_SOCK)NULL;
+	}
+	pthread_mutex_init(&ptr->sq_lock, NULL);
+
+	// Allocate pipe for waking the client thread when messages are
+	// queued. Both ends are non-blocking, the decoder must never wait.
 	pipestatus = pipe(ptr->msgpipe);
 	if (pipestatus < 0)
 	{
 		perror("error allocating pipe");
+		free(ptr->sq.buf);
 		free(ptr);
 		return (P_TCP_SOCK)NULL;
 	}
+	fcntl(ptr->msgpipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(ptr->msgpipe[1], F_SETFL, O_NONBLOCK);
 
 	return ptr;
 }
@@ -499,8 +1820,102 @@ void delete_node(P_TCP_SOCK p)
 		if (end == temp)
 			end = prev;
 	}
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_lock(&ais_lock);
+	zclient_end(p);
+	pthread_mutex_unlock(&ais_lock);
+	close(p->msgpipe[0]);
+	close(p->msgpipe[1]);
+	pthread_mutex_destroy(&p->sq_lock);
+	free(p->sq.buf);
 	free(p);
+}
+
+// ------------------------------------------------------------
+// Print per-client queue metrics
+// ------------------------------------------------------------
+void printTcpStats()
+{
+	P_TCP_SOCK t;
+	int clients = 0;
+
+	pthread_mutex_lock(&lock);
+	for (t = head; t != NULL; t = t->next)
+	{
+		pthread_mutex_lock(&t->sq_lock);
+		fprintf(stderr, "TCP %s: up %lds, queued %u bytes (max %u), sent %lu bytes, dropped %lu, coalesced %lu, filtered %lu\n",
+				t->from_ip, (long)(time(NULL) - t->connected), t->sq.used, t->max_queued,
+				t->sent_bytes, t->dropped_msgs, t->coalesced_msgs, t->filtered_msgs);
+		pthread_mutex_unlock(&t->sq_lock);
+		clients++;
+	}
 	pthread_mutex_unlock(&lock);
+	fprintf(stderr, "TCP: %d clients, dropped %lu, coalesced %lu messages, %lu overflow disconnects\n",
+			clients, total_dropped_msgs, total_coalesced_msgs, total_overflow_disconnects);
+	pthread_mutex_lock(&ais_lock);
+	fprintf(stderr, "TCP: history %u messages, %llu of %u bytes, %lu overwritten before timeout\n",
+			ais_history.count, ais_history.head - ais_history.tail, ais_history.size, ais_history.overwritten);
+	if (zsockfd >= 0)
+		fprintf(stderr, "TCP: compressed %lu -> %lu bytes shared (%.1fx), %lu -> %lu bytes private (%.1fx)\n",
+				zshared_in, zshared_out, zshared_out ? (double)zshared_in / zshared_out : 0.0,
+				zprivate_in, zprivate_out, zprivate_out ? (double)zprivate_in / zprivate_out : 0.0);
+	if (_vessel_age > 0)
+		fprintf(stderr, "TCP: vessel cache %u vessels, %lu bytes of reports, table size %u\n",
+				vessels.count, vessels.bytes, vessels.size);
+	pthread_mutex_unlock(&ais_lock);
+}
+
+// ------------------------------------------------------------------
+// Client and history metrics, for the /metrics endpoint
+// ------------------------------------------------------------------
+static const char *client_port_name(P_TCP_SOCK t)
+{
+	return t->compressed ? "compressed" : t->http ? "http" : "tcp";
+}
+
+static void tcp_metrics(struct metrics_out *out)
+{
+	P_TCP_SOCK t;
+	int clients = 0, i;
+	static const char *families[][3] = {
+		{"rtl_ais_tcp_client_queued_bytes", "gauge", "Bytes waiting in the send queue of each client."},
+		{"rtl_ais_tcp_client_sent_bytes_total", "counter", "Bytes sent to each client."},
+		{"rtl_ais_tcp_client_dropped_total", "counter", "Messages dropped or coalesced for each slow client."},
+	};
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < 3; i++)
+	{
+		metrics_family(out, families[i][0], families[i][1], families[i][2]);
+		for (t = head; t != NULL; t = t->next)
+		{
+			unsigned long value;
+			pthread_mutex_lock(&t->sq_lock);
+			value = i == 0 ? t->sq.used : i == 1 ? t->sent_bytes : t->dropped_msgs + t->coalesced_msgs;
+			pthread_mutex_unlock(&t->sq_lock);
+			metrics_printf(out, "%s{client=\"%s:%u\",port=\"%s\"} %lu\n", families[i][0],
+						   t->from_ip, ntohs(t->cli_addr.sin_port), client_port_name(t), value);
+			if (i == 0)
+				clients++;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	metrics_family(out, "rtl_ais_tcp_clients", "gauge", "Connected TCP and http clients.");
+	metrics_printf(out, "rtl_ais_tcp_clients %d\n", clients);
+
+	pthread_mutex_lock(&ais_lock);
+	metrics_family(out, "rtl_ais_tcp_dropped_total", "counter", "Messages dropped for slow clients, including disconnected ones.");
+	metrics_printf(out, "rtl_ais_tcp_dropped_total %lu\n", total_dropped_msgs + total_coalesced_msgs);
+	metrics_family(out, "rtl_ais_tcp_overflow_disconnects_total", "counter", "Clients closed because their send queue was full.");
+	metrics_printf(out, "rtl_ais_tcp_overflow_disconnects_total %lu\n", total_overflow_disconnects);
+	metrics_family(out, "rtl_ais_tcp_history_messages", "gauge", "Messages saved for new clients.");
+	metrics_printf(out, "rtl_ais_tcp_history_messages %u\n", ais_history.count);
+	if (_vessel_age > 0)
+	{
+		metrics_family(out, "rtl_ais_vessels", "gauge", "Vessels in the vessel cache.");
+		metrics_printf(out, "rtl_ais_vessels %u\n", vessels.count);
+	}
+	pthread_mutex_unlock(&ais_lock);
 }
 
 // ------------------------------------------------------------------
@@ -7,10 +7,57 @@
 
 #define MAX_TCP_CONNECTIONS 100
 
+// Per-client send queue size, and what to do when a client falls so far
+// behind that its queue is full.
+#define TCP_DEFAULT_QUEUE_KB 512
+#define TCP_OVERFLOW_DROP 0       // drop the new message
+#define TCP_OVERFLOW_COALESCE 1   // drop the oldest unsent messages instead
+#define TCP_OVERFLOW_DISCONNECT 2 // close the client
+
+// With subscriptions enabled, a client may send "SUB key=value;..." lines
+// to filter what it receives. The saved messages are replayed after its
+// first SUB line, or after this long without one.
+#define TCP_SUBSCRIBE_GRACE_MS 1000
+#define TCP_SUBSCRIBE_LINE 2048	// also holds the request of an http client
+
+// Compressed port (-z): deflate at this level, with a sync flush every
+// TCP_ZFLUSH_MS by default. A new segment, where new clients can join
+// the shared stream, starts after TCP_ZSEGMENT_SEC or TCP_ZSEGMENT_BYTES
+// of input.
+#define TCP_ZLEVEL 6
+#define TCP_ZFLUSH_MS 250
+#define TCP_ZSEGMENT_SEC 10
+#define TCP_ZSEGMENT_BYTES (256 * 1024)
+#define TCP_ZCHUNK 16384
+
+// HTTP port (-w): vessels heard within TCP_HTTP_VESSEL_AGE seconds are
+// listed on /vessels when no -V age is given. A WebSocket message is
+// at most TCP_JSON_MAX bytes of JSON.
+#define TCP_HTTP_VESSEL_AGE 600
+#define TCP_HTTP_TIMEOUT_SEC 5
+#define TCP_JSON_MAX 4096
+
+// Priority messages (safety and SAR traffic) wait in up to
+// TCP_PRIORITY_SLOTS slots of their own per client and are sent before
+// the next message of the send queue. Longer ones, or more, take the
+// send queue.
+#define TCP_PRIORITY_SLOTS 8
+#define TCP_PRIORITY_MAX 1024
+
+// The -t history is a ring sized for this much traffic per second of
+// keep time, within the given bounds.
+#define AIS_HISTORY_BYTES_PER_SEC (8 * 1024)
+#define AIS_HISTORY_MIN_SIZE (256 * 1024)
+#define AIS_HISTORY_MAX_SIZE (64 * 1024 * 1024)
+
+struct ais_msg;
+
 // Prototypes
-int initTcpSocket( const char *portnumber, int debug_nmea, int tcp_keep_ais_time, int tcp_stream_forever);
-int add_nmea_ais_message(const char * mess, unsigned int length);
+int initTcpSocket( const char *portnumber, int debug_nmea, int tcp_keep_ais_time, int tcp_stream_forever, int send_queue_kb, const char *overflow_policy, int allow_subscribe, int snapshot_age, const char *zportnumber, int zflush_ms, const char *http_portnumber);
+int add_nmea_ais_message(const char * mess, unsigned int length, const struct ais_msg *msg);
 void closeTcpSocket();
+void setTcpKeepTime(int tcp_keep_ais_time);
+void printTcpStats();
 
 #endif
 
@@ -0,0 +1,227 @@
+// ------------------------------------------------------------
+// vessel_cache.c
+// Latest reports per MMSI.
+//
+// Every vessel has one slot per report kind, holding the sentences
+// of the newest message of that kind. A snapshot is then at most
+// VESSEL_REPORTS messages per vessel, however long the vessel has
+// been reporting.
+// ------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+
+#include "vessel_cache.h"
+
+static unsigned int vessel_hash(P_VESSEL_CACHE c, unsigned long mmsi)
+{
+	return (unsigned int)((mmsi * 2654435761u) >> 7) & (c->size - 1);
+}
+
+// Which report slot a message type goes to, or -1 if it is not cached.
+static int report_kind(const struct ais_msg *msg)
+{
+	switch (msg->type)
+	{
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+	case 9:
+	case 18:
+	case 19:
+	case 21:
+	case 27:
+		return VESSEL_DYNAMIC;
+	case 5:
+		return VESSEL_STATIC;
+	case 24:
+		if (msg->part == 0)
+			return VESSEL_STATIC_A;
+		if (msg->part == 1)
+			return VESSEL_STATIC_B;
+		return -1;
+	}
+	return -1;
+}
+
+int vessel_cache_init(P_VESSEL_CACHE c)
+{
+	memset(c, 0, sizeof(VESSEL_CACHE));
+	c->size = VESSEL_CACHE_MIN_SIZE;
+	c->slot = calloc(c->size, sizeof(VESSEL));
+	if (c->slot == NULL)
+		return 0;
+	return 1;
+}
+
+static void free_vessel(P_VESSEL_CACHE c, VESSEL *v)
+{
+	int i;
+	for (i = 0; i < VESSEL_REPORTS; i++)
+	{
+		c->bytes -= v->report[i].length;
+		free(v->report[i].data);
+	}
+	memset(v, 0, sizeof(VESSEL));
+}
+
+void vessel_cache_free(P_VESSEL_CACHE c)
+{
+	unsigned int i;
+	for (i = 0; i < c->size; i++)
+		if (c->slot[i].mmsi)
+			free_vessel(c, &c->slot[i]);
+	free(c->slot);
+	c->slot = NULL;
+	c->count = 0;
+}
+
+// ------------------------------------------------------------
+// Move all vessels to a new table of the given size. The vessels
+// are moved, not copied.
+// ------------------------------------------------------------
+static int rehash(P_VESSEL_CACHE c, unsigned int size)
+{
+	VESSEL *old = c->slot;
+	unsigned int old_size = c->size, i, h;
+
+	c->slot = calloc(size, sizeof(VESSEL));
+	if (c->slot == NULL)
+	{
+		c->slot = old;
+		return 0;
+	}
+	c->size = size;
+	for (i = 0; i < old_size; i++)
+	{
+		if (!old[i].mmsi)
+			continue;
+		h = vessel_hash(c, old[i].mmsi);
+		while (c->slot[h].mmsi)
+			h = (h + 1) & (c->size - 1);
+		c->slot[h] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+// ------------------------------------------------------------
+// Save a message as the latest of its kind for its vessel.
+// Returns 1 if saved, 0 if the message is not cached or there is
+// no memory.
+// ------------------------------------------------------------
+int vessel_cache_update(P_VESSEL_CACHE c, const struct timeval *timestamp, const struct ais_msg *msg, const char *data, unsigned int length)
+{
+	int kind = report_kind(msg);
+	VESSEL_REPORT *r;
+	VESSEL *v;
+	unsigned int h;
+
+	if (kind < 0 || msg->mmsi == 0)
+		return 0;
+	if ((c->count + 1) * 2 > c->size && !rehash(c, c->size * 2))
+		return 0;
+
+	h = vessel_hash(c, msg->mmsi);
+	while (c->slot[h].mmsi && c->slot[h].mmsi != msg->mmsi)
+		h = (h + 1) & (c->size - 1);
+	v = &c->slot[h];
+	if (!v->mmsi)
+	{
+		v->mmsi = msg->mmsi;
+		c->count++;
+	}
+	v->last_seen = timestamp->tv_sec;
+
+	r = &v->report[kind];
+	if (r->alloc < length)
+	{
+		char *p = realloc(r->data, length);
+		if (p == NULL)
+			return 0;
+		r->data = p;
+		r->alloc = length;
+	}
+	memcpy(r->data, data, length);
+	c->bytes += length;
+	c->bytes -= r->length;
+	r->length = length;
+	r->timestamp = *timestamp;
+	r->msg = *msg;
+	return 1;
+}
+
+// ------------------------------------------------------------
+// Remove vessels not heard since older_than. Emptied slots would
+// break the probe sequences behind them, so the table is rebuilt
+// afterwards. Returns the number of vessels removed.
+// ------------------------------------------------------------
+unsigned int vessel_cache_expire(P_VESSEL_CACHE c, time_t older_than)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < c->size; i++)
+	{
+		if (!c->slot[i].mmsi || c->slot[i].last_seen >= older_than)
+			continue;
+		free_vessel(c, &c->slot[i]);
+		c->count--;
+		n++;
+	}
+	if (n > 0 && !rehash(c, c->size))
+	{
+		// Out of memory, the table cannot be fixed up. Start over empty.
+		for (i = 0; i < c->size; i++)
+			if (c->slot[i].mmsi)
+			{
+				free_vessel(c, &c->slot[i]);
+				n++;
+			}
+		c->count = 0;
+	}
+	return n;
+}
+
+// ------------------------------------------------------------
+// Call fn for every vessel heard since newer_than. Returns the
+// number of vessels.
+// ------------------------------------------------------------
+unsigned int vessel_cache_foreach(P_VESSEL_CACHE c, time_t newer_than, vessel_fn fn, void *arg)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < c->size; i++)
+	{
+		if (!c->slot[i].mmsi || c->slot[i].last_seen < newer_than)
+			continue;
+		fn(arg, &c->slot[i]);
+		n++;
+	}
+	return n;
+}
+
+// ------------------------------------------------------------
+// Call fn for every report received since newer_than, static
+// reports of a vessel first. Returns the number of reports.
+// ------------------------------------------------------------
+unsigned int vessel_cache_replay(P_VESSEL_CACHE c, time_t newer_than, vessel_replay_fn fn, void *arg)
+{
+	unsigned int i, n = 0;
+	int k;
+
+	for (i = 0; i < c->size; i++)
+	{
+		VESSEL *v = &c->slot[i];
+		if (!v->mmsi || v->last_seen < newer_than)
+			continue;
+		for (k = 0; k < VESSEL_REPORTS; k++)
+		{
+			VESSEL_REPORT *r = &v->report[k];
+			if (r->length == 0 || r->timestamp.tv_sec < newer_than)
+				continue;
+			fn(arg, &r->timestamp, &r->msg, r->data, r->length);
+			n++;
+		}
+	}
+	return n;
+}
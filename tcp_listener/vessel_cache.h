@@ -0,0 +1,59 @@
+// -------------------------------------------------------
+// vessel_cache.h
+// Latest reports per MMSI, used for the -V connect-time
+// snapshot of the tcp listener.
+// -------------------------------------------------------
+#ifndef __VESSEL_CACHE_H_
+#define __VESSEL_CACHE_H_
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "../aisdecoder/lib/aismsg.h"
+
+// Report slots kept per vessel. Static data is replayed before the
+// position, so a client can name a vessel as soon as it shows up.
+#define VESSEL_STATIC 0    // type 5
+#define VESSEL_STATIC_A 1  // type 24 part A
+#define VESSEL_STATIC_B 2  // type 24 part B
+#define VESSEL_DYNAMIC 3   // position reports, types 1-4, 9, 18, 19, 21, 27
+#define VESSEL_REPORTS 4
+
+#define VESSEL_CACHE_MIN_SIZE 1024
+
+typedef struct t_vessel_report
+{
+	struct timeval timestamp;
+	struct ais_msg msg;
+	char *data;
+	unsigned int length;
+	unsigned int alloc;
+} VESSEL_REPORT;
+
+typedef struct t_vessel
+{
+	unsigned long mmsi;	// 0: free slot
+	time_t last_seen;
+	VESSEL_REPORT report[VESSEL_REPORTS];
+} VESSEL;
+
+// Open addressing hash table with linear probing, kept at most half full.
+typedef struct t_vessel_cache
+{
+	VESSEL *slot;
+	unsigned int size;	// power of two
+	unsigned int count;
+	unsigned long bytes;	// report data held
+} VESSEL_CACHE, *P_VESSEL_CACHE;
+
+typedef void (*vessel_fn)(void *arg, const VESSEL *v);
+typedef void (*vessel_replay_fn)(void *arg, const struct timeval *timestamp, const struct ais_msg *msg, const char *data, unsigned int length);
+
+int vessel_cache_init(P_VESSEL_CACHE c);
+void vessel_cache_free(P_VESSEL_CACHE c);
+int vessel_cache_update(P_VESSEL_CACHE c, const struct timeval *timestamp, const struct ais_msg *msg, const char *data, unsigned int length);
+unsigned int vessel_cache_expire(P_VESSEL_CACHE c, time_t older_than);
+unsigned int vessel_cache_foreach(P_VESSEL_CACHE c, time_t newer_than, vessel_fn fn, void *arg);
+unsigned int vessel_cache_replay(P_VESSEL_CACHE c, time_t newer_than, vessel_replay_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,170 @@
+// ------------------------------------------------------------
+// websocket.c
+// WebSocket handshake and framing (RFC 6455), with the SHA-1 and
+// base64 needed for the handshake.
+// ------------------------------------------------------------
+#include <string.h>
+#include <stdio.h>
+
+#include "websocket.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(unsigned int h[5], const unsigned char *p)
+{
+	unsigned int w[80], a, b, c, d, e, f, k, tmp;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (p[4 * i] << 24) | (p[4 * i + 1] << 16) | (p[4 * i + 2] << 8) | p[4 * i + 3];
+	for (i = 16; i < 80; i++)
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+	for (i = 0; i < 80; i++)
+	{
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		tmp = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+// SHA-1 of a short message (the handshake key is 60 bytes).
+static void sha1(const unsigned char *msg, unsigned int len, unsigned char digest[20])
+{
+	unsigned int h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+	unsigned char block[64];
+	unsigned long long bits = (unsigned long long)len * 8;
+	unsigned int i, n;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		sha1_block(h, msg + i);
+
+	// Final block(s): the rest, 0x80, zeros and the length in bits.
+	n = len - i;
+	memset(block, 0, sizeof(block));
+	memcpy(block, msg + i, n);
+	block[n] = 0x80;
+	if (n >= 56)
+	{
+		sha1_block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	for (i = 0; i < 8; i++)
+		block[63 - i] = bits >> (8 * i);
+	sha1_block(h, block);
+
+	for (i = 0; i < 20; i++)
+		digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static void base64(const unsigned char *in, unsigned int len, char *out)
+{
+	static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned int i, v;
+
+	for (i = 0; i < len; i += 3)
+	{
+		v = in[i] << 16;
+		if (i + 1 < len)
+			v |= in[i + 1] << 8;
+		if (i + 2 < len)
+			v |= in[i + 2];
+		*out++ = tab[(v >> 18) & 63];
+		*out++ = tab[(v >> 12) & 63];
+		*out++ = i + 1 < len ? tab[(v >> 6) & 63] : '=';
+		*out++ = i + 2 < len ? tab[v & 63] : '=';
+	}
+	*out = 0;
+}
+
+void ws_accept_key(const char *key, char accept[29])
+{
+	static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	unsigned char buf[128], digest[20];
+	unsigned int len = strlen(key);
+
+	if (len > sizeof(buf) - sizeof(guid))
+		len = sizeof(buf) - sizeof(guid);
+	memcpy(buf, key, len);
+	memcpy(buf + len, guid, sizeof(guid) - 1);
+	sha1(buf, len + sizeof(guid) - 1, digest);
+	base64(digest, sizeof(digest), accept);
+}
+
+unsigned int ws_frame_header(unsigned char *hdr, int opcode, unsigned int length)
+{
+	hdr[0] = 0x80 | opcode;
+	if (length < 126)
+	{
+		hdr[1] = length;
+		return 2;
+	}
+	hdr[1] = 126;
+	hdr[2] = length >> 8;
+	hdr[3] = length & 0xff;
+	return 4;
+}
+
+int ws_parse_frame(unsigned char *buf, unsigned int avail, int *opcode, unsigned char **payload, unsigned int *length)
+{
+	unsigned int hlen = 2, len, i;
+	unsigned char *mask;
+
+	if (avail < 2)
+		return 0;
+	// Fragmented frames and unmasked client frames are not accepted.
+	if (!(buf[0] & 0x80) || !(buf[1] & 0x80))
+		return -1;
+	len = buf[1] & 0x7f;
+	if (len == 127)
+		return -1;
+	if (len == 126)
+	{
+		if (avail < 4)
+			return 0;
+		len = (buf[2] << 8) | buf[3];
+		hlen = 4;
+	}
+	if (avail < hlen + 4 + len)
+		return 0;
+	mask = buf + hlen;
+	*payload = buf + hlen + 4;
+	for (i = 0; i < len; i++)
+		(*payload)[i] ^= mask[i % 4];
+	*opcode = buf[0] & 0x0f;
+	*length = len;
+	return hlen + 4 + len;
+}
@@ -0,0 +1,29 @@
+// -------------------------------------------------------
+// websocket.h
+// The bits of RFC 6455 the http listener needs: the
+// handshake key and frame headers.
+// -------------------------------------------------------
+#ifndef __WEBSOCKET_H_
+#define __WEBSOCKET_H_
+
+#define WS_OP_TEXT 0x1
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xa
+
+// Longest frame header the server sends (payloads up to 64 kB).
+#define WS_MAX_HEADER 4
+
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key, 28 characters plus nul.
+void ws_accept_key(const char *key, char accept[29]);
+
+// Write the header of an unmasked, unfragmented server frame.
+// Returns its length.
+unsigned int ws_frame_header(unsigned char *hdr, int opcode, unsigned int length);
+
+// Parse a client frame from buf. Returns the frame length once all of
+// it is in buf, 0 if more data is needed, -1 if it is not acceptable.
+// The payload is unmasked in place, *payload and *length point to it.
+int ws_parse_frame(unsigned char *buf, unsigned int avail, int *opcode, unsigned char **payload, unsigned int *length);
+
+#endif